@@ -42,6 +42,7 @@ typedef struct TA_CAP("mutex") mutex {
 void mutex_init(mutex_t *);
 void mutex_destroy(mutex_t *);
 status_t mutex_acquire(mutex_t *m) TA_ACQ(m);
+bool mutex_try_acquire(mutex_t *m) TA_TRY_ACQ(true, m);
 void mutex_release(mutex_t *m) TA_REL(m);
 
 /* Internal functions for use by condvar implementation. */
@@ -120,6 +120,7 @@ status_t pmm_add_arena(const pmm_arena_info_t* arena) __NONNULL((1));
 /* flags for allocation routines below */
 #define PMM_ALLOC_FLAG_ANY (0x0)  /* no restrictions on which arena to allocate from */
 #define PMM_ALLOC_FLAG_KMAP (0x1) /* allocate only from arenas marked KMAP */
+#define PMM_ALLOC_FLAG_ZERO (0x2) /* page contents must be zeroed */
 
 /* Allocate count pages of physical memory, adding to the tail of the passed list.
  * The list must be initialized.
@@ -157,6 +158,19 @@ size_t pmm_count_free_pages(void);
 // Return amount of physical memory in system, in bytes.
 size_t pmm_count_total_bytes(void);
 
+/* memory pressure levels, from the amount of free physical memory */
+#define VM_PRESSURE_NORMAL   (0)
+#define VM_PRESSURE_WARNING  (1) /* free memory is getting low, shed caches */
+#define VM_PRESSURE_CRITICAL (2) /* allocations are about to fail */
+
+/* Return the current memory pressure level. */
+uint vm_pressure_level(void);
+
+/* Block until the memory pressure level is something other than level.
+ * Returns the new level.
+ */
+uint vm_pressure_wait(uint level);
+
 /* Allocate a run of pages out of the kernel area and return the pointer in kernel space.
  * If the optional list is passed, append the allocate page structures to the tail of the list.
  * If the optional physical address pointer is passed, return the address.
@@ -116,10 +116,6 @@ public:
     mxtl::RefPtr<VmAddressRegion> as_vm_address_region();
     mxtl::RefPtr<VmMapping> as_vm_mapping();
 
-    // Page fault in an address within the region.  Recursively traverses
-    // the regions to find the target mapping, if it exists.
-    virtual status_t PageFault(vaddr_t va, uint pf_flags) = 0;
-
     // WAVL tree key function
     vaddr_t GetKey() const { return base(); }
 
@@ -235,7 +231,6 @@ public:
     bool is_mapping() const override { return false; }
 
     void Dump(uint depth, bool verbose) const override;
-    status_t PageFault(vaddr_t va, uint pf_flags) override;
 protected:
     static const uint32_t kMagic = 0x564d4152; // VMAR
 
@@ -272,6 +267,10 @@ private:
     // Version of FindRegion() that does not acquire the aspace lock
     mxtl::RefPtr<VmAddressRegionOrMapping> FindRegionLocked(vaddr_t addr);
 
+    // Recursively traverses the regions to find the mapping containing *va*,
+    // if it exists.  Used by the page fault path.
+    mxtl::RefPtr<VmMapping> FindMappingLocked(vaddr_t va);
+
     // Version of Destroy() that does not acquire the aspace lock
     status_t DestroyLocked() override;
 
@@ -355,12 +354,6 @@ public:
         return;
     }
 
-    status_t PageFault(vaddr_t va, uint pf_flags) override {
-        // We should never be trying to page fault on this...
-        ASSERT(false);
-        return ERR_BAD_STATE;
-    }
-
     size_t AllocatedPages() const override {
         return 0;
     }
@@ -415,7 +408,13 @@ public:
     bool is_mapping() const override { return true; }
 
     void Dump(uint depth, bool verbose) const override;
-    status_t PageFault(vaddr_t va, uint pf_flags) override;
+
+    // Page fault in an address within the mapping.  Called by the aspace
+    // without its lock held; *object* is this mapping's object, referenced by
+    // the caller while it held the aspace lock.  Returns ERR_BAD_STATE if the
+    // mapping no longer covers *va*, in which case the caller should look the
+    // address up again.
+    status_t PageFault(vaddr_t va, uint pf_flags, VmObject* object);
 
 protected:
     static const uint32_t kMagic = 0x564d4150; // VMAP
@@ -429,9 +428,15 @@ protected:
     // unmap any pages that map the passed in vmo range. May not intersect with this range
     status_t UnmapVmoRangeLocked(uint64_t start, uint64_t size) const;
 
+    // like UnmapVmoRangeLocked(), but fails with ERR_SHOULD_WAIT rather than
+    // wait for the page table lock, including when the caller holds it
+    status_t TryUnmapVmoRangeLocked(uint64_t start, uint64_t size) const;
+
 private:
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmMapping);
 
+    status_t UnmapVmoRangeLocked(uint64_t start, uint64_t size, bool try_lock) const;
+
     // allow VmAddressRegion to manipulate VmMapping internals for construction
     // and bookkeeping
     friend class VmAddressRegion;
@@ -456,6 +461,22 @@ private:
 
     void Activate() override;
 
+    // A page mapped along with the one a fault was taken on.
+    struct FaultPage {
+        vaddr_t va;
+        paddr_t pa;
+    };
+
+    // Collect the extra pages to map for a fault on *va*: pages committed
+    // ahead of a sequential access pattern, or resident neighbours of the
+    // faulting page.  Called with the object's lock held.
+    size_t GatherFaultPagesLocked(VmObject* object, vaddr_t va, uint pf_flags,
+                                  FaultPage* pages);
+
+    // Map the pages collected by GatherFaultPagesLocked(), coalescing
+    // contiguous runs.  Called with the object and page table locks held.
+    void MapFaultPagesLocked(const FaultPage* pages, size_t count, uint mmu_flags);
+
     // Version of Activate that does not take the object_ lock.
     // Should be annotated TA_REQ(object_->lock()), but due to limitations
     // in Clang around capability aliasing, we need to relax the analysis.
@@ -468,6 +489,13 @@ private:
     // cached mapping flags (read/write/user/etc)
     uint arch_mmu_flags_;
 
-    // used to detect recursions through the vmo fault path
+    // used to detect recursions through the vmo fault path.
+    // Guarded by the object's lock.
     bool currently_faulting_ = false;
+
+    // Sequential fault detection, guarded by the object's lock: the object
+    // offset a sequential scan is expected to fault on next, and how many
+    // pages to commit ahead of it when it does.
+    uint64_t next_fault_offset_ = UINT64_MAX;
+    uint32_t fault_ahead_pages_ = 0;
 };
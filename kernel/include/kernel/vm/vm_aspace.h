@@ -110,6 +110,7 @@ protected:
     friend class VmAddressRegion;
     friend class VmMapping;
     mutex_t* lock() { return &lock_; }
+    mutex_t* pt_lock() { return &pt_lock_; }
 
     void AslrDraw(uint8_t* buf, size_t len);
 
@@ -144,6 +145,12 @@ private:
 
     mutable mutex_t lock_ = MUTEX_INITIAL_VALUE(lock_);
 
+    // Serializes changes to the architectural page tables.  Page faults and
+    // VMO-driven unmaps only hold the lock of the object involved, so several
+    // may update this aspace's page tables at once.  Always the innermost of
+    // the aspace, object and page table locks.
+    mutex_t pt_lock_ = MUTEX_INITIAL_VALUE(pt_lock_);
+
     // root of virtual address space
     // Access to this reference is guarded by lock_.
     mxtl::RefPtr<VmAddressRegion> root_vmar_;
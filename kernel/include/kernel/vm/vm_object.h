@@ -62,6 +62,17 @@ public:
         return ERR_NOT_SUPPORTED;
     }
 
+    // Lock or unlock the pages of a discardable object.  While an object is
+    // unlocked the kernel may discard all of its pages to relieve memory
+    // pressure.  Locking it reports whether that happened since it was last
+    // unlocked.  Locks nest.  For now the range must cover the whole object.
+    virtual status_t LockRange(uint64_t offset, uint64_t len, bool* discarded) {
+        return ERR_NOT_SUPPORTED;
+    }
+    virtual status_t UnlockRange(uint64_t offset, uint64_t len) {
+        return ERR_NOT_SUPPORTED;
+    }
+
     // read/write operators against kernel pointers only
     virtual status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read) {
         return ERR_NOT_SUPPORTED;
@@ -147,6 +158,19 @@ public:
 
     static mxtl::RefPtr<VmObject> CreateFromROData(const void* data, size_t size);
 
+    // Create an object whose pages may be discarded while it is unlocked
+    // (see LockRange()).  It starts out unlocked.
+    static mxtl::RefPtr<VmObject> CreateDiscardable(uint32_t pmm_alloc_flags, uint64_t size);
+
+    // Discard the pages of unlocked discardable objects, least recently
+    // unlocked first, until at least |target| pages have been freed.  Objects
+    // that are busy are skipped.  With |nonblocking| no lock is waited on at
+    // all: objects whose lock, or the page table lock of an address space
+    // they are mapped into, is held by anyone, the caller included, are
+    // skipped too.  That makes it safe to call from the allocation path with
+    // other VM locks held.  Returns the number of pages freed.
+    static size_t ReclaimDiscardable(size_t target, bool nonblocking);
+
     status_t Resize(uint64_t size) override;
 
     uint64_t size() const override { return size_; }
@@ -157,6 +181,9 @@ public:
                                            uint8_t alignment_log2) override;
     status_t DecommitRange(uint64_t offset, uint64_t len, uint64_t* decommitted) override;
 
+    status_t LockRange(uint64_t offset, uint64_t len, bool* discarded) override;
+    status_t UnlockRange(uint64_t offset, uint64_t len) override;
+
     status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read) override;
     status_t Write(const void* ptr, uint64_t offset, size_t len, size_t* bytes_written) override;
     status_t Lookup(uint64_t offset, uint64_t len, uint pf_flags,
@@ -203,6 +230,22 @@ private:
     status_t ReadWriteInternal(uint64_t offset, size_t len, size_t* bytes_copied, bool write,
                                T copyfunc);
 
+    // unmap and free every page of the object, returning the number freed;
+    // with |nonblocking|, frees nothing if a page table lock is busy
+    size_t DiscardLocked(bool nonblocking) TA_REQ(lock_);
+
+    struct DiscardableListTraits {
+        static mxtl::DoublyLinkedListNodeState<VmObjectPaged*>& node_state(VmObjectPaged& obj) {
+            return obj.discardable_node_;
+        }
+    };
+    using DiscardableList = mxtl::DoublyLinkedList<VmObjectPaged*, DiscardableListTraits>;
+
+    // Unlocked discardable objects, least recently unlocked first.  Ordered
+    // before every object's lock.
+    static Mutex discardable_lock_;
+    static DiscardableList discardable_list_ TA_GUARDED(discardable_lock_);
+
 // constants
 #if _LP64
     static const uint64_t MAX_SIZE = ROUNDDOWN(SIZE_MAX, PAGE_SIZE);
@@ -216,6 +259,12 @@ private:
 
     // a tree of pages
     VmPageList page_list_ TA_GUARDED(lock_);
+
+    // discardable state
+    bool discardable_ = false;
+    uint32_t lock_count_ TA_GUARDED(discardable_lock_) = 0;
+    bool discarded_ TA_GUARDED(discardable_lock_) = false;
+    mxtl::DoublyLinkedListNodeState<VmObjectPaged*> discardable_node_;
 };
 
 // VMO representing a physical range of memory
@@ -99,6 +99,31 @@ status_t mutex_acquire(mutex_t *m)
     return ret;
 }
 
+/**
+ * @brief  Acquire the mutex only if no thread holds it, without blocking
+ *
+ * Fails if the calling thread already owns the mutex.
+ *
+ * @return  true if the mutex was acquired
+ */
+bool mutex_try_acquire(mutex_t *m) TA_NO_THREAD_SAFETY_ANALYSIS
+{
+    DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    bool acquired = false;
+
+    THREAD_LOCK(state);
+    if (m->count == 0) {
+        m->count = 1;
+        m->holder = get_current_thread();
+        acquired = true;
+    }
+    THREAD_UNLOCK(state);
+
+    return acquired;
+}
+
 void mutex_release_internal(mutex_t *m, bool reschedule) TA_NO_THREAD_SAFETY_ANALYSIS
 {
     DEBUG_ASSERT(arch_ints_disabled());
@@ -10,8 +10,10 @@
 #include <err.h>
 #include <inttypes.h>
 #include <kernel/auto_lock.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <kernel/vm.h>
 #include <lib/console.h>
@@ -35,6 +37,44 @@ static Mutex arena_lock;
 static mxtl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
 static size_t arena_cumulative_size TA_GUARDED(arena_lock);
 
+// Per cpu page caches.  Single page allocations and frees, which is what the
+// fault path does, are served from a list of pages owned by the current cpu.
+// The list is refilled from and spilled back to the arenas kCacheBatch pages
+// at a time, so arena_lock is only taken once per batch.
+//
+// Each cache also keeps a pool of pages that the zeroing thread cleared
+// ahead of time, to hand out for PMM_ALLOC_FLAG_ZERO allocations.
+//
+// As far as the arenas are concerned cached pages are allocated.  They only
+// ever come from KMAP arenas, so they can be zeroed through the kernel map.
+static const size_t kCacheBatch = 32;
+static const size_t kCacheHighWater = kCacheBatch * 2;
+static const size_t kZeroPoolTarget = 64;
+
+namespace {
+
+struct PmmCache {
+    spin_lock_t lock;
+
+    // pages with whatever contents they were freed with
+    list_node free_list;
+    size_t free_count;
+
+    // pages already cleared by the zeroing thread
+    list_node zero_list;
+    size_t zero_count;
+};
+
+} // namespace
+
+static PmmCache pmm_cache[SMP_MAX_CPUS];
+
+// set once the caches are initialized; until then everything goes to the arenas
+static bool pmm_cache_enabled;
+
+static event_t pmm_zero_event;
+static thread_t* pmm_zero_thread;
+
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
     for (auto& a : arena_list) {
@@ -105,7 +145,22 @@ done_add:
     return NO_ERROR;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+static size_t pmm_arena_free_count() TA_REQ(arena_lock) {
+    size_t free = 0;
+    for (const auto& a : arena_list) {
+        free += a.free_count();
+    }
+    return free;
+}
+
+// Lets the pressure monitor know how much memory is left in the arenas.
+// Pages sitting in the per-cpu caches are not counted, which errs on the
+// side of reporting pressure a little early.
+static void pmm_arena_update_pressure() TA_REQ(arena_lock) {
+    vm_pressure_update(pmm_arena_free_count());
+}
+
+static vm_page_t* pmm_arena_alloc_page(uint alloc_flags, paddr_t* pa) {
     AutoLock al(&arena_lock);
 
     /* walk the arenas in order until we find one with a free page */
@@ -118,20 +173,18 @@ vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
 
         // try to allocate the page out of the arena
         vm_page_t* page = a.AllocPage(pa);
-        if (page)
+        if (page) {
+            pmm_arena_update_pressure();
             return page;
+        }
     }
 
     LTRACEF("failed to allocate page\n");
+    pmm_arena_update_pressure();
     return nullptr;
 }
 
-size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
-    LTRACEF("count %zu\n", count);
-
-    /* list must be initialized prior to calling this */
-    DEBUG_ASSERT(list);
-
+static size_t pmm_arena_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     if (count == 0)
         return 0;
 
@@ -155,17 +208,116 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
             break;
     }
 
+    pmm_arena_update_pressure();
     return allocated;
 }
 
-size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
-    LTRACEF("address %#" PRIxPTR ", count %zu\n", address, count);
+static size_t pmm_arena_free(struct list_node* list) {
+    AutoLock al(&arena_lock);
 
-    uint allocated = 0;
-    if (count == 0)
-        return 0;
+    uint count = 0;
+    while (!list_is_empty(list)) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
 
-    address = ROUNDDOWN(address, PAGE_SIZE);
+        DEBUG_ASSERT(!page_is_free(page));
+
+        /* see which arena this page belongs to and add it */
+        for (auto& a : arena_list) {
+            if (a.FreePage(page) >= 0) {
+                count++;
+                break;
+            }
+        }
+    }
+
+    pmm_arena_update_pressure();
+    return count;
+}
+
+// The arena list does not change after boot, so it can be walked without
+// the arena lock.
+static bool pmm_page_is_kmap(const vm_page_t* page) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (const auto& a : arena_list) {
+        if (a.page_belongs_to_arena(page))
+            return (a.flags() & PMM_ARENA_FLAG_KMAP) != 0;
+    }
+    return false;
+}
+
+static void pmm_zero_page(vm_page_t* page) {
+    void* ptr = paddr_to_kvaddr(vm_page_to_paddr(page));
+    DEBUG_ASSERT(ptr);
+
+    arch_zero_page(ptr);
+}
+
+static void pmm_cache_kick_zero_thread() {
+    if (pmm_zero_thread)
+        event_signal(&pmm_zero_event, false);
+}
+
+// Moves every page on |src| to the tail of |dst|.
+static void pmm_list_splice(list_node* dst, list_node* src) {
+    list_node* node;
+    while ((node = list_remove_head(src)))
+        list_add_tail(dst, node);
+}
+
+// Takes up to |count| pages out of the current cpu's cache, from the zero
+// pool first if |zero|, and from the other list after that.  Pre-zeroed
+// pages go on |zeroed|, the rest on |dirty|.  Returns the number taken.
+static size_t pmm_cache_take(size_t count, bool zero, list_node* zeroed, list_node* dirty) {
+    PmmCache& cache = pmm_cache[arch_curr_cpu_num()];
+    size_t taken = 0;
+    bool kick;
+    {
+        AutoSpinLockIrqSave guard(cache.lock);
+
+        auto take_from_zero_pool = [&]() {
+            list_node* node;
+            while (taken < count && (node = list_remove_head(&cache.zero_list))) {
+                list_add_tail(zeroed, node);
+                cache.zero_count--;
+                taken++;
+            }
+        };
+
+        if (zero)
+            take_from_zero_pool();
+        list_node* node;
+        while (taken < count && (node = list_remove_head(&cache.free_list))) {
+            list_add_tail(dirty, node);
+            cache.free_count--;
+            taken++;
+        }
+        if (!zero)
+            take_from_zero_pool();
+
+        kick = cache.zero_count < kZeroPoolTarget / 2;
+    }
+
+    if (kick)
+        pmm_cache_kick_zero_thread();
+    return taken;
+}
+
+// Returns every cached page to the arenas, so a failing allocation can see
+// memory that other cpus are holding on to.  Returns the number of pages.
+static size_t pmm_cache_drain() {
+    list_node list = LIST_INITIAL_VALUE(list);
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        PmmCache& cache = pmm_cache[i];
+        AutoSpinLockIrqSave guard(cache.lock);
+        pmm_list_splice(&list, &cache.free_list);
+        pmm_list_splice(&list, &cache.zero_list);
+        cache.free_count = 0;
+        cache.zero_count = 0;
+    }
+    return pmm_arena_free(&list);
+}
+
+static size_t pmm_arena_alloc_range(paddr_t address, size_t count, struct list_node* list) {
+    size_t allocated = 0;
 
     AutoLock al(&arena_lock);
 
@@ -187,18 +339,30 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
             break;
     }
 
+    pmm_arena_update_pressure();
     return allocated;
 }
 
-size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_log2, paddr_t* pa,
-                            struct list_node* list) {
-    LTRACEF("count %zu, align %u\n", count, alignment_log2);
+size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
+    LTRACEF("address %#" PRIxPTR ", count %zu\n", address, count);
 
     if (count == 0)
         return 0;
-    if (alignment_log2 < PAGE_SIZE_SHIFT)
-        alignment_log2 = PAGE_SIZE_SHIFT;
 
+    address = ROUNDDOWN(address, PAGE_SIZE);
+
+    size_t allocated = pmm_arena_alloc_range(address, count, list);
+    if (allocated < count && pmm_cache_enabled) {
+        // the next page may be sitting in a cache
+        if (pmm_cache_drain() > 0)
+            allocated += pmm_arena_alloc_range(address + allocated * PAGE_SIZE,
+                                               count - allocated, list);
+    }
+    return allocated;
+}
+
+static size_t pmm_arena_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_log2,
+                                         paddr_t* pa, struct list_node* list) {
     AutoLock al(&arena_lock);
 
     for (auto& a : arena_list) {
@@ -211,14 +375,145 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
         size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
         if (allocated > 0) {
             DEBUG_ASSERT(allocated == count);
+            pmm_arena_update_pressure();
             return allocated;
         }
     }
 
-    LTRACEF("couldn't find run\n");
     return 0;
 }
 
+size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_log2, paddr_t* pa,
+                            struct list_node* list) {
+    LTRACEF("count %zu, align %u\n", count, alignment_log2);
+
+    if (count == 0)
+        return 0;
+    if (alignment_log2 < PAGE_SIZE_SHIFT)
+        alignment_log2 = PAGE_SIZE_SHIFT;
+
+    paddr_t run_pa;
+    size_t allocated = pmm_arena_alloc_contiguous(count, alloc_flags, alignment_log2, &run_pa, list);
+    if (allocated == 0 && pmm_cache_enabled) {
+        // cached pages may be all that breaks up a run
+        if (pmm_cache_drain() > 0)
+            allocated = pmm_arena_alloc_contiguous(count, alloc_flags, alignment_log2, &run_pa,
+                                                   list);
+    }
+    if (allocated == 0) {
+        LTRACEF("couldn't find run\n");
+        return 0;
+    }
+
+    // runs never come out of the caches, so there is no pre-zeroed pool
+    if (alloc_flags & PMM_ALLOC_FLAG_ZERO) {
+        for (size_t i = 0; i < allocated; i++)
+            pmm_zero_page(paddr_to_vm_page(run_pa + i * PAGE_SIZE));
+    }
+    if (pa)
+        *pa = run_pa;
+    return allocated;
+}
+
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    if (!pmm_cache_enabled) {
+        vm_page_t* page = pmm_arena_alloc_page(alloc_flags, pa);
+        if (page && (alloc_flags & PMM_ALLOC_FLAG_ZERO))
+            pmm_zero_page(page);
+        return page;
+    }
+
+    list_node list = LIST_INITIAL_VALUE(list);
+    if (pmm_alloc_pages(1, alloc_flags, &list) == 0) {
+        LTRACEF("failed to allocate page\n");
+        return nullptr;
+    }
+
+    vm_page_t* page = list_remove_head_type(&list, vm_page_t, free.node);
+    if (pa)
+        *pa = vm_page_to_paddr(page);
+    return page;
+}
+
+size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
+    LTRACEF("count %zu\n", count);
+
+    /* list must be initialized prior to calling this */
+    DEBUG_ASSERT(list);
+
+    if (count == 0)
+        return 0;
+
+    const bool zero = alloc_flags & PMM_ALLOC_FLAG_ZERO;
+    if (!pmm_cache_enabled) {
+        list_node fresh = LIST_INITIAL_VALUE(fresh);
+        size_t allocated = pmm_arena_alloc_pages(count, alloc_flags, &fresh);
+        if (zero) {
+            vm_page_t* p;
+            list_for_every_entry (&fresh, p, vm_page_t, free.node) { pmm_zero_page(p); }
+        }
+        pmm_list_splice(list, &fresh);
+        return allocated;
+    }
+
+    // everything in the caches is from a KMAP arena, so they serve any request
+    list_node zeroed = LIST_INITIAL_VALUE(zeroed);
+    list_node dirty = LIST_INITIAL_VALUE(dirty);
+    size_t allocated = pmm_cache_take(count, zero, &zeroed, &dirty);
+
+    if (allocated < count) {
+        // Go to the arenas.  A small request refills the cache with the rest
+        // of the batch, a large one just takes what it needs.
+        const size_t want = count - allocated;
+        const bool refill = want < kCacheBatch;
+        const uint flags = refill ? (alloc_flags | PMM_ALLOC_FLAG_KMAP) : alloc_flags;
+        list_node fresh = LIST_INITIAL_VALUE(fresh);
+        size_t got = pmm_arena_alloc_pages(refill ? kCacheBatch : want, flags, &fresh);
+        if (got < want) {
+            // other cpus may be caching what we need; give it all back and retry
+            if (pmm_cache_drain() > 0)
+                got += pmm_arena_alloc_pages(want - got, alloc_flags, &fresh);
+        }
+        if (got < want) {
+            // Still short.  Throw away the contents of discardable objects;
+            // their pages land in the caches on the way back, so drain again.
+            if (vm_reclaim_nonblocking(want - got) > 0) {
+                pmm_cache_drain();
+                got += pmm_arena_alloc_pages(want - got, alloc_flags, &fresh);
+            }
+        }
+
+        size_t used = 0;
+        list_node* node;
+        while (used < want && (node = list_remove_head(&fresh))) {
+            list_add_tail(&dirty, node);
+            used++;
+        }
+        allocated += used;
+
+        if (!list_is_empty(&fresh)) {
+            PmmCache& cache = pmm_cache[arch_curr_cpu_num()];
+            AutoSpinLockIrqSave guard(cache.lock);
+            cache.free_count += got - used;
+            pmm_list_splice(&cache.free_list, &fresh);
+        }
+    }
+
+    vm_page_t* p;
+    list_for_every_entry (&dirty, p, vm_page_t, free.node) {
+        p->state = VM_PAGE_STATE_ALLOC;
+        if (zero)
+            pmm_zero_page(p);
+    }
+    list_for_every_entry (&zeroed, p, vm_page_t, free.node) {
+        p->state = VM_PAGE_STATE_ALLOC;
+    }
+    pmm_list_splice(list, &zeroed);
+    pmm_list_splice(list, &dirty);
+
+    return allocated;
+}
+
 /* physically allocate a run from arenas marked as KMAP */
 void* pmm_alloc_kpages(size_t count, struct list_node* list, paddr_t* _pa) {
     LTRACEF("count %zu\n", count);
@@ -293,24 +588,48 @@ size_t pmm_free(struct list_node* list) {
 
     DEBUG_ASSERT(list);
 
-    AutoLock al(&arena_lock);
+    if (!pmm_cache_enabled)
+        return pmm_arena_free(list);
 
-    uint count = 0;
+    // Keep KMAP pages in the current cpu's cache, up to its high water mark
+    // less a batch so the next few frees do not spill straight away.  The
+    // rest goes back to the arenas.
+    list_node keep = LIST_INITIAL_VALUE(keep);
+    list_node spill = LIST_INITIAL_VALUE(spill);
+    size_t kept = 0;
     while (!list_is_empty(list)) {
         vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
 
         DEBUG_ASSERT(!page_is_free(page));
 
-        /* see which arena this page belongs to and add it */
-        for (auto& a : arena_list) {
-            if (a.FreePage(page) >= 0) {
-                count++;
-                break;
+        if (kept < kCacheHighWater && pmm_page_is_kmap(page)) {
+            page->state = VM_PAGE_STATE_ALLOC;
+            list_add_tail(&keep, &page->free.node);
+            kept++;
+        } else {
+            list_add_tail(&spill, &page->free.node);
+        }
+    }
+
+    size_t evicted = 0;
+    {
+        PmmCache& cache = pmm_cache[arch_curr_cpu_num()];
+        AutoSpinLockIrqSave guard(cache.lock);
+        pmm_list_splice(&cache.free_list, &keep);
+        cache.free_count += kept;
+        if (cache.free_count > kCacheHighWater) {
+            while (cache.free_count > kCacheHighWater - kCacheBatch) {
+                list_add_tail(&spill, list_remove_head(&cache.free_list));
+                cache.free_count--;
+                evicted++;
             }
         }
     }
 
-    LTRACEF("returning count %u\n", count);
+    // pages evicted from the cache were already counted in |kept|
+    size_t count = kept + pmm_arena_free(&spill) - evicted;
+
+    LTRACEF("returning count %zu\n", count);
 
     return count;
 }
@@ -333,15 +652,95 @@ void pmm_dump_free() TA_REQ(arena_lock) {
     printf(" %zu free MBs\n", megabytes_free);
 }
 
-size_t pmm_count_free_pages() {
-    size_t free = 0u;
+size_t pmm_count_arena_free_pages() {
     AutoLock al(&arena_lock);
-    for (const auto& a : arena_list) {
-        free += a.free_count();
+    return pmm_arena_free_count();
+}
+
+size_t pmm_count_free_pages() {
+    size_t free = pmm_count_arena_free_pages();
+    if (pmm_cache_enabled) {
+        for (uint i = 0; i < arch_max_num_cpus(); i++) {
+            PmmCache& cache = pmm_cache[i];
+            AutoSpinLockIrqSave guard(cache.lock);
+            free += cache.free_count + cache.zero_count;
+        }
     }
     return free;
 }
 
+// Tops up the zero pool of every cpu's cache, taking pages from the cache's
+// own free list first and then from the arenas.  The zeroing happens with no
+// locks held.
+static void pmm_zero_pool_fill() {
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        PmmCache& cache = pmm_cache[i];
+        for (;;) {
+            list_node list = LIST_INITIAL_VALUE(list);
+            size_t count = 0;
+            {
+                AutoSpinLockIrqSave guard(cache.lock);
+                if (cache.zero_count >= kZeroPoolTarget)
+                    break;
+                list_node* node;
+                while (count < kZeroPoolTarget - cache.zero_count &&
+                       (node = list_remove_head(&cache.free_list))) {
+                    list_add_tail(&list, node);
+                    count++;
+                }
+                cache.free_count -= count;
+            }
+            if (count == 0) {
+                count = pmm_arena_alloc_pages(kCacheBatch, PMM_ALLOC_FLAG_KMAP, &list);
+                if (count == 0)
+                    return;
+            }
+
+            vm_page_t* p;
+            list_for_every_entry (&list, p, vm_page_t, free.node) {
+                p->state = VM_PAGE_STATE_ALLOC;
+                pmm_zero_page(p);
+            }
+
+            AutoSpinLockIrqSave guard(cache.lock);
+            pmm_list_splice(&cache.zero_list, &list);
+            cache.zero_count += count;
+        }
+    }
+}
+
+// Runs just above the idle threads, so pages are only zeroed in time that
+// would otherwise go unused.
+static int pmm_zero_thread_entry(void*) {
+    for (;;) {
+        __UNUSED status_t err = event_wait(&pmm_zero_event);
+        DEBUG_ASSERT(err == NO_ERROR);
+
+        pmm_zero_pool_fill();
+    }
+    return 0;
+}
+
+static void pmm_cache_init(uint level) {
+    for (auto& cache : pmm_cache) {
+        spin_lock_init(&cache.lock);
+        list_initialize(&cache.free_list);
+        list_initialize(&cache.zero_list);
+    }
+    event_init(&pmm_zero_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+    pmm_cache_enabled = true;
+}
+LK_INIT_HOOK(pmm_cache, &pmm_cache_init, LK_INIT_LEVEL_VM);
+
+static void pmm_zero_thread_init(uint level) {
+    thread_t* t = thread_create("pmm zero", &pmm_zero_thread_entry, nullptr,
+                                LOWEST_PRIORITY + 1, DEFAULT_STACK_SIZE);
+    pmm_zero_thread = t;
+    thread_detach_and_resume(t);
+    pmm_cache_kick_zero_thread();
+}
+LK_INIT_HOOK(pmm_zero_thread, &pmm_zero_thread_init, LK_INIT_LEVEL_THREADING);
+
 size_t pmm_count_total_bytes() TA_REQ(arena_lock) {
     return arena_cumulative_size;
 }
@@ -0,0 +1,143 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "vm_priv.h"
+#include <arch/ops.h>
+#include <assert.h>
+#include <err.h>
+#include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/thread.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_object.h>
+#include <kernel/wait.h>
+#include <lk/init.h>
+#include <mxtl/atomic.h>
+#include <trace.h>
+
+#define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
+
+// Memory pressure is judged from the number of free pages in the pmm arenas,
+// against thresholds that are a percentage of all memory.  A level is only
+// left for a lower one once free memory is an eighth past its threshold, so
+// the level does not flap while the reclaim thread is working.
+
+static size_t pressure_warning_pages;
+static size_t pressure_critical_pages;
+
+static mxtl::atomic<int> pressure_initialized;
+static mxtl::atomic<uint> pressure_level;
+
+// woken, under the thread lock, whenever the level changes
+static wait_queue_t pressure_wait_queue;
+
+static uint vm_pressure_compute(size_t free_pages, uint current) {
+    uint level;
+    if (free_pages < pressure_critical_pages) {
+        level = VM_PRESSURE_CRITICAL;
+    } else if (free_pages < pressure_warning_pages) {
+        level = VM_PRESSURE_WARNING;
+    } else {
+        level = VM_PRESSURE_NORMAL;
+    }
+
+    if (level < current) {
+        size_t threshold = (current == VM_PRESSURE_CRITICAL) ? pressure_critical_pages
+                                                              : pressure_warning_pages;
+        if (free_pages < threshold + threshold / 8)
+            level = current;
+    }
+    return level;
+}
+
+void vm_pressure_update(size_t free_pages) {
+    if (!pressure_initialized.load())
+        return;
+
+    // the pmm serializes callers with its arena lock
+    uint current = pressure_level.load();
+    uint level = vm_pressure_compute(free_pages, current);
+    if (level == current)
+        return;
+
+    LTRACEF("memory pressure %u -> %u, %zu free pages\n", current, level, free_pages);
+
+    THREAD_LOCK(state);
+    pressure_level.store(level);
+    wait_queue_wake_all(&pressure_wait_queue, false, NO_ERROR);
+    THREAD_UNLOCK(state);
+}
+
+uint vm_pressure_level(void) {
+    return pressure_level.load();
+}
+
+uint vm_pressure_wait(uint level) {
+    DEBUG_ASSERT(pressure_initialized.load());
+
+    THREAD_LOCK(state);
+    uint current;
+    while ((current = pressure_level.load()) == level) {
+        wait_queue_block(&pressure_wait_queue, INFINITE_TIME);
+    }
+    THREAD_UNLOCK(state);
+
+    return current;
+}
+
+size_t vm_reclaim_nonblocking(size_t pages) {
+    // nothing to give back until the system is up, and never from a context
+    // that cannot take a mutex
+    if (!pressure_initialized.load() || arch_ints_disabled() || arch_in_int_handler())
+        return 0;
+
+    return VmObjectPaged::ReclaimDiscardable(pages, true);
+}
+
+// Discards unlocked discardable objects while free memory is low.  It stops
+// once the level drops back to normal or there is nothing left to discard.
+static int vm_reclaim_thread(void*) {
+    uint level = vm_pressure_level();
+    for (;;) {
+        if (level >= VM_PRESSURE_WARNING) {
+            // judged by the same count as the pressure level, so reclaim
+            // stops where the level drops back to normal
+            size_t free = pmm_count_arena_free_pages();
+            size_t target = pressure_warning_pages + pressure_warning_pages / 8;
+            if (free < target) {
+                size_t freed = VmObjectPaged::ReclaimDiscardable(target - free, false);
+                LTRACEF("reclaimed %zu pages\n", freed);
+                if (freed > 0) {
+                    level = vm_pressure_level();
+                    continue;
+                }
+            }
+        }
+        level = vm_pressure_wait(level);
+    }
+    return 0;
+}
+
+static void vm_pressure_init(uint level) {
+    size_t total_pages = pmm_count_total_bytes() / PAGE_SIZE;
+    uint32_t warning = MIN(cmdline_get_uint32("vm.pressure_warning", 10), 100u);
+    uint32_t critical = MIN(cmdline_get_uint32("vm.pressure_critical", 4), warning);
+
+    pressure_warning_pages = total_pages * warning / 100;
+    pressure_critical_pages = total_pages * critical / 100;
+    wait_queue_init(&pressure_wait_queue);
+
+    pressure_level.store(vm_pressure_compute(pmm_count_arena_free_pages(), VM_PRESSURE_NORMAL));
+    pressure_initialized.store(1);
+
+    LTRACEF("warning below %zu pages, critical below %zu pages\n",
+            pressure_warning_pages, pressure_critical_pages);
+
+    thread_t* t = thread_create("vm reclaim", &vm_reclaim_thread, nullptr,
+                                HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+}
+LK_INIT_HOOK(vm_pressure, &vm_pressure_init, LK_INIT_LEVEL_THREADING);
@@ -331,7 +331,7 @@ size_t VmAddressRegion::AllocatedPagesLocked() const {
     return sum;
 }
 
-status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
+mxtl::RefPtr<VmMapping> VmAddressRegion::FindMappingLocked(vaddr_t va) {
     DEBUG_ASSERT(magic_ == kMagic);
     DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
 
@@ -339,11 +339,11 @@ status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
     while (1) {
         mxtl::RefPtr<VmAddressRegionOrMapping> next(vmar->FindRegionLocked(va));
         if (!next) {
-            return ERR_NOT_FOUND;
+            return nullptr;
         }
 
         if (next->is_mapping()) {
-            return next->PageFault(va, pf_flags);
+            return next->as_vm_mapping();
         }
 
         vmar = next->as_vm_address_region();
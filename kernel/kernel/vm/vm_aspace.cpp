@@ -501,15 +501,39 @@ void VmAspace::AttachToThread(thread_t* t) {
 
 status_t VmAspace::PageFault(vaddr_t va, uint flags) {
     DEBUG_ASSERT(magic_ == MAGIC);
-    DEBUG_ASSERT(!aspace_destroyed_);
     LTRACEF("va %#" PRIxPTR ", flags %#x\n", va, flags);
 
-    // for now, hold the aspace lock across the page fault operation,
-    // which stops any other operations on the address space from moving
-    // the region out from underneath it
-    AutoLock a(&lock_);
+    // Only hold the aspace lock long enough to find the mapping and take a
+    // reference to its object.  The fault itself is serialized by the object's
+    // lock, so threads faulting on different objects (heap growth on many
+    // threads, for example) can allocate, zero and map pages in parallel.
+    for (;;) {
+        mxtl::RefPtr<VmMapping> mapping;
+        mxtl::RefPtr<VmObject> vmo;
+        {
+            AutoLock a(&lock_);
+            // the aspace may have been destroyed since the fault was taken,
+            // or while an earlier attempt ran without the lock
+            if (aspace_destroyed_) {
+                return ERR_NOT_FOUND;
+            }
+
+            mapping = root_vmar_->FindMappingLocked(va);
+            if (!mapping) {
+                return ERR_NOT_FOUND;
+            }
+            vmo = mapping->vmo();
+        }
+
+        status_t status = mapping->PageFault(va, flags, vmo.get());
+        if (status != ERR_BAD_STATE) {
+            return status;
+        }
 
-    return root_vmar_->PageFault(va, flags);
+        // the mapping was unmapped, split or protected while we weren't
+        // holding the aspace lock, look it up again
+        LTRACEF("mapping changed under fault at va %#" PRIxPTR ", retrying\n", va);
+    }
 }
 
 void VmAspace::Dump(bool verbose) const {
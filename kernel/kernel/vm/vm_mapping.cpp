@@ -10,9 +10,11 @@
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
+#include <lk/init.h>
 #include <mxtl/auto_call.h>
 #include <mxtl/auto_lock.h>
 #include <new.h>
@@ -21,6 +23,20 @@
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+// upper bound on the extra pages handled by a single fault
+static const uint32_t kMaxFaultPages = 32;
+
+uint32_t vm_fault_around_pages = 16;
+uint32_t vm_fault_ahead_max_pages = 16;
+
+static void vm_fault_tuning_init(uint level) {
+    vm_fault_around_pages = MIN(cmdline_get_uint32("vm.fault_around", vm_fault_around_pages),
+                                kMaxFaultPages);
+    vm_fault_ahead_max_pages = MIN(cmdline_get_uint32("vm.fault_ahead", vm_fault_ahead_max_pages),
+                                   kMaxFaultPages);
+}
+LK_INIT_HOOK(vm_fault_tuning, &vm_fault_tuning_init, LK_INIT_LEVEL_VM);
+
 VmMapping::VmMapping(VmAddressRegion& parent, vaddr_t base, size_t size, uint32_t vmar_flags,
                      mxtl::RefPtr<VmObject> vmo, uint64_t vmo_offset, uint arch_mmu_flags,
                      const char* name)
@@ -104,6 +120,7 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
     DEBUG_ASSERT(object_);
     // grab the lock for the vmo
     AutoLock al(object_->lock());
+    AutoLock pt(aspace_->pt_lock());
 
     // Persist our current caching mode
     new_arch_mmu_flags |= (arch_mmu_flags_ & ARCH_MMU_FLAG_CACHE_MASK);
@@ -250,6 +267,7 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
     // grab the lock for the vmo
     DEBUG_ASSERT(object_);
     AutoLock al(object_->lock());
+    AutoLock pt(aspace_->pt_lock());
 
     // Check if unmapping from one of the ends
     if (base_ == base || base + size == base_ + size_) {
@@ -301,6 +319,16 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
 }
 
 status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len) const {
+    return UnmapVmoRangeLocked(offset, len, false);
+}
+
+status_t VmMapping::TryUnmapVmoRangeLocked(uint64_t offset, uint64_t len) const {
+    return UnmapVmoRangeLocked(offset, len, true);
+}
+
+// The locking here is conditional, which the analysis cannot follow.
+status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len, bool try_lock) const
+    TA_NO_THREAD_SAFETY_ANALYSIS {
     DEBUG_ASSERT(magic_ == kMagic);
 
     LTRACEF("region %p '%s' obj_offset %#" PRIx64 " size %zu, offset %#" PRIx64 " len %#" PRIx64 "\n",
@@ -359,8 +387,15 @@ status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len) const {
     LTRACEF("going to unmap %#" PRIxPTR ", len %#" PRIx64 " aspace %p\n",
             unmap_base.ValueOrDie(), len_new, aspace_.get());
 
+    if (try_lock) {
+        if (!mutex_try_acquire(aspace_->pt_lock()))
+            return ERR_SHOULD_WAIT;
+    } else {
+        mutex_acquire(aspace_->pt_lock());
+    }
     status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), unmap_base.ValueOrDie(),
                                      static_cast<size_t>(len_new) / PAGE_SIZE, nullptr);
+    mutex_release(aspace_->pt_lock());
     if (status < 0)
         return status;
 
@@ -413,6 +448,7 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
         LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR "\n", pa, va);
 
         size_t mapped;
+        AutoLock pt(aspace_->pt_lock());
         auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, pa, 1, arch_mmu_flags_, &mapped);
         if (ret < 0) {
             TRACEF("error %d mapping page at va %#" PRIxPTR " pa %#" PRIxPTR "\n", ret, va, pa);
@@ -464,13 +500,24 @@ status_t VmMapping::DestroyLocked() {
     return NO_ERROR;
 }
 
-status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
+status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags, VmObject* object) {
     DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
-
-    DEBUG_ASSERT(va >= base_ && va <= base_ + size_ - 1);
+    DEBUG_ASSERT(!is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(object);
 
     va = ROUNDDOWN(va, PAGE_SIZE);
+
+    // grab the lock for the vmo
+    AutoLock al(object->lock());
+
+    // Our range, object offset and permissions only change with the object
+    // lock held (see UnmapLocked() and ProtectLocked()), so they are stable
+    // from here on.  If the mapping was destroyed, shrunk or split since the
+    // aspace looked it up, have it look again.
+    if (!is_in_range(va, PAGE_SIZE)) {
+        return ERR_BAD_STATE;
+    }
+
     uint64_t vmo_offset = va - base_ + object_offset_;
 
     __UNUSED char pf_string[5];
@@ -495,9 +542,6 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         return ERR_ACCESS_DENIED;
     }
 
-    // grab the lock for the vmo
-    AutoLock al(object_->lock());
-
     // set the currently faulting flag for any recursive calls the vmo may make back into us
     // The specific path we're avoiding is if the VMO calls back into us during vmo->GetPageLocked()
     // via UnmapVmoRangeLocked(). Since we're responsible for that page, signal to ourself to skip
@@ -509,13 +553,19 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     // fault in or grab an existing page
     paddr_t new_pa;
     vm_page_t *page;
-    status_t status = object_->GetPageLocked(vmo_offset, pf_flags, &page, &new_pa);
+    status_t status = object->GetPageLocked(vmo_offset, pf_flags, &page, &new_pa);
     if (status < 0) {
         TRACEF("ERROR: failed to fault in or grab existing page\n");
         TRACEF("%p '%s', vmo_offset %#" PRIx64 ", pf_flags %#x\n", this, name_, vmo_offset, pf_flags);
         return status;
     }
 
+    // pick up any neighbours worth mapping while we still hold the object
+    // lock; committing pages may unmap other mappings of the object, which
+    // must not happen with our page table lock held
+    FaultPage extra[kMaxFaultPages];
+    size_t extra_count = GatherFaultPagesLocked(object, va, pf_flags, extra);
+
     // if we read faulted, make sure we map or modify the page without any write permissions
     // this ensures we will fault again if a write is attempted so we can potentially
     // replace this page with a copy or a new one
@@ -525,6 +575,10 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         mmu_flags &= ~ARCH_MMU_FLAG_PERM_WRITE;
     }
 
+    // The object lock keeps other faults on this range out, but unrelated
+    // faults and unmaps in the aspace may be touching the page tables.
+    AutoLock pt(aspace_->pt_lock());
+
     // see if something is mapped here now
     // this may happen if we are one of multiple threads racing on a single address
     uint page_flags;
@@ -572,8 +626,6 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
                 return ERR_NO_MEMORY;
             }
             DEBUG_ASSERT(mapped == 1);
-
-            return NO_ERROR;
         }
     } else {
         // nothing was mapped there before, map it now
@@ -592,6 +644,8 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         DEBUG_ASSERT(mapped == 1);
     }
 
+    MapFaultPagesLocked(extra, extra_count, mmu_flags);
+
 // TODO: figure out what to do with this
 #if ARCH_ARM64
     if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)
@@ -600,6 +654,120 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     return NO_ERROR;
 }
 
+size_t VmMapping::GatherFaultPagesLocked(VmObject* object, vaddr_t va, uint pf_flags,
+                                         FaultPage* pages) {
+    DEBUG_ASSERT(object->lock()->IsHeld());
+
+    const vaddr_t rel = va - base_;
+    const uint64_t vmo_offset = rel + object_offset_;
+    size_t count = 0;
+
+    // A fault right where the last one left off looks like a sequential
+    // scan: commit a window ahead of it, doubling the window each time the
+    // pattern holds.  Anything else resets it.
+    if (vmo_offset == next_fault_offset_) {
+        fault_ahead_pages_ = MIN(MAX(fault_ahead_pages_ * 2, 1u), vm_fault_ahead_max_pages);
+    } else {
+        fault_ahead_pages_ = 0;
+    }
+
+    if (fault_ahead_pages_ > 0) {
+        for (vaddr_t off = rel + PAGE_SIZE; off < size_ && count < fault_ahead_pages_;
+             off += PAGE_SIZE) {
+            paddr_t pa;
+            if (object->GetPageLocked(off + object_offset_, pf_flags, nullptr, &pa) < 0)
+                break;
+            pages[count++] = { base_ + off, pa };
+        }
+        next_fault_offset_ = vmo_offset + (count + 1) * PAGE_SIZE;
+        LTRACEF("%p '%s' sequential fault, committed %zu ahead\n", this, name_, count);
+        return count;
+    }
+    next_fault_offset_ = vmo_offset + PAGE_SIZE;
+
+    // Otherwise, on a read fault, map whatever is already resident in the
+    // aligned window of the object around the faulting page.  Nothing is
+    // allocated, so a sparse object stays sparse.
+    const uint32_t window = vm_fault_around_pages;
+    if (window <= 1 || (pf_flags & VMM_PF_FLAG_WRITE))
+        return 0;
+
+    const size_t window_size = window * PAGE_SIZE;
+    const size_t lead = MIN(static_cast<size_t>(vmo_offset % window_size), rel);
+    const vaddr_t end = MIN(rel - lead + window_size, size_);
+    for (vaddr_t off = rel - lead; off < end; off += PAGE_SIZE) {
+        if (off == rel)
+            continue;
+        paddr_t pa;
+        if (object->GetPageLocked(off + object_offset_, 0, nullptr, &pa) < 0)
+            continue;
+        pages[count++] = { base_ + off, pa };
+    }
+    LTRACEF("%p '%s' fault around %#" PRIxPTR ", %zu resident\n", this, name_, va, count);
+    return count;
+}
+
+void VmMapping::MapFaultPagesLocked(const FaultPage* pages, size_t count, uint mmu_flags) {
+    DEBUG_ASSERT(is_mutex_held(aspace_->pt_lock()));
+
+    // Committing ahead may have replaced pages that are still mapped, and
+    // the unmap the object asked for was skipped while faulting.  If mapping
+    // fails part way, whatever is left of the range is unmapped, so a later
+    // access faults in the right page rather than seeing a stale one.
+    auto unmap_rest = [&](size_t from) {
+        for (size_t j = from; j < count; j++)
+            arch_mmu_unmap(&aspace_->arch_aspace(), pages[j].va, 1, nullptr);
+    };
+
+    // arch_mmu_map() takes a physically contiguous run, so coalesce the pages
+    // into as few calls as their layout allows: one for a contiguous or
+    // physical object
+    size_t i = 0;
+    while (i < count) {
+        paddr_t pa;
+        if (arch_mmu_query(&aspace_->arch_aspace(), pages[i].va, &pa, nullptr) >= 0) {
+            if (pa == pages[i].pa) {
+                // already there, leave its permissions alone
+                i++;
+                continue;
+            }
+            if (arch_mmu_unmap(&aspace_->arch_aspace(), pages[i].va, 1, nullptr) < 0) {
+                TRACEF("failed to unmap stale page around fault\n");
+                unmap_rest(i + 1);
+                return;
+            }
+        }
+
+        // assert that we're not accidentally mapping the zero page writable
+        DEBUG_ASSERT((pages[i].pa != vm_get_zero_page_paddr()) ||
+                     !(mmu_flags & ARCH_MMU_FLAG_PERM_WRITE));
+
+        size_t run = 1;
+        while (i + run < count &&
+               pages[i + run].va == pages[i].va + run * PAGE_SIZE &&
+               pages[i + run].pa == pages[i].pa + run * PAGE_SIZE &&
+               arch_mmu_query(&aspace_->arch_aspace(), pages[i + run].va, nullptr, nullptr) < 0) {
+            run++;
+        }
+
+        size_t mapped;
+        if (arch_mmu_map(&aspace_->arch_aspace(), pages[i].va, pages[i].pa, run, mmu_flags,
+                         &mapped) < 0) {
+            // these pages are only a hint, the faulting page is already in place
+            TRACEF("failed to map %zu pages around fault\n", run);
+            unmap_rest(i);
+            return;
+        }
+        DEBUG_ASSERT(mapped == run);
+
+#if ARCH_ARM64
+        if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)
+            arch_sync_cache_range(pages[i].va, run * PAGE_SIZE);
+#endif
+        i += run;
+    }
+}
+
 // We disable thread safety analysis here because one of the common uses of this
 // function is for splitting one mapping object into several that will be backed
 // by the same VmObject.  In that case, object_->lock() gets aliased across all
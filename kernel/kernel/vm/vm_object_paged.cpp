@@ -24,31 +24,24 @@
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
-namespace {
-
-void ZeroPage(paddr_t pa) {
-    void* ptr = paddr_to_kvaddr(pa);
-    DEBUG_ASSERT(ptr);
-
-    arch_zero_page(ptr);
-}
-
-void ZeroPage(vm_page_t* p) {
-    paddr_t pa = vm_page_to_paddr(p);
-    ZeroPage(pa);
-}
-
-} // namespace
-
 VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags)
     : pmm_alloc_flags_(pmm_alloc_flags) {
     LTRACEF("%p\n", this);
 }
 
+Mutex VmObjectPaged::discardable_lock_;
+VmObjectPaged::DiscardableList VmObjectPaged::discardable_list_;
+
 VmObjectPaged::~VmObjectPaged() {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("%p\n", this);
 
+    if (discardable_) {
+        AutoLock a(&discardable_lock_);
+        if (discardable_node_.InContainer())
+            discardable_list_.erase(*this);
+    }
+
     // free all of the pages attached to us
     page_list_.FreeAllPages();
 }
@@ -74,6 +67,18 @@ mxtl::RefPtr<VmObject> VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t
     return vmo;
 }
 
+mxtl::RefPtr<VmObject> VmObjectPaged::CreateDiscardable(uint32_t pmm_alloc_flags, uint64_t size) {
+    auto vmo = Create(pmm_alloc_flags, size);
+    if (vmo) {
+        auto paged = static_cast<VmObjectPaged*>(vmo.get());
+        paged->discardable_ = true;
+
+        AutoLock a(&discardable_lock_);
+        discardable_list_.push_back(paged);
+    }
+    return vmo;
+}
+
 void VmObjectPaged::Dump(uint depth, bool verbose) {
     if (magic_ != MAGIC) {
         printf("VmObjectPaged at %p has bad magic\n", this);
@@ -217,15 +222,12 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
 
     // allocate a page
     paddr_t pa;
-    p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+    p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZERO, &pa);
     if (!p)
         return ERR_NO_MEMORY;
 
     p->state = VM_PAGE_STATE_OBJECT;
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
-
     __UNUSED auto status = page_list_.AddPage(p, offset);
     DEBUG_ASSERT(status == NO_ERROR);
 
@@ -279,7 +281,7 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_, &page_list);
+    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZERO, &page_list);
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -303,9 +305,6 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
 
         p->state = VM_PAGE_STATE_OBJECT;
 
-        // TODO: remove once pmm returns zeroed pages
-        ZeroPage(p);
-
         __UNUSED auto status = page_list_.AddPage(p, o);
         DEBUG_ASSERT(status == NO_ERROR);
 
@@ -357,7 +356,8 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_, alignment_log2, nullptr, &page_list);
+    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZERO,
+                                            alignment_log2, nullptr, &page_list);
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -379,9 +379,6 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
 
         p->state = VM_PAGE_STATE_OBJECT;
 
-        // TODO: remove once pmm returns zeroed pages
-        ZeroPage(p);
-
         __UNUSED auto status = page_list_.AddPage(p, o);
         DEBUG_ASSERT(status == NO_ERROR);
 
@@ -441,6 +438,113 @@ status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t* d
     return NO_ERROR;
 }
 
+status_t VmObjectPaged::LockRange(uint64_t offset, uint64_t len, bool* discarded) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    if (!discardable_)
+        return ERR_NOT_SUPPORTED;
+
+    AutoLock dl(&discardable_lock_);
+    {
+        AutoLock a(&lock_);
+        if (offset != 0 || len < size_)
+            return ERR_INVALID_ARGS;
+    }
+
+    if (lock_count_++ == 0)
+        discardable_list_.erase(*this);
+
+    if (discarded)
+        *discarded = discarded_;
+    discarded_ = false;
+
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::UnlockRange(uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    if (!discardable_)
+        return ERR_NOT_SUPPORTED;
+
+    AutoLock dl(&discardable_lock_);
+    {
+        AutoLock a(&lock_);
+        if (offset != 0 || len < size_)
+            return ERR_INVALID_ARGS;
+    }
+
+    if (lock_count_ == 0)
+        return ERR_BAD_STATE;
+
+    if (--lock_count_ == 0) {
+        DEBUG_ASSERT(!discardable_node_.InContainer());
+        discardable_list_.push_back(this);
+    }
+
+    return NO_ERROR;
+}
+
+size_t VmObjectPaged::DiscardLocked(bool nonblocking) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    uint64_t len = ROUNDUP_PAGE_SIZE(size_);
+    if (len > 0) {
+        for (auto& m : mapping_list_) {
+            if (!nonblocking) {
+                m.UnmapVmoRangeLocked(0, len);
+            } else if (m.TryUnmapVmoRangeLocked(0, len) == ERR_SHOULD_WAIT) {
+                // The pages stay.  Mappings already unmapped fault them
+                // back in.
+                return 0;
+            }
+        }
+    }
+
+    return page_list_.FreeAllPages();
+}
+
+// The locking here is conditional, which the analysis cannot follow.
+size_t VmObjectPaged::ReclaimDiscardable(size_t target, bool nonblocking)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
+    if (nonblocking) {
+        if (!mutex_try_acquire(discardable_lock_.GetInternal()))
+            return 0;
+    } else {
+        discardable_lock_.Acquire();
+    }
+
+    size_t freed = 0;
+    for (auto iter = discardable_list_.begin(); iter.IsValid() && freed < target;) {
+        VmObjectPaged& vmo = *iter;
+        ++iter;
+
+        DEBUG_ASSERT(vmo.lock_count_ == 0);
+
+        // Someone is working on the object.  It may be the caller, further
+        // up the stack, so never wait for it.
+        if (!mutex_try_acquire(vmo.lock_.GetInternal()))
+            continue;
+
+        // Likewise for the page table locks unmapping takes.
+        size_t count = vmo.DiscardLocked(nonblocking);
+        vmo.lock_.Release();
+
+        // the object stays on the list; it may pick up pages again while
+        // unlocked, and those are as fair game as the first ones were
+        if (count > 0) {
+            LTRACEF("discarded %zu pages from vmo %p\n", count, &vmo);
+            freed += count;
+            vmo.discarded_ = true;
+        }
+    }
+
+    discardable_lock_.Release();
+    return freed;
+}
+
 status_t VmObjectPaged::Resize(uint64_t s) {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("vmo %p, size %" PRIu64 "\n", this, s);
@@ -29,6 +29,27 @@ void vmm_init(void);
 // global vmm lock (for now)
 extern mutex_t vmm_lock;
 
+// Page fault tuning, in pages: the aligned window of resident pages mapped
+// around a read fault, and the largest window committed ahead of a
+// sequential fault pattern.  Zero disables either one.  Set from the kernel
+// command line (vm.fault_around, vm.fault_ahead).
+extern uint32_t vm_fault_around_pages;
+extern uint32_t vm_fault_ahead_max_pages;
+
+// Called by the pmm, with the arena lock held, whenever the number of free
+// pages in the arenas changes.  Cheap unless the pressure level changes.
+void vm_pressure_update(size_t free_pages);
+
+// The number of free pages in the arenas, not counting the per-cpu caches.
+// This is the count the pressure levels are judged by.
+size_t pmm_count_arena_free_pages();
+
+// Try to free |pages| pages by discarding the contents of unlocked
+// discardable objects, skipping any whose object or page table locks are
+// busy rather than blocking.  Safe to call from the allocation path.  Returns
+// the number of pages freed.
+size_t vm_reclaim_nonblocking(size_t pages);
+
 // utility function to test that offset + len is entirely within a range
 // returns false if out of range
 // NOTE: only use unsigned lengths
@@ -7,14 +7,19 @@
 #include <app/tests.h>
 #include <assert.h>
 #include <err.h>
+#include <inttypes.h>
+#include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
 #include <kernel/vm/vm_address_region.h>
 #include <mxtl/array.h>
 #include <new.h>
+#include <platform.h>
 #include <unittest.h>
 
+#include "vm_priv.h"
+
 static const uint kArchRwFlags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
 
 // Allocates a single page, translates it to a vm_page_t and frees it.
@@ -70,6 +75,45 @@ static bool pmm_oversized_alloc_test(void* context) {
     END_TEST;
 }
 
+// Dirties and frees a batch of pages, then checks that zeroed allocations,
+// whether they come out of the zero pool or not, read back as zero.
+static bool pmm_zero_alloc_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 256;
+
+    auto count = pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_KMAP, &list);
+    EXPECT_EQ(alloc_count, count, "pmm_alloc_pages count");
+    vm_page_t* p;
+    list_for_every_entry (&list, p, vm_page_t, free.node) {
+        memset(paddr_to_kvaddr(vm_page_to_paddr(p)), 0xa5, PAGE_SIZE);
+    }
+    pmm_free(&list);
+
+    count = pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_ZERO, &list);
+    EXPECT_EQ(alloc_count, count, "pmm_alloc_pages zeroed count");
+    for (size_t i = 0; i < 16; i++) {
+        paddr_t pa;
+        vm_page_t* page = pmm_alloc_page(PMM_ALLOC_FLAG_ZERO, &pa);
+        REQUIRE_NONNULL(page, "pmm_alloc_page zeroed");
+        list_add_tail(&list, &page->free.node);
+    }
+
+    list_for_every_entry (&list, p, vm_page_t, free.node) {
+        const uint8_t* ptr = static_cast<uint8_t*>(paddr_to_kvaddr(vm_page_to_paddr(p)));
+        bool zero = true;
+        for (size_t i = 0; i < PAGE_SIZE; i++) {
+            zero = zero && ptr[i] == 0;
+        }
+        EXPECT_TRUE(zero, "zeroed page has non zero contents");
+    }
+
+    auto ret = pmm_free(&list);
+    EXPECT_EQ(alloc_count + 16, ret, "pmm_free on a list of pages");
+    END_TEST;
+}
+
 static uint32_t test_rand(uint32_t seed) {
     return (seed = seed * 1664525 + 1013904223);
 }
@@ -620,6 +664,237 @@ static bool vmo_read_write_smoke_test(void* context) {
     END_TEST;
 }
 
+// Per thread state for the concurrent fault tests.
+struct fault_thread_args {
+    uint8_t* base;
+    size_t len;
+    size_t offset; // first byte this thread writes
+    uint8_t value;
+};
+
+// Writes one byte in every page of the range, write faulting each page.
+static int fault_thread(void* arg) {
+    auto args = static_cast<fault_thread_args*>(arg);
+    for (size_t i = args->offset; i < args->len; i += PAGE_SIZE) {
+        args->base[i] = args->value;
+    }
+    return 0;
+}
+
+static const uint kMaxFaultThreads = 8;
+static const size_t kFaultPages = 512;
+
+// Runs |num_threads| threads that each write fault |kFaultPages| pages of
+// demand paged memory.  If |shared|, all of them fault on the same mapping,
+// each writing its own byte of every page; otherwise every thread faults on a
+// mapping and object of its own.  Returns the time taken, or 0 on failure.
+static lk_bigtime_t run_fault_threads(uint num_threads, bool shared) {
+    static const size_t len = kFaultPages * PAGE_SIZE;
+    auto ka = VmAspace::kernel_aspace();
+    uint8_t* ptrs[kMaxFaultThreads] = {};
+    fault_thread_args args[kMaxFaultThreads];
+    thread_t* threads[kMaxFaultThreads];
+    lk_bigtime_t elapsed = 0;
+
+    DEBUG_ASSERT(num_threads <= kMaxFaultThreads);
+    const uint num_mappings = shared ? 1 : num_threads;
+    for (uint i = 0; i < num_mappings; i++) {
+        auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, len);
+        if (!vmo || ka->MapObject(mxtl::move(vmo), "fault test", 0, len, (void**)&ptrs[i],
+                                  0, 0, 0, kArchRwFlags) != NO_ERROR) {
+            goto done;
+        }
+    }
+
+    for (uint i = 0; i < num_threads; i++) {
+        args[i].base = shared ? ptrs[0] : ptrs[i];
+        args[i].len = len;
+        args[i].offset = shared ? i : 0;
+        args[i].value = static_cast<uint8_t>(i + 1);
+    }
+
+    {
+        lk_bigtime_t start = current_time_hires();
+        for (uint i = 0; i < num_threads; i++) {
+            threads[i] = thread_create("fault test", fault_thread, &args[i],
+                                       DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+            thread_resume(threads[i]);
+        }
+        for (uint i = 0; i < num_threads; i++) {
+            thread_join(threads[i], nullptr, INFINITE_TIME);
+        }
+        elapsed = current_time_hires() - start;
+    }
+
+    // every write must have landed, none lost to a racing fault
+    for (uint i = 0; i < num_threads; i++) {
+        for (size_t o = args[i].offset; o < len; o += PAGE_SIZE) {
+            if (args[i].base[o] != args[i].value) {
+                elapsed = 0;
+                goto done;
+            }
+        }
+    }
+
+done:
+    for (uint i = 0; i < num_mappings; i++) {
+        if (ptrs[i]) {
+            ka->FreeRegion((vaddr_t)ptrs[i]);
+        }
+    }
+    return elapsed;
+}
+
+// Write faults pages on several threads at once, each into its own object.
+// Faults on different objects do not serialize on the aspace lock, so on a
+// multi-cpu machine the aggregate fault rate should grow with the thread count.
+static bool vmo_concurrent_fault_test(void* context) {
+    BEGIN_TEST;
+    const uint max_threads = MIN(arch_max_num_cpus(), kMaxFaultThreads);
+    printf("\n");
+    for (uint n = 1; n <= max_threads; n *= 2) {
+        lk_bigtime_t elapsed = run_fault_threads(n, false);
+        EXPECT_NEQ(0u, elapsed, "faulting on separate objects");
+        if (elapsed) {
+            printf("%u thread(s): %zu faults in %" PRIu64 " usec, %" PRIu64 " faults/msec\n",
+                   n, n * kFaultPages, elapsed / 1000, n * kFaultPages * 1000000 / elapsed);
+        }
+    }
+    END_TEST;
+}
+
+// Has several threads race to fault in the same pages of one mapping.
+static bool vmo_shared_fault_race_test(void* context) {
+    BEGIN_TEST;
+    const uint num_threads = MAX(MIN(arch_max_num_cpus(), kMaxFaultThreads), 2u);
+    EXPECT_NEQ(0u, run_fault_threads(num_threads, true), "faulting on a shared object");
+    END_TEST;
+}
+
+// Read faults one page of a fully committed, demand mapped object and checks
+// that the resident pages in the aligned window around it got mapped too.
+static bool vmo_fault_around_test(void* context) {
+    BEGIN_TEST;
+    static const size_t num_pages = 64;
+    static const size_t alloc_size = num_pages * PAGE_SIZE;
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+    EXPECT_EQ(NO_ERROR, vmo->CommitRange(0, alloc_size, nullptr), "committing object");
+
+    auto ka = VmAspace::kernel_aspace();
+    void* ptr;
+    auto ret = ka->MapObject(vmo, "test", 0, alloc_size, &ptr,
+                             0, 0, 0, kArchRwFlags);
+    REQUIRE_EQ(ret, NO_ERROR, "mapping object");
+    const vaddr_t base = reinterpret_cast<vaddr_t>(ptr);
+
+    static const size_t fault_page = 37;
+    __UNUSED volatile uint8_t val = static_cast<volatile uint8_t*>(ptr)[fault_page * PAGE_SIZE];
+    EXPECT_EQ(NO_ERROR, arch_mmu_query(&ka->arch_aspace(), base + fault_page * PAGE_SIZE,
+                                       nullptr, nullptr), "faulting page mapped");
+
+    const size_t window = vm_fault_around_pages;
+    if (window > 1) {
+        const size_t start = ROUNDDOWN(fault_page, window);
+        const size_t end = MIN(start + window, num_pages);
+        for (size_t i = start; i < end; i++) {
+            EXPECT_EQ(NO_ERROR, arch_mmu_query(&ka->arch_aspace(), base + i * PAGE_SIZE,
+                                               nullptr, nullptr), "neighbour mapped");
+        }
+        if (end < num_pages) {
+            EXPECT_NEQ(NO_ERROR, arch_mmu_query(&ka->arch_aspace(), base + end * PAGE_SIZE,
+                                                nullptr, nullptr), "outside window mapped");
+        }
+    }
+
+    auto err = ka->FreeRegion(base);
+    EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    END_TEST;
+}
+
+// Write faults the first pages of a demand paged object in order and checks
+// that the second, sequential fault committed and mapped pages ahead of it.
+static bool vmo_fault_ahead_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 64;
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+
+    auto ka = VmAspace::kernel_aspace();
+    void* ptr;
+    auto ret = ka->MapObject(vmo, "test", 0, alloc_size, &ptr,
+                             0, 0, 0, kArchRwFlags);
+    REQUIRE_EQ(ret, NO_ERROR, "mapping object");
+    const vaddr_t base = reinterpret_cast<vaddr_t>(ptr);
+    volatile uint8_t* p = static_cast<volatile uint8_t*>(ptr);
+
+    p[0] = 1;
+    p[PAGE_SIZE] = 2;
+    if (vm_fault_ahead_max_pages > 0) {
+        EXPECT_EQ(3u, vmo->AllocatedPages(), "committed ahead of sequential fault");
+        EXPECT_EQ(NO_ERROR, arch_mmu_query(&ka->arch_aspace(), base + 2 * PAGE_SIZE,
+                                           nullptr, nullptr), "page ahead mapped");
+    } else {
+        EXPECT_EQ(2u, vmo->AllocatedPages(), "committed only faulting pages");
+    }
+
+    // stream through the rest; every write must land
+    for (size_t i = 2; i < alloc_size / PAGE_SIZE; i++) {
+        p[i * PAGE_SIZE] = static_cast<uint8_t>(i + 1);
+    }
+    EXPECT_EQ(alloc_size / PAGE_SIZE, vmo->AllocatedPages(), "all pages committed");
+    for (size_t i = 0; i < alloc_size / PAGE_SIZE; i++) {
+        EXPECT_EQ(static_cast<uint8_t>(i + 1), p[i * PAGE_SIZE], "page contents");
+    }
+
+    auto err = ka->FreeRegion(base);
+    EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    END_TEST;
+}
+
+// Unlocks a mapped discardable object, reclaims it and checks that its pages
+// and mappings are gone and that relocking reports the loss.
+static bool vmo_discardable_reclaim_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 8;
+    auto vmo = VmObjectPaged::CreateDiscardable(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+
+    bool discarded = true;
+    EXPECT_EQ(NO_ERROR, vmo->LockRange(0, alloc_size, &discarded), "lock");
+    EXPECT_FALSE(discarded, "fresh object discarded");
+    EXPECT_EQ(ERR_INVALID_ARGS, vmo->UnlockRange(PAGE_SIZE, PAGE_SIZE), "partial unlock");
+
+    auto ka = VmAspace::kernel_aspace();
+    void* ptr;
+    auto ret = ka->MapObject(vmo, "test", 0, alloc_size, &ptr,
+                             0, 0, VMM_FLAG_COMMIT, kArchRwFlags);
+    REQUIRE_EQ(ret, NO_ERROR, "mapping object");
+    const vaddr_t base = reinterpret_cast<vaddr_t>(ptr);
+    volatile uint8_t* p = static_cast<volatile uint8_t*>(ptr);
+    p[PAGE_SIZE] = 0x5a;
+
+    // locked objects are left alone
+    VmObjectPaged::ReclaimDiscardable(SIZE_MAX, false);
+    EXPECT_EQ(alloc_size / PAGE_SIZE, vmo->AllocatedPages(), "locked object reclaimed");
+
+    EXPECT_EQ(NO_ERROR, vmo->UnlockRange(0, alloc_size), "unlock");
+    EXPECT_EQ(ERR_BAD_STATE, vmo->UnlockRange(0, alloc_size), "unlock while unlocked");
+    EXPECT_LE(alloc_size / PAGE_SIZE, VmObjectPaged::ReclaimDiscardable(SIZE_MAX, false),
+              "reclaimed pages");
+    EXPECT_EQ(0u, vmo->AllocatedPages(), "unlocked object not reclaimed");
+    EXPECT_NEQ(NO_ERROR, arch_mmu_query(&ka->arch_aspace(), base + PAGE_SIZE,
+                                        nullptr, nullptr), "discarded page still mapped");
+
+    EXPECT_EQ(NO_ERROR, vmo->LockRange(0, alloc_size, &discarded), "relock");
+    EXPECT_TRUE(discarded, "discard not reported");
+    EXPECT_EQ(0u, p[PAGE_SIZE], "discarded page reads zero");
+
+    auto err = ka->FreeRegion(base);
+    EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    END_TEST;
+}
+
 // Use the function name as the test name
 #define VM_UNITTEST(fname) UNITTEST(#fname, fname)
 
@@ -627,6 +902,7 @@ UNITTEST_START_TESTCASE(vm_tests)
 VM_UNITTEST(pmm_smoke_test)
 VM_UNITTEST(pmm_large_alloc_test)
 VM_UNITTEST(pmm_oversized_alloc_test)
+VM_UNITTEST(pmm_zero_alloc_test)
 VM_UNITTEST(vmm_alloc_smoke_test)
 VM_UNITTEST(vmm_alloc_contiguous_smoke_test)
 VM_UNITTEST(multiple_regions_test)
@@ -646,5 +922,10 @@ VM_UNITTEST(vmo_dropped_ref_test)
 VM_UNITTEST(vmo_remap_test)
 VM_UNITTEST(vmo_double_remap_test)
 VM_UNITTEST(vmo_read_write_smoke_test)
+VM_UNITTEST(vmo_concurrent_fault_test)
+VM_UNITTEST(vmo_shared_fault_race_test)
+VM_UNITTEST(vmo_fault_around_test)
+VM_UNITTEST(vmo_fault_ahead_test)
+VM_UNITTEST(vmo_discardable_reclaim_test)
 VM_UNITTEST(dump_all_aspaces)  // Run last
 UNITTEST_END_TESTCASE(vm_tests, "vmtests", "Virtual memory tests", nullptr, nullptr);
@@ -7,9 +7,12 @@
 #pragma once
 
 #include <kernel/event.h>
+#include <kernel/spinlock.h>
 
 #include <magenta/dispatcher.h>
+#include <magenta/port_dispatcher_v2.h>
 #include <mxtl/canary.h>
+#include <mxtl/ref_ptr.h>
 #include <sys/types.h>
 
 // TODO:
@@ -25,6 +28,8 @@ class InterruptDispatcher : public Dispatcher {
 public:
     InterruptDispatcher& operator=(const InterruptDispatcher &) = delete;
 
+    ~InterruptDispatcher();
+
     mx_obj_type_t get_type() const final { return MX_OBJ_TYPE_INTERRUPT; }
 
     // Notify the system that the caller has finished processing the interrupt.
@@ -34,9 +39,12 @@ public:
     // Signal the IRQ from non-IRQ state in response to a user-land request.
     virtual status_t UserSignal() = 0;
 
-    status_t WaitForInterrupt() {
-        return event_wait(&event_);
-    }
+    // Deliver the interrupt as an MX_PKT_TYPE_INTERRUPT packet with |key|
+    // on |port| instead of waking WaitForInterrupt(). A dispatcher can only
+    // be bound once, and InterruptComplete() still re-arms the interrupt.
+    status_t Bind(mxtl::RefPtr<PortDispatcherV2> port, uint64_t key);
+
+    status_t WaitForInterrupt();
 
     virtual void on_zero_handles() final {
         // Ensure any waiters stop waiting
@@ -44,12 +52,10 @@ public:
     }
 
 protected:
-    InterruptDispatcher() {
-        event_init(&event_, false, 0);
-    }
-    int signal(bool resched = false) {
-        return event_signal(&event_, resched);
-    }
+    InterruptDispatcher();
+
+    // Safe to call from interrupt context.
+    int signal(bool resched = false);
     void unsignal() {
         event_unsignal(&event_);
     }
@@ -57,4 +63,10 @@ protected:
 private:
     mxtl::Canary<mxtl::magic("INTD")> canary_;
     event_t event_;
+
+    // |port_| is set once by Bind() and never cleared, so the irq path only
+    // needs the lock to observe it.
+    SpinLock lock_;
+    mxtl::RefPtr<PortDispatcherV2> port_;
+    PortPacket packet_;
 };
@@ -0,0 +1,15 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <magenta/dispatcher.h>
+#include <mxtl/ref_ptr.h>
+
+// Returns the event that reflects the kernel's memory pressure level: exactly
+// one of MX_MEMORY_PRESSURE_NORMAL, _WARNING or _CRITICAL is asserted on it
+// at any time.  Null until the threading init level has run.
+mxtl::RefPtr<Dispatcher> GetMemoryPressureEvent();
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 
 #include <magenta/dispatcher.h>
 #include <magenta/semaphore.h>
@@ -138,6 +139,14 @@ public:
     mx_status_t QueueUser(const mx_port_packet_t& packet);
     mx_status_t DeQueue(mx_time_t timeout, mx_port_packet_t* packet);
 
+    // Queues an MX_PKT_TYPE_INTERRUPT packet owned by an interrupt dispatcher.
+    // Safe to call from interrupt context. Does nothing if the packet is
+    // already queued; otherwise stamps it with |timestamp|. Returns the
+    // number of threads woken.
+    int QueueInterrupt(PortPacket* packet, mx_time_t timestamp);
+    // Removes |packet| from the port if it is still queued.
+    void CancelInterrupt(PortPacket* packet);
+
     // Decides who is going to destroy the observer. If it returns |true| it
     // is the duty of the caller. If it is false it is the duty of the port.
     bool CanReap(PortObserver* observer, PortPacket* port_packet);
@@ -156,4 +165,10 @@ private:
     Semaphore sema_;
     bool zero_handles_ TA_GUARDED(lock_);
     mxtl::DoublyLinkedList<PortPacket*> packets_ TA_GUARDED(lock_);
+
+    // Interrupt packets are queued from irq context, so they get their own
+    // list under a spinlock. They are dequeued ahead of |packets_|.
+    SpinLock irq_lock_;
+    bool irq_zero_handles_;
+    mxtl::DoublyLinkedList<PortPacket*> irq_packets_;
 };
@@ -0,0 +1,69 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <magenta/interrupt_dispatcher.h>
+
+#include <err.h>
+#include <kernel/auto_lock.h>
+#include <kernel/thread.h>
+#include <platform.h>
+
+InterruptDispatcher::InterruptDispatcher() {
+    event_init(&event_, false, 0);
+}
+
+InterruptDispatcher::~InterruptDispatcher() {
+    // Our subclass has already unregistered its irq handler, so the packet
+    // cannot be queued again.
+    if (port_)
+        port_->CancelInterrupt(&packet_);
+}
+
+status_t InterruptDispatcher::Bind(mxtl::RefPtr<PortDispatcherV2> port, uint64_t key) {
+    canary_.Assert();
+
+    {
+        AutoSpinLockIrqSave guard(lock_);
+        if (port_)
+            return ERR_ALREADY_BOUND;
+
+        packet_.packet.key = key;
+        packet_.packet.type = MX_PKT_TYPE_INTERRUPT;
+        packet_.packet.status = NO_ERROR;
+        port_ = mxtl::move(port);
+    }
+
+    // Interrupts no longer reach the event, so release anyone still blocked
+    // in WaitForInterrupt().
+    event_signal_etc(&event_, true, ERR_BAD_STATE);
+    return NO_ERROR;
+}
+
+status_t InterruptDispatcher::WaitForInterrupt() {
+    canary_.Assert();
+
+    {
+        AutoSpinLockIrqSave guard(lock_);
+        if (port_)
+            return ERR_BAD_STATE;
+    }
+    return event_wait(&event_);
+}
+
+int InterruptDispatcher::signal(bool resched) {
+    PortDispatcherV2* port;
+    {
+        AutoSpinLockIrqSave guard(lock_);
+        port = port_.get();
+    }
+    if (!port)
+        return event_signal(&event_, resched);
+
+    int wake_count = port->QueueInterrupt(&packet_, current_time_hires());
+    if (resched && wake_count > 0)
+        thread_preempt(false);
+    return wake_count;
+}
@@ -0,0 +1,59 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <magenta/memory_pressure.h>
+
+#include <assert.h>
+#include <err.h>
+#include <kernel/thread.h>
+#include <kernel/vm.h>
+#include <lk/init.h>
+
+#include <magenta/event_dispatcher.h>
+#include <magenta/state_tracker.h>
+
+constexpr mx_signals_t kPressureSignals =
+    MX_MEMORY_PRESSURE_NORMAL | MX_MEMORY_PRESSURE_WARNING | MX_MEMORY_PRESSURE_CRITICAL;
+
+static mxtl::RefPtr<Dispatcher> pressure_event;
+
+static mx_signals_t pressure_signal(uint level) {
+    switch (level) {
+    case VM_PRESSURE_NORMAL:
+        return MX_MEMORY_PRESSURE_NORMAL;
+    case VM_PRESSURE_WARNING:
+        return MX_MEMORY_PRESSURE_WARNING;
+    default:
+        return MX_MEMORY_PRESSURE_CRITICAL;
+    }
+}
+
+// Mirrors the vm's pressure level onto the event.
+static int memory_pressure_thread(void*) {
+    uint level = vm_pressure_level();
+    for (;;) {
+        pressure_event->get_state_tracker()->UpdateState(kPressureSignals,
+                                                         pressure_signal(level));
+        level = vm_pressure_wait(level);
+    }
+    return 0;
+}
+
+mxtl::RefPtr<Dispatcher> GetMemoryPressureEvent() {
+    return pressure_event;
+}
+
+static void memory_pressure_init(uint level) {
+    mx_rights_t rights;
+    __UNUSED status_t status = EventDispatcher::Create(0u, &pressure_event, &rights);
+    DEBUG_ASSERT(status == NO_ERROR);
+
+    thread_t* t = thread_create("memory pressure", &memory_pressure_thread, nullptr,
+                                HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+}
+// after the vm's own pressure monitor, which is also at the threading level
+LK_INIT_HOOK(memory_pressure, &memory_pressure_init, LK_INIT_LEVEL_THREADING + 1);
@@ -112,7 +112,7 @@ mx_status_t PortDispatcherV2::Create(uint32_t options,
 }
 
 PortDispatcherV2::PortDispatcherV2(uint32_t /*options*/)
-    : zero_handles_(false) {
+    : zero_handles_(false), irq_zero_handles_(false) {
 }
 
 PortDispatcherV2::~PortDispatcherV2() {
@@ -126,6 +126,11 @@ void PortDispatcherV2::on_zero_handles() {
         AutoLock al(&lock_);
         zero_handles_ = true;
     }
+    {
+        AutoSpinLockIrqSave guard(irq_lock_);
+        irq_zero_handles_ = true;
+        irq_packets_.clear();
+    }
     while (DeQueue(0ull, nullptr) == NO_ERROR) {}
 }
 
@@ -167,6 +172,32 @@ mx_status_t PortDispatcherV2::Queue(PortPacket* packet, uint64_t count) {
     return NO_ERROR;
 }
 
+int PortDispatcherV2::QueueInterrupt(PortPacket* packet, mx_time_t timestamp) {
+    canary_.Assert();
+
+    {
+        AutoSpinLockIrqSave guard(irq_lock_);
+        if (irq_zero_handles_ || packet->InContainer())
+            return 0;
+        // Written under the lock DeQueue() copies the packet out under, and
+        // only while the packet is not queued.
+        packet->packet.interrupt.timestamp = timestamp;
+        irq_packets_.push_back(packet);
+    }
+    // The semaphore only takes the thread lock, which is safe in irq context.
+    return sema_.Post();
+}
+
+void PortDispatcherV2::CancelInterrupt(PortPacket* packet) {
+    canary_.Assert();
+
+    // The semaphore count is left alone; DeQueue() goes back to waiting when
+    // it wakes up to an empty port.
+    AutoSpinLockIrqSave guard(irq_lock_);
+    if (packet->InContainer())
+        irq_packets_.erase(*packet);
+}
+
 bool PortDispatcherV2::UpdateSignalCountLocked(PortPacket* port_packet, uint64_t count) {
     if (port_packet->InContainer()) {
         DEBUG_ASSERT(port_packet->type() == MX_PKT_TYPE_SIGNAL_REP);
@@ -186,6 +217,15 @@ mx_status_t PortDispatcherV2::DeQueue(mx_time_t timeout, mx_port_packet_t* packe
     PortObserver* observer = nullptr;
 
     while (true) {
+        {
+            AutoSpinLockIrqSave guard(irq_lock_);
+            if (!irq_packets_.is_empty()) {
+                port_packet = irq_packets_.pop_front();
+                if (packet)
+                    *packet = port_packet->packet;
+                return NO_ERROR;
+            }
+        }
         {
             AutoLock al(&lock_);
             if (packets_.is_empty())
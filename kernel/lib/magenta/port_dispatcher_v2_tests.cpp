@@ -0,0 +1,57 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <magenta/port_dispatcher_v2.h>
+
+#include <err.h>
+#include <unittest.h>
+
+#include <magenta/syscalls/port.h>
+
+namespace {
+
+static bool queue_interrupt_timestamp(void* context) {
+    BEGIN_TEST;
+
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    REQUIRE_EQ(NO_ERROR, PortDispatcherV2::Create(0u, &dispatcher, &rights), "");
+    auto port = DownCastDispatcher<PortDispatcherV2>(&dispatcher);
+    REQUIRE_NONNULL(port, "");
+
+    PortPacket packet;
+    packet.packet.key = 7u;
+    packet.packet.type = MX_PKT_TYPE_INTERRUPT;
+
+    port->QueueInterrupt(&packet, 10);
+    // Already queued: the packet, and the timestamp in it, stay as they are.
+    port->QueueInterrupt(&packet, 20);
+
+    mx_port_packet_t out = {};
+    EXPECT_EQ(NO_ERROR, port->DeQueue(0ull, &out), "");
+    EXPECT_EQ(7u, out.key, "");
+    EXPECT_EQ(10u, out.interrupt.timestamp, "first timestamp should be kept");
+    EXPECT_EQ(ERR_TIMED_OUT, port->DeQueue(0ull, &out), "should be queued once");
+
+    port->QueueInterrupt(&packet, 30);
+    EXPECT_EQ(NO_ERROR, port->DeQueue(0ull, &out), "");
+    EXPECT_EQ(30u, out.interrupt.timestamp, "requeue should restamp");
+
+    // A cancelled packet is not delivered.
+    port->QueueInterrupt(&packet, 40);
+    port->CancelInterrupt(&packet);
+    EXPECT_EQ(ERR_TIMED_OUT, port->DeQueue(0ull, &out), "");
+
+    port->on_zero_handles();
+
+    END_TEST;
+}
+
+} // namespace
+
+UNITTEST_START_TESTCASE(port_dispatcher_v2_tests)
+UNITTEST("queue interrupt timestamp", queue_interrupt_timestamp)
+UNITTEST_END_TESTCASE(port_dispatcher_v2_tests, "port2", "Port Dispatcher V2 Tests", nullptr, nullptr);
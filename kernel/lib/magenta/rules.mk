@@ -24,11 +24,13 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/handle.cpp \
     $(LOCAL_DIR)/handle_reaper.cpp \
     $(LOCAL_DIR)/hypervisor_dispatcher.cpp \
+    $(LOCAL_DIR)/interrupt_dispatcher.cpp \
     $(LOCAL_DIR)/interrupt_event_dispatcher.cpp \
     $(LOCAL_DIR)/io_mapping_dispatcher.cpp \
     $(LOCAL_DIR)/job_dispatcher.cpp \
     $(LOCAL_DIR)/log_dispatcher.cpp \
     $(LOCAL_DIR)/magenta.cpp \
+    $(LOCAL_DIR)/memory_pressure.cpp \
     $(LOCAL_DIR)/message_packet.cpp \
     $(LOCAL_DIR)/pci_device_dispatcher.cpp \
     $(LOCAL_DIR)/pci_interrupt_dispatcher.cpp \
@@ -36,6 +38,7 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/port_client.cpp \
     $(LOCAL_DIR)/port_dispatcher.cpp \
     $(LOCAL_DIR)/port_dispatcher_v2.cpp \
+    $(LOCAL_DIR)/port_dispatcher_v2_tests.cpp \
     $(LOCAL_DIR)/process_dispatcher.cpp \
     $(LOCAL_DIR)/resource_dispatcher.cpp \
     $(LOCAL_DIR)/semaphore.cpp \
@@ -54,5 +57,6 @@ MODULE_DEPS := \
     lib/mxtl \
     dev/interrupt \
     dev/udisplay \
+    lib/unittest \
 
 include make/module.mk
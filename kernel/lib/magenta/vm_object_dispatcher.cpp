@@ -89,10 +89,21 @@ mx_status_t VmObjectDispatcher::RangeOp(uint32_t op, uint64_t offset, uint64_t s
             auto status = vmo_->DecommitRange(offset, size, nullptr);
             return status;
         }
-        case MX_VMO_OP_LOCK:
+        case MX_VMO_OP_LOCK: {
+            bool discarded;
+            auto status = vmo_->LockRange(offset, size, &discarded);
+            if (status != NO_ERROR)
+                return status;
+            // optionally tell the caller whether the contents were lost
+            if (buffer && buffer_size >= sizeof(uint32_t)) {
+                uint32_t flag = discarded ? 1u : 0u;
+                if (buffer.reinterpret<uint32_t>().copy_to_user(flag) != NO_ERROR)
+                    return ERR_INVALID_ARGS;
+            }
+            return NO_ERROR;
+        }
         case MX_VMO_OP_UNLOCK:
-            // TODO: handle
-            return ERR_NOT_SUPPORTED;
+            return vmo_->UnlockRange(offset, size);
         case MX_VMO_OP_LOOKUP:
             // we will be using the user pointer
             if (!buffer)
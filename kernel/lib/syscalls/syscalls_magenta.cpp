@@ -26,6 +26,7 @@
 #include <magenta/handle_owner.h>
 #include <magenta/log_dispatcher.h>
 #include <magenta/magenta.h>
+#include <magenta/memory_pressure.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/syscalls/log.h>
 #include <magenta/user_copy.h>
@@ -116,6 +117,36 @@ mx_status_t sys_event_create(uint32_t options, user_ptr<mx_handle_t> _out) {
     return NO_ERROR;
 }
 
+mx_status_t sys_system_get_event(uint32_t kind, user_ptr<mx_handle_t> _out) {
+    LTRACEF("kind %u\n", kind);
+
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    switch (kind) {
+    case MX_SYSTEM_EVENT_MEMORY_PRESSURE:
+        dispatcher = GetMemoryPressureEvent();
+        break;
+    default:
+        return ERR_INVALID_ARGS;
+    }
+    if (!dispatcher)
+        return ERR_BAD_STATE;
+
+    // the kernel owns the signals; callers may only watch them
+    constexpr mx_rights_t rights = MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ;
+
+    HandleOwner handle(MakeHandle(mxtl::move(dispatcher), rights));
+    if (!handle)
+        return ERR_NO_MEMORY;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    if (_out.copy_to_user(up->MapHandleToValue(handle)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    up->AddHandle(mxtl::move(handle));
+    return NO_ERROR;
+}
+
 mx_status_t sys_eventpair_create(uint32_t options,
                                  user_ptr<mx_handle_t> _out0, user_ptr<mx_handle_t> _out1) {
     LTRACEF("entry out_handles %p,%p\n", _out0.get(), _out1.get());
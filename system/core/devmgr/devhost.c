@@ -228,6 +228,17 @@ int main(int argc, char** argv) {
 
     devhost_init_drivers(as_root);
 
+    // Optionally service device rpcs from a pool of threads, so that one
+    // slow client request does not hold up the others. The main thread
+    // joins the pool below.
+    const char* threads = getenv("devhost.rpc-threads");
+    if (threads != NULL) {
+        uint32_t n = strtoul(threads, NULL, 10);
+        if (n > 1) {
+            mxio_dispatcher_start_pool(devhost_rio_dispatcher, "devhost-rio", n - 1);
+        }
+    }
+
     mxio_dispatcher_run(devhost_rio_dispatcher);
     printf("devhost: rio dispatcher exited?\n");
     return 0;
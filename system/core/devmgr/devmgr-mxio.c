@@ -39,14 +39,16 @@ struct bootfile {
 
 struct callback_data {
     mx_handle_t vmo;
+    bootdata_lazy_t* lazy;
     unsigned int file_count;
-    mx_status_t (*add_file)(const char* path, mx_handle_t vmo, mx_off_t off, size_t len);
+    mx_status_t (*add_file)(const char* path, mx_handle_t vmo, mx_off_t off, size_t len,
+                            bootdata_lazy_t* lazy);
 };
 
 static void callback(void* arg, const char* path, size_t off, size_t len) {
     struct callback_data* cd = arg;
     //printf("bootfs: %s @%zd (%zd bytes)\n", path, off, len);
-    cd->add_file(path, cd->vmo, off, len);
+    cd->add_file(path, cd->vmo, off, len, cd->lazy);
     ++cd->file_count;
 }
 
@@ -114,7 +116,8 @@ static void start_system_init(void) {
 }
 
 static bool has_secondary_bootfs = false;
-static ssize_t setup_bootfs_vmo(uint32_t n, uint32_t type, mx_handle_t vmo) {
+static ssize_t setup_bootfs_vmo(uint32_t n, uint32_t type, mx_handle_t vmo,
+                                bootdata_lazy_t* lazy) {
     uint64_t size;
     mx_status_t status = mx_vmo_get_size(vmo, &size);
     if (status != NO_ERROR) {
@@ -126,6 +129,7 @@ static ssize_t setup_bootfs_vmo(uint32_t n, uint32_t type, mx_handle_t vmo) {
     }
     struct callback_data cd = {
         .vmo = vmo,
+        .lazy = lazy,
         .add_file = (type == BOOTDATA_BOOTFS_SYSTEM) ? systemfs_add_file : bootfs_add_file,
     };
     if ((type == BOOTDATA_BOOTFS_SYSTEM) && !has_secondary_bootfs) {
@@ -141,12 +145,18 @@ static ssize_t setup_bootfs_vmo(uint32_t n, uint32_t type, mx_handle_t vmo) {
 #define HND_BOOTFS(n) MX_HND_INFO(MX_HND_TYPE_BOOTFS_VMO, n)
 #define HND_BOOTDATA(n) MX_HND_INFO(MX_HND_TYPE_BOOTDATA_VMO, n)
 
+static bool bootfs_lazy_enabled(void) {
+    const char* v = getenv("bootfs.lazy");
+    return v && strcmp(v, "0") && strcmp(v, "false") && strcmp(v, "off");
+}
+
 static void setup_bootfs(void) {
     mx_handle_t vmo;
     unsigned idx = 0;
+    bool lazy = bootfs_lazy_enabled();
 
     if ((vmo = mx_get_startup_handle(HND_BOOTFS(0)))) {
-        setup_bootfs_vmo(idx++, BOOTDATA_BOOTFS_BOOT, vmo);
+        setup_bootfs_vmo(idx++, BOOTDATA_BOOTFS_BOOT, vmo, NULL);
     } else {
         printf("devmgr: missing primary bootfs?!\n");
     }
@@ -187,14 +197,22 @@ static void setup_bootfs(void) {
             case BOOTDATA_BOOTFS_SYSTEM: {
                 const char* errmsg;
                 mx_handle_t bootfs_vmo;
-                printf("devmgr: decompressing bootfs #%u\n", idx);
-                status = decompress_bootdata(mx_vmar_root_self(), vmo,
-                                             off, bootdata.length + sizeof(bootdata),
-                                             &bootfs_vmo, &errmsg);
+                bootdata_lazy_t* bootfs_lazy = NULL;
+                if (lazy && (bootdata.flags & BOOTDATA_BOOTFS_FLAG_COMPRESSED)) {
+                    printf("devmgr: deferring decompression of bootfs #%u\n", idx);
+                    status = decompress_bootdata_lazy(mx_vmar_root_self(), vmo,
+                                                      off, bootdata.length + sizeof(bootdata),
+                                                      &bootfs_lazy, &bootfs_vmo, &errmsg);
+                } else {
+                    printf("devmgr: decompressing bootfs #%u\n", idx);
+                    status = decompress_bootdata_parallel(mx_vmar_root_self(), vmo,
+                                                          off, bootdata.length + sizeof(bootdata),
+                                                          0, &bootfs_vmo, &errmsg);
+                }
                 if (status < 0) {
-                    printf("devmgr: failed to decompress bootdata\n");
+                    printf("devmgr: failed to decompress bootdata: %s\n", errmsg);
                 } else {
-                    setup_bootfs_vmo(idx++, bootdata.type, bootfs_vmo);
+                    setup_bootfs_vmo(idx++, bootdata.type, bootfs_vmo, bootfs_lazy);
                 }
                 break;
             }
@@ -220,7 +238,7 @@ done:
 }
 
 ssize_t devmgr_add_systemfs_vmo(mx_handle_t vmo) {
-    ssize_t added = setup_bootfs_vmo(100, BOOTDATA_BOOTFS_SYSTEM, vmo);
+    ssize_t added = setup_bootfs_vmo(100, BOOTDATA_BOOTFS_SYSTEM, vmo, NULL);
     if (added > 0) {
         start_system_init();
     }
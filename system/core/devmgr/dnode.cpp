@@ -17,6 +17,58 @@
 
 namespace memfs {
 
+// Child indexes start at this many buckets and double whenever a directory
+// holds more children than buckets.
+#define DN_MIN_BUCKETS 8
+
+// FNV-1a
+static uint32_t dn_hash(const char* name, size_t len) {
+    uint32_t n = 2166136261u;
+    while (len-- > 0) {
+        n = (n ^ static_cast<uint8_t>(*name++)) * 16777619u;
+    }
+    return n;
+}
+
+static void dn_hash_insert(dnode_t* parent, dnode_t* child) {
+    dnode_t** bucket = &parent->buckets[child->hash & (parent->bucket_count - 1)];
+    child->hash_next = *bucket;
+    *bucket = child;
+}
+
+static void dn_hash_remove(dnode_t* parent, dnode_t* child) {
+    if (parent->bucket_count == 0) {
+        return;
+    }
+    dnode_t** link = &parent->buckets[child->hash & (parent->bucket_count - 1)];
+    while (*link != nullptr) {
+        if (*link == child) {
+            *link = child->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    child->hash_next = nullptr;
+}
+
+// Rebuild the index of 'parent' from its list of children.
+// On failure the old index is left in place.
+static bool dn_rehash(dnode_t* parent, uint32_t count) {
+    dnode_t** buckets = static_cast<dnode_t**>(calloc(count, sizeof(dnode_t*)));
+    if (buckets == nullptr) {
+        return false;
+    }
+    free(parent->buckets);
+    parent->buckets = buckets;
+    parent->bucket_count = count;
+
+    dnode_t* dn;
+    list_for_every_entry(&parent->children, dn, dnode_t, dn_entry) {
+        dn_hash_insert(parent, dn);
+    }
+    return true;
+}
+
 // create a new dnode and attach it to a vnode
 mx_status_t dn_create(dnode_t** out, const char* name, size_t len, VnodeMemfs* vn) {
     mx_status_t status;
@@ -56,11 +108,24 @@ void dn_attach(dnode_t* dn, VnodeMemfs* vn) {
 void dn_delete(dnode_t* dn) {
     MX_DEBUG_ASSERT(list_is_empty(&dn->children));
 
+    // devfs and bootfs change outside of the vfs, so the lookup cache is
+    // kept up to date here.
+    if (dn->vnode) {
+        fs::vfs_cache_purge(dn->vnode);
+    }
+
     // detach from parent
     if (dn->parent) {
+        dnode_t* parent = dn->parent;
         list_delete(&dn->dn_entry);
+        dn_hash_remove(parent, dn);
+        if (--parent->child_count == 0) {
+            free(parent->buckets);
+            parent->buckets = nullptr;
+            parent->bucket_count = 0;
+        }
         if (DNODE_IS_DIR(dn)) {
-            dn->parent->vnode->link_count_--;
+            parent->vnode->link_count_--;
         }
         dn->parent = nullptr;
     }
@@ -74,6 +139,7 @@ void dn_delete(dnode_t* dn) {
         dn->vnode = nullptr;
     }
 
+    free(dn->buckets);
     free(dn);
 }
 
@@ -91,6 +157,8 @@ void dn_add_child(dnode_t* parent, dnode_t* child) {
         panic();
     }
 
+    fs::vfs_cache_invalidate(parent->vnode, child->name, DN_NAME_LEN(child->flags));
+
     child->parent = parent;
     child->vnode->link_count_++;
     if (child->vnode->dnode_) {
@@ -98,6 +166,47 @@ void dn_add_child(dnode_t* parent, dnode_t* child) {
         parent->vnode->link_count_++;
     }
     list_add_tail(&parent->children, &child->dn_entry);
+
+    // Ordinals only grow, so the list stays sorted by them.
+    child->ordinal = ++parent->next_ordinal;
+    child->hash = dn_hash(child->name, DN_NAME_LEN(child->flags));
+    if (++parent->child_count > parent->bucket_count) {
+        uint32_t count = parent->bucket_count ? parent->bucket_count * 2 : DN_MIN_BUCKETS;
+        if (dn_rehash(parent, count)) {
+            return;
+        }
+    }
+    if (parent->bucket_count != 0) {
+        dn_hash_insert(parent, child);
+    }
+}
+
+void dn_move_children(dnode_t* src, dnode_t* dst) {
+    MX_DEBUG_ASSERT(list_is_empty(&dst->children));
+    MX_DEBUG_ASSERT(dst->buckets == nullptr);
+
+    list_move(&src->children, &dst->children);
+    dst->buckets = src->buckets;
+    dst->bucket_count = src->bucket_count;
+    dst->child_count = src->child_count;
+    dst->next_ordinal = src->next_ordinal;
+    src->buckets = nullptr;
+    src->bucket_count = 0;
+    src->child_count = 0;
+
+    // TODO(smklein): Because each child has an explicit pointer
+    // to the parent entry, we must traverse through all children
+    // to rename a parent directory.
+    //
+    // Possible solution:
+    //  - Don't reallocate the new dnode. Decouple dnode names from the
+    //  rest of their structure (possibly allow in-line storage for short
+    //  names). Resuing the original dnode will not require any
+    //  modifications in the childs.
+    dnode_t* dn;
+    list_for_every_entry(&dst->children, dn, dnode_t, dn_entry) {
+        dn->parent = dst;
+    }
 }
 
 mx_status_t dn_lookup(dnode_t* parent, dnode_t** out, const char* name, size_t len) {
@@ -110,7 +219,22 @@ mx_status_t dn_lookup(dnode_t* parent, dnode_t** out, const char* name, size_t l
         *out = parent->parent;
         return NO_ERROR;
     }
-    list_for_every_entry(&parent->children, dn, dnode_t, dn_entry) {
+    if (parent->bucket_count == 0) {
+        // The index could not be allocated; fall back to the list.
+        list_for_every_entry(&parent->children, dn, dnode_t, dn_entry) {
+            if ((DN_NAME_LEN(dn->flags) == len) && (memcmp(dn->name, name, len) == 0)) {
+                *out = dn;
+                return NO_ERROR;
+            }
+        }
+        return ERR_NOT_FOUND;
+    }
+    uint32_t hash = dn_hash(name, len);
+    for (dn = parent->buckets[hash & (parent->bucket_count - 1)]; dn != nullptr;
+         dn = dn->hash_next) {
+        if (dn->hash != hash) {
+            continue;
+        }
         if (DN_NAME_LEN(dn->flags) != len) {
             continue;
         }
@@ -123,17 +247,26 @@ mx_status_t dn_lookup(dnode_t* parent, dnode_t** out, const char* name, size_t l
     return ERR_NOT_FOUND;
 }
 
+static void dn_copy_name(const dnode_t* dn, char* out, size_t out_len) {
+    mx_off_t len = DN_NAME_LEN(dn->flags);
+    if (len > out_len-1) {
+        len = out_len-1;
+    }
+    memcpy(out, dn->name, len);
+    out[len] = '\0';
+}
+
 // return the (first) name matching this vnode
 mx_status_t dn_lookup_name(const dnode_t* parent, const VnodeMemfs* vn, char* out, size_t out_len) {
+    // A directory has exactly one dnode, which it points back at.
+    if ((vn->dnode_ != nullptr) && (vn->dnode_->parent == parent)) {
+        dn_copy_name(vn->dnode_, out, out_len);
+        return NO_ERROR;
+    }
     dnode_t* dn;
     list_for_every_entry(&parent->children, dn, dnode_t, dn_entry) {
         if (dn->vnode == vn) {
-            mx_off_t len = DN_NAME_LEN(dn->flags);
-            if (len > out_len-1) {
-                len = out_len-1;
-            }
-            memcpy(out, dn->name, len);
-            out[len] = '\0';
+            dn_copy_name(dn, out, out_len);
             return NO_ERROR;
         }
     }
@@ -150,17 +283,48 @@ void dn_print_children(dnode_t* parent, int indent) {
     }
 }
 
+// Readdir state, kept in the caller's vdircookie_t. The last child returned
+// is remembered by ordinal rather than by pointer, so the cursor stays valid
+// if that child is removed between calls.
+typedef struct dn_cookie {
+    uint32_t n;       // number of entries returned
+    uint32_t hash;    // name hash of the last child returned
+    uint64_t ordinal; // ordinal of the last child returned, or 0
+} dn_cookie_t;
+
+static_assert(sizeof(dn_cookie_t) <= sizeof(vdircookie_t),
+              "dnode cookie too large to fit in IO state");
+
+// Returns the first child after the cursor, or nullptr.
+static dnode_t* dn_readdir_next(dnode_t* parent, const dn_cookie_t* c) {
+    dnode_t* dn;
+    if (c->ordinal == 0) {
+        return list_peek_head_type(&parent->children, dnode_t, dn_entry);
+    }
+    if (parent->bucket_count != 0) {
+        for (dn = parent->buckets[c->hash & (parent->bucket_count - 1)]; dn != nullptr;
+             dn = dn->hash_next) {
+            if (dn->ordinal == c->ordinal) {
+                return list_next_type(&parent->children, &dn->dn_entry, dnode_t, dn_entry);
+            }
+        }
+    }
+    // The last child returned is gone; the list is sorted by ordinal, so
+    // its successor is the first child past it.
+    list_for_every_entry(&parent->children, dn, dnode_t, dn_entry) {
+        if (dn->ordinal > c->ordinal) {
+            return dn;
+        }
+    }
+    return nullptr;
+}
+
 mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len) {
-    vdircookie_t* c = static_cast<vdircookie_t*>(cookie);
-    dnode_t* last = static_cast<dnode_t*>(c->p);
+    dn_cookie_t* c = static_cast<dn_cookie_t*>(cookie);
     size_t pos = 0;
     char* ptr = static_cast<char*>(data);
-    bool search = (last != nullptr);
     mx_status_t r;
-    dnode_t* dn;
 
-    // Use 'c->p' to point to the last seen vnode.
-    // Use 'c->n' to count the number of entries we've already returned.
     if (c->n == 0) {
         r = fs::vfs_fill_dirent(reinterpret_cast<vdirent_t*>(ptr + pos), len - pos, ".", 1,
                                 VTYPE_TO_DTYPE(V_TYPE_DIR));
@@ -184,26 +348,21 @@ mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len) {
         return static_cast<mx_status_t>(pos);
     }
 
-    list_for_every_entry(&parent->children, dn, dnode_t, dn_entry) {
-        if (search) {
-            if (dn == last) {
-                search = false;
-            }
-        } else {
-            uint32_t vtype = DNODE_IS_DIR(dn) ? V_TYPE_DIR : V_TYPE_FILE;
-            r = fs::vfs_fill_dirent(reinterpret_cast<vdirent_t*>(ptr + pos), len - pos,
-                                    dn->name, DN_NAME_LEN(dn->flags),
-                                    VTYPE_TO_DTYPE(vtype));
-            if (r < 0) {
-                break;
-            }
-            last = dn;
-            pos += r;
-            c->n++;
+    for (dnode_t* dn = dn_readdir_next(parent, c); dn != nullptr;
+         dn = list_next_type(&parent->children, &dn->dn_entry, dnode_t, dn_entry)) {
+        uint32_t vtype = DNODE_IS_DIR(dn) ? V_TYPE_DIR : V_TYPE_FILE;
+        r = fs::vfs_fill_dirent(reinterpret_cast<vdirent_t*>(ptr + pos), len - pos,
+                                dn->name, DN_NAME_LEN(dn->flags),
+                                VTYPE_TO_DTYPE(vtype));
+        if (r < 0) {
+            break;
         }
+        c->ordinal = dn->ordinal;
+        c->hash = dn->hash;
+        pos += r;
+        c->n++;
     }
 
-    c->p = last;
     return static_cast<mx_status_t>(pos);
 }
 
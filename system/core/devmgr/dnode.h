@@ -33,12 +33,23 @@ static_assert(((DN_NAME_MAX + 1) & DN_NAME_MAX) == 0,
 
 namespace memfs {
 
+// A directory's children are kept in 'children' in the order they were
+// added, and indexed by name in a hash table which grows with the directory.
+// Each child is stamped with an ordinal, unique within its parent, which
+// readdir uses to resume where it left off.
 typedef struct dnode {
     dnode_t* parent;
     VnodeMemfs* vnode;
     list_node_t children;
     list_node_t dn_entry; // entry in parent's list
     list_node_t vn_entry; // entry in vnode's list
+    dnode_t** buckets;    // name index of children (nullptr until needed)
+    uint32_t bucket_count;
+    uint32_t child_count;
+    uint64_t next_ordinal;
+    dnode_t* hash_next;   // entry in parent's bucket
+    uint64_t ordinal;     // position in parent's list
+    uint32_t hash;
     uint32_t flags;
     char name[];
 } dnode_t;
@@ -62,8 +73,13 @@ mx_status_t dn_lookup_name(const dnode_t* dn, const VnodeMemfs* vn, char* out_na
 
 // Increments child link count by one.
 // If the child is a directory, increments parent link count by one.
+// Does not fail; if the index cannot grow, lookups just get slower.
 void dn_add_child(dnode_t* parent, dnode_t* child);
 
+// Moves all children of 'src' to the empty dnode 'dst', keeping their
+// order and ordinals so that open directory cursors remain valid.
+void dn_move_children(dnode_t* src, dnode_t* dst);
+
 mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len);
 
 void dn_print_children(dnode_t* parent, int indent);
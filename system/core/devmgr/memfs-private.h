@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <bootdata/decompress.h>
 #include <ddk/device.h>
 #include <fs/vfs.h>
 #include <magenta/compiler.h>
@@ -74,8 +75,14 @@ private:
     mx_status_t Truncate(size_t len) final;
     mx_status_t Getattr(vnattr_t* a) final;
 
+    // Ensures the VMO covers at least 'len' bytes.
+    mx_status_t Reserve(size_t len);
+
+    // Bytes of the VMO past 'length_' are always zero, and 'capacity_' is
+    // the size of the VMO, a whole number of pages.
     mx_handle_t vmo_;
     mx_off_t length_;
+    mx_off_t capacity_;
 };
 
 class VnodeDir final : public VnodeMemfs {
@@ -105,10 +112,16 @@ public:
     // due to our implementation of "_memfs_create".
     // We should improve our construction of VnodeVmos, and remove this
     // function.
-    void Init(mx_handle_t vmo, mx_off_t length, mx_off_t offset) {
+    //
+    // If |lazy| is non-null, the VMO is a bootfs image that is decompressed
+    // on demand: reads commit the range they cover, and handing out the VMO
+    // commits the whole file.
+    void Init(mx_handle_t vmo, mx_off_t length, mx_off_t offset,
+              bootdata_lazy_t* lazy = nullptr) {
         vmo_ = vmo;
         length_ = length;
         offset_ = offset;
+        lazy_ = lazy;
     }
 
 private:
@@ -117,10 +130,13 @@ private:
     mx_status_t Getattr(vnattr_t* a) final;
     mx_status_t GetHandles(uint32_t flags, mx_handle_t* hnds,
                            uint32_t* type, void* extra, uint32_t* esize) final;
+    // Make sure bytes [off, off + len) of the file are present in the VMO.
+    mx_status_t Commit(mx_off_t off, size_t len);
 
     mx_handle_t vmo_;
     mx_off_t length_;
     mx_off_t offset_;
+    bootdata_lazy_t* lazy_;
 };
 
 class VnodeDevice final : public VnodeMemfs {
@@ -167,11 +183,13 @@ mx_status_t devfs_remove(VnodeMemfs* vn);
 
 // boot fs
 VnodeMemfs* bootfs_get_root(void);
-mx_status_t bootfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len);
+mx_status_t bootfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len,
+                            bootdata_lazy_t* lazy);
 
 // system fs
 VnodeMemfs* systemfs_get_root(void);
-mx_status_t systemfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len);
+mx_status_t systemfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len,
+                              bootdata_lazy_t* lazy);
 
 // memory fs
 VnodeMemfs* memfs_get_root(void);
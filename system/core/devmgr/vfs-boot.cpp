@@ -23,12 +23,25 @@
 
 namespace memfs {
 
+mx_status_t VnodeVmo::Commit(mx_off_t off, size_t len) {
+    if (lazy_ == nullptr) {
+        return NO_ERROR;
+    }
+    // Cheap once the blocks backing the range have been decompressed.
+    return bootdata_lazy_commit(lazy_, offset_ + off, len);
+}
+
 mx_status_t VnodeVmo::GetHandles(uint32_t flags, mx_handle_t* hnds,
                                  uint32_t* type, void* extra, uint32_t* esize) {
     mx_off_t* off = static_cast<mx_off_t*>(extra);
     mx_off_t* len = off + 1;
+    // Clients read the VMO directly, so the whole file must be present
+    // before we hand it out.
+    mx_status_t status = Commit(0, length_);
+    if (status < 0)
+        return status;
     mx_handle_t vmo;
-    mx_status_t status = mx_handle_duplicate(vmo_, MX_RIGHT_READ | MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER, &vmo);
+    status = mx_handle_duplicate(vmo_, MX_RIGHT_READ | MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER, &vmo);
     if (status < 0)
         return status;
     xprintf("vmofile: %x (%x) off=%" PRIu64 " len=%" PRIu64 "\n", vmo, vmo_, offset_, length_);
@@ -43,7 +56,8 @@ mx_status_t VnodeVmo::GetHandles(uint32_t flags, mx_handle_t* hnds,
 
 static mx_status_t _vnb_create(VnodeMemfs* parent, VnodeMemfs** out,
                                const char* name, size_t namelen,
-                               mx_handle_t h, mx_off_t off, size_t datalen) {
+                               mx_handle_t h, mx_off_t off, size_t datalen,
+                               bootdata_lazy_t* lazy) {
     if (parent->dnode_ == nullptr) {
         return ERR_NOT_DIR;
     }
@@ -57,7 +71,7 @@ static mx_status_t _vnb_create(VnodeMemfs* parent, VnodeMemfs** out,
     VnodeVmo* vnb = static_cast<VnodeVmo*>(vnb_fs);
     xprintf("vnb_create: vn=%p, parent=%p name='%.*s' datalen=%zd\n",
             vnb, parent, (int)namelen, name, datalen);
-    vnb->Init(h, datalen, off);
+    vnb->Init(h, datalen, off, lazy);
 
     *out = vnb;
     return NO_ERROR;
@@ -89,7 +103,7 @@ static mx_status_t _vnb_mkdir(VnodeMemfs* parent, VnodeMemfs** out, const char*
 }
 
 static mx_status_t _add_file(VnodeMemfs* vnb, const char* path, mx_handle_t vmo,
-                             mx_off_t off, size_t len) {
+                             mx_off_t off, size_t len, bootdata_lazy_t* lazy) {
     mx_status_t r;
     if ((path[0] == '/') || (path[0] == 0))
         return ERR_INVALID_ARGS;
@@ -99,7 +113,7 @@ static mx_status_t _add_file(VnodeMemfs* vnb, const char* path, mx_handle_t vmo,
             if (path[0] == 0) {
                 return ERR_INVALID_ARGS;
             }
-            return _vnb_create(vnb, &vnb, path, strlen(path), vmo, off, len);
+            return _vnb_create(vnb, &vnb, path, strlen(path), vmo, off, len, lazy);
         } else {
             if (nextpath == path)
                 return ERR_INVALID_ARGS;
@@ -117,10 +131,12 @@ static mx_status_t _add_file(VnodeMemfs* vnb, const char* path, mx_handle_t vmo,
 // The following functions exist outside the memfs namespace so they can
 // be exposed to C:
 
-mx_status_t bootfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len) {
-    return _add_file(bootfs_get_root(), path, vmo, off, len);
+mx_status_t bootfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len,
+                            bootdata_lazy_t* lazy) {
+    return _add_file(bootfs_get_root(), path, vmo, off, len, lazy);
 }
 
-mx_status_t systemfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len) {
-    return _add_file(systemfs_get_root(), path, vmo, off, len);
+mx_status_t systemfs_add_file(const char* path, mx_handle_t vmo, mx_off_t off, size_t len,
+                              bootdata_lazy_t* lazy) {
+    return _add_file(systemfs_get_root(), path, vmo, off, len, lazy);
 }
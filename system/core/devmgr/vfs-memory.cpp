@@ -16,6 +16,7 @@
 
 #include <mxio/debug.h>
 #include <mxio/vfs.h>
+#include <mxtl/algorithm.h>
 
 #include <fcntl.h>
 #include <limits.h>
@@ -45,7 +46,7 @@ VnodeMemfs::VnodeMemfs() : seqcount_(0), dnode_(nullptr), link_count_(0) {
 }
 VnodeMemfs::~VnodeMemfs() {}
 
-VnodeFile::VnodeFile() : vmo_(MX_HANDLE_INVALID), length_(0) {}
+VnodeFile::VnodeFile() : vmo_(MX_HANDLE_INVALID), length_(0), capacity_(0) {}
 VnodeFile::~VnodeFile() {}
 
 VnodeDir::VnodeDir() {
@@ -53,7 +54,7 @@ VnodeDir::VnodeDir() {
 }
 VnodeDir::~VnodeDir() {}
 
-VnodeVmo::VnodeVmo() : vmo_(MX_HANDLE_INVALID), length_(0), offset_(0) {}
+VnodeVmo::VnodeVmo() : vmo_(MX_HANDLE_INVALID), length_(0), offset_(0), lazy_(nullptr) {}
 VnodeVmo::~VnodeVmo() {}
 
 VnodeDevice::VnodeDevice() {
@@ -103,6 +104,8 @@ ssize_t VnodeFile::Read(void* data, size_t len, size_t off) {
         return 0;
     }
 
+    // The VMO may extend past the end of the file.
+    len = mxtl::min(len, static_cast<size_t>(length_ - off));
     size_t actual;
     mx_status_t status;
     if ((status = mx_vmo_read(vmo_, data, off, len, &actual)) != NO_ERROR) {
@@ -117,7 +120,11 @@ ssize_t VnodeVmo::Read(void* data, size_t len, size_t off) {
     size_t rlen = length_ - off;
     if (len > rlen)
         len = rlen;
-    mx_status_t r = mx_vmo_read(vmo_, data, offset_ + off, len, &len);
+    mx_status_t r = Commit(off, len);
+    if (r < 0) {
+        return r;
+    }
+    r = mx_vmo_read(vmo_, data, offset_ + off, len, &len);
     if (r < 0) {
         return r;
     }
@@ -129,18 +136,10 @@ ssize_t VnodeFile::Write(const void* data, size_t len, size_t off) {
     size_t newlen = off + len;
     newlen = newlen > kMinfsMaxFileSize ? kMinfsMaxFileSize : newlen;
 
-    // TODO(smklein): Round up to PAGE_SIZE increments to reduce overhead on a series of small
-    // writes.
-    if (vmo_ == MX_HANDLE_INVALID) {
-        // First access to the file? Allocate it.
-        if ((status = mx_vmo_create(newlen, 0, &vmo_)) != NO_ERROR) {
-            return status;
-        }
-    } else if (newlen > length_) {
-        // Accessing beyond the end of the file? Extend it.
-        if ((status = mx_vmo_set_size(vmo_, newlen)) != NO_ERROR) {
-            return status;
-        }
+    // Writing past the end of the file leaves a hole, which reads back as
+    // zeroes and is not backed by memory until written.
+    if ((status = Reserve(newlen)) != NO_ERROR) {
+        return status;
     }
 
     size_t actual;
@@ -159,6 +158,31 @@ ssize_t VnodeFile::Write(const void* data, size_t len, size_t off) {
     return actual;
 }
 
+mx_status_t VnodeFile::Reserve(size_t len) {
+    if ((vmo_ != MX_HANDLE_INVALID) && (len <= capacity_)) {
+        return NO_ERROR;
+    }
+
+    // Grow by doubling, so that a series of small appends resizes the VMO
+    // only a logarithmic number of times. Pages past the end of the file are
+    // never written, so the extra capacity costs no memory.
+    size_t capacity = mxtl::roundup(len, static_cast<size_t>(PAGE_SIZE));
+    capacity = mxtl::max(capacity, static_cast<size_t>(capacity_ * 2));
+    capacity = mxtl::min(capacity, static_cast<size_t>(kMinfsMaxFileSize));
+
+    mx_status_t status;
+    if (vmo_ == MX_HANDLE_INVALID) {
+        // First access to the file? Allocate it.
+        if ((status = mx_vmo_create(capacity, 0, &vmo_)) != NO_ERROR) {
+            return status;
+        }
+    } else if ((status = mx_vmo_set_size(vmo_, capacity)) != NO_ERROR) {
+        return status;
+    }
+    capacity_ = capacity;
+    return NO_ERROR;
+}
+
 ssize_t VnodeVmo::Write(const void* data, size_t len, size_t off) {
     size_t rlen;
     if (off+len > length_) {
@@ -308,32 +332,34 @@ mx_status_t VnodeFile::Truncate(size_t len) {
     mx_status_t status;
     len = len > kMinfsMaxFileSize ? kMinfsMaxFileSize : len;
 
-    if (vmo_ == MX_HANDLE_INVALID) {
-        // First access to the file? Allocate it.
-        if ((status = mx_vmo_create(len, 0, &vmo_)) != NO_ERROR) {
+    if (len > length_) {
+        // Everything past the old end of the file is already zero.
+        if ((status = Reserve(len)) != NO_ERROR) {
             return status;
         }
-    } else if ((len < length_) && (len % PAGE_SIZE != 0)) {
-        // TODO(smklein): Remove this case when the VMO system causes 'shrinking to a partial page'
-        // to fill the end of that page with zeroes.
+    } else if (len < length_) {
+        // Keep the bytes past the new end zero: clear the rest of the last
+        // partial page, and give back every page after it.
         //
-        // Currently, if the file is truncated to a 'partial page', an later re-expanded, then the
-        // partial page is *not necessarily* filled with zeroes. As a consequence, we manually must
-        // fill the portion between "len" and the next highest page (or vn->length, whichever
-        // is smaller) with zeroes.
-        char buf[PAGE_SIZE];
-        size_t ppage_size = PAGE_SIZE - (len % PAGE_SIZE);
-        ppage_size = len + ppage_size < length_ ? ppage_size : length_ - len;
-        memset(buf, 0, ppage_size);
-        size_t actual;
-        status = mx_vmo_write(vmo_, buf, len, ppage_size, &actual);
-        if ((status != NO_ERROR) || (actual != ppage_size)) {
-            return status != NO_ERROR ? ERR_IO : status;
-        } else if ((status = mx_vmo_set_size(vmo_, len)) != NO_ERROR) {
+        // TODO(smklein): Remove the first step when the VMO system causes
+        // 'shrinking to a partial page' to fill the end of that page with
+        // zeroes.
+        if (len % PAGE_SIZE != 0) {
+            char buf[PAGE_SIZE];
+            size_t ppage_size = PAGE_SIZE - (len % PAGE_SIZE);
+            ppage_size = len + ppage_size < length_ ? ppage_size : length_ - len;
+            memset(buf, 0, ppage_size);
+            size_t actual;
+            status = mx_vmo_write(vmo_, buf, len, ppage_size, &actual);
+            if ((status != NO_ERROR) || (actual != ppage_size)) {
+                return status != NO_ERROR ? ERR_IO : status;
+            }
+        }
+        size_t capacity = mxtl::roundup(len, static_cast<size_t>(PAGE_SIZE));
+        if ((status = mx_vmo_set_size(vmo_, capacity)) != NO_ERROR) {
             return status;
         }
-    } else if ((status = mx_vmo_set_size(vmo_, len)) != NO_ERROR) {
-        return status;
+        capacity_ = capacity;
     }
 
     length_ = len;
@@ -420,20 +446,7 @@ mx_status_t VnodeDir::Rename(fs::Vnode* _newdir, const char* oldname, size_t old
     uint32_t oldtype = DN_TYPE(olddn->flags);
 
     // Move the children of the source dnode to the new dnode.
-    list_move(&olddn->children, &newdn->children);
-    dnode_t* dn;
-    list_for_every_entry(&newdn->children, dn, dnode_t, dn_entry) {
-        // TODO(smklein): Because each child has an explicit pointer
-        // to the parent entry, we must traverse through all children
-        // to rename a parent directory.
-        //
-        // Possible solution:
-        //  - Don't reallocate the new dnode. Decouple dnode names from the
-        //  rest of their structure (possibly allow in-line storage for short
-        //  names). Resuing the original dnode will not require any
-        //  modifications in the childs.
-        dn->parent = newdn;
-    }
+    dn_move_children(olddn, newdn);
 
     // Delete source dnode
     bool moved_node_was_dir = vn->IsDirectory();
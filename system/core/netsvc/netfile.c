@@ -13,11 +13,6 @@
 #include <sys/stat.h>
 
 #include <inet6/inet6.h>
-#include <inet6/netifc.h>
-
-#include <magenta/processargs.h>
-#include <magenta/syscalls.h>
-#include <launchpad/launchpad.h>
 
 #include <magenta/boot/netboot.h>
 
@@ -69,6 +64,10 @@ void netfile_open(const char *filename, uint32_t cookie, uint32_t arg,
     strlcpy(netfile.filename, filename, sizeof(netfile.filename));
     netfile.blocknum = 0;
     netfile.cookie = cookie;
+    netfile.windowed = (arg & NB_OPEN_WINDOW) != 0;
+    netfile.window_base = 0;
+    netfile.window_mask = 0;
+    netfile.eof = false;
 
     struct stat st;
 again: // label here to catch filename=/path/to/new/directory/
@@ -77,7 +76,7 @@ again: // label here to catch filename=/path/to/new/directory/
         goto err;
     }
 
-    switch (arg) {
+    switch (arg & ~NB_OPEN_WINDOW) {
     case O_RDONLY:
         netfile.needs_rename = false;
         netfile.fd = open(filename, O_RDONLY);
@@ -119,7 +118,68 @@ err:
     udp6_send(&m, sizeof(m), saddr, sport, dport);
 }
 
-void netfile_read(uint32_t cookie, uint32_t arg,
+// Reads a full window block, unless the file ends first.
+static ssize_t netfile_read_block(uint8_t* data) {
+    size_t n = 0;
+    while (n < NB_WINDOW_BLOCK_SIZE) {
+        ssize_t r = read(netfile.fd, data + n, NB_WINDOW_BLOCK_SIZE - n);
+        if (r < 0) {
+            return r;
+        }
+        if (r == 0) {
+            break;
+        }
+        n += r;
+    }
+    return n;
+}
+
+static void netfile_read_window(const char* data, size_t len, netfilemsg* m, uint32_t arg,
+                                const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
+    uint32_t mask;
+    if (len < sizeof(mask)) {
+        return;
+    }
+    memcpy(&mask, data, sizeof(mask));
+    if ((arg < netfile.window_base) || (arg > netfile.blocknum)) {
+        // ignore stale or bogus read requests
+        return;
+    }
+    // The host has every block before arg, so their slots can be reused.
+    netfile.window_base = arg;
+
+    for (uint32_t i = 0; i < NB_WINDOW_BLOCKS; i++) {
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        uint32_t blocknum = arg + i;
+        while ((netfile.blocknum <= blocknum) && !netfile.eof) {
+            uint32_t slot = netfile.blocknum % NB_WINDOW_BLOCKS;
+            ssize_t n = netfile_read_block(netfile.window[slot]);
+            if (n < 0) {
+                printf("netsvc: error reading '%s': %d\n", netfile.filename, errno);
+                m->hdr.arg = -errno;
+                close(netfile.fd);
+                netfile.fd = -1;
+                udp6_send(&m->hdr, sizeof(m->hdr), saddr, sport, dport);
+                return;
+            }
+            netfile.window_len[slot] = n;
+            netfile.eof = (n < NB_WINDOW_BLOCK_SIZE);
+            netfile.blocknum++;
+        }
+        if (blocknum >= netfile.blocknum) {
+            // past the end of the file
+            return;
+        }
+        uint32_t slot = blocknum % NB_WINDOW_BLOCKS;
+        m->hdr.arg = blocknum;
+        memcpy(m->data, netfile.window[slot], netfile.window_len[slot]);
+        udp6_send(m, sizeof(m->hdr) + netfile.window_len[slot], saddr, sport, dport);
+    }
+}
+
+void netfile_read(const char* data, size_t len, uint32_t cookie, uint32_t arg,
                   const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
     netfilemsg m;
     m.hdr.magic = NB_MAGIC;
@@ -132,6 +192,10 @@ void netfile_read(uint32_t cookie, uint32_t arg,
         udp6_send(&m.hdr, sizeof(m.hdr), saddr, sport, dport);
         return;
     }
+    if (netfile.windowed) {
+        netfile_read_window(data, len, &m, arg, saddr, sport, dport);
+        return;
+    }
     if (arg == (netfile.blocknum - 1)) {
         // repeat of last block read, probably due to dropped packet
         // unless cookie doesn't match, in which case it's an error
@@ -164,6 +228,54 @@ void netfile_read(uint32_t cookie, uint32_t arg,
     udp6_send(&m, sizeof(m.hdr) + netfile.datasize, saddr, sport, dport);
 }
 
+static void netfile_write_window(const char* data, size_t len, uint32_t cookie, uint32_t arg,
+                                 const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
+    struct {
+        nbmsg    hdr;
+        uint32_t mask;
+    } m;
+    m.hdr.magic = NB_MAGIC;
+    m.hdr.cookie = cookie;
+    m.hdr.cmd = NB_ACK;
+
+    if (len > NB_WINDOW_BLOCK_SIZE) {
+        return;
+    }
+    // Blocks before the window are repeats, probably due to a dropped ack,
+    // and blocks past it are bogus; either way the host gets the current
+    // state of the window.
+    if ((arg >= netfile.blocknum) && (arg - netfile.blocknum < NB_WINDOW_BLOCKS)) {
+        uint32_t bit = 1u << (arg - netfile.blocknum);
+        if (!(netfile.window_mask & bit)) {
+            uint32_t slot = arg % NB_WINDOW_BLOCKS;
+            memcpy(netfile.window[slot], data, len);
+            netfile.window_len[slot] = len;
+            netfile.window_mask |= bit;
+        }
+        while (netfile.window_mask & 1) {
+            uint32_t slot = netfile.blocknum % NB_WINDOW_BLOCKS;
+            ssize_t n = write(netfile.fd, netfile.window[slot], netfile.window_len[slot]);
+            if (n != (ssize_t)netfile.window_len[slot]) {
+                printf("netsvc: error writing %s: %d\n", netfile.filename, errno);
+                m.hdr.arg = -errno;
+                if (m.hdr.arg == 0) {
+                    m.hdr.arg = -EIO;
+                }
+                close(netfile.fd);
+                netfile.fd = -1;
+                udp6_send(&m.hdr, sizeof(m.hdr), saddr, sport, dport);
+                return;
+            }
+            netfile.blocknum++;
+            netfile.window_mask >>= 1;
+        }
+    }
+
+    m.hdr.arg = netfile.blocknum;
+    m.mask = netfile.window_mask;
+    udp6_send(&m, sizeof(m), saddr, sport, dport);
+}
+
 void netfile_write(const char* data, size_t len, uint32_t cookie, uint32_t arg,
                    const ip6_addr_t* saddr, uint16_t sport, uint16_t dport) {
     nbmsg m;
@@ -178,6 +290,10 @@ void netfile_write(const char* data, size_t len, uint32_t cookie, uint32_t arg,
         udp6_send(&m, sizeof(m), saddr, sport, dport);
         return;
     }
+    if (netfile.windowed) {
+        netfile_write_window(data, len, cookie, arg, saddr, sport, dport);
+        return;
+    }
 
     if (arg == (netfile.blocknum - 1)) {
         // repeat of last block write, probably due to dropped packet
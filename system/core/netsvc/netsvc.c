@@ -128,9 +128,18 @@ void udp6_recv(void* data, size_t len,
             netfile_open((char*)msg->data, msg->cookie, msg->arg, saddr, sport, dport);
             break;
         case NB_READ:
-            netfile_read(msg->cookie, msg->arg, saddr, sport, dport);
+            if (len < 1) {
+                // no room for the NUL terminator
+                break;
+            }
+            len--; // NB NUL-terminator is not part of the data
+            netfile_read((char*)msg->data, len, msg->cookie, msg->arg, saddr, sport, dport);
             break;
         case NB_WRITE:
+            if (len < 1) {
+                // no room for the NUL terminator
+                break;
+            }
             len--; // NB NUL-terminator is not part of the data
             netfile_write((char*)msg->data, len, msg->cookie, msg->arg, saddr, sport, dport);
             break;
@@ -158,8 +167,8 @@ void udp6_recv(void* data, size_t len,
     }
 }
 
-void netifc_recv(void* data, size_t len) {
-    eth_recv(data, len);
+void netifc_recv(void* data, size_t len, uint32_t flags) {
+    eth_recv(data, len, flags);
 }
 
 int main(int argc, char** argv) {
@@ -21,19 +21,28 @@ typedef struct netfile_state_t {
     uint32_t cookie;
     uint8_t  data[1024];
     size_t   datasize;
+    // Opened with NB_OPEN_WINDOW
+    bool     windowed;
+    // Reads: blocks [window_base, blocknum) are held in the window.
+    // Writes: bit i is set if block (blocknum + i) has arrived.
+    uint32_t window_base;
+    uint32_t window_mask;
+    bool     eof;
+    uint16_t window_len[NB_WINDOW_BLOCKS];
+    uint8_t  window[NB_WINDOW_BLOCKS][NB_WINDOW_BLOCK_SIZE];
 } netfile_state;
 
 extern netfile_state netfile;
 
 typedef struct netfilemsg_t {
     nbmsg   hdr;
-    uint8_t data[1024];
+    uint8_t data[NB_WINDOW_BLOCK_SIZE];
 } netfilemsg;
 
 void netfile_open(const char* filename, uint32_t cookie, uint32_t arg,
                 const ip6_addr_t* saddr, uint16_t sport, uint16_t dport);
 
-void netfile_read(uint32_t cookie, uint32_t arg,
+void netfile_read(const char* data, size_t len, uint32_t cookie, uint32_t arg,
                   const ip6_addr_t* saddr, uint16_t sport, uint16_t dport);
 
 void netfile_write(const char* data, size_t len, uint32_t cookie, uint32_t arg,
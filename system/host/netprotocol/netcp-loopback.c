@@ -0,0 +1,370 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Runs netcp's file transfers against netsvc's netfile.c over UDP on the
+// loopback interface, dropping packets on purpose to exercise the windowed
+// protocol's selective acks and the fallback to an older netsvc.
+
+#define main netcp_main
+#include "netcp.c"
+#undef main
+
+#include <pthread.h>
+
+// netfile.c is built for the host as is. Not every host libc has strlcpy.
+static size_t netfile_strlcpy(char* dst, const char* src, size_t size) {
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#undef strlcpy
+#define strlcpy netfile_strlcpy
+#include "netfile.c"
+#undef strlcpy
+
+// How the fake netsvc below treats the traffic of a test.
+static struct {
+    pthread_mutex_t lock;
+    bool stop;
+    // Reject NB_OPEN_WINDOW like a netsvc which predates it.
+    bool legacy;
+    // Drop this percentage of the packets of windowed transfers, in both
+    // directions.
+    int loss;
+    // Drop the first copy of the data blocks whose number is 2 mod 5.
+    bool drop_blocks;
+    uint32_t rand;
+
+    int window_opens;       // NB_OPEN_WINDOW opens which were rejected
+    int window_blocks;      // data packets of a full window block
+    int data_packets;       // NB_READ acks sent, or NB_WRITEs received
+    int dropped_blocks;     // by drop_blocks
+    uint8_t dropped[4096];  // by block number, for drop_blocks
+} server = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+#define countof(a) (sizeof(a) / sizeof((a)[0]))
+
+static int server_sock;
+static struct sockaddr_in6 server_peer;
+// The command the server is answering.
+static uint32_t server_cmd;
+
+// Only the packets of windowed reads and writes are lost; opens and closes
+// are lockstep, and retried by netboot_txn() a limited number of times.
+static bool lose_packet(void) {
+    if ((server.loss == 0) || !netfile.windowed ||
+        ((server_cmd != NB_READ) && (server_cmd != NB_WRITE))) {
+        return false;
+    }
+    server.rand = server.rand * 1103515245 + 12345;
+    return (int)((server.rand >> 16) % 100) < server.loss;
+}
+
+static bool drop_block(uint32_t blocknum) {
+    if (!server.drop_blocks || (blocknum % 5 != 2) ||
+        (blocknum >= sizeof(server.dropped)) || server.dropped[blocknum]) {
+        return false;
+    }
+    server.dropped[blocknum] = 1;
+    server.dropped_blocks++;
+    return true;
+}
+
+int udp6_send(const void* data, size_t len, const ip6_addr_t* daddr,
+              uint16_t dport, uint16_t sport) {
+    const nbmsg* msg = data;
+    pthread_mutex_lock(&server.lock);
+    bool lost = lose_packet();
+    if ((server_cmd == NB_READ) && ((int32_t)msg->arg >= 0)) {
+        // a block of the file
+        if (netfile.windowed && drop_block(msg->arg)) {
+            lost = true;
+        }
+        server.data_packets++;
+        if (len == sizeof(nbmsg) + NB_WINDOW_BLOCK_SIZE) {
+            server.window_blocks++;
+        }
+    }
+    pthread_mutex_unlock(&server.lock);
+    if (!lost) {
+        sendto(server_sock, data, len, 0, (void*)&server_peer, sizeof(server_peer));
+    }
+    return 0;
+}
+
+// The file transfer half of netsvc's udp6_recv().
+static void server_recv(void* data, size_t len) {
+    nbmsg* msg = data;
+    if ((len < (sizeof(nbmsg) + 1)) ||
+        (msg->magic != NB_MAGIC)) {
+        return;
+    }
+    len -= sizeof(nbmsg);
+    msg->data[len - 1] = 0;
+    server_cmd = msg->cmd;
+
+    pthread_mutex_lock(&server.lock);
+    bool lost = lose_packet();
+    if (msg->cmd == NB_WRITE) {
+        if (netfile.windowed && drop_block(msg->arg)) {
+            lost = true;
+        }
+        if (!lost) {
+            server.data_packets++;
+            if (len - 1 == NB_WINDOW_BLOCK_SIZE) {
+                server.window_blocks++;
+            }
+        }
+    }
+    bool reject = server.legacy && (msg->cmd == NB_OPEN) && (msg->arg & NB_OPEN_WINDOW);
+    if (reject && !lost) {
+        server.window_opens++;
+    }
+    pthread_mutex_unlock(&server.lock);
+    if (lost) {
+        return;
+    }
+
+    ip6_addr_t saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    switch (msg->cmd) {
+    case NB_OPEN:
+        if (reject) {
+            nbmsg m = {
+                .magic = NB_MAGIC,
+                .cookie = msg->cookie,
+                .cmd = NB_ACK,
+                .arg = -EINVAL,
+            };
+            udp6_send(&m, sizeof(m), &saddr, 0, 0);
+            break;
+        }
+        netfile_open((char*)msg->data, msg->cookie, msg->arg, &saddr, 0, 0);
+        break;
+    case NB_READ:
+        if (len < 1) {
+            // no room for the NUL terminator
+            break;
+        }
+        len--;
+        netfile_read((char*)msg->data, len, msg->cookie, msg->arg, &saddr, 0, 0);
+        break;
+    case NB_WRITE:
+        if (len < 1) {
+            // no room for the NUL terminator
+            break;
+        }
+        len--;
+        netfile_write((char*)msg->data, len, msg->cookie, msg->arg, &saddr, 0, 0);
+        break;
+    case NB_CLOSE:
+        netfile_close(msg->cookie, &saddr, 0, 0);
+        break;
+    }
+}
+
+static void* server_thread(void* arg) {
+    static uint8_t buf[2048];
+    for (;;) {
+        pthread_mutex_lock(&server.lock);
+        bool stop = server.stop;
+        pthread_mutex_unlock(&server.lock);
+        if (stop) {
+            return NULL;
+        }
+        socklen_t len = sizeof(server_peer);
+        ssize_t r = recvfrom(server_sock, buf, sizeof(buf), 0, (void*)&server_peer, &len);
+        if (r > 0) {
+            server_recv(buf, r);
+        }
+    }
+}
+
+static void reset_server(bool legacy, int loss, bool drop_blocks) {
+    pthread_mutex_lock(&server.lock);
+    server.legacy = legacy;
+    server.loss = loss;
+    server.drop_blocks = drop_blocks;
+    server.rand = 1;
+    server.window_opens = 0;
+    server.window_blocks = 0;
+    server.data_packets = 0;
+    server.dropped_blocks = 0;
+    memset(server.dropped, 0, sizeof(server.dropped));
+    pthread_mutex_unlock(&server.lock);
+}
+
+static char tmpdir[64];
+static uint8_t contents[1 << 20];
+
+static int write_file(const char* path, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    int r = (write(fd, contents, size) == (ssize_t)size) ? 0 : -1;
+    close(fd);
+    return r;
+}
+
+static bool check_file(const char* path, size_t size) {
+    // netfile.c creates files without passing a mode
+    chmod(path, 0644);
+    static uint8_t buf[sizeof(contents) + 1];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    size_t n = 0;
+    ssize_t r;
+    while ((r = read(fd, buf + n, sizeof(buf) - n)) > 0) {
+        n += r;
+    }
+    close(fd);
+    if ((n != size) || memcmp(buf, contents, size)) {
+        fprintf(stderr, "%s: read back %zu bytes, wanted %zu\n", path, n, size);
+        return false;
+    }
+    return true;
+}
+
+static int failures;
+
+#define EXPECT(cond)                                                           \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond);  \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+// Pushes a file of the given size to the server and pulls it back.
+static void transfer(int s, size_t size, bool legacy, int loss, bool drop_blocks) {
+    char local[PATH_MAX];
+    char remote[PATH_MAX];
+    char pulled[PATH_MAX];
+    snprintf(local, sizeof(local), "%s/local", tmpdir);
+    snprintf(remote, sizeof(remote), "%s/remote", tmpdir);
+    snprintf(pulled, sizeof(pulled), "%s/pulled", tmpdir);
+    unlink(remote);
+    unlink(pulled);
+
+    uint32_t blocks = size / NB_WINDOW_BLOCK_SIZE + 1;
+    fprintf(stderr, "size %zu legacy %d loss %d%% drop blocks %d\n",
+            size, legacy, loss, drop_blocks);
+    EXPECT(write_file(local, size) == 0);
+
+    reset_server(legacy, loss, drop_blocks);
+    EXPECT(push_file(s, remote, local) == 0);
+    EXPECT(check_file(remote, size));
+    pthread_mutex_lock(&server.lock);
+    if (legacy) {
+        EXPECT(server.window_opens >= 1);
+        EXPECT(server.window_blocks == 0);
+        EXPECT(server.data_packets == (int)((size + MAXSIZE - 1) / MAXSIZE));
+    } else if (loss == 0) {
+        EXPECT(server.window_blocks == (int)(size / NB_WINDOW_BLOCK_SIZE));
+        // Only the dropped blocks are sent again, though one may be sent
+        // twice if its retry timer fires before its ack comes back.
+        int sent = (size % NB_WINDOW_BLOCK_SIZE) ? blocks : blocks - 1;
+        EXPECT(server.data_packets >= sent);
+        EXPECT(server.data_packets <= sent + server.dropped_blocks);
+        EXPECT(!drop_blocks || (server.dropped_blocks > 0));
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    reset_server(legacy, loss, drop_blocks);
+    EXPECT(pull_file(s, pulled, remote) == 0);
+    EXPECT(check_file(pulled, size));
+    pthread_mutex_lock(&server.lock);
+    if (legacy) {
+        EXPECT(server.window_opens >= 1);
+        EXPECT(server.window_blocks == 0);
+    } else if (loss == 0) {
+        EXPECT(server.window_blocks >= (int)(size / NB_WINDOW_BLOCK_SIZE));
+        // Likewise for the blocks asked for again.
+        EXPECT(server.data_packets >= (int)blocks);
+        EXPECT(server.data_packets <= (int)blocks + 2 * server.dropped_blocks);
+    }
+    pthread_mutex_unlock(&server.lock);
+}
+
+int main(int argc, char** argv) {
+    appname = argv[0];
+
+    snprintf(tmpdir, sizeof(tmpdir), "/tmp/netcp-loopback.XXXXXX");
+    if (mkdtemp(tmpdir) == NULL) {
+        fprintf(stderr, "%s: cannot create temporary directory: %s\n",
+                appname, strerror(errno));
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (uint8_t)((i * 7) ^ (i >> 8));
+    }
+
+    struct sockaddr_in6 addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_loopback;
+    socklen_t addrlen = sizeof(addr);
+    server_sock = socket(AF_INET6, SOCK_DGRAM, 0);
+    if ((server_sock < 0) ||
+        bind(server_sock, (void*)&addr, sizeof(addr)) ||
+        getsockname(server_sock, (void*)&addr, &addrlen)) {
+        fprintf(stderr, "%s: cannot bind to ::1: %s\n", appname, strerror(errno));
+        return -1;
+    }
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+    setsockopt(server_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    int s = socket(AF_INET6, SOCK_DGRAM, 0);
+    if ((s < 0) || connect(s, (void*)&addr, sizeof(addr))) {
+        fprintf(stderr, "%s: cannot connect to ::1: %s\n", appname, strerror(errno));
+        return -1;
+    }
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, server_thread, NULL);
+
+    const size_t sizes[] = {
+        0,
+        1,
+        NB_WINDOW_BLOCK_SIZE,
+        NB_WINDOW_BLOCK_SIZE * NB_WINDOW_BLOCKS * 3,
+        sizeof(contents) - 1,
+    };
+    for (size_t i = 0; i < countof(sizes); i++) {
+        transfer(s, sizes[i], false, 0, false);
+        transfer(s, sizes[i], true, 0, false);
+    }
+    transfer(s, sizeof(contents), false, 0, true);
+    transfer(s, sizeof(contents) - 1, false, 10, false);
+    transfer(s, sizeof(contents) / 4, false, 30, false);
+
+    pthread_mutex_lock(&server.lock);
+    server.stop = true;
+    pthread_mutex_unlock(&server.lock);
+    pthread_join(thread, NULL);
+    close(s);
+    close(server_sock);
+
+    char path[PATH_MAX];
+    const char* names[] = { "local", "remote", "pulled" };
+    for (size_t i = 0; i < countof(names); i++) {
+        snprintf(path, sizeof(path), "%s/%s", tmpdir, names[i]);
+        unlink(path);
+    }
+    rmdir(tmpdir);
+
+    fprintf(stderr, "%s: %s\n", appname, failures ? "FAILED" : "PASSED");
+    return failures ? -1 : 0;
+}
@@ -8,6 +8,7 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -19,31 +20,264 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <errno.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <magenta/boot/netboot.h>
 
 static const char* appname;
 
+// A block which has not arrived, or not been acked, this long after it was
+// asked for or sent is asked for or sent again. The transfer fails once
+// no progress has been made for WINDOW_TIMEOUT_US.
+#define WINDOW_RETRY_US   50000
+#define WINDOW_TIMEOUT_US 1500000
+
+static uint8_t window[NB_WINDOW_BLOCKS][NB_WINDOW_BLOCK_SIZE];
+static size_t window_len[NB_WINDOW_BLOCKS];
+static uint64_t window_time[NB_WINDOW_BLOCKS];
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// Waits up to timeout_us for an ack with the given cookie. Returns its
+// length, 0 on timeout, or -1 on error.
+static int window_recv(int s, msg* in, uint32_t cookie, uint64_t timeout_us) {
+    struct pollfd fds = {
+        .fd = s,
+        .events = POLLIN,
+    };
+    uint64_t deadline = now_us() + timeout_us;
+    for (;;) {
+        uint64_t now = now_us();
+        int r = poll(&fds, 1, now < deadline ? (deadline - now + 999) / 1000 : 0);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (r == 0) {
+            return 0;
+        }
+        ssize_t n = recv(s, in, sizeof(*in), MSG_DONTWAIT);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                continue;
+            }
+            return -1;
+        }
+        if ((n < (ssize_t)sizeof(in->hdr)) ||
+            (in->hdr.magic != NB_MAGIC) ||
+            (in->hdr.cookie != cookie) ||
+            (in->hdr.cmd != NB_ACK)) {
+            continue;
+        }
+        int arg = in->hdr.arg;
+        if (arg < 0) {
+            errno = -arg;
+            return -1;
+        }
+        return n;
+    }
+}
+
+static int pull_window(int s, int fd, int* total) {
+    msg in, out;
+    uint32_t cookie = netboot_new_cookie();
+    out.hdr.magic = NB_MAGIC;
+    out.hdr.cookie = cookie;
+    out.hdr.cmd = NB_READ;
+
+    // bit i of each mask stands for block (base + i)
+    uint32_t base = 0;
+    uint32_t have = 0;
+    uint32_t asked = 0;
+    uint32_t last = UINT32_MAX;
+    uint64_t progress = now_us();
+    for (;;) {
+        // Ask for the blocks which are neither here nor on their way, but
+        // wait until there are enough of them to be worth a request unless
+        // nothing else is outstanding.
+        uint64_t now = now_us();
+        uint32_t mask = 0;
+        int count = 0;
+        bool outstanding = false;
+        for (uint32_t i = 0; (i < NB_WINDOW_BLOCKS) && (base + i <= last); i++) {
+            uint32_t bit = 1u << i;
+            if (have & bit) {
+                continue;
+            }
+            if ((asked & bit) &&
+                (now - window_time[(base + i) % NB_WINDOW_BLOCKS] < WINDOW_RETRY_US)) {
+                outstanding = true;
+                continue;
+            }
+            mask |= bit;
+            count++;
+        }
+        if (mask && ((count >= NB_WINDOW_BLOCKS / 4) || !outstanding)) {
+            out.hdr.arg = base;
+            memcpy(out.data, &mask, sizeof(mask));
+            out.data[sizeof(mask)] = 0;
+            write(s, &out, sizeof(out.hdr) + sizeof(mask) + 1);
+            for (uint32_t i = 0; i < NB_WINDOW_BLOCKS; i++) {
+                if (mask & (1u << i)) {
+                    window_time[(base + i) % NB_WINDOW_BLOCKS] = now;
+                }
+            }
+            asked |= mask;
+        }
+
+        int r = window_recv(s, &in, cookie, WINDOW_RETRY_US);
+        if (r < 0) {
+            return -1;
+        }
+        if (r > 0) {
+            uint32_t i = in.hdr.arg - base;
+            size_t len = r - sizeof(in.hdr);
+            if ((i < NB_WINDOW_BLOCKS) && !(have & (1u << i)) &&
+                (in.hdr.arg <= last) && (len <= NB_WINDOW_BLOCK_SIZE)) {
+                uint32_t slot = in.hdr.arg % NB_WINDOW_BLOCKS;
+                memcpy(window[slot], in.data, len);
+                window_len[slot] = len;
+                have |= 1u << i;
+                if (len < NB_WINDOW_BLOCK_SIZE) {
+                    last = in.hdr.arg;
+                }
+            }
+        }
+
+        while (have & 1) {
+            uint32_t slot = base % NB_WINDOW_BLOCKS;
+            if (write(fd, window[slot], window_len[slot]) < (ssize_t)window_len[slot]) {
+                fprintf(stderr, "%s: pull short local write: %s\n",
+                        appname, strerror(errno));
+                return -1;
+            }
+            *total += window_len[slot];
+            if (base == last) {
+                return 0;
+            }
+            base++;
+            have >>= 1;
+            asked >>= 1;
+            progress = now_us();
+        }
+        if (now_us() - progress > WINDOW_TIMEOUT_US) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+static void push_block(int s, msg* out, uint32_t blocknum) {
+    uint32_t slot = blocknum % NB_WINDOW_BLOCKS;
+    out->hdr.arg = blocknum;
+    memcpy(out->data, window[slot], window_len[slot]);
+    out->data[window_len[slot]] = 0;
+    write(s, out, sizeof(out->hdr) + window_len[slot] + 1);
+    window_time[slot] = now_us();
+}
+
+static int push_window(int s, int fd, int* total) {
+    msg in, out;
+    uint32_t cookie = netboot_new_cookie();
+    out.hdr.magic = NB_MAGIC;
+    out.hdr.cookie = cookie;
+    out.hdr.cmd = NB_WRITE;
+
+    // blocks [base, next) have been sent; bit i of acked stands for
+    // block (base + i)
+    uint32_t base = 0;
+    uint32_t next = 0;
+    uint32_t acked = 0;
+    bool eof = false;
+    uint64_t progress = now_us();
+    for (;;) {
+        while (!eof && (next - base < NB_WINDOW_BLOCKS)) {
+            uint32_t slot = next % NB_WINDOW_BLOCKS;
+            ssize_t len = read(fd, window[slot], NB_WINDOW_BLOCK_SIZE);
+            if (len < 0) {
+                fprintf(stderr, "%s: error reading block %u (%d)\n",
+                        appname, next, errno);
+                return -1;
+            }
+            if (len == 0) {
+                eof = true;
+                break;
+            }
+            window_len[slot] = len;
+            push_block(s, &out, next++);
+            *total += len;
+        }
+        if (base == next) {
+            return 0;
+        }
+
+        int r = window_recv(s, &in, cookie, WINDOW_RETRY_US);
+        if (r < 0) {
+            return -1;
+        }
+        if (r >= (int)(sizeof(in.hdr) + sizeof(uint32_t))) {
+            uint32_t mask;
+            memcpy(&mask, in.data, sizeof(mask));
+            // ignore acks older than the window
+            if (in.hdr.arg - base <= next - base) {
+                if (in.hdr.arg != base) {
+                    base = in.hdr.arg;
+                    acked = 0;
+                    progress = now_us();
+                }
+                acked |= mask;
+            }
+        }
+
+        // send the blocks which were lost again
+        uint64_t now = now_us();
+        for (uint32_t b = base; b != next; b++) {
+            if (!(acked & (1u << (b - base))) &&
+                (now - window_time[b % NB_WINDOW_BLOCKS] >= WINDOW_RETRY_US)) {
+                push_block(s, &out, b);
+            }
+        }
+        if (now - progress > WINDOW_TIMEOUT_US) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
 static int pull_file(int s, const char* dst, const char* src) {
     int r;
     msg in, out;
     size_t src_len = strlen(src);
 
     out.hdr.cmd = NB_OPEN;
-    out.hdr.arg = O_RDONLY;
+    out.hdr.arg = O_RDONLY | NB_OPEN_WINDOW;
     memcpy(out.data, src, src_len);
     out.data[src_len] = 0;
 
+again:
     r = netboot_txn(s, &in, &out, sizeof(out.hdr) + src_len + 1);
     if (r < 0) {
+        if ((errno == EINVAL) && (out.hdr.arg & NB_OPEN_WINDOW)) {
+            // the remote end predates windowed transfers
+            out.hdr.arg = O_RDONLY;
+            goto again;
+        }
         fprintf(stderr, "%s: error opening remote file %s (%d)\n",
                 appname, src, errno);
         return r;
     }
+    bool windowed = (out.hdr.arg & NB_OPEN_WINDOW) != 0;
 
     char final_dst[MAXPATHLEN];
     struct stat st;
@@ -61,29 +295,38 @@ static int pull_file(int s, const char* dst, const char* src) {
 
     int n = 0;
     int blocknum = 0;
-    for (;;) {
-        memset(&out, 0, sizeof(out));
-        out.hdr.cmd = NB_READ;
-        out.hdr.arg = blocknum;
-        r = netboot_txn(s, &in, &out, sizeof(out.hdr) + 1);
-        if (r < 0) {
-            fprintf(stderr, "%s: error reading block %d (%d)\n",
-                    appname, blocknum, errno);
+    if (windowed) {
+        if ((r = pull_window(s, fd, &n)) < 0) {
+            fprintf(stderr, "%s: error reading %s (%d)\n",
+                    appname, src, errno);
             close(fd);
             return r;
         }
-        r -= sizeof(in.hdr);
-        if (r == 0) {
-            break; // EOF
-        }
-        if (write(fd, in.data, r) < r) {
-            fprintf(stderr, "%s: pull short local write: %s\n",
-                    appname, strerror(errno));
-            close(fd);
-            return -1;
+    } else {
+        for (;;) {
+            memset(&out, 0, sizeof(out));
+            out.hdr.cmd = NB_READ;
+            out.hdr.arg = blocknum;
+            r = netboot_txn(s, &in, &out, sizeof(out.hdr) + 1);
+            if (r < 0) {
+                fprintf(stderr, "%s: error reading block %d (%d)\n",
+                        appname, blocknum, errno);
+                close(fd);
+                return r;
+            }
+            r -= sizeof(in.hdr);
+            if (r == 0) {
+                break; // EOF
+            }
+            if (write(fd, in.data, r) < r) {
+                fprintf(stderr, "%s: pull short local write: %s\n",
+                        appname, strerror(errno));
+                close(fd);
+                return -1;
+            }
+            blocknum++;
+            n += r;
         }
-        blocknum++;
-        n += r;
     }
 
     memset(&out, 0, sizeof(out));
@@ -114,13 +357,18 @@ static int push_file(int s, const char* dst, const char* src) {
     const char* ptr;
 
     out.hdr.cmd = NB_OPEN;
-    out.hdr.arg = O_WRONLY;
+    out.hdr.arg = O_WRONLY | NB_OPEN_WINDOW;
     memcpy(out.data, dst, dst_len);
     out.data[dst_len] = 0;
 
 again:
     r = netboot_txn(s, &in, &out, sizeof(out.hdr) + dst_len + 1);
     if (r < 0) {
+        if ((errno == EINVAL) && (out.hdr.arg & NB_OPEN_WINDOW)) {
+            // the remote end predates windowed transfers
+            out.hdr.arg = O_WRONLY;
+            goto again;
+        }
         if (errno == EISDIR) {
             ptr = strrchr(src, '/');
             if (!ptr) {
@@ -142,6 +390,7 @@ again:
                 appname, out.data, errno);
         return r;
     }
+    bool windowed = (out.hdr.arg & NB_OPEN_WINDOW) != 0;
 
     int fd = open(src, O_RDONLY, 0664);
     if (!fd) {
@@ -153,32 +402,41 @@ again:
     int n = 0;
     int len = 0;
     int blocknum = 0;
-    for (;;) {
-        memset(&out, 0, sizeof(out));
-        out.hdr.cmd = NB_WRITE;
-        out.hdr.arg = blocknum;
-
-        len = read(fd, out.data, sizeof(out.data));
-        if (len < 0) {
-            fprintf(stderr, "%s: error reading block %d (%d)\n",
-                    appname, blocknum, errno);
+    if (windowed) {
+        if ((r = push_window(s, fd, &n)) < 0) {
+            fprintf(stderr, "%s: error writing %s (%d)\n",
+                    appname, dst, errno);
             close(fd);
             return r;
         }
-        if (len == 0) {
-            break; // EOF
-        }
+    } else {
+        for (;;) {
+            memset(&out, 0, sizeof(out));
+            out.hdr.cmd = NB_WRITE;
+            out.hdr.arg = blocknum;
+
+            len = read(fd, out.data, MAXSIZE);
+            if (len < 0) {
+                fprintf(stderr, "%s: error reading block %d (%d)\n",
+                        appname, blocknum, errno);
+                close(fd);
+                return r;
+            }
+            if (len == 0) {
+                break; // EOF
+            }
 
-        r = netboot_txn(s, &in, &out, sizeof(out.hdr) + len + 1);
-        if (r < 0) {
-            fprintf(stderr, "%s: error writing block %d (%d)\n",
-                    appname, blocknum, errno);
-            close(fd);
-            return r;
-        }
+            r = netboot_txn(s, &in, &out, sizeof(out.hdr) + len + 1);
+            if (r < 0) {
+                fprintf(stderr, "%s: error writing block %d (%d)\n",
+                        appname, blocknum, errno);
+                close(fd);
+                return r;
+            }
 
-        blocknum++;
-        n += len;
+            blocknum++;
+            n += len;
+        }
     }
 
     memset(&out, 0, sizeof(out));
@@ -139,6 +139,10 @@ int netboot_open(const char* hostname, unsigned port, struct sockaddr_in6* addr_
     return -1;
 }
 
+uint32_t netboot_new_cookie(void) {
+    return ++cookie;
+}
+
 // The netboot protocol ignores response packets that are invalid,
 // retransmits requests if responses don't arrive in a timely
 // fashion, and only returns an error upon eventual timeout or
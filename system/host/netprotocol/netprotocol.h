@@ -10,7 +10,8 @@
 
 typedef struct {
     struct nbmsg_t hdr;
-    uint8_t data[MAXSIZE];
+    // room for a windowed transfer block and its NUL terminator
+    uint8_t data[NB_WINDOW_BLOCK_SIZE + 1];
 } msg;
 
 struct sockaddr_in6;
@@ -18,3 +19,7 @@ struct sockaddr_in6;
 int netboot_open(const char* hostname, unsigned port, struct sockaddr_in6* addr_out);
 
 int netboot_txn(int s, msg* in, msg* out, int outlen);
+
+// Returns a cookie not used by any other request, for transfers which
+// keep several requests in flight instead of using netboot_txn.
+uint32_t netboot_new_cookie(void);
@@ -23,3 +23,17 @@ MODULE_SRCS += $(LOCAL_DIR)/netcp.c $(LOCAL_DIR)/netprotocol.c
 MODULE_NAME := netcp
 
 include make/module.mk
+
+MODULE := $(LOCAL_DIR)-netcp-loopback
+
+MODULE_TYPE := hostapp
+
+MODULE_COMPILEFLAGS += \
+	-Isystem/core/netsvc \
+	-Isystem/ulib/inet6/include
+
+MODULE_SRCS += $(LOCAL_DIR)/netcp-loopback.c $(LOCAL_DIR)/netprotocol.c
+
+MODULE_NAME := netcp-loopback
+
+include make/module.mk
@@ -24,13 +24,16 @@
 #define NB_BOOT               4 // arg=0
 #define NB_QUERY              5 // arg=0, data=hostname (or "*")
 #define NB_SHELL_CMD          6 // arg=0, data=command string
-#define NB_OPEN               7 // arg=O_RDONLY|O_WRONLY, data=filename
-#define NB_READ               8 // arg=blocknum
+#define NB_OPEN               7 // arg=O_RDONLY|O_WRONLY[|NB_OPEN_WINDOW], data=filename
+#define NB_READ               8 // arg=blocknum, NB_OPEN_WINDOW: data=uint32 block mask
 #define NB_WRITE              9 // arg=blocknum, data=data
 #define NB_CLOSE             10 // arg=0
 #define NB_LAST_DATA         11  // arg=blocknum, data=data
 
 #define NB_ACK                0 // arg=0 or -err, NB_READ: data=data
+                                // NB_OPEN_WINDOW NB_READ: arg=blocknum, data=data
+                                // NB_OPEN_WINDOW NB_WRITE: arg=next blocknum,
+                                //                          data=uint32 block mask
 #define NB_FILE_RECEIVED      0x70000001 // arg=size
 
 #define NB_ADVERTISE          0x77777777
@@ -41,6 +44,26 @@
 #define NB_ERROR_TOO_LARGE    0x80000003
 #define NB_ERROR_BAD_FILE     0x80000004
 
+// An NB_OPEN with NB_OPEN_WINDOW set moves the file in blocks of
+// NB_WINDOW_BLOCK_SIZE bytes, of which up to NB_WINDOW_BLOCKS may be in
+// flight. Bit i of a block mask stands for block (arg + i).
+//
+// Reads: the host asks for the blocks set in the mask of an NB_READ, whose
+// arg also tells the server that all blocks before it have arrived. The
+// server answers each with its own NB_ACK; a block shorter than
+// NB_WINDOW_BLOCK_SIZE is the last one.
+//
+// Writes: the host sends NB_WRITEs for the blocks in the window without
+// waiting. Each is answered with an NB_ACK whose arg is the first block not
+// yet received and whose mask holds the blocks received past it, so that
+// only the missing blocks need to be sent again.
+//
+// A server which predates windowed transfers fails such an open with
+// -EINVAL, and the host falls back to one block per round trip.
+#define NB_OPEN_WINDOW        0x80000000
+#define NB_WINDOW_BLOCKS      32
+#define NB_WINDOW_BLOCK_SIZE  1408
+
 #define NB_VERSION_1_0  0x0001000
 #define NB_VERSION_1_1  0x0001010
 #define NB_VERSION_CURRENT NB_VERSION_1_1
@@ -45,6 +45,15 @@
 // otherwise, closing the client fifo is sufficient to shut down the server.
 #define IOCTL_BLOCK_FIFO_CLOSE \
     IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 11)
+// Read the fifo server's scheduling statistics for a txn
+#define IOCTL_BLOCK_GET_STATS \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 12)
+// Get the fifo protocol version and limits of the device's fifo server
+#define IOCTL_BLOCK_GET_FIFO_INFO \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 13)
+// Read the statistics the device driver itself keeps (if supported)
+#define IOCTL_BLOCK_GET_DEVICE_STATS \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_BLOCK, 14)
 
 // Block Core ioctls (specific to each block device):
 
@@ -77,7 +86,7 @@ typedef uint16_t vmoid_t;
 // ssize_t ioctl_block_attach_vmo(int fd, mx_handle_t* in, vmoid_t* out_vmoid);
 IOCTL_WRAPPER_INOUT(ioctl_block_attach_vmo, IOCTL_BLOCK_ATTACH_VMO, mx_handle_t, vmoid_t);
 
-#define MAX_TXN_MESSAGES 16
+#define MAX_TXN_MESSAGES 128
 #define MAX_TXN_COUNT    256
 
 typedef uint16_t txnid_t;
@@ -91,6 +100,58 @@ IOCTL_WRAPPER_IN(ioctl_block_free_txn, IOCTL_BLOCK_FREE_TXN, txnid_t);
 // ssize_t ioctl_block_fifo_close(int fd);
 IOCTL_WRAPPER(ioctl_block_fifo_close, IOCTL_BLOCK_FIFO_CLOSE);
 
+#define BLOCK_LATENCY_BUCKETS 20
+
+typedef struct {
+    // For the whole fifo server
+    uint64_t ops;           // Operations issued to the device
+    uint64_t merged;        // Requests merged into another request's operation
+    // For the txn
+    uint32_t queued;        // Requests waiting to be issued to the device
+    uint32_t in_flight;     // Requests issued to the device, not yet complete
+    uint64_t completed;     // Requests completed since the txn was allocated
+    // Time from the server reading a request to its completion. Bucket N
+    // counts requests which took [2^N, 2^(N+1)) microseconds; the first
+    // bucket also counts faster requests and the last one slower requests.
+    uint64_t latency[BLOCK_LATENCY_BUCKETS];
+} block_stats_t;
+
+// ssize_t ioctl_block_get_stats(int fd, const txnid_t* in, block_stats_t* out);
+IOCTL_WRAPPER_INOUT(ioctl_block_get_stats, IOCTL_BLOCK_GET_STATS, txnid_t, block_stats_t);
+
+typedef struct {
+    uint64_t commands;      // Commands issued to the device
+    uint64_t requests;      // iotxns completed
+    uint64_t merged;        // iotxns which shared a command with the one before
+    uint64_t errors;        // iotxns completed with an error
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint32_t queue_depth;   // Most commands the driver keeps in flight
+    uint32_t in_flight;     // Commands in flight now
+    uint32_t max_in_flight; // Most commands seen in flight at once
+    uint32_t reserved;
+    // Time from issuing a command to its completion, bucketed like
+    // block_stats_t.latency.
+    uint64_t latency[BLOCK_LATENCY_BUCKETS];
+} block_device_stats_t;
+
+// ssize_t ioctl_block_get_device_stats(int fd, block_device_stats_t* out);
+IOCTL_WRAPPER_OUT(ioctl_block_get_device_stats, IOCTL_BLOCK_GET_DEVICE_STATS, block_device_stats_t);
+
+// Version 2 added larger txns, scatter/gather requests (BLOCKIO_SG), and
+// BLOCKIO_SYNC, BLOCKIO_FUA and BLOCKIO_BARRIER.
+#define BLOCK_FIFO_PROTOCOL_VERSION 2
+
+typedef struct {
+    uint32_t version;           // BLOCK_FIFO_PROTOCOL_VERSION
+    uint32_t max_txn_messages;  // MAX_TXN_MESSAGES
+    uint32_t max_txn_count;     // MAX_TXN_COUNT
+    uint32_t fifo_depth;        // BLOCK_FIFO_MAX_DEPTH
+} block_fifo_info_t;
+
+// ssize_t ioctl_block_get_fifo_info(int fd, block_fifo_info_t* out);
+IOCTL_WRAPPER_OUT(ioctl_block_get_fifo_info, IOCTL_BLOCK_GET_FIFO_INFO, block_fifo_info_t);
+
 // Multiple Block IO operations may be sent at once before a response is actually sent back.
 // Block IO ops may be sent concurrently to different vmoids, and they also may be sent
 // to different transactions at any point in time. Up to MAX_TXN_COUNT transactions may
@@ -112,6 +173,23 @@ IOCTL_WRAPPER(ioctl_block_fifo_close, IOCTL_BLOCK_FIFO_CLOSE);
 // For BLOCKIO_READ and BLOCKIO_WRITE, N may be greater than 1.
 // Otherwise, N == 1 (skipping step (1) in the protocol above).
 //
+// Scatter/gather: a read or write may cover contiguous blocks of the device
+// using several vmo ranges. The request describes the first range and sets
+// |segments| to the number of further ranges. These follow on the same txn
+// in BLOCKIO_SG entries, two ranges per entry, each range continuing on the
+// device where the previous one ended. If the request ends the txn, the
+// BLOCKIO_TXN_END flag goes on its last BLOCKIO_SG entry. Each range counts
+// as one of the txn's MAX_TXN_MESSAGES messages.
+//
+// Ordering: requests are not otherwise ordered with respect to each other.
+// - BLOCKIO_BARRIER: the request is issued to the device only once every
+//   request the server read before it has completed, and requests read after
+//   it are issued only once it has completed. For scatter/gather requests
+//   this applies to each range.
+// - BLOCKIO_FUA: the write completes only once it is on stable storage.
+// - BLOCKIO_SYNC: flushes the device's write cache; implies BLOCKIO_BARRIER.
+// Devices which cannot flush their cache only provide the ordering.
+//
 // Notes:
 // - txnids may operate on any number of vmoids at once.
 // - If additional requests are sent on the same txnid before step (3) has completed, then
@@ -134,23 +212,39 @@ IOCTL_WRAPPER(ioctl_block_fifo_close, IOCTL_BLOCK_FIFO_CLOSE);
 
 #define BLOCKIO_READ      0x0001 // Reads from the Block device into the VMO
 #define BLOCKIO_WRITE     0x0002 // Writes to the Block device from the VMO
-#define BLOCKIO_SYNC      0x0003 // Unimplemented
+#define BLOCKIO_SYNC      0x0003 // Flushes the device's write cache
 #define BLOCKIO_CLOSE_VMO 0x0004 // Detaches the VMO from the block device; closes the handle to it.
+#define BLOCKIO_SG        0x0005 // Further vmo ranges of a scatter/gather read or write
 #define BLOCKIO_OP_MASK   0x00FF
 
 #define BLOCKIO_TXN_END   0x0100 // Expects response after request (and all previous) have completed
+#define BLOCKIO_FUA       0x0200 // Completes the write only once it is on stable storage
+#define BLOCKIO_BARRIER   0x0400 // Orders the request after all earlier and before all later ones
 #define BLOCKIO_FLAG_MASK 0xFF00
 
 typedef struct {
     txnid_t txnid;
     vmoid_t vmoid;
     uint16_t opcode;
-    uint16_t reserved0;
+    uint16_t segments;  // Scatter/gather ranges following this one (read and write only)
     uint64_t length;
     uint64_t vmo_offset;
     uint64_t dev_offset;
 } block_fifo_request_t;
 
+// A BLOCKIO_SG entry. If a request has an odd number of further ranges, the
+// second range of its last entry is ignored.
+typedef struct {
+    txnid_t txnid;
+    vmoid_t vmoid0;
+    uint16_t opcode;
+    vmoid_t vmoid1;
+    uint32_t length0;
+    uint32_t length1;
+    uint64_t vmo_offset0;
+    uint64_t vmo_offset1;
+} block_fifo_sg_t;
+
 typedef struct {
     txnid_t txnid;
     uint16_t reserved0;
@@ -163,6 +257,8 @@ typedef struct {
 
 static_assert(sizeof(block_fifo_request_t) == sizeof(block_fifo_response_t),
               "FIFO messages are the same size in both directions");
+static_assert(sizeof(block_fifo_request_t) == sizeof(block_fifo_sg_t),
+              "Scatter/gather entries are the same size as requests");
 
 #define BLOCK_FIFO_ESIZE (sizeof(block_fifo_request_t))
 #define BLOCK_FIFO_MAX_DEPTH (4096 / BLOCK_FIFO_ESIZE)
@@ -25,7 +25,13 @@ typedef struct eth_info_t {
     uint32_t reserved[12];
 } eth_info_t;
 
-#define ETH_FEATURE_WLAN 1
+#define ETH_FEATURE_WLAN    1
+// The device computes the UDP and ICMPv6 checksums of IPv6 frames sent
+// with ETH_FIFO_TX_CSUM
+#define ETH_FEATURE_TX_CSUM 2
+// The device verifies the UDP and ICMPv6 checksums of IPv6 frames, and
+// flags the good ones ETH_FIFO_RX_CSUM_OK
+#define ETH_FEATURE_RX_CSUM 4
 
 // Get the fifos to submit tx and rx operations
 //   in: none
@@ -79,19 +85,30 @@ typedef struct eth_fifos_t {
 // of the received packet.  The flags field will indicate success or a
 // specific failure condition.
 //
+// To save on syscalls, the driver reads as many rx entries as the client
+// has written at once, and writes received packets back in batches.  A
+// batch is written once it is full, once the driver has no more buffers
+// from the client, or after a fraction of a millisecond at most.
+//
+// Where the hardware allows, packets are transmitted from and received
+// into the io_vmo directly, without copying.  For that, receive buffers
+// must be at least mtu bytes and must not cross a page boundary; other
+// receive buffers may be returned unused, flagged ETH_FIFO_INVALID.
+//
 // IMPORTANT: The driver *will not* buffer response messages.  It is the
 // client's responsibility to ensure that there is space in the reply side
 // of each fifo for each outstanding tx or rx request.  The fifo sizes
 // are returned along with the fifo handles in the eth_fifos_t.
 
 // flags values for request messages
-// - none -
+#define ETH_FIFO_TX_CSUM    (1u)   // compute the checksum (ETH_FEATURE_TX_CSUM)
 
 // flags values for response messages
 #define ETH_FIFO_RX_OK   (1u)   // packet received okay
 #define ETH_FIFO_TX_OK   (1u)   // packet transmitted okay
 #define ETH_FIFO_INVALID (2u)   // offset+length not within io_vmo bounds
 #define ETH_FIFO_RX_TX   (4u)   // received our own tx packet (when TX_LISTEN)
+#define ETH_FIFO_RX_CSUM_OK (8u) // checksum verified (ETH_FEATURE_RX_CSUM)
 
 typedef struct eth_fifo_entry {
     // offset from start of io_vmo to packet data
@@ -50,6 +50,7 @@ typedef struct mx_exception_packet {
 #define MX_PKT_TYPE_USER            0u
 #define MX_PKT_TYPE_SIGNAL_ONE      1u
 #define MX_PKT_TYPE_SIGNAL_REP      2u
+#define MX_PKT_TYPE_INTERRUPT       3u
 
 // port_packet_t::type MX_PKT_TYPE_USER.
 typedef union mx_packet_user {
@@ -66,6 +67,12 @@ typedef struct mx_packet_signal {
     uint64_t count;
 } mx_packet_signal_t;
 
+// port_packet_t::type MX_PKT_TYPE_INTERRUPT.
+typedef struct mx_packet_interrupt {
+    mx_time_t timestamp;    // MX_CLOCK_MONOTONIC time the interrupt fired.
+    uint64_t reserved[3];
+} mx_packet_interrupt_t;
+
 typedef struct mx_port_packet {
     uint64_t key;
     uint32_t type;
@@ -73,6 +80,7 @@ typedef struct mx_port_packet {
     union {
         mx_packet_user_t user;
         mx_packet_signal_t signal;
+        mx_packet_interrupt_t interrupt;
     };
 } mx_port_packet_t;
 
@@ -138,6 +138,11 @@ typedef uint32_t mx_signals_t;
 // Process
 #define MX_PROCESS_TERMINATED       __MX_OBJECT_SIGNALED
 
+// Memory pressure event (mx_system_get_event)
+#define MX_MEMORY_PRESSURE_NORMAL   __MX_OBJECT_SIGNAL_4
+#define MX_MEMORY_PRESSURE_WARNING  __MX_OBJECT_SIGNAL_5
+#define MX_MEMORY_PRESSURE_CRITICAL __MX_OBJECT_SIGNAL_6
+
 // Thread
 #define MX_THREAD_TERMINATED        __MX_OBJECT_SIGNALED
 
@@ -202,6 +207,9 @@ typedef uint32_t mx_rights_t;
 
 #define MX_RIGHT_SAME_RIGHTS      ((mx_rights_t)1u << 31)
 
+// VM Object creation options
+#define MX_VMO_DISCARDABLE               (1u << 0)
+
 // VM Object opcodes
 #define MX_VMO_OP_COMMIT                 1u
 #define MX_VMO_OP_DECOMMIT               2u
@@ -256,6 +264,9 @@ typedef int64_t mx_rel_off_t;
 // Socket options and limits.
 #define MX_SOCKET_HALF_CLOSE                1u
 
+// Kinds of event for mx_system_get_event.
+#define MX_SYSTEM_EVENT_MEMORY_PRESSURE     1u
+
 // Flags which can be used to to control cache policy for APIs which map memory.
 typedef enum {
     MX_CACHE_POLICY_CACHED          = 0,
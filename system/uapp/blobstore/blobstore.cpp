@@ -775,6 +775,8 @@ mx_status_t Blobstore::LoadBitmaps() {
             return ERR_IO;
         }
     }
+    // the block map was filled in behind its back
+    block_map_.RebuildSummary();
     return NO_ERROR;
 }
 
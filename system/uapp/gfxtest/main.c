@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 
+#include <magenta/compiler.h>
 #include <magenta/device/console.h>
 #include <magenta/device/display.h>
 #include <magenta/process.h>
@@ -13,10 +15,99 @@
 
 #include <gfx/gfx.h>
 
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_LOOPS 50
+
+static unsigned bench_fill(gfx_surface* dst, gfx_surface* src) {
+    gfx_fillrect(dst, 0, 0, dst->width, dst->height, 0xff336699);
+    return dst->width * dst->height;
+}
+
+// what the console does for every line of output
+static unsigned bench_scroll(gfx_surface* dst, gfx_surface* src) {
+    gfx_copyrect(dst, 0, 16, dst->width, dst->height - 16, 0, 0);
+    return dst->width * (dst->height - 16);
+}
+
+static unsigned bench_blend(gfx_surface* dst, gfx_surface* src) {
+    gfx_blend(dst, src, 0, 0, src->width, src->height, 0, 0);
+    return src->width * src->height;
+}
+
+typedef struct bench {
+    const char* name;
+    unsigned dst_format;
+    unsigned src_format;
+    unsigned (*fn)(gfx_surface* dst, gfx_surface* src);
+} bench_t;
+
+static const bench_t benches[] = {
+    { "fill x888", MX_PIXEL_FORMAT_RGB_x888, 0, bench_fill },
+    { "fill 565", MX_PIXEL_FORMAT_RGB_565, 0, bench_fill },
+    { "scroll x888", MX_PIXEL_FORMAT_RGB_x888, 0, bench_scroll },
+    { "copy x888", MX_PIXEL_FORMAT_RGB_x888, MX_PIXEL_FORMAT_RGB_x888, bench_blend },
+    { "blend argb", MX_PIXEL_FORMAT_ARGB_8888, MX_PIXEL_FORMAT_ARGB_8888, bench_blend },
+    { "x888 to 565", MX_PIXEL_FORMAT_RGB_565, MX_PIXEL_FORMAT_RGB_x888, bench_blend },
+};
+
+// Times the drawing operations on offscreen surfaces, in megapixels per
+// second.
+static int bench(void) {
+    for (size_t i = 0; i < countof(benches); i++) {
+        const bench_t* b = &benches[i];
+        gfx_surface* dst = gfx_create_surface(NULL, BENCH_WIDTH, BENCH_HEIGHT, BENCH_WIDTH,
+                                              b->dst_format, 0);
+        gfx_surface* src = NULL;
+        if (b->src_format) {
+            src = gfx_create_surface(NULL, BENCH_WIDTH, BENCH_HEIGHT, BENCH_WIDTH,
+                                     b->src_format, 0);
+        }
+        if (!dst || (b->src_format && !src)) {
+            printf("failed to create gfx surface\n");
+            return -1;
+        }
+        memset(dst->ptr, 0x40, dst->len);
+        if (src) {
+            // every alpha value, so blending takes all of its paths
+            uint32_t* p = src->ptr;
+            for (size_t n = 0; n < src->len / 4; n++) {
+                p[n] = (uint32_t)(n * 2654435761u);
+            }
+        }
+
+        uint64_t pixels = 0;
+        mx_time_t t = mx_time_get(MX_CLOCK_MONOTONIC);
+        for (int n = 0; n < BENCH_LOOPS; n++) {
+            pixels += b->fn(dst, src);
+        }
+        t = mx_time_get(MX_CLOCK_MONOTONIC) - t;
+        printf("%-12s %8" PRIu64 " Mpix/s\n", b->name, (pixels * 1000) / (t ? t : 1));
+
+        if (src) {
+            gfx_surface_destroy(src);
+        }
+        gfx_surface_destroy(dst);
+    }
+    return 0;
+}
+
+static void usage(void) {
+    printf("usage: gfxtest [-f]   draw on the console, full screen with -f\n"
+           "       gfxtest -b     benchmark drawing to memory\n");
+}
+
 int main(int argc, char* argv[]) {
     uint32_t fs = 0;
-    if (argc > 1 && !strcmp(argv[1], "-f")) {
-        fs = 1;
+    if (argc > 1) {
+        if (!strcmp(argv[1], "-f")) {
+            fs = 1;
+        } else if (!strcmp(argv[1], "-b")) {
+            return bench();
+        } else {
+            usage();
+            return -1;
+        }
     }
 
     int vfd = open("/dev/class/console/vc", O_RDWR);
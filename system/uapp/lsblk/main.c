@@ -162,6 +162,37 @@ out:
     return rc;
 }
 
+static int cmd_stats(const char* dev) {
+    int fd = open(dev, O_RDONLY);
+    if (fd < 0) {
+        printf("Error opening %s\n", dev);
+        return fd;
+    }
+
+    block_device_stats_t stats;
+    ssize_t rc = ioctl_block_get_device_stats(fd, &stats);
+    close(fd);
+    if (rc < 0) {
+        printf("Error %zd getting stats for %s\n", rc, dev);
+        return rc;
+    }
+
+    printf("commands:      %" PRIu64 "\n", stats.commands);
+    printf("requests:      %" PRIu64 " (%" PRIu64 " merged, %" PRIu64 " failed)\n",
+           stats.requests, stats.merged, stats.errors);
+    printf("bytes read:    %" PRIu64 "\n", stats.bytes_read);
+    printf("bytes written: %" PRIu64 "\n", stats.bytes_written);
+    printf("in flight:     %u now, %u at most, queue depth %u\n",
+           stats.in_flight, stats.max_in_flight, stats.queue_depth);
+    printf("command latency:\n");
+    for (int i = 0; i < BLOCK_LATENCY_BUCKETS; i++) {
+        if (stats.latency[i]) {
+            printf("  %8lluus: %" PRIu64 "\n", 1ull << i, stats.latency[i]);
+        }
+    }
+    return 0;
+}
+
 int main(int argc, const char** argv) {
     int rc = 0;
     const char *cmd = argc > 1 ? argv[1] : NULL;
@@ -171,6 +202,9 @@ int main(int argc, const char** argv) {
         } else if (!strcmp(cmd, "read")) {
             if (argc < 5) goto usage;
             rc = cmd_read_blk(argv[2], strtoul(argv[3], NULL, 10), strtoull(argv[4], NULL, 10));
+        } else if (!strcmp(cmd, "stats")) {
+            if (argc < 3) goto usage;
+            rc = cmd_stats(argv[2]);
         } else {
             printf("Unrecognized command %s!\n", cmd);
             goto usage;
@@ -183,5 +217,6 @@ usage:
     printf("Usage:\n");
     printf("%s\n", argv[0]);
     printf("%s read <blkdev> <offset> <count>\n", argv[0]);
+    printf("%s stats <blkdev>\n", argv[0]);
     return 0;
 }
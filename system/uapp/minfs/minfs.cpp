@@ -401,6 +401,9 @@ mx_status_t Minfs::LoadBitmaps() {
             error("minfs: failed reading inode bitmap\n");
         }
     }
+    // the bitmaps were filled in behind their backs
+    block_map_.RebuildSummary();
+    inode_map_.RebuildSummary();
     return NO_ERROR;
 }
 
@@ -154,6 +154,43 @@ done:
     return status;
 }
 
+static ssize_t blkdev_get_stats(blkdev_t* bdev,
+                                const void* in_buf, size_t in_len,
+                                void* out_buf, size_t out_len) {
+    if ((in_len != sizeof(txnid_t)) || (out_len < sizeof(block_stats_t))) {
+        return ERR_INVALID_ARGS;
+    }
+
+    mx_status_t status;
+    mtx_lock(&bdev->lock);
+    if (bdev->bs == NULL) {
+        status = ERR_BAD_STATE;
+        goto done;
+    }
+
+    txnid_t txnid = *(txnid_t*)in_buf;
+    if ((status = blockserver_get_stats(bdev->bs, txnid, out_buf)) != NO_ERROR) {
+        goto done;
+    }
+
+    status = sizeof(block_stats_t);
+done:
+    mtx_unlock(&bdev->lock);
+    return status;
+}
+
+static ssize_t blkdev_get_fifo_info(void* out_buf, size_t out_len) {
+    if (out_len < sizeof(block_fifo_info_t)) {
+        return ERR_INVALID_ARGS;
+    }
+    block_fifo_info_t* info = out_buf;
+    info->version = BLOCK_FIFO_PROTOCOL_VERSION;
+    info->max_txn_messages = MAX_TXN_MESSAGES;
+    info->max_txn_count = MAX_TXN_COUNT;
+    info->fifo_depth = BLOCK_FIFO_MAX_DEPTH;
+    return sizeof(block_fifo_info_t);
+}
+
 static ssize_t blkdev_fifo_close(blkdev_t* bdev) {
     mtx_lock(&bdev->lock);
     if (bdev->bs != NULL) {
@@ -187,6 +224,10 @@ static ssize_t blkdev_ioctl(mx_device_t* dev, uint32_t op, const void* cmd,
         return blkdev_free_txn(blkdev, cmd, cmdlen, reply, max);
     case IOCTL_BLOCK_FIFO_CLOSE:
         return blkdev_fifo_close(blkdev);
+    case IOCTL_BLOCK_GET_STATS:
+        return blkdev_get_stats(blkdev, cmd, cmdlen, reply, max);
+    case IOCTL_BLOCK_GET_FIFO_INFO:
+        return blkdev_get_fifo_info(reply, max);
     default: {
         mx_device_t* parent = dev->parent;
         return parent->ops->ioctl(parent, op, cmd, cmdlen, reply, max);
@@ -0,0 +1,386 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <ddk/device.h>
+#include <magenta/assert.h>
+#include <magenta/device/block.h>
+#include <magenta/device/device.h>
+#include <magenta/syscalls.h>
+#include <mxtl/auto_lock.h>
+
+#include "server.h"
+
+static void scheduler_complete(void* cookie, mx_status_t status) {
+    block_msg_t* msg = static_cast<block_msg_t*>(cookie);
+    msg->sched->Complete(msg, status);
+}
+
+static block_callbacks_t cb = {
+    scheduler_complete,
+};
+
+static size_t latency_bucket(mx_time_t latency) {
+    uint64_t usec = latency / MX_USEC(1);
+    size_t bucket = 0;
+    while ((usec >>= 1) != 0 && bucket < BLOCK_LATENCY_BUCKETS - 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+static bool is_write(const block_msg_t* msg) {
+    return (msg->opcode & BLOCKIO_OP_MASK) == BLOCKIO_WRITE;
+}
+
+// Whether |later| may not go ahead of |earlier|: they overlap on the device
+// and one of them writes.
+static bool conflicts(const block_msg_t* earlier, const block_msg_t* later) {
+    return (is_write(earlier) || is_write(later)) &&
+           (earlier->dev_offset < later->dev_offset + later->length) &&
+           (later->dev_offset < earlier->dev_offset + earlier->length);
+}
+
+IoScheduler::IoScheduler() : dev_(nullptr), ops_(nullptr), event_(MX_HANDLE_INVALID),
+    in_flight_(0), epoch_(0), flight_epoch_(0), head_(0), seq_(0), writes_(0), op_count_(0),
+    merged_(0) {
+    memset(stats_, 0, sizeof(stats_));
+}
+
+IoScheduler::~IoScheduler() {
+    MX_DEBUG_ASSERT(queue_.is_empty());
+    MX_DEBUG_ASSERT(flush_.is_empty());
+    MX_DEBUG_ASSERT(flight_.is_empty());
+    MX_DEBUG_ASSERT(in_flight_ == 0);
+    if (event_ != MX_HANDLE_INVALID) {
+        mx_handle_close(event_);
+    }
+}
+
+mx_status_t IoScheduler::Init() {
+    return mx_event_create(0, &event_);
+}
+
+void IoScheduler::Start(mx_device_t* dev, block_ops_t* ops) {
+    dev_ = dev;
+    ops_ = ops;
+    ops_->set_callbacks(dev_, &cb);
+}
+
+void IoScheduler::Enqueue(block_msg_t* msg) {
+    msg->sched = this;
+    msg->enqueued = mx_time_get(MX_CLOCK_MONOTONIC);
+    msg->next = nullptr;
+
+    mxtl::AutoLock lock(&lock_);
+    stats_[msg->txn->GetTxnid()].queued++;
+    msg->seq = seq_++;
+    if (is_write(msg)) {
+        writes_++;
+    }
+    if (msg->opcode & BLOCKIO_BARRIER) {
+        msg->epoch = ++epoch_;
+        epoch_++;
+    } else {
+        msg->epoch = epoch_;
+    }
+
+    // Requests mostly arrive in ascending order, so look for the insertion
+    // point from the back. Everything queued is earlier than this request,
+    // so it must not go ahead of anything it conflicts with.
+    auto iter = queue_.end();
+    while (iter != queue_.begin()) {
+        auto prev = iter;
+        --prev;
+        if (prev->dev_offset <= msg->dev_offset || conflicts(&*prev, msg)) {
+            break;
+        }
+        iter = prev;
+    }
+    queue_.insert(iter, msg);
+}
+
+bool IoScheduler::CanMergeLocked(const block_msg_t* msg, const block_msg_t* first,
+                                 uint64_t length) const {
+    const uint16_t kMask = BLOCKIO_OP_MASK | BLOCKIO_FUA;
+    return ((msg->opcode & kMask) == (first->opcode & kMask)) &&
+           (msg->epoch == first->epoch) &&
+           (msg->iobuf.get() == first->iobuf.get()) &&
+           (msg->dev_offset == first->dev_offset + length) &&
+           (msg->vmo_offset == first->vmo_offset + length) &&
+           (length + msg->length <= kMaxMergeBytes) &&
+           !BlockedLocked(msg);
+}
+
+bool IoScheduler::BlockedLocked(const block_msg_t* msg) const {
+    if (writes_ == 0) {
+        return false;
+    }
+    // Whatever is in flight was issued before this request, and could not
+    // have been had it been later and conflicting.
+    for (const auto& other : flight_) {
+        if (conflicts(&other, msg)) {
+            return true;
+        }
+    }
+    for (const auto& other : queue_) {
+        if (other.seq < msg->seq && conflicts(&other, msg)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+block_msg_t* IoScheduler::NextLocked(mx_time_t now, uint64_t* length_out) {
+    // Only the oldest epoch may be issued, and only once the device is done
+    // with any other.
+    uint64_t epoch = queue_.front().epoch;
+    for (const auto& msg : queue_) {
+        epoch = msg.epoch < epoch ? msg.epoch : epoch;
+    }
+    if (in_flight_ > 0 && epoch != flight_epoch_) {
+        return nullptr;
+    }
+
+    // A request past its deadline goes first, oldest first.
+    block_msg_t* first = nullptr;
+    for (auto& msg : queue_) {
+        if (msg.epoch != epoch) {
+            continue;
+        }
+        mx_time_t deadline = kWriteDeadline;
+        if ((msg.opcode & BLOCKIO_OP_MASK) == BLOCKIO_READ) {
+            deadline = kReadDeadline;
+        }
+        if ((now - msg.enqueued >= deadline) &&
+            (first == nullptr || msg.seq < first->seq) && !BlockedLocked(&msg)) {
+            first = &msg;
+        }
+    }
+
+    // Otherwise continue the sweep up the device, wrapping at the end.
+    if (first == nullptr) {
+        block_msg_t* lowest = nullptr;
+        for (auto& msg : queue_) {
+            if (msg.epoch != epoch || BlockedLocked(&msg)) {
+                continue;
+            }
+            if (lowest == nullptr) {
+                lowest = &msg;
+            }
+            if (msg.dev_offset >= head_) {
+                first = &msg;
+                break;
+            }
+        }
+        if (first == nullptr) {
+            first = lowest;
+        }
+    }
+    // Everything of the epoch waits for requests in flight.
+    if (first == nullptr) {
+        return nullptr;
+    }
+
+    auto iter = queue_.make_iterator(*first);
+    ++iter;
+    queue_.erase(*first);
+
+    uint64_t length = first->length;
+    if ((first->opcode & BLOCKIO_OP_MASK) == BLOCKIO_SYNC) {
+        *length_out = 0;
+        return first;
+    }
+    block_msg_t* last = first;
+    while (iter.IsValid() && CanMergeLocked(&*iter, first, length)) {
+        block_msg_t* msg = &*iter;
+        ++iter;
+        queue_.erase(*msg);
+        length += msg->length;
+        last->next = msg;
+        last = msg;
+        merged_++;
+    }
+
+    *length_out = length;
+    return first;
+}
+
+void IoScheduler::Dispatch() {
+    mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+    while (true) {
+        if (FlushPending()) {
+            continue;
+        }
+
+        block_msg_t* msg;
+        uint64_t length;
+        {
+            mxtl::AutoLock lock(&lock_);
+            if (queue_.is_empty() || in_flight_ >= kMaxInFlight) {
+                return;
+            }
+            if ((msg = NextLocked(now, &length)) == nullptr) {
+                return;
+            }
+            for (block_msg_t* m = msg; m != nullptr; m = m->next) {
+                TxnStats* stats = &stats_[m->txn->GetTxnid()];
+                stats->queued--;
+                stats->in_flight++;
+            }
+            in_flight_++;
+            flight_epoch_ = msg->epoch;
+            op_count_++;
+            if ((msg->opcode & BLOCKIO_OP_MASK) == BLOCKIO_SYNC) {
+                flush_.push_back(msg);
+                continue;
+            }
+            for (block_msg_t* m = msg; m != nullptr; m = m->next) {
+                flight_.push_back(m);
+            }
+            head_ = msg->dev_offset + length;
+        }
+
+        // The device may complete the operation before returning.
+        if ((msg->opcode & BLOCKIO_OP_MASK) == BLOCKIO_READ) {
+            ops_->read(dev_, msg->iobuf->io_vmo_, length, msg->vmo_offset,
+                       msg->dev_offset, msg);
+        } else {
+            ops_->write(dev_, msg->iobuf->io_vmo_, length, msg->vmo_offset,
+                        msg->dev_offset, msg);
+        }
+    }
+}
+
+void IoScheduler::Complete(block_msg_t* msg, mx_status_t status) {
+    {
+        mxtl::AutoLock lock(&lock_);
+        for (block_msg_t* m = msg; m != nullptr; m = m->next) {
+            flight_.erase(*m);
+            if (is_write(m)) {
+                writes_--;
+            }
+        }
+    }
+    if ((status == NO_ERROR) && (msg->opcode & BLOCKIO_FUA)) {
+        // The device may complete this on its own thread, which should not
+        // wait for a flush.
+        {
+            mxtl::AutoLock lock(&lock_);
+            flush_.push_back(msg);
+        }
+        mx_object_signal(event_, 0, MX_EVENT_SIGNALED);
+        return;
+    }
+    Finish(msg, status);
+}
+
+bool IoScheduler::FlushPending() {
+    mxtl::DoublyLinkedList<block_msg_t*> flush;
+    {
+        mxtl::AutoLock lock(&lock_);
+        flush.swap(flush_);
+    }
+    if (flush.is_empty()) {
+        return false;
+    }
+
+    // A device without a sync ioctl has no cache we can flush.
+    ssize_t r = dev_->ops->ioctl(dev_, IOCTL_DEVICE_SYNC, nullptr, 0, nullptr, 0);
+    mx_status_t status = (r < 0 && r != ERR_NOT_SUPPORTED) ? static_cast<mx_status_t>(r)
+                                                           : NO_ERROR;
+    while (!flush.is_empty()) {
+        Finish(flush.pop_front(), status);
+    }
+    return true;
+}
+
+void IoScheduler::Finish(block_msg_t* msg, mx_status_t status) {
+    mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+    bool wake;
+    {
+        mxtl::AutoLock lock(&lock_);
+        for (block_msg_t* m = msg; m != nullptr; m = m->next) {
+            TxnStats* stats = &stats_[m->txn->GetTxnid()];
+            stats->in_flight--;
+            stats->completed++;
+            stats->latency[latency_bucket(now - m->enqueued)]++;
+        }
+        in_flight_--;
+        wake = !queue_.is_empty() || in_flight_ == 0;
+    }
+
+    while (msg != nullptr) {
+        // Once its txn completes, the client may reuse the message slot.
+        block_msg_t* next = msg->next;
+        mxtl::RefPtr<BlockTransaction> txn = mxtl::move(msg->txn);
+        // Since iobuf is a RefPtr, it lives at least as long as the txn,
+        // and is not discarded underneath the block device driver.
+        msg->iobuf = nullptr;
+        txn->Complete(status);
+        msg = next;
+    }
+
+    if (wake) {
+        mx_object_signal(event_, 0, MX_EVENT_SIGNALED);
+    }
+}
+
+void IoScheduler::Drain() {
+    while (true) {
+        block_msg_t* msg;
+        {
+            mxtl::AutoLock lock(&lock_);
+            if (queue_.is_empty()) {
+                break;
+            }
+            msg = queue_.pop_front();
+            stats_[msg->txn->GetTxnid()].queued--;
+            if (is_write(msg)) {
+                writes_--;
+            }
+        }
+        mxtl::RefPtr<BlockTransaction> txn = mxtl::move(msg->txn);
+        msg->iobuf = nullptr;
+        txn->Complete(ERR_BAD_STATE);
+    }
+
+    while (true) {
+        if (FlushPending()) {
+            continue;
+        }
+        {
+            mxtl::AutoLock lock(&lock_);
+            if (in_flight_ == 0) {
+                return;
+            }
+        }
+        mx_object_wait_one(event_, MX_EVENT_SIGNALED, MX_TIME_INFINITE, nullptr);
+        mx_object_signal(event_, MX_EVENT_SIGNALED, 0);
+    }
+}
+
+void IoScheduler::ResetStats(txnid_t txnid) {
+    // Requests of a freed txn may still be outstanding, so only the history
+    // is cleared.
+    mxtl::AutoLock lock(&lock_);
+    stats_[txnid].completed = 0;
+    memset(stats_[txnid].latency, 0, sizeof(stats_[txnid].latency));
+}
+
+mx_status_t IoScheduler::GetStats(txnid_t txnid, block_stats_t* out) {
+    if (txnid >= MAX_TXN_COUNT) {
+        return ERR_INVALID_ARGS;
+    }
+    mxtl::AutoLock lock(&lock_);
+    const TxnStats* stats = &stats_[txnid];
+    out->ops = op_count_;
+    out->merged = merged_;
+    out->queued = stats->queued;
+    out->in_flight = stats->in_flight;
+    out->completed = stats->completed;
+    memcpy(out->latency, stats->latency, sizeof(out->latency));
+    return NO_ERROR;
+}
@@ -17,26 +17,6 @@
 
 #include "server.h"
 
-static mx_status_t do_read(mx_handle_t fifo, block_fifo_request_t* requests, uint32_t* count) {
-    mx_status_t status;
-    while (true) {
-        status = mx_fifo_read(fifo, requests, sizeof(block_fifo_request_t), count);
-        if (status == ERR_SHOULD_WAIT) {
-            mx_signals_t signals;
-            if ((status = mx_object_wait_one(fifo,
-                                             MX_FIFO_READABLE | MX_FIFO_PEER_CLOSED,
-                                             MX_TIME_INFINITE, &signals)) != NO_ERROR) {
-                return status;
-            } else if (signals & MX_FIFO_PEER_CLOSED) {
-                return ERR_REMOTE_CLOSED;
-            }
-            // Try reading again...
-        } else {
-            return status;
-        }
-    }
-}
-
 static void OutOfBandErrorRespond(mx_handle_t fifo, mx_status_t status, txnid_t txnid) {
     block_fifo_response_t response;
     response.status = status;
@@ -52,6 +32,7 @@ static void OutOfBandErrorRespond(mx_handle_t fifo, mx_status_t status, txnid_t
 
 BlockTransaction::BlockTransaction(mx_handle_t fifo, txnid_t txnid) :
     fifo_(fifo), flags_(0), goal_(0) {
+    memset(&sg, 0, sizeof(sg));
     memset(&response_, 0, sizeof(response_));
     response_.txnid = txnid;
 }
@@ -177,6 +158,7 @@ mx_status_t BlockServer::AllocateTxn(txnid_t* out) {
             if (!ac.check()) {
                 return ERR_NO_MEMORY;
             }
+            sched_.ResetStats(txnid);
             *out = txnid;
             return NO_ERROR;
         }
@@ -192,6 +174,10 @@ void BlockServer::FreeTxn(txnid_t txnid) {
     txns_[txnid] = nullptr;
 }
 
+mx_status_t BlockServer::GetStats(txnid_t txnid, block_stats_t* out) {
+    return sched_.GetStats(txnid, out);
+}
+
 mx_status_t BlockServer::Create(mx_handle_t* fifo_out, BlockServer** out) {
     AllocChecker ac;
     BlockServer* bs = new (&ac) BlockServer();
@@ -200,6 +186,10 @@ mx_status_t BlockServer::Create(mx_handle_t* fifo_out, BlockServer** out) {
     }
 
     mx_status_t status;
+    if ((status = bs->sched_.Init()) != NO_ERROR) {
+        delete bs;
+        return status;
+    }
     if ((status = mx_fifo_create(BLOCK_FIFO_MAX_DEPTH, BLOCK_FIFO_ESIZE, 0,
                                  fifo_out, &bs->fifo_)) != NO_ERROR) {
         delete bs;
@@ -210,22 +200,73 @@ mx_status_t BlockServer::Create(mx_handle_t* fifo_out, BlockServer** out) {
     return NO_ERROR;
 }
 
-void blockserver_fifo_complete(void* cookie, mx_status_t status) {
-    block_msg_t* msg = static_cast<block_msg_t*>(cookie);
-    // Since iobuf is a RefPtr, it lives at least as long as the txn,
-    // and is not discarded underneath the block device driver.
-    msg->iobuf = nullptr;
-    msg->txn->Complete(status);
-    msg->txn = nullptr;
+void BlockServer::QueueLocked(const block_fifo_request_t* request, bool wants_reply,
+                              mxtl::RefPtr<IoBuffer> iobuf) {
+    txnid_t txnid = request->txnid;
+    block_msg_t* msg;
+    if (txns_[txnid]->Enqueue(wants_reply, &msg) != NO_ERROR) {
+        return;
+    }
+
+    // Hack to ensure that the vmo is valid.
+    // In the future, this code will be responsible for pinning VMO pages,
+    // and the completion will be responsible for un-pinning those same pages.
+    if (iobuf != nullptr) {
+        mx_status_t status = iobuf->ValidateVmoHack(request->length, request->vmo_offset);
+        if (status != NO_ERROR) {
+            txns_[txnid]->Complete(status);
+            return;
+        }
+    }
+
+    msg->txn = txns_[txnid];
+    msg->iobuf = mxtl::move(iobuf);
+    msg->opcode = request->opcode;
+    msg->length = request->length;
+    msg->vmo_offset = request->vmo_offset;
+    msg->dev_offset = request->dev_offset;
+    sched_.Enqueue(msg);
+}
+
+void BlockServer::QueueSgLocked(const block_fifo_sg_t* entry, bool wants_reply) {
+    BlockTransaction* txn = txns_[entry->txnid].get();
+    const vmoid_t vmoids[2] = { entry->vmoid0, entry->vmoid1 };
+    const uint32_t lengths[2] = { entry->length0, entry->length1 };
+    const uint64_t vmo_offsets[2] = { entry->vmo_offset0, entry->vmo_offset1 };
+
+    for (size_t i = 0; i < countof(vmoids) && txn->sg.remaining > 0; i++) {
+        block_fifo_request_t range;
+        memset(&range, 0, sizeof(range));
+        range.txnid = entry->txnid;
+        range.vmoid = vmoids[i];
+        range.opcode = txn->sg.opcode;
+        range.length = lengths[i];
+        range.vmo_offset = vmo_offsets[i];
+        range.dev_offset = txn->sg.dev_offset;
+        txn->sg.dev_offset += lengths[i];
+
+        // The last range stands in for the whole request.
+        bool reply = (--txn->sg.remaining == 0) && (wants_reply || txn->sg.respond);
+        auto iobuf = tree_.find(range.vmoid);
+        if (!iobuf.IsValid()) {
+            FailLocked(entry->txnid, reply);
+            continue;
+        }
+        QueueLocked(&range, reply, iobuf.CopyPointer());
+    }
 }
 
-static block_callbacks_t cb = {
-    blockserver_fifo_complete,
-};
+void BlockServer::FailLocked(txnid_t txnid, bool wants_reply) {
+    // Unlike an out of band error, this counts towards the txn, so the
+    // response comes once the rest of it completes.
+    block_msg_t* msg;
+    if (txns_[txnid]->Enqueue(wants_reply, &msg) == NO_ERROR) {
+        txns_[txnid]->Complete(ERR_IO);
+    }
+}
 
 mx_status_t BlockServer::Serve(mx_device_t* dev, block_ops_t* ops) {
-
-    ops->set_callbacks(dev, &cb);
+    sched_.Start(dev, ops);
 
     mx_status_t status;
     block_fifo_request_t requests[BLOCK_FIFO_MAX_DEPTH];
@@ -235,9 +276,33 @@ mx_status_t BlockServer::Serve(mx_device_t* dev, block_ops_t* ops) {
         mxtl::AutoLock server_lock(&server_lock_);
         fifo = fifo_;
     }
+    mx_wait_item_t items[2] = {
+        { fifo, MX_FIFO_READABLE | MX_FIFO_PEER_CLOSED, 0 },
+        { sched_.GetEvent(), MX_EVENT_SIGNALED, 0 },
+    };
     while (true) {
-        if ((status = do_read(fifo, &requests[0], &count)) != NO_ERROR) {
-            return status;
+        // Drain as much of the fifo as fits, so the scheduler sees the
+        // whole batch.
+        status = mx_fifo_read(fifo, requests, sizeof(requests), &count);
+        if (status == ERR_SHOULD_WAIT) {
+            // Wait for more requests, or for the device to make room for
+            // the ones already queued.
+            if ((status = mx_object_wait_many(items, countof(items),
+                                              MX_TIME_INFINITE)) != NO_ERROR) {
+                break;
+            }
+            if (items[1].pending & MX_EVENT_SIGNALED) {
+                mx_object_signal(items[1].handle, MX_EVENT_SIGNALED, 0);
+                sched_.Dispatch();
+            }
+            if (!(items[0].pending & MX_FIFO_READABLE) &&
+                (items[0].pending & MX_FIFO_PEER_CLOSED)) {
+                status = ERR_REMOTE_CLOSED;
+                break;
+            }
+            continue;
+        } else if (status != NO_ERROR) {
+            break;
         }
 
         for (size_t i = 0; i < count; i++) {
@@ -246,54 +311,67 @@ mx_status_t BlockServer::Serve(mx_device_t* dev, block_ops_t* ops) {
             vmoid_t vmoid = requests[i].vmoid;
 
             mxtl::AutoLock server_lock(&server_lock_);
-            auto iobuf = tree_.find(vmoid);
-            if (!iobuf.IsValid()) {
-                // Operation which is not accessing a valid vmo
+            if (txnid >= MAX_TXN_COUNT || txns_[txnid] == nullptr) {
+                // Operation which is not accessing a valid txn
                 if (wants_reply) {
                     OutOfBandErrorRespond(fifo, ERR_IO, txnid);
                 }
                 continue;
             }
-            if (txnid >= MAX_TXN_COUNT || txns_[txnid] == nullptr) {
-                // Operation which is not accessing a valid txn
+
+            uint16_t op = requests[i].opcode & BLOCKIO_OP_MASK;
+            if (op == BLOCKIO_SG) {
+                if (txns_[txnid]->sg.remaining == 0) {
+                    // Not continuing a scatter/gather request
+                    if (wants_reply) {
+                        OutOfBandErrorRespond(fifo, ERR_IO, txnid);
+                    }
+                    continue;
+                }
+                QueueSgLocked(reinterpret_cast<const block_fifo_sg_t*>(&requests[i]),
+                              wants_reply);
+                continue;
+            } else if (txns_[txnid]->sg.remaining > 0) {
+                // The rest of the scatter/gather request never came. Fail it
+                // in place of its last range.
+                bool respond = txns_[txnid]->sg.respond;
+                txns_[txnid]->sg.remaining = 0;
+                FailLocked(txnid, respond);
+            }
+
+            if (op == BLOCKIO_SYNC) {
+                block_fifo_request_t sync = requests[i];
+                sync.opcode |= BLOCKIO_BARRIER;
+                QueueLocked(&sync, wants_reply, nullptr);
+                continue;
+            }
+
+            auto iobuf = tree_.find(vmoid);
+            if (!iobuf.IsValid()) {
+                // Operation which is not accessing a valid vmo
                 if (wants_reply) {
                     OutOfBandErrorRespond(fifo, ERR_IO, txnid);
                 }
                 continue;
             }
 
-            switch (requests[i].opcode & BLOCKIO_OP_MASK) {
+            switch (op) {
             case BLOCKIO_READ:
             case BLOCKIO_WRITE: {
-                block_msg_t* msg;
-                status = txns_[txnid]->Enqueue(wants_reply, &msg);
-                if (status != NO_ERROR) {
+                uint16_t segments = requests[i].segments;
+                if (segments == 0) {
+                    QueueLocked(&requests[i], wants_reply, iobuf.CopyPointer());
                     break;
-                }
-                msg->txn = txns_[txnid];
-                msg->iobuf = iobuf.CopyPointer();
-
-                // Hack to ensure that the vmo is valid.
-                // In the future, this code will be responsible for pinning VMO pages,
-                // and the completion will be responsible for un-pinning those same pages.
-                status = iobuf->ValidateVmoHack(requests[i].length, requests[i].vmo_offset);
-                if (status != NO_ERROR) {
-                    cb.complete(msg, status);
+                } else if (segments >= MAX_TXN_MESSAGES) {
+                    FailLocked(txnid, wants_reply);
                     break;
                 }
-
-                if ((requests[i].opcode & BLOCKIO_OP_MASK) == BLOCKIO_READ) {
-                    ops->read(dev, iobuf->io_vmo_, requests[i].length,
-                              requests[i].vmo_offset, requests[i].dev_offset, msg);
-                } else {
-                    ops->write(dev, iobuf->io_vmo_, requests[i].length,
-                               requests[i].vmo_offset, requests[i].dev_offset, msg);
-                }
-                break;
-            }
-            case BLOCKIO_SYNC: {
-                // TODO(smklein): It might be more useful to have this on a per-vmo basis
-                fprintf(stderr, "Warning: BLOCKIO_SYNC is currently unimplemented\n");
+                BlockTransaction* txn = txns_[txnid].get();
+                txn->sg.remaining = segments;
+                txn->sg.opcode = static_cast<uint16_t>(requests[i].opcode & ~BLOCKIO_TXN_END);
+                txn->sg.dev_offset = requests[i].dev_offset + requests[i].length;
+                txn->sg.respond = wants_reply;
+                QueueLocked(&requests[i], false, iobuf.CopyPointer());
                 break;
             }
             case BLOCKIO_CLOSE_VMO: {
@@ -309,7 +387,15 @@ mx_status_t BlockServer::Serve(mx_device_t* dev, block_ops_t* ops) {
             }
             }
         }
+
+        // Everything read is queued before anything is issued, so requests
+        // from the same batch can be ordered and merged.
+        sched_.Dispatch();
     }
+
+    // Nothing may be left referring to the scheduler once we return.
+    sched_.Drain();
+    return status;
 }
 
 BlockServer::BlockServer() : fifo_(MX_HANDLE_INVALID), last_id(0) {}
@@ -347,3 +433,6 @@ mx_status_t blockserver_allocate_txn(BlockServer* bs, txnid_t* out) {
 void blockserver_free_txn(BlockServer* bs, txnid_t txnid) {
     return bs->FreeTxn(txnid);
 }
+mx_status_t blockserver_get_stats(BlockServer* bs, txnid_t txnid, block_stats_t* out) {
+    return bs->GetStats(txnid, out);
+}
@@ -14,6 +14,7 @@
 
 #ifdef __cplusplus
 
+#include <mxtl/intrusive_double_list.h>
 #include <mxtl/intrusive_wavl_tree.h>
 #include <mxtl/mutex.h>
 #include <mxtl/ref_counted.h>
@@ -36,6 +37,7 @@ public:
 
 private:
     friend class BlockServer;
+    friend class IoScheduler;
     friend struct TypeWAVLTraits;
     DISALLOW_COPY_ASSIGN_AND_MOVE(IoBuffer);
 
@@ -46,11 +48,24 @@ private:
 constexpr uint32_t kTxnFlagRespond = 0x00000001; // Should a reponse be sent when we hit goal?
 
 class BlockTransaction;
+class IoScheduler;
 
-typedef struct {
+struct block_msg_t : public mxtl::DoublyLinkedListable<block_msg_t*> {
     mxtl::RefPtr<BlockTransaction> txn;
     mxtl::RefPtr<IoBuffer> iobuf;
-} block_msg_t;
+
+    // The request, as read from the fifo.
+    uint16_t opcode;
+    uint64_t length;
+    uint64_t vmo_offset;
+    uint64_t dev_offset;
+
+    IoScheduler* sched;
+    mx_time_t enqueued;     // When the server read the request.
+    uint64_t seq;           // Order in which the server read the request.
+    uint64_t epoch;         // Barriers start and end an epoch.
+    block_msg_t* next;      // Requests merged into the same device operation.
+};
 
 class BlockTransaction : public mxtl::RefCounted<BlockTransaction> {
 public:
@@ -67,6 +82,15 @@ public:
     void Complete(mx_status_t status);
 
     txnid_t GetTxnid() const;
+
+    // The scatter/gather request in progress on this txn. Only used by the
+    // server thread.
+    struct {
+        uint32_t remaining;     // Ranges still to come in BLOCKIO_SG entries
+        uint16_t opcode;
+        uint64_t dev_offset;    // Where the next range goes on the device
+        bool respond;           // The request itself had BLOCKIO_TXN_END set
+    } sg;
 private:
     DISALLOW_COPY_ASSIGN_AND_MOVE(BlockTransaction);
     const mx_handle_t fifo_;
@@ -81,6 +105,94 @@ private:
     uint32_t goal_; // How many ops does the block device need to complete?
 };
 
+// Orders reads and writes on their way to the device.
+//
+// Requests are held in a queue sorted by device offset while the device has
+// kMaxInFlight operations outstanding. The next operation starts at the
+// first request at or past the end of the previous one, wrapping around to
+// the lowest offset (C-LOOK), unless some request has waited past its
+// deadline, in which case the oldest such request goes first. Requests of
+// the same kind on the same vmo that are contiguous both on the device and
+// in the vmo are merged into one operation, whichever txn they came from.
+//
+// Requests are reordered only where that cannot be observed: a request never
+// goes ahead of an earlier one it overlaps on the device if either of them
+// is a write. This holds for the sort, the deadline and sweep picks and the
+// merges, and against operations in flight.
+//
+// A barrier request is alone in its epoch, and only requests of the oldest
+// epoch are issued. BLOCKIO_SYNC, and BLOCKIO_FUA writes once they complete,
+// are handed back to the server thread, which flushes the device.
+class IoScheduler {
+public:
+    IoScheduler();
+    ~IoScheduler();
+
+    mx_status_t Init();
+    void Start(mx_device_t* dev, block_ops_t* ops);
+
+    // Signaled whenever Dispatch() may have more work to do.
+    mx_handle_t GetEvent() const { return event_; }
+
+    void Enqueue(block_msg_t* msg);
+    void Dispatch();
+    void Complete(block_msg_t* msg, mx_status_t status);
+
+    // Fails every queued request and waits for outstanding operations.
+    void Drain();
+
+    void ResetStats(txnid_t txnid);
+    mx_status_t GetStats(txnid_t txnid, block_stats_t* out);
+
+private:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(IoScheduler);
+
+    struct TxnStats {
+        uint32_t queued;
+        uint32_t in_flight;
+        uint64_t completed;
+        uint64_t latency[BLOCK_LATENCY_BUCKETS];
+    };
+
+    static constexpr uint32_t kMaxInFlight = 16;
+    static constexpr uint64_t kMaxMergeBytes = 1 << 20;
+    static constexpr mx_time_t kReadDeadline = MX_MSEC(50);
+    static constexpr mx_time_t kWriteDeadline = MX_MSEC(500);
+
+    // Unlinks the requests making up the next operation, chained through
+    // |next|, and returns the first. |length_out| is the operation length.
+    block_msg_t* NextLocked(mx_time_t now, uint64_t* length_out);
+    bool CanMergeLocked(const block_msg_t* msg, const block_msg_t* first,
+                        uint64_t length) const;
+    // Whether |msg| has to wait for an earlier request, queued or in flight,
+    // which it overlaps.
+    bool BlockedLocked(const block_msg_t* msg) const;
+    // Flushes the device for the operations waiting on a flush, if any, and
+    // completes them. Returns false if there were none.
+    bool FlushPending();
+    void Finish(block_msg_t* msg, mx_status_t status);
+
+    mx_device_t* dev_;
+    block_ops_t* ops_;
+
+    mxtl::Mutex lock_;
+    mx_handle_t event_;
+    // Sorted by dev_offset, except that a request stays behind the earlier
+    // ones it overlaps.
+    mxtl::DoublyLinkedList<block_msg_t*> queue_;
+    mxtl::DoublyLinkedList<block_msg_t*> flight_; // Reads and writes issued
+    mxtl::DoublyLinkedList<block_msg_t*> flush_; // Operations waiting on a flush
+    uint32_t in_flight_;    // Operations issued to the device
+    uint64_t epoch_;        // Epoch of the next request enqueued
+    uint64_t flight_epoch_; // Epoch of the operations in flight
+    uint64_t head_;         // End of the last operation issued
+    uint64_t seq_;          // Sequence number of the next request enqueued
+    uint32_t writes_;       // Writes queued or in flight
+    uint64_t op_count_;
+    uint64_t merged_;
+    TxnStats stats_[MAX_TXN_COUNT];
+};
+
 class BlockServer {
 public:
     // Creates a new BlockServer
@@ -91,6 +203,7 @@ public:
     mx_status_t AttachVmo(mx_handle_t vmo, vmoid_t* out);
     mx_status_t AllocateTxn(txnid_t* out);
     void FreeTxn(txnid_t txnid);
+    mx_status_t GetStats(txnid_t txnid, block_stats_t* out);
 
     void ShutDown();
 
@@ -100,12 +213,17 @@ private:
     BlockServer();
 
     mx_status_t FindVmoIDLocked(vmoid_t* out);
+    void QueueLocked(const block_fifo_request_t* request, bool wants_reply,
+                     mxtl::RefPtr<IoBuffer> iobuf);
+    void QueueSgLocked(const block_fifo_sg_t* entry, bool wants_reply);
+    void FailLocked(txnid_t txnid, bool wants_reply);
 
     mxtl::Mutex server_lock_;
     mx_handle_t fifo_;
     mxtl::WAVLTree<vmoid_t, mxtl::RefPtr<IoBuffer>> tree_;
     mxtl::RefPtr<BlockTransaction> txns_[MAX_TXN_COUNT];
     vmoid_t last_id;
+    IoScheduler sched_;
 };
 
 #else
@@ -136,4 +254,7 @@ mx_status_t blockserver_attach_vmo(BlockServer* bs, mx_handle_t vmo, vmoid_t* ou
 mx_status_t blockserver_allocate_txn(BlockServer* bs, txnid_t* out);
 void blockserver_free_txn(BlockServer* bs, txnid_t txnid);
 
+// Read the scheduler statistics for a txn
+mx_status_t blockserver_get_stats(BlockServer* bs, txnid_t txnid, block_stats_t* out);
+
 __END_CDECLS
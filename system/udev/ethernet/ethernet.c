@@ -13,14 +13,21 @@
 #include <magenta/syscalls.h>
 #include <magenta/types.h>
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <threads.h>
 
 #define FIFO_DEPTH 256
 #define FIFO_ESIZE sizeof(eth_fifo_entry_t)
 
+// Received frames are returned to a client in batches of up to RX_BATCH
+// entries.  A partial batch waits for at most RX_FLUSH_DELAY.
+#define RX_BATCH 32
+#define RX_FLUSH_DELAY MX_USEC(250)
+
 #define TRACE 0
 
 #if TRACE
@@ -34,6 +41,37 @@
 // ensure that we will not exceed fifo capacity
 static_assert((FIFO_DEPTH * FIFO_ESIZE) <= 4096, "");
 
+typedef struct ethdev ethdev_t;
+
+// A client's fifo entry that has been queued with the ethermac (queue
+// mode), held until the ethermac completes it.
+typedef struct eth_pending {
+    ethdev_t* edev;
+    eth_fifo_entry_t e;
+
+    // the DMA buffer of this slot in the ring
+    void* buf;
+    mx_paddr_t phys;
+} eth_pending_t;
+
+// Pending entries, completed in the order they were queued.
+//
+// The ethermac DMAs to and from buffers owned by this driver, one per
+// slot, and frames are copied between them and the clients' io buffers.
+// A client can decommit or resize its io buffer at any time, and nothing
+// keeps its pages in place while the device is using them.
+typedef struct eth_ring {
+    eth_pending_t* entries;
+    uint32_t depth;
+    uint32_t head;
+    uint32_t count;
+
+    mx_handle_t vmo;
+    void* buf;
+    size_t buf_size;
+    size_t slot_size;
+} eth_ring_t;
+
 // ethernet device
 typedef struct ethdev0 {
     // shared state
@@ -54,14 +92,40 @@ typedef struct ethdev0 {
 
     ethmac_info_t info;
 
+    // With FEATURE_TX_QUEUE, frames are queued with the ethermac rather
+    // than sent.  With FEATURE_RX_QUEUE, one active client, the rx owner,
+    // provides the buffers queued with the ethermac, and frames received
+    // into them are copied to the others.
+    eth_ring_t tx_ring;
+    eth_ring_t rx_ring;
+    ethdev_t* rx_owner;
+
+    // The lock is dropped around the ethermac's stop(), which waits for
+    // callbacks in progress, and those take the lock.  Until mac_stopping
+    // is clear again nothing else starts, stops or queues to the ethermac.
+    bool mac_stopping;
+    cnd_t mac_stopped;
+
     mx_device_t dev;
 } ethdev0_t;
 
+static void eth_ring_release(eth_ring_t* ring) {
+    if (ring->buf != NULL) {
+        mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t)ring->buf, ring->buf_size);
+    }
+    if (ring->vmo != MX_HANDLE_INVALID) {
+        mx_handle_close(ring->vmo);
+    }
+    free(ring->entries);
+}
+
 static void eth0_downref(ethdev0_t* edev0) {
     mtx_lock(&edev0->lock);
     edev0->refcount--;
     if (edev0->refcount == 0) {
         mtx_unlock(&edev0->lock);
+        eth_ring_release(&edev0->tx_ring);
+        eth_ring_release(&edev0->rx_ring);
         free(edev0);
     } else {
         mtx_unlock(&edev0->lock);
@@ -84,7 +148,7 @@ static void eth0_downref(ethdev0_t* edev0) {
 #define ETHDEV_TX_LISTEN (16u)
 
 // ethernet instance device
-typedef struct ethdev {
+struct ethdev {
     list_node_t node;
 
     ethdev0_t* edev0;
@@ -104,26 +168,133 @@ typedef struct ethdev {
     void* io_buf;
     size_t io_size;
 
-    // fifo thread
+    // rx buffers read from the rx fifo but not yet filled
+    eth_fifo_entry_t rx_avail[FIFO_DEPTH];
+    uint32_t rx_avail_head;
+    uint32_t rx_avail_count;
+
+    // received frames not yet written back to the rx fifo
+    eth_fifo_entry_t rx_done[RX_BATCH];
+    uint32_t rx_done_count;
+    mx_time_t rx_flush_deadline;
+
+    // fifo thread, and an event to wake it when room frees up in the
+    // ethermac's queues, it becomes the rx owner, or received frames are
+    // waiting to be flushed
     thrd_t tx_thr;
+    mx_handle_t wake_evt;
 
     mx_device_t dev;
-} ethdev_t;
+};
 
 #define get_ethdev(d) containerof(d, ethdev_t, dev)
 #define get_ethdev0(d) containerof(d, ethdev0_t, dev)
 
-static void eth_handle_rx(ethdev_t* edev, const void* data, size_t len, uint32_t extra) {
-    eth_fifo_entry_t e;
+static eth_pending_t* eth_ring_push(eth_ring_t* ring, ethdev_t* edev,
+                                    const eth_fifo_entry_t* e) {
+    eth_pending_t* p = &ring->entries[(ring->head + ring->count) % ring->depth];
+    p->edev = edev;
+    p->e = *e;
+    ring->count++;
+    return p;
+}
+
+static eth_pending_t* eth_ring_pop(eth_ring_t* ring) {
+    if (ring->count == 0) {
+        return NULL;
+    }
+    eth_pending_t* p = &ring->entries[ring->head];
+    ring->head = (ring->head + 1) % ring->depth;
+    ring->count--;
+    return p;
+}
+
+static void eth_reply(mx_handle_t fifo, const eth_fifo_entry_t* e) {
     mx_status_t status;
     uint32_t count;
+    if ((status = mx_fifo_write(fifo, e, sizeof(*e), &count)) < 0) {
+        printf("eth: cannot return fifo entry: %d\n", status);
+    }
+}
+
+// Checks that an entry refers to data within the client's io buffer.
+static bool eth_entry_valid(ethdev_t* edev, const eth_fifo_entry_t* e) {
+    return (e->length > 0) && (e->offset < edev->io_size) &&
+           (e->length <= (edev->io_size - e->offset));
+}
 
-    // TODO: read multiple and cache locally to reduce syscalls
-    if ((status = mx_fifo_read(edev->rx_fifo, &e, sizeof(e), &count)) < 0) {
-        printf("eth: rx_fifo: cannot read: %d\n", status);
+static void eth0_wake_locked(ethdev0_t* edev0) {
+    ethdev_t* edev;
+    list_for_every_entry(&edev0->list_active, edev, ethdev_t, node) {
+        mx_object_signal(edev->wake_evt, 0, MX_EVENT_SIGNALED);
+    }
+}
+
+// Writes the received frames back to the client in one go.
+static void eth_rx_flush_locked(ethdev_t* edev) {
+    if (edev->rx_done_count == 0) {
         return;
     }
 
+    mx_status_t status;
+    uint32_t count;
+    if ((status = mx_fifo_write(edev->rx_fifo, edev->rx_done,
+                                sizeof(eth_fifo_entry_t) * edev->rx_done_count, &count)) < 0) {
+        printf("eth: rx_fifo: cannot write: %d\n", status);
+    } else if (count != edev->rx_done_count) {
+        printf("eth: rx_fifo: only wrote %u of %u!\n", count, edev->rx_done_count);
+    }
+    edev->rx_done_count = 0;
+}
+
+// Returns a received frame to the client, right away if 'flush' is set,
+// otherwise along with the rest of its batch.
+static void eth_rx_done_locked(ethdev_t* edev, const eth_fifo_entry_t* e, bool flush) {
+    edev->rx_done[edev->rx_done_count++] = *e;
+    if (flush || (edev->rx_done_count == RX_BATCH)) {
+        eth_rx_flush_locked(edev);
+    } else if (edev->rx_done_count == 1) {
+        // have the fifo thread flush the batch if it does not fill up
+        edev->rx_flush_deadline = mx_time_get(MX_CLOCK_MONOTONIC) + RX_FLUSH_DELAY;
+        mx_object_signal(edev->wake_evt, 0, MX_EVENT_SIGNALED);
+    }
+}
+
+// Flushes a batch of received frames which has waited long enough.  Returns
+// how long the fifo thread may wait before it needs to call this again.
+static mx_time_t eth_rx_flush_timeout_locked(ethdev_t* edev) {
+    if (edev->rx_done_count == 0) {
+        return MX_TIME_INFINITE;
+    }
+    mx_time_t now = mx_time_get(MX_CLOCK_MONOTONIC);
+    if (now >= edev->rx_flush_deadline) {
+        eth_rx_flush_locked(edev);
+        return MX_TIME_INFINITE;
+    }
+    return edev->rx_flush_deadline - now;
+}
+
+static void eth_handle_rx(ethdev_t* edev, const void* data, size_t len, uint32_t extra) {
+    if (edev->rx_avail_count == 0) {
+        // Take all the buffers the client has posted at once, except from
+        // the rx owner, whose buffers are meant for the ethermac.
+        size_t max = (edev == edev->edev0->rx_owner) ? 1 : countof(edev->rx_avail);
+        mx_status_t status;
+        uint32_t count;
+        if ((status = mx_fifo_read(edev->rx_fifo, edev->rx_avail,
+                                   sizeof(eth_fifo_entry_t) * max, &count)) < 0) {
+            if (status != ERR_SHOULD_WAIT) {
+                printf("eth: rx_fifo: cannot read: %d\n", status);
+            }
+            return;
+        }
+        edev->rx_avail_head = 0;
+        edev->rx_avail_count = count;
+    }
+
+    eth_fifo_entry_t e = edev->rx_avail[edev->rx_avail_head++];
+    edev->rx_avail_count--;
+
     if ((e.offset >= edev->io_size) || ((e.length > (edev->io_size - e.offset)))) {
         // invalid offset/length. report error. drop packet
         e.length = 0;
@@ -138,10 +309,8 @@ static void eth_handle_rx(ethdev_t* edev, const void* data, size_t len, uint32_t
         e.flags = ETH_FIFO_RX_OK | extra;
     }
 
-    if ((status = mx_fifo_write(edev->rx_fifo, &e, sizeof(e), &count)) < 0) {
-        printf("eth: rx_fifo: cannot write: %d\n", status);
-        return;
-    }
+    // the client needs its frames back before it can post more buffers
+    eth_rx_done_locked(edev, &e, edev->rx_avail_count == 0);
 }
 
 static void eth0_status(void* cookie, uint32_t status) {
@@ -155,26 +324,326 @@ static void eth0_recv(void* cookie, void* data, size_t len, uint32_t flags) {
 
     ethdev_t* edev;
     mtx_lock(&edev0->lock);
+    uint32_t extra = (flags & ETHMAC_RX_CSUM_OK) ? ETH_FIFO_RX_CSUM_OK : 0;
     list_for_every_entry(&edev0->list_active, edev, ethdev_t, node) {
-        eth_handle_rx(edev, data, len, 0);
+        eth_handle_rx(edev, data, len, extra);
+    }
+    mtx_unlock(&edev0->lock);
+}
+
+static void eth0_complete_tx(void* cookie, uint32_t count) {
+    ethdev0_t* edev0 = cookie;
+
+    mtx_lock(&edev0->lock);
+    eth_pending_t* p;
+    while ((count-- > 0) && ((p = eth_ring_pop(&edev0->tx_ring)) != NULL)) {
+        p->e.flags = ETH_FIFO_TX_OK;
+        eth_reply(p->edev->tx_fifo, &p->e);
     }
+    eth0_wake_locked(edev0);
+    mtx_unlock(&edev0->lock);
+}
+
+static void eth0_complete_rx(void* cookie, uint32_t len, uint32_t flags) {
+    ethdev0_t* edev0 = cookie;
+
+    mtx_lock(&edev0->lock);
+    eth_pending_t* p = eth_ring_pop(&edev0->rx_ring);
+    if (p == NULL) {
+        mtx_unlock(&edev0->lock);
+        return;
+    }
+
+    ethdev_t* owner = p->edev;
+    uint32_t extra = (flags & ETHMAC_RX_CSUM_OK) ? ETH_FIFO_RX_CSUM_OK : 0;
+    if ((len == 0) || (len > edev0->rx_ring.slot_size)) {
+        p->e.length = 0;
+        p->e.flags = 0;
+    } else {
+        ethdev_t* edev;
+        list_for_every_entry(&edev0->list_active, edev, ethdev_t, node) {
+            if (edev != owner) {
+                eth_handle_rx(edev, p->buf, len, extra);
+            }
+        }
+        if (len > p->e.length) {
+            p->e.length = 0;
+            p->e.flags = ETH_FIFO_INVALID;
+        } else {
+            memcpy(owner->io_buf + p->e.offset, p->buf, len);
+            p->e.length = len;
+            p->e.flags = ETH_FIFO_RX_OK | extra;
+        }
+    }
+    eth_rx_done_locked(owner, &p->e, edev0->rx_ring.count == 0);
+    mx_object_signal(owner->wake_evt, 0, MX_EVENT_SIGNALED);
     mtx_unlock(&edev0->lock);
 }
 
 static ethmac_ifc_t ethmac_ifc = {
     .status = eth0_status,
     .recv = eth0_recv,
+    .complete_rx = eth0_complete_rx,
+    .complete_tx = eth0_complete_tx,
 };
 
-static void eth_tx_echo(ethdev0_t* edev0, const void* data, size_t len) {
+static void eth_tx_echo_locked(ethdev0_t* edev0, const void* data, size_t len) {
     ethdev_t* edev;
-    mtx_lock(&edev0->lock);
     list_for_every_entry(&edev0->list_active, edev, ethdev_t, node) {
         if (edev->state & ETHDEV_TX_LISTEN) {
             eth_handle_rx(edev, data, len, ETH_FIFO_RX_TX);
         }
     }
+}
+
+static void eth_tx_echo(ethdev0_t* edev0, const void* data, size_t len) {
+    mtx_lock(&edev0->lock);
+    eth_tx_echo_locked(edev0, data, len);
+    mtx_unlock(&edev0->lock);
+}
+
+// Returns every entry still queued with the ethermac to its client, which
+// must be done after stopping the ethermac: tx frames as not sent, rx
+// buffers empty.
+static void eth0_flush_locked(ethdev0_t* edev0) {
+    eth_pending_t* p;
+    while ((p = eth_ring_pop(&edev0->tx_ring)) != NULL) {
+        p->e.flags = 0;
+        eth_reply(p->edev->tx_fifo, &p->e);
+    }
+    while ((p = eth_ring_pop(&edev0->rx_ring)) != NULL) {
+        p->e.length = 0;
+        p->e.flags = 0;
+        eth_reply(p->edev->rx_fifo, &p->e);
+    }
+}
+
+// Stops the ethermac and returns everything still queued with it.  No
+// callback made before stop() is still running when this returns.
+static void eth0_stop_mac_locked(ethdev0_t* edev0) {
+    edev0->mac_stopping = true;
     mtx_unlock(&edev0->lock);
+    edev0->macops->stop(edev0->mac);
+    mtx_lock(&edev0->lock);
+    edev0->mac_stopping = false;
+    cnd_broadcast(&edev0->mac_stopped);
+    eth0_flush_locked(edev0);
+}
+
+static void eth0_wait_mac_locked(ethdev0_t* edev0) {
+    while (edev0->mac_stopping) {
+        cnd_wait(&edev0->mac_stopped, &edev0->lock);
+    }
+}
+
+static bool eth_ring_holds(eth_ring_t* ring, ethdev_t* edev) {
+    for (uint32_t i = 0; i < ring->count; i++) {
+        if (ring->entries[(ring->head + i) % ring->depth].edev == edev) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool eth0_holds_locked(ethdev0_t* edev0, ethdev_t* edev) {
+    return ((edev0->tx_ring.count > 0) && eth_ring_holds(&edev0->tx_ring, edev)) ||
+           ((edev0->rx_ring.count > 0) && eth_ring_holds(&edev0->rx_ring, edev));
+}
+
+// Makes the first active client the rx owner, if there is none.
+static void eth0_pick_rx_owner_locked(ethdev0_t* edev0) {
+    if ((edev0->info.features & ETHMAC_FEATURE_RX_QUEUE) && (edev0->rx_owner == NULL)) {
+        edev0->rx_owner = list_peek_head_type(&edev0->list_active, ethdev_t, node);
+        if (edev0->rx_owner != NULL) {
+            mx_object_signal(edev0->rx_owner->wake_evt, 0, MX_EVENT_SIGNALED);
+        }
+    }
+}
+
+// Hands the owner's posted rx buffers to the ethermac.
+static void eth_rx_queue_locked(ethdev_t* edev) {
+    ethdev0_t* edev0 = edev->edev0;
+    eth_fifo_entry_t entries[FIFO_DEPTH / 2];
+    uint32_t room = MIN(edev0->rx_ring.depth - edev0->rx_ring.count, countof(entries));
+    if ((edev0->rx_owner != edev) || (room == 0)) {
+        return;
+    }
+
+    // buffers taken by eth_handle_rx() before this client became the rx
+    // owner go first
+    uint32_t count = MIN(room, edev->rx_avail_count);
+    memcpy(entries, edev->rx_avail + edev->rx_avail_head, sizeof(eth_fifo_entry_t) * count);
+    edev->rx_avail_head += count;
+    edev->rx_avail_count -= count;
+
+    if (count < room) {
+        mx_status_t status;
+        uint32_t n;
+        if ((status = mx_fifo_read(edev->rx_fifo, entries + count,
+                                   sizeof(eth_fifo_entry_t) * (room - count), &n)) < 0) {
+            if (status != ERR_SHOULD_WAIT) {
+                printf("eth: rx_fifo: cannot read: %d\n", status);
+            }
+        } else {
+            count += n;
+        }
+    }
+
+    for (eth_fifo_entry_t* e = entries; count-- > 0; e++) {
+        if (!eth_entry_valid(edev, e)) {
+            e->length = 0;
+            e->flags = ETH_FIFO_INVALID;
+            eth_reply(edev->rx_fifo, e);
+            continue;
+        }
+        eth_pending_t* p = eth_ring_push(&edev0->rx_ring, edev, e);
+        edev0->macops->queue_rx(edev0->mac, 0, p->phys, 0, edev0->rx_ring.slot_size);
+    }
+}
+
+// The ethermac options for sending a tx entry.
+static uint32_t eth_tx_options(ethdev0_t* edev0, const eth_fifo_entry_t* e) {
+    if ((e->flags & ETH_FIFO_TX_CSUM) && (edev0->info.features & ETHMAC_FEATURE_TX_CSUM)) {
+        return ETHMAC_TX_CSUM;
+    }
+    return 0;
+}
+
+// Hands a batch of tx entries to the ethermac.
+static void eth_tx_queue_locked(ethdev_t* edev) {
+    ethdev0_t* edev0 = edev->edev0;
+    eth_fifo_entry_t entries[FIFO_DEPTH / 2];
+    uint32_t room = MIN(edev0->tx_ring.depth - edev0->tx_ring.count, countof(entries));
+    if (room == 0) {
+        return;
+    }
+
+    mx_status_t status;
+    uint32_t count;
+    if ((status = mx_fifo_read(edev->tx_fifo, entries, sizeof(eth_fifo_entry_t) * room,
+                               &count)) < 0) {
+        if (status != ERR_SHOULD_WAIT) {
+            printf("eth: tx_fifo: cannot read: %d\n", status);
+        }
+        return;
+    }
+
+    for (eth_fifo_entry_t* e = entries; count-- > 0; e++) {
+        if (!eth_entry_valid(edev, e) || (e->length > edev0->tx_ring.slot_size)) {
+            e->flags = ETH_FIFO_INVALID;
+            eth_reply(edev->tx_fifo, e);
+        } else if (!(edev->state & ETHDEV_RUNNING)) {
+            // the ethermac only runs while a client has started it
+            e->flags = 0;
+            eth_reply(edev->tx_fifo, e);
+        } else {
+            if (edev->state & ETHDEV_TX_LOOPBACK) {
+                eth_tx_echo_locked(edev0, edev->io_buf + e->offset, e->length);
+            }
+            eth_pending_t* p = eth_ring_push(&edev0->tx_ring, edev, e);
+            memcpy(p->buf, edev->io_buf + e->offset, e->length);
+            edev0->macops->queue_tx(edev0->mac, eth_tx_options(edev0, e),
+                                    p->phys, 0, e->length);
+        }
+    }
+}
+
+// Sends a batch of tx entries through the ethermac's copying interface.
+static mx_status_t eth_tx_copy(ethdev_t* edev) {
+    ethdev0_t* edev0 = edev->edev0;
+    eth_fifo_entry_t entries[FIFO_DEPTH / 2];
+    mx_status_t status;
+    uint32_t count;
+
+    if ((status = mx_fifo_read(edev->tx_fifo, entries, sizeof(entries), &count)) < 0) {
+        if (status != ERR_SHOULD_WAIT) {
+            printf("eth: tx_fifo: cannot read: %d\n", status);
+        }
+        return status;
+    }
+
+    uint32_t n = count;
+    for (eth_fifo_entry_t* e = entries; count-- > 0; e++) {
+        if ((e->offset > edev->io_size) || ((e->length > (edev->io_size - e->offset)))) {
+            e->flags = ETH_FIFO_INVALID;
+        } else {
+            edev0->macops->send(edev0->mac, eth_tx_options(edev0, e),
+                                edev->io_buf + e->offset, e->length);
+            e->flags = ETH_FIFO_TX_OK;
+            if (edev->state & ETHDEV_TX_LOOPBACK) {
+                eth_tx_echo(edev0, edev->io_buf + e->offset, e->length);
+            }
+        }
+    }
+
+    if ((status = mx_fifo_write(edev->tx_fifo, entries, sizeof(eth_fifo_entry_t) * n, &count)) < 0) {
+        printf("eth: tx_fifo: cannot write %u! %d\n", n, status);
+        if (status != ERR_SHOULD_WAIT) {
+            return status;
+        }
+    }
+    if (count != n) {
+        printf("eth: tx_fifo: only wrote %u of %u!\n", count, n);
+    }
+    return NO_ERROR;
+}
+
+// In queue mode, entries are read from the fifos only while there is
+// room for them in the ethermac's queues.
+static int eth_queue_thread(ethdev_t* edev) {
+    ethdev0_t* edev0 = edev->edev0;
+    mx_status_t status;
+
+    for (;;) {
+        mx_wait_item_t items[3] = {
+            { .handle = edev->tx_fifo, .waitfor = MX_FIFO_PEER_CLOSED },
+            { .handle = edev->wake_evt, .waitfor = MX_EVENT_SIGNALED },
+            { .handle = edev->rx_fifo, .waitfor = 0 },
+        };
+
+        mtx_lock(&edev0->lock);
+        eth0_wait_mac_locked(edev0);
+        if (edev->state & ETHDEV_DEAD) {
+            mtx_unlock(&edev0->lock);
+            status = ERR_BAD_STATE;
+            break;
+        }
+        mx_object_signal(edev->wake_evt, MX_EVENT_SIGNALED, 0);
+        mx_time_t timeout = eth_rx_flush_timeout_locked(edev);
+        if (edev0->info.features & ETHMAC_FEATURE_TX_QUEUE) {
+            eth_tx_queue_locked(edev);
+            if (edev0->tx_ring.count < edev0->tx_ring.depth) {
+                items[0].waitfor |= MX_FIFO_READABLE;
+            }
+        }
+        if (edev0->info.features & ETHMAC_FEATURE_RX_QUEUE) {
+            eth_rx_queue_locked(edev);
+            if ((edev0->rx_owner == edev) && (edev0->rx_ring.count < edev0->rx_ring.depth)) {
+                items[2].waitfor = MX_FIFO_READABLE;
+            }
+        }
+        mtx_unlock(&edev0->lock);
+
+        if (!(edev0->info.features & ETHMAC_FEATURE_TX_QUEUE)) {
+            if ((status = eth_tx_copy(edev)) < 0 && status != ERR_SHOULD_WAIT) {
+                break;
+            }
+            items[0].waitfor |= MX_FIFO_READABLE;
+        }
+
+        if (((status = mx_object_wait_many(items, countof(items), timeout)) < 0) &&
+            (status != ERR_TIMED_OUT)) {
+            printf("eth: fifos: error waiting: %d\n", status);
+            break;
+        }
+        if (items[0].pending & MX_FIFO_PEER_CLOSED) {
+            status = ERR_REMOTE_CLOSED;
+            break;
+        }
+    }
+
+    printf("eth: queue_thread: exit: %d\n", status);
+    return 0;
 }
 
 static mx_status_t eth_tx_listen_locked(ethdev_t* edev, bool yes) {
@@ -210,48 +679,38 @@ static mx_status_t eth_tx_listen_locked(ethdev_t* edev, bool yes) {
 static int eth_tx_thread(void* arg) {
     ethdev_t* edev = (ethdev_t*)arg;
     ethdev0_t* edev0 = edev->edev0;
-    eth_fifo_entry_t entries[FIFO_DEPTH / 2];
     mx_status_t status;
-    uint32_t count;
+
+    if (edev0->info.features & (ETHMAC_FEATURE_TX_QUEUE | ETHMAC_FEATURE_RX_QUEUE)) {
+        return eth_queue_thread(edev);
+    }
 
     for (;;) {
-        if ((status = mx_fifo_read(edev->tx_fifo, entries, sizeof(entries), &count)) < 0) {
-            if (status == ERR_SHOULD_WAIT) {
-                if ((status = mx_object_wait_one(edev->tx_fifo,
-                                                 MX_FIFO_READABLE | MX_FIFO_PEER_CLOSED,
-                                                 MX_TIME_INFINITE, NULL)) < 0) {
-                    printf("eth: tx_fifo: error waiting: %d\n", status);
-                    break;
-                }
-                continue;
-            } else {
-                printf("eth: tx_fifo: cannot read: %d\n", status);
-                break;
-            }
+        if (((status = eth_tx_copy(edev)) < 0) && (status != ERR_SHOULD_WAIT)) {
+            break;
         }
 
-        uint32_t n = count;
-        for (eth_fifo_entry_t* e = entries; count-- > 0; e++) {
-            if ((e->offset > edev->io_size) || ((e->length > (edev->io_size - e->offset)))) {
-                e->flags = ETH_FIFO_INVALID;
-            } else {
-                edev0->macops->send(edev0->mac, 0, edev->io_buf + e->offset, e->length);
-                e->flags = ETH_FIFO_TX_OK;
-                if (edev->state & ETHDEV_TX_LOOPBACK) {
-                    eth_tx_echo(edev0, edev->io_buf + e->offset, e->length);
-                }
-            }
+        // the event is cleared before looking for received frames to
+        // flush, so that a batch started afterwards wakes the wait
+        bool wait = (status == ERR_SHOULD_WAIT);
+        mtx_lock(&edev0->lock);
+        if (wait) {
+            mx_object_signal(edev->wake_evt, MX_EVENT_SIGNALED, 0);
         }
+        mx_time_t timeout = eth_rx_flush_timeout_locked(edev);
+        mtx_unlock(&edev0->lock);
 
-        if ((status = mx_fifo_write(edev->tx_fifo, entries, sizeof(eth_fifo_entry_t) * n, &count)) < 0) {
-            printf("eth: tx_fifo: cannot write %u! %d\n", n, status);
-            if (status != ERR_SHOULD_WAIT) {
+        if (wait) {
+            mx_wait_item_t items[2] = {
+                { .handle = edev->tx_fifo, .waitfor = MX_FIFO_READABLE | MX_FIFO_PEER_CLOSED },
+                { .handle = edev->wake_evt, .waitfor = MX_EVENT_SIGNALED },
+            };
+            if (((status = mx_object_wait_many(items, countof(items), timeout)) < 0) &&
+                (status != ERR_TIMED_OUT)) {
+                printf("eth: tx_fifo: error waiting: %d\n", status);
                 break;
             }
         }
-        if (count != n) {
-            printf("eth: tx_fifo: only wrote %u of %u!\n", count, n);
-        }
     }
 
     printf("eth: tx_thread: exit: %d\n", status);
@@ -334,11 +793,20 @@ static mx_status_t eth_start_locked(ethdev_t* edev) {
         return ERR_BAD_STATE;
     }
 
+    eth0_wait_mac_locked(edev0);
+    if (edev->state & ETHDEV_DEAD) {
+        return ERR_BAD_STATE;
+    }
     if (edev->state & ETHDEV_RUNNING) {
         return NO_ERROR;
     }
 
     if (!(edev->state & ETHDEV_TX_THREAD)) {
+        mx_status_t status;
+        if ((edev->wake_evt == MX_HANDLE_INVALID) &&
+            ((status = mx_event_create(0, &edev->wake_evt)) < 0)) {
+            return status;
+        }
         int r = thrd_create_with_name(&edev->tx_thr, eth_tx_thread,
                                       edev, "eth-tx-thread");
         if (r != thrd_success) {
@@ -359,6 +827,7 @@ static mx_status_t eth_start_locked(ethdev_t* edev) {
         edev->state |= ETHDEV_RUNNING;
         list_delete(&edev->node);
         list_add_tail(&edev0->list_active, &edev->node);
+        eth0_pick_rx_owner_locked(edev0);
     } else {
         printf("eth: failed to start mac: %d\n", status);
     }
@@ -369,14 +838,31 @@ static mx_status_t eth_start_locked(ethdev_t* edev) {
 static mx_status_t eth_stop_locked(ethdev_t* edev) {
     ethdev0_t* edev0 = edev->edev0;
 
+    eth0_wait_mac_locked(edev0);
     if (edev->state & ETHDEV_RUNNING) {
+        eth_rx_flush_locked(edev);
         edev->state &= (~ETHDEV_RUNNING);
         list_delete(&edev->node);
         list_add_tail(&edev0->list_idle, &edev->node);
         if (list_is_empty(&edev0->list_active)) {
             if (!(edev->state & ETHDEV_DEAD)) {
-                edev0->macops->stop(edev0->mac);
+                eth0_stop_mac_locked(edev0);
+            } else {
+                eth0_flush_locked(edev0);
             }
+        } else if (eth0_holds_locked(edev0, edev)) {
+            // The ethermac still has some of this client's buffers, and
+            // the only way to take them back is to restart it.
+            eth0_stop_mac_locked(edev0);
+            mx_status_t status = edev0->macops->start(edev0->mac, &ethmac_ifc, edev0);
+            if (status < 0) {
+                printf("eth: failed to restart mac: %d\n", status);
+            }
+            eth0_wake_locked(edev0);
+        }
+        if (edev0->rx_owner == edev) {
+            edev0->rx_owner = NULL;
+            eth0_pick_rx_owner_locked(edev0);
         }
     }
 
@@ -406,6 +892,12 @@ static ssize_t eth_ioctl(mx_device_t* dev, uint32_t op,
             if (edev->edev0->info.features & ETHMAC_FEATURE_WLAN) {
                 info->features |= ETH_FEATURE_WLAN;
             }
+            if (edev->edev0->info.features & ETHMAC_FEATURE_TX_CSUM) {
+                info->features |= ETH_FEATURE_TX_CSUM;
+            }
+            if (edev->edev0->info.features & ETHMAC_FEATURE_RX_CSUM) {
+                info->features |= ETH_FEATURE_RX_CSUM;
+            }
             info->mtu = edev->edev0->info.mtu;
             status = sizeof(*info);
         }
@@ -455,6 +947,10 @@ static void eth_kill_locked(ethdev_t* edev) {
     // make sure any future ioctls or other ops will fail
     edev->state |= ETHDEV_DEAD;
 
+    // anything taken from the fifos goes with them
+    edev->rx_avail_count = 0;
+    edev->rx_done_count = 0;
+
     // try to convince clients to close us
     if (edev->rx_fifo) {
         mx_handle_close(edev->rx_fifo);
@@ -469,23 +965,30 @@ static void eth_kill_locked(ethdev_t* edev) {
         edev->io_vmo = MX_HANDLE_INVALID;
     }
 
-    // closing handles will 'encourage' the tx thread to exit
+    // closing handles will 'encourage' the tx thread to exit; it is
+    // joined in release, since it may be waiting for the lock we hold
+    if (edev->wake_evt) {
+        mx_object_signal(edev->wake_evt, 0, MX_EVENT_SIGNALED);
+    }
+}
+
+static mx_status_t eth_release(mx_device_t* dev) {
+    ethdev_t* edev = get_ethdev(dev);
+
     if (edev->state & ETHDEV_TX_THREAD) {
         edev->state &= (~ETHDEV_TX_THREAD);
         int ret;
         thrd_join(edev->tx_thr, &ret);
-        xprintf("eth: kill: tx thread exited\n");
+        xprintf("eth: release: tx thread exited\n");
+    }
+    if (edev->wake_evt) {
+        mx_handle_close(edev->wake_evt);
     }
-
     if (edev->io_buf) {
         mx_vmar_unmap(mx_vmar_root_self(), (uintptr_t) edev->io_buf, 0);
-        edev->io_buf = NULL;
     }
     xprintf("eth: all resources released\n");
-}
 
-static mx_status_t eth_release(mx_device_t* dev) {
-    ethdev_t* edev = get_ethdev(dev);
     eth0_downref(edev->edev0);
     free(edev);
     return ERR_NOT_SUPPORTED;
@@ -545,6 +1048,11 @@ static void eth0_unbind(mx_device_t* dev) {
     ethdev0_t* edev0 = get_ethdev0(dev);
 
     mtx_lock(&edev0->lock);
+    eth0_wait_mac_locked(edev0);
+
+    // the ethermac is going away, and with it any buffers still queued
+    eth0_flush_locked(edev0);
+    edev0->rx_owner = NULL;
 
     // tear down shared memory, fifos, and threads
     // to encourage any open instances to close
@@ -573,8 +1081,56 @@ static mx_protocol_device_t ethdev0_ops = {
     .release = eth0_release,
 };
 
+// Sets up a ring and its DMA buffers, one of 'slot_size' bytes per slot.
+// Slots are a power of two no larger than a page, so none of them crosses
+// a page boundary.
+static mx_status_t eth_ring_init(eth_ring_t* ring, uint32_t depth, size_t slot_size) {
+    if (depth == 0) {
+        return ERR_NOT_SUPPORTED;
+    }
+    if ((ring->entries = calloc(depth, sizeof(eth_pending_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    ring->depth = depth;
+    ring->slot_size = slot_size;
+
+    size_t size = roundup(depth * slot_size, PAGE_SIZE);
+    size_t pages = size / PAGE_SIZE;
+    mx_paddr_t* phys;
+    if ((phys = calloc(pages, sizeof(mx_paddr_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+
+    mx_status_t status;
+    if ((status = mx_vmo_create(size, 0, &ring->vmo)) < 0) {
+        ring->vmo = MX_HANDLE_INVALID;
+        goto done;
+    }
+    if ((status = mx_vmo_op_range(ring->vmo, MX_VMO_OP_COMMIT, 0, size, NULL, 0)) < 0) {
+        goto done;
+    }
+    if ((status = mx_vmo_op_range(ring->vmo, MX_VMO_OP_LOOKUP, 0, size, phys,
+                                  pages * sizeof(mx_paddr_t))) < 0) {
+        goto done;
+    }
+    if ((status = mx_vmar_map(mx_vmar_root_self(), 0, ring->vmo, 0, size,
+                              MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
+                              (uintptr_t*)&ring->buf)) < 0) {
+        ring->buf = NULL;
+        goto done;
+    }
+    ring->buf_size = size;
+
+    for (uint32_t i = 0; i < depth; i++) {
+        size_t offset = i * slot_size;
+        ring->entries[i].buf = ring->buf + offset;
+        ring->entries[i].phys = phys[offset / PAGE_SIZE] + (offset % PAGE_SIZE);
+    }
 
-#define BAD_FEATURES (ETHMAC_FEATURE_RX_QUEUE | ETHMAC_FEATURE_TX_QUEUE)
+done:
+    free(phys);
+    return status;
+}
 
 static mx_status_t eth_bind(mx_driver_t* drv, mx_device_t* dev, void** cookie) {
     ethdev0_t* edev0;
@@ -594,15 +1150,28 @@ static mx_status_t eth_bind(mx_driver_t* drv, mx_device_t* dev, void** cookie) {
         goto fail;
     }
 
-    if (edev0->info.features & BAD_FEATURES) {
-        printf("eth: bind: ethermac requires unsupported features: %08x\n",
-               edev0->info.features & BAD_FEATURES);
+    // a DMA buffer holds any frame
+    size_t slot_size = (edev0->info.mtu <= PAGE_SIZE / 2) ? PAGE_SIZE / 2 : PAGE_SIZE;
+    if ((edev0->info.features & (ETHMAC_FEATURE_TX_QUEUE | ETHMAC_FEATURE_RX_QUEUE)) &&
+        (edev0->info.mtu > PAGE_SIZE)) {
+        printf("eth: bind: mtu %u too large to queue\n", edev0->info.mtu);
         status = ERR_NOT_SUPPORTED;
         goto fail;
     }
+    if ((edev0->info.features & ETHMAC_FEATURE_TX_QUEUE) &&
+        ((status = eth_ring_init(&edev0->tx_ring, edev0->info.tx_depth, slot_size)) < 0)) {
+        printf("eth: bind: cannot set up tx queue: %d\n", status);
+        goto fail;
+    }
+    if ((edev0->info.features & ETHMAC_FEATURE_RX_QUEUE) &&
+        ((status = eth_ring_init(&edev0->rx_ring, edev0->info.rx_depth, slot_size)) < 0)) {
+        printf("eth: bind: cannot set up rx queue: %d\n", status);
+        goto fail;
+    }
 
     device_init(&edev0->dev, drv, "ethernet", &ethdev0_ops);
     mtx_init(&edev0->lock, mtx_plain);
+    cnd_init(&edev0->mac_stopped);
     list_initialize(&edev0->list_active);
     list_initialize(&edev0->list_idle);
 
@@ -619,6 +1188,8 @@ static mx_status_t eth_bind(mx_driver_t* drv, mx_device_t* dev, void** cookie) {
     return NO_ERROR;
 
 fail:
+    eth_ring_release(&edev0->tx_ring);
+    eth_ring_release(&edev0->rx_ring);
     free(edev0);
     return status;
 }
@@ -32,9 +32,13 @@ typedef struct ethernet_device {
     thrd_t thread;
     io_buffer_t buffer;
 
-    // callback interface to attached ethernet layer
+    // callback interface to attached ethernet layer, guarded by lock
     ethmac_ifc_t* ifc;
     void* cookie;
+    // the irq thread is calling into the ethernet layer; eth_stop() waits
+    // for it to finish
+    bool in_callback;
+    cnd_t callback_done;
 } ethernet_device_t;
 
 #define get_eth_device(d) containerof(d, ethernet_device_t, dev)
@@ -52,19 +56,37 @@ static int irq_thread(void* arg) {
         if (edev->edge_triggered_irq)
             mx_interrupt_complete(edev->irqh);
 
+        // The ethernet layer's callbacks take its own lock, which it holds
+        // when it calls eth_start(), so they are made with no lock held.
+        // The rings have locks of their own.
         mtx_lock(&edev->lock);
-        if (eth_handle_irq(&edev->eth) & ETH_IRQ_RX) {
-            void* data;
-            size_t len;
+        ethmac_ifc_t* ifc = edev->ifc;
+        void* cookie = edev->cookie;
+        edev->in_callback = (ifc != NULL);
+        mtx_unlock(&edev->lock);
 
-            while (eth_rx(&edev->eth, &data, &len) == NO_ERROR) {
-                if (edev->ifc) {
-                    edev->ifc->recv(edev->cookie, data, len, 0);
+        unsigned irq = eth_handle_irq(&edev->eth);
+        if (irq & ETH_IRQ_RX) {
+            size_t len;
+            while (eth_complete_rx(&edev->eth, &len) == NO_ERROR) {
+                if (ifc) {
+                    ifc->complete_rx(cookie, len, 0);
                 }
-                eth_rx_ack(&edev->eth);
             }
         }
-        mtx_unlock(&edev->lock);
+        if (irq & ETH_IRQ_TX) {
+            unsigned count = eth_complete_tx(&edev->eth);
+            if (count && ifc) {
+                ifc->complete_tx(cookie, count);
+            }
+        }
+
+        if (ifc) {
+            mtx_lock(&edev->lock);
+            edev->in_callback = false;
+            cnd_broadcast(&edev->callback_done);
+            mtx_unlock(&edev->lock);
+        }
 
         if (!edev->edge_triggered_irq)
             mx_interrupt_complete(edev->irqh);
@@ -80,7 +102,10 @@ static mx_status_t eth_query(mx_device_t* dev, uint32_t options, ethmac_info_t*
     }
 
     memset(info, 0, sizeof(*info));
+    info->features = ETHMAC_FEATURE_RX_QUEUE | ETHMAC_FEATURE_TX_QUEUE;
     info->mtu = ETH_RXBUF_SIZE; //TODO: not actually the mtu!
+    info->tx_depth = ETH_TX_DEPTH;
+    info->rx_depth = ETH_RX_DEPTH;
     memcpy(info->mac, edev->eth.mac, sizeof(edev->eth.mac));
 
     return NO_ERROR;
@@ -89,7 +114,16 @@ static mx_status_t eth_query(mx_device_t* dev, uint32_t options, ethmac_info_t*
 static void eth_stop(mx_device_t* dev) {
     ethernet_device_t* edev = get_eth_device(dev);
     mtx_lock(&edev->lock);
-    edev->ifc = NULL;
+    if (edev->ifc) {
+        eth_disable_queues(&edev->eth);
+        edev->ifc = NULL;
+    }
+    // A callback already under way may still report frames completed
+    // before the queues were disabled.  It has to be done before the
+    // ethernet layer takes back what it queued, or restarts.
+    while (edev->in_callback) {
+        cnd_wait(&edev->callback_done, &edev->lock);
+    }
     mtx_unlock(&edev->lock);
 }
 
@@ -103,22 +137,37 @@ static mx_status_t eth_start(mx_device_t* dev, ethmac_ifc_t* ifc, void* cookie)
     } else {
         edev->ifc = ifc;
         edev->cookie = cookie;
+        eth_enable_queues(&edev->eth);
     }
     mtx_unlock(&edev->lock);
 
     return status;
 }
 
-static void eth_send(mx_device_t* dev, uint32_t options, void* data, size_t length) {
+static void eth_queue_tx_frame(mx_device_t* dev, uint32_t options,
+                               uintptr_t pa0, uintptr_t pa1, size_t length) {
+    ethernet_device_t* edev = get_eth_device(dev);
+    mx_status_t status = eth_queue_tx(&edev->eth, pa0, pa1, length);
+    if (status != NO_ERROR) {
+        printf("eth: cannot queue tx frame: %d\n", status);
+    }
+}
+
+static void eth_queue_rx_buffer(mx_device_t* dev, uint32_t options,
+                                uintptr_t pa0, uintptr_t pa1, size_t length) {
     ethernet_device_t* edev = get_eth_device(dev);
-    eth_tx(&edev->eth, data, length);
+    mx_status_t status = eth_queue_rx(&edev->eth, pa0);
+    if (status != NO_ERROR) {
+        printf("eth: cannot queue rx buffer: %d\n", status);
+    }
 }
 
 static ethmac_protocol_t ethmac_ops = {
     .query = eth_query,
     .stop = eth_stop,
     .start = eth_start,
-    .send = eth_send,
+    .queue_tx = eth_queue_tx_frame,
+    .queue_rx = eth_queue_rx_buffer,
 };
 
 static mx_status_t eth_release(mx_device_t* dev) {
@@ -141,7 +190,9 @@ static mx_status_t eth_bind(mx_driver_t* drv, mx_device_t* dev, void** cookie) {
         return ERR_NO_MEMORY;
     }
     mtx_init(&edev->lock, mtx_plain);
+    cnd_init(&edev->callback_done);
     mtx_init(&edev->eth.send_lock, mtx_plain);
+    mtx_init(&edev->eth.recv_lock, mtx_plain);
 
     pci_protocol_t* pci;
     if (device_get_protocol(dev, MX_PROTOCOL_PCI, (void**)&pci)) {
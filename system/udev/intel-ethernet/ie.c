@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <inttypes.h>
+#include <limits.h>
 #include <stdint.h>
 #include <magenta/listnode.h>
 
@@ -45,81 +46,115 @@ unsigned eth_handle_irq(ethdev_t* eth) {
     return readl(IE_ICR);
 }
 
-status_t eth_rx(ethdev_t* eth, void** data, size_t* len) {
-    uint32_t n = eth->rx_rd_ptr;
-    uint64_t info = eth->rxd[n].info;
+status_t eth_queue_rx(ethdev_t* eth, uint64_t phys) {
+    mx_status_t status = NO_ERROR;
+    mtx_lock(&eth->recv_lock);
 
-    if (!(info & IE_RXD_DONE)) {
-        return ERR_SHOULD_WAIT;
+    uint32_t n = eth->rx_wr_ptr;
+    uint32_t next = (n + 1) & (ETH_RXD_COUNT - 1);
+    if (next == eth->rx_rd_ptr) {
+        status = ERR_NO_RESOURCES;
+        goto out;
     }
 
-    // copy out packet
-    mx_status_t r = IE_RXD_LEN(info);
-
-    *data = eth->rxb + ETH_RXBUF_SIZE * n;
-    *len = r;
+    // make buffer available to hw
+    eth->rxd[n].addr = phys;
+    eth->rxd[n].info = 0;
+    eth->rx_wr_ptr = next;
+    writel(next, IE_RDT);
 
-    return NO_ERROR;
+out:
+    mtx_unlock(&eth->recv_lock);
+    return status;
 }
 
-void eth_rx_ack(ethdev_t* eth) {
+status_t eth_complete_rx(ethdev_t* eth, size_t* len) {
+    mx_status_t status = NO_ERROR;
+    mtx_lock(&eth->recv_lock);
+
     uint32_t n = eth->rx_rd_ptr;
+    uint64_t info = eth->rxd[n].info;
+    if ((n == eth->rx_wr_ptr) || !(info & IE_RXD_DONE)) {
+        status = ERR_SHOULD_WAIT;
+        goto out;
+    }
 
-    // make buffer available to hw
+    if (info & (IE_RXD_RXE | IE_RXD_CXE | IE_RXD_SEQ | IE_RXD_SE | IE_RXD_CE)) {
+        *len = 0;
+    } else {
+        *len = IE_RXD_LEN(info);
+    }
     eth->rxd[n].info = 0;
-    writel(n, IE_RDT);
-    n = (n + 1) & (ETH_RXBUF_COUNT - 1);
-    eth->rx_rd_ptr = n;
+    eth->rx_rd_ptr = (n + 1) & (ETH_RXD_COUNT - 1);
+
+out:
+    mtx_unlock(&eth->recv_lock);
+    return status;
 }
 
-status_t eth_tx(ethdev_t* eth, const void* data, size_t len) {
-    if ((len < 60) || (len > ETH_TXBUF_DSIZE)) {
+status_t eth_queue_tx(ethdev_t* eth, uint64_t phys0, uint64_t phys1, size_t len) {
+    if ((len == 0) || (len > ETH_RXBUF_SIZE)) {
         return ERR_INVALID_ARGS;
     }
 
+    // the first descriptor runs up to the page boundary
+    size_t len0 = len;
+    uint32_t need = 1;
+    if (phys1) {
+        len0 = PAGE_SIZE - (phys0 & (PAGE_SIZE - 1));
+        need = 2;
+    }
+
     mx_status_t status = NO_ERROR;
+    mtx_lock(&eth->send_lock);
+
+    uint32_t n = eth->tx_wr_ptr;
+    if (((eth->tx_rd_ptr - n - 1) & (ETH_TXD_COUNT - 1)) < need) {
+        status = ERR_NO_RESOURCES;
+        goto out;
+    }
+
+    // every descriptor reports status, so eth_complete_tx() can reclaim
+    // them one at a time and count frames at their EOP descriptor
+    eth->txd[n].addr = phys0;
+    eth->txd[n].info = IE_TXD_LEN(len0) | IE_TXD_IFCS | IE_TXD_RS | (phys1 ? 0 : IE_TXD_EOP);
+    n = (n + 1) & (ETH_TXD_COUNT - 1);
+    if (phys1) {
+        eth->txd[n].addr = phys1;
+        eth->txd[n].info = IE_TXD_LEN(len - len0) | IE_TXD_EOP | IE_TXD_IFCS | IE_TXD_RS;
+        n = (n + 1) & (ETH_TXD_COUNT - 1);
+    }
 
+    // inform hw of buffer availability
+    eth->tx_wr_ptr = n;
+    writel(n, IE_TDT);
+
+out:
+    mtx_unlock(&eth->send_lock);
+    return status;
+}
+
+unsigned eth_complete_tx(ethdev_t* eth) {
+    unsigned count = 0;
     mtx_lock(&eth->send_lock);
 
-    // reclaim completed buffers from hw
+    // reclaim completed descriptors from hw
     uint32_t n = eth->tx_rd_ptr;
-    for (;;) {
+    while (n != eth->tx_wr_ptr) {
         uint64_t info = eth->txd[n].info;
         if (!(info & IE_TXD_DONE)) {
             break;
         }
-        framebuf_t* frame = list_remove_head_type(&eth->busy_frames, framebuf_t, node);
-        if (frame == NULL) {
-            panic();
+        if (info & IE_TXD_EOP) {
+            count++;
         }
-        // TODO: verify that this is the matching buffer to txd[n] addr?
-        list_add_tail(&eth->free_frames, &frame->node);
         eth->txd[n].info = 0;
-        n = (n + 1) & (ETH_TXBUF_COUNT - 1);
+        n = (n + 1) & (ETH_TXD_COUNT - 1);
     }
     eth->tx_rd_ptr = n;
 
-    // obtain buffer, copy into it, setup descriptor
-    framebuf_t *frame = list_remove_head_type(&eth->free_frames, framebuf_t, node);
-    if (frame == NULL) {
-        status = ERR_NO_MEMORY;
-        goto out;
-    }
-
-    n = eth->tx_wr_ptr;
-    memcpy(frame->data, data, len);
-    eth->txd[n].addr = frame->phys;
-    eth->txd[n].info = IE_TXD_LEN(len) | IE_TXD_EOP | IE_TXD_IFCS | IE_TXD_RS;
-    list_add_tail(&eth->busy_frames, &frame->node);
-
-    // inform hw of buffer availability
-    n = (n + 1) & (ETH_TXBUF_COUNT - 1);
-    eth->tx_wr_ptr = n;
-    writel(n, IE_TDT);
-
-out:
     mtx_unlock(&eth->send_lock);
-    return status;
+    return count;
 }
 
 status_t eth_reset_hw(ethdev_t* eth) {
@@ -146,42 +181,78 @@ status_t eth_reset_hw(ethdev_t* eth) {
     return NO_ERROR;
 }
 
+#define ETH_RCTL (IE_RCTL_BSIZE2048 | IE_RCTL_DPF | IE_RCTL_SECRC | IE_RCTL_BAM | IE_RCTL_MPE)
+#define ETH_TCTL (IE_TCTL_CT(15) | IE_TCTL_COLD_FD | IE_TCTL_PSP)
+
 void eth_init_hw(ethdev_t* eth) {
     //TODO: tune RXDCTL and TXDCTL settings
     //TODO: TCTL COLD should be based on link state
     //TODO: use address filtering for multicast
 
-    // setup rx ring
-    eth->rx_rd_ptr = 0;
+    // setup rx ring; rx stays disabled until eth_enable_queues()
     writel(0, IE_RXCSUM);
     writel((4 << 0) | (1 << 8) | (1 << 16) | (1 << 24), IE_RXDCTL);
     writel(eth->rxd_phys, IE_RDBAL);
     writel(eth->rxd_phys >> 32, IE_RDBAH);
-    writel(ETH_RXBUF_COUNT * 16, IE_RDLEN);
-    writel(ETH_RXBUF_COUNT - 1, IE_RDT);
-    writel(IE_RCTL_BSIZE2048 | IE_RCTL_DPF | IE_RCTL_SECRC | IE_RCTL_BAM | IE_RCTL_MPE | IE_RCTL_EN, IE_RCTL);
+    writel(ETH_RXD_COUNT * sizeof(ie_rxd_t), IE_RDLEN);
+    writel(ETH_RCTL, IE_RCTL);
 
-    // setup tx ring
-    eth->tx_wr_ptr = 0;
-    eth->tx_rd_ptr = 0;
+    // setup tx ring; tx pads short frames, since they come straight
+    // from the caller's buffers
     writel((4 << 0) | (1 << 8) | (1 << 16) | (1 << 24), IE_TXDCTL);
     writel(eth->txd_phys, IE_TDBAL);
     writel(eth->txd_phys >> 32, IE_TDBAH);
-    writel(ETH_TXBUF_COUNT * 16, IE_TDLEN);
-    writel(IE_TCTL_CT(15) | IE_TCTL_COLD_FD | IE_TCTL_EN, IE_TCTL);
+    writel(ETH_TXD_COUNT * sizeof(ie_txd_t), IE_TDLEN);
+    writel(ETH_TCTL, IE_TCTL);
 
     // disable all irqs (write to "clear" mask)
     writel(0xFFFF, IE_IMC);
-    // enable rx irq (write to "set" mask)
-    writel(IE_INT_RXT0, IE_IMS);
+    // enable rx and tx irqs (write to "set" mask)
+    writel(IE_INT_RXT0 | IE_INT_TXDW, IE_IMS);
+}
+
+void eth_enable_queues(ethdev_t* eth) {
+    mtx_lock(&eth->recv_lock);
+    mtx_lock(&eth->send_lock);
+
+    memset(eth->rxd, 0, ETH_DRING_SIZE);
+    memset(eth->txd, 0, ETH_DRING_SIZE);
+    eth->rx_wr_ptr = 0;
+    eth->rx_rd_ptr = 0;
+    eth->tx_wr_ptr = 0;
+    eth->tx_rd_ptr = 0;
+    writel(0, IE_RDH);
+    writel(0, IE_RDT);
+    writel(0, IE_TDH);
+    writel(0, IE_TDT);
+
+    writel(ETH_RCTL | IE_RCTL_EN, IE_RCTL);
+    writel(ETH_TCTL | IE_TCTL_EN, IE_TCTL);
+
+    mtx_unlock(&eth->send_lock);
+    mtx_unlock(&eth->recv_lock);
+}
+
+void eth_disable_queues(ethdev_t* eth) {
+    mtx_lock(&eth->recv_lock);
+    mtx_lock(&eth->send_lock);
+
+    writel(ETH_RCTL, IE_RCTL);
+    writel(ETH_TCTL, IE_TCTL);
+    // let any descriptor fetch or writeback in progress finish
+    __nanosleep(MX_MSEC(1));
+
+    // nothing queued is completed from here on
+    eth->rx_rd_ptr = eth->rx_wr_ptr;
+    eth->tx_rd_ptr = eth->tx_wr_ptr;
+
+    mtx_unlock(&eth->send_lock);
+    mtx_unlock(&eth->recv_lock);
 }
 
 void eth_setup_buffers(ethdev_t* eth, void* iomem, mx_paddr_t iophys) {
     printf("eth: iomem @%p (phys %" PRIxPTR ")\n", iomem, iophys);
 
-    list_initialize(&eth->free_frames);
-    list_initialize(&eth->busy_frames);
-
     eth->rxd = iomem;
     eth->rxd_phys = iophys;
     iomem += ETH_DRING_SIZE;
@@ -190,26 +261,5 @@ void eth_setup_buffers(ethdev_t* eth, void* iomem, mx_paddr_t iophys) {
 
     eth->txd = iomem;
     eth->txd_phys = iophys;
-    iomem += ETH_DRING_SIZE;
-    iophys += ETH_DRING_SIZE;
     memset(eth->txd, 0, ETH_DRING_SIZE);
-
-    eth->rxb = iomem;
-    eth->rxb_phys = iophys;
-    iomem += ETH_RXBUF_SIZE * ETH_RXBUF_COUNT;
-    iophys += ETH_RXBUF_SIZE * ETH_RXBUF_COUNT;
-
-    for (int n = 0; n < ETH_RXBUF_COUNT; n++) {
-        eth->rxd[n].addr = eth->rxb_phys + ETH_RXBUF_SIZE * n;
-    }
-    for (int n = 0; n < ETH_TXBUF_COUNT - 1; n++) {
-        framebuf_t *txb = iomem;
-        txb->phys = iophys + ETH_TXBUF_HSIZE;
-        txb->size = ETH_TXBUF_SIZE - ETH_TXBUF_HSIZE;
-        txb->data = iomem + ETH_TXBUF_HSIZE;
-        list_add_tail(&eth->free_frames, &txb->node);
-
-        iomem += ETH_TXBUF_SIZE;
-        iophys += ETH_TXBUF_SIZE;
-    }
 }
@@ -8,16 +8,10 @@
 
 #include "ie-hw.h"
 
-typedef struct framebuf framebuf_t;
 typedef struct ethdev ethdev_t;
 
-struct framebuf {
-    list_node_t node;
-    uintptr_t phys;
-    void* data;
-    size_t size;
-};
-
+// Frames are sent from and received into buffers supplied by the caller
+// (the ethernet driver's clients); the driver owns only the descriptor rings.
 struct ethdev {
     uintptr_t iobase;
 
@@ -27,37 +21,33 @@ struct ethdev {
 
     uint32_t tx_wr_ptr;
     uint32_t tx_rd_ptr;
+    uint32_t rx_wr_ptr;
     uint32_t rx_rd_ptr;
 
-    list_node_t free_frames;
-    list_node_t busy_frames;
-
-    // base physical addresses for
-    // tx/rx rings and rx buffers
+    // base physical addresses for tx/rx rings
     // store as 64bit integer to match hw register size
     uint64_t txd_phys;
     uint64_t rxd_phys;
-    uint64_t rxb_phys;
-    void* rxb;
 
     uint8_t mac[6];
 
+    // protect the tx and rx rings respectively
     mtx_t send_lock;
+    mtx_t recv_lock;
 };
 
 #define ETH_RXBUF_SIZE  2048
-#define ETH_RXBUF_COUNT 32
-
-#define ETH_TXBUF_SIZE  2048
-#define ETH_TXBUF_COUNT 32
-#define ETH_TXBUF_HSIZE 128
-#define ETH_TXBUF_DSIZE (ETH_TXBUF_SIZE - ETH_TXBUF_HSIZE)
 
 #define ETH_DRING_SIZE 2048
+#define ETH_RXD_COUNT  (ETH_DRING_SIZE / sizeof(ie_rxd_t))
+#define ETH_TXD_COUNT  (ETH_DRING_SIZE / sizeof(ie_txd_t))
+
+// One descriptor always stays unused, so that a full ring can be told
+// from an empty one.  A frame that crosses a page boundary takes two.
+#define ETH_RX_DEPTH (ETH_RXD_COUNT - 1)
+#define ETH_TX_DEPTH ((ETH_TXD_COUNT - 1) / 2)
 
-#define ETH_ALLOC ((ETH_RXBUF_SIZE * ETH_RXBUF_COUNT) + \
-                   (ETH_TXBUF_SIZE * ETH_TXBUF_COUNT) + \
-                   (ETH_DRING_SIZE * 2))
+#define ETH_ALLOC (ETH_DRING_SIZE * 2)
 
 status_t eth_reset_hw(ethdev_t* eth);
 void eth_setup_buffers(ethdev_t* eth, void* iomem, uintptr_t iophys);
@@ -65,10 +55,22 @@ void eth_init_hw(ethdev_t* eth);
 
 void eth_dump_regs(ethdev_t* eth);
 
-status_t eth_rx(ethdev_t* eth, void** data, size_t* len);
-void eth_rx_ack(ethdev_t* eth);
+// Empty both rings and start or stop the rx and tx units.  Buffers still
+// queued when the queues are disabled are abandoned.
+void eth_enable_queues(ethdev_t* eth);
+void eth_disable_queues(ethdev_t* eth);
+
+// queue a receive buffer of ETH_RXBUF_SIZE bytes
+status_t eth_queue_rx(ethdev_t* eth, uint64_t phys);
+// dequeue the oldest buffer, if filled; len is 0 for a bad frame
+status_t eth_complete_rx(ethdev_t* eth, size_t* len);
 
-status_t eth_tx(ethdev_t* eth, const void* data, size_t len);
+// queue a frame; phys1 is the second page of one that crosses a page
+// boundary, or 0
+status_t eth_queue_tx(ethdev_t* eth, uint64_t phys0, uint64_t phys1, size_t len);
+// returns the number of frames sent since the last call
+unsigned eth_complete_tx(ethdev_t* eth);
 
 #define ETH_IRQ_RX IE_INT_RXT0
+#define ETH_IRQ_TX IE_INT_TXDW
 unsigned eth_handle_irq(ethdev_t* eth);
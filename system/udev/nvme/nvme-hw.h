@@ -0,0 +1,139 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <assert.h>
+#include <magenta/compiler.h>
+#include <stdint.h>
+
+// NVM Express 1.2 register and data structure definitions
+
+// clang-format off
+
+// controller registers (BAR0)
+#define NVME_REG_CAP            0x00 // 64 bit
+#define NVME_REG_VS             0x08
+#define NVME_REG_INTMS          0x0c
+#define NVME_REG_INTMC          0x10
+#define NVME_REG_CC             0x14
+#define NVME_REG_CSTS           0x1c
+#define NVME_REG_AQA            0x24
+#define NVME_REG_ASQ            0x28 // 64 bit
+#define NVME_REG_ACQ            0x30 // 64 bit
+#define NVME_REG_DOORBELL_BASE  0x1000
+
+#define NVME_CAP_MQES(cap)      ((uint32_t)((cap) & 0xffff)) // 0-based
+#define NVME_CAP_TO(cap)        ((uint32_t)(((cap) >> 24) & 0xff)) // 500ms units
+#define NVME_CAP_DSTRD(cap)     ((uint32_t)(((cap) >> 32) & 0xf))
+#define NVME_CAP_MPSMIN(cap)    ((uint32_t)(((cap) >> 48) & 0xf))
+
+#define NVME_CC_EN              (1 << 0)
+#define NVME_CC_CSS_NVM         (0 << 4)
+#define NVME_CC_MPS(shift)      (((shift) - 12) << 7)
+#define NVME_CC_AMS_RR          (0 << 11)
+#define NVME_CC_SHN_NORMAL      (1 << 14)
+#define NVME_CC_IOSQES(shift)   ((shift) << 16)
+#define NVME_CC_IOCQES(shift)   ((shift) << 20)
+
+#define NVME_CSTS_RDY           (1 << 0)
+#define NVME_CSTS_CFS           (1 << 1)
+
+// admin command opcodes
+#define NVME_ADMIN_DELETE_SQ    0x00
+#define NVME_ADMIN_CREATE_SQ    0x01
+#define NVME_ADMIN_DELETE_CQ    0x04
+#define NVME_ADMIN_CREATE_CQ    0x05
+#define NVME_ADMIN_IDENTIFY     0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+// nvm command set opcodes
+#define NVME_CMD_FLUSH          0x00
+#define NVME_CMD_WRITE          0x01
+#define NVME_CMD_READ           0x02
+
+// command dword 0
+#define NVME_CMD_CID(cid)       ((uint32_t)(cid) << 16)
+#define NVME_CMD_PSDT_SGL       (1 << 14) // data pointer is an sgl segment
+
+// create queue flags (cdw11)
+#define NVME_QUEUE_PC           (1 << 0) // physically contiguous
+#define NVME_QUEUE_IEN          (1 << 1) // interrupts enabled (cq)
+
+#define NVME_IDENTIFY_NS        0
+#define NVME_IDENTIFY_CTRL      1
+
+#define NVME_FEATURE_NUM_QUEUES 0x07
+
+// sgl descriptor types, in the high nibble of the type byte
+#define NVME_SGL_DATA_BLOCK     (0x0 << 4)
+
+// completion status: phase tag in bit 0, status field above it
+#define NVME_CPL_PHASE          (1 << 0)
+#define NVME_CPL_STATUS(s)      (((s) >> 1) & 0x7fff)
+
+// identify controller, byte offsets
+#define NVME_ID_CTRL_SN         4   // 20 bytes
+#define NVME_ID_CTRL_MN         24  // 40 bytes
+#define NVME_ID_CTRL_FR         64  // 8 bytes
+#define NVME_ID_CTRL_MDTS       77  // 8 bit, log2 of min page size units
+#define NVME_ID_CTRL_NN         516 // 32 bit
+#define NVME_ID_CTRL_SGLS       536 // 32 bit
+
+#define NVME_ID_CTRL_SN_LEN     20
+#define NVME_ID_CTRL_MN_LEN     40
+#define NVME_ID_CTRL_FR_LEN     8
+
+#define NVME_SGLS_SUPPORTED(s)  (((s) & 0x3) != 0)
+
+// identify namespace, byte offsets
+#define NVME_ID_NS_NSZE         0   // 64 bit
+#define NVME_ID_NS_FLBAS        26  // 8 bit
+#define NVME_ID_NS_LBAF         128 // 16 x 32 bit
+
+#define NVME_LBAF_MS(f)         ((f) & 0xffff)
+#define NVME_LBAF_LBADS(f)      (((f) >> 16) & 0xff)
+
+// clang-format on
+
+typedef struct {
+    uint32_t cdw0; // opcode, fused, psdt, command id
+    uint32_t nsid;
+    uint64_t reserved;
+    uint64_t mptr;
+    union {
+        struct {
+            uint64_t prp1;
+            uint64_t prp2;
+        } prp;
+        struct {
+            uint64_t addr;
+            uint32_t length;
+            uint8_t reserved[3];
+            uint8_t type;
+        } sgl;
+    } dptr;
+    uint32_t cdw10;
+    uint32_t cdw11;
+    uint32_t cdw12;
+    uint32_t cdw13;
+    uint32_t cdw14;
+    uint32_t cdw15;
+} __PACKED nvme_cmd_t;
+
+static_assert(sizeof(nvme_cmd_t) == 64, "");
+
+typedef struct {
+    uint32_t result;
+    uint32_t reserved;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t cid;
+    uint16_t status;
+} __PACKED nvme_cpl_t;
+
+static_assert(sizeof(nvme_cpl_t) == 16, "");
+
+#define NVME_SQES_SHIFT 6 // 64 byte submission entries
+#define NVME_CQES_SHIFT 4 // 16 byte completion entries
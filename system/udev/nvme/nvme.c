@@ -0,0 +1,1023 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <ddk/binding.h>
+#include <ddk/device.h>
+#include <ddk/driver.h>
+#include <ddk/io-buffer.h>
+#include <ddk/protocol/block.h>
+#include <ddk/protocol/pci.h>
+#include <hw/arch_ops.h>
+#include <hw/pci.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <magenta/device/device.h>
+#include <magenta/listnode.h>
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+#include <sync/completion.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include "nvme-hw.h"
+
+// clang-format off
+#define TRACE 1
+
+#if TRACE
+#define xprintf(fmt...) printf(fmt)
+#else
+#define xprintf(fmt...) \
+    do {                \
+    } while (0)
+#endif
+
+#define NVME_MAX_QUEUES     16 // io queue pairs, one per cpu up to this many
+#define NVME_MAX_VECTORS    NVME_MAX_QUEUES
+#define NVME_MAX_NAMESPACES 8
+#define NVME_ADMIN_DEPTH    16
+#define NVME_IO_DEPTH       64 // entries per io queue, if the controller allows it
+
+// Without SGL support, a command's data is described by PRPs: prp1 holds the
+// first (possibly unaligned) page and prp2 either the second page or the
+// address of a list of the rest.  Each command id owns a 512 byte list in its
+// queue's memory, so a command moves at most 64 pages.
+#define NVME_PRP_LIST_ENTRIES 64
+#define NVME_PRP_LIST_SIZE    (NVME_PRP_LIST_ENTRIES * sizeof(uint64_t))
+
+// with SGLs, the limit is the 16 bit block count of a read or write
+#define NVME_SGL_MAX_XFER     (65536 * 512)
+
+// private opcode for the flush issued by IOCTL_DEVICE_SYNC
+#define NVME_IOTXN_OP_FLUSH   0x100
+
+#define NVME_ADMIN_TIMEOUT    MX_SEC(5)
+// clang-format on
+
+typedef struct nvme_device nvme_device_t;
+
+typedef struct nvme_queue {
+    uint16_t id;
+    uint16_t depth;
+
+    mtx_t lock;
+
+    nvme_cmd_t* sq;
+    nvme_cpl_t* cq;
+    volatile uint32_t* sq_doorbell;
+    volatile uint32_t* cq_doorbell;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint16_t cq_phase;
+
+    // commands in flight, indexed by command id
+    uint64_t busy;
+    iotxn_t* txns[NVME_IO_DEPTH];
+
+    // iotxns that still have commands to be submitted
+    list_node_t pending;
+
+    uint64_t* prp_list;
+    mx_paddr_t prp_list_phys;
+
+    io_buffer_t buffer;
+} nvme_queue_t;
+
+typedef struct nvme_ns {
+    mx_device_t device;
+    nvme_device_t* ctrl;
+
+    block_callbacks_t* callbacks;
+
+    uint32_t nsid;
+    uint32_t lba_shift;
+    uint64_t block_size;
+    mx_off_t capacity; // bytes
+} nvme_ns_t;
+
+typedef struct nvme_irq {
+    nvme_device_t* dev;
+    uint32_t vector;
+    mx_handle_t handle;
+    thrd_t thread;
+} nvme_irq_t;
+
+struct nvme_device {
+    mx_device_t device;
+    mx_device_t* pcidev;
+    pci_protocol_t* pci;
+
+    void* regs;
+    uint64_t regs_size;
+    mx_handle_t regs_handle;
+
+    uint64_t cap;
+    uint32_t doorbell_stride;
+
+    mx_pci_irq_mode_t irq_mode;
+    uint32_t irq_count;
+    nvme_irq_t irqs[NVME_MAX_VECTORS];
+
+    nvme_queue_t admin;
+    uint32_t queue_count;
+    nvme_queue_t queues[NVME_MAX_QUEUES];
+
+    bool sgl;
+    size_t max_xfer; // bytes per read or write command
+
+    // set when initialization fails, to stop the irq threads
+    atomic_bool shutdown;
+};
+
+#define get_nvme_device(dev) containerof(dev, nvme_device_t, device)
+#define get_nvme_ns(dev) containerof(dev, nvme_ns_t, device)
+
+static inline uint32_t nvme_read32(nvme_device_t* dev, uint32_t reg) {
+    return pcie_read32((volatile uint32_t*)((uintptr_t)dev->regs + reg));
+}
+
+static inline void nvme_write32(nvme_device_t* dev, uint32_t reg, uint32_t val) {
+    pcie_write32((volatile uint32_t*)((uintptr_t)dev->regs + reg), val);
+}
+
+static inline uint64_t nvme_read64(nvme_device_t* dev, uint32_t reg) {
+    uint64_t lo = nvme_read32(dev, reg);
+    uint64_t hi = nvme_read32(dev, reg + 4);
+    return (hi << 32) | lo;
+}
+
+static inline void nvme_write64(nvme_device_t* dev, uint32_t reg, uint64_t val) {
+    nvme_write32(dev, reg, (uint32_t)val);
+    nvme_write32(dev, reg + 4, (uint32_t)(val >> 32));
+}
+
+static mx_status_t nvme_wait_ready(nvme_device_t* dev, bool ready) {
+    // CAP.TO is the worst case time to change state, in 500ms units
+    mx_time_t timeout = MX_MSEC(500) * MAX(NVME_CAP_TO(dev->cap), 1u);
+    mx_time_t start_time = mx_time_get(MX_CLOCK_MONOTONIC);
+    do {
+        uint32_t csts = nvme_read32(dev, NVME_REG_CSTS);
+        if (ready && (csts & NVME_CSTS_CFS)) {
+            return ERR_IO;
+        }
+        if (!!(csts & NVME_CSTS_RDY) == ready) {
+            return NO_ERROR;
+        }
+        usleep(10 * 1000);
+    } while (mx_time_get(MX_CLOCK_MONOTONIC) - start_time < timeout);
+    return ERR_TIMED_OUT;
+}
+
+// queue memory is the submission queue in the first page, the completion
+// queue in the second, then the prp lists
+static mx_status_t nvme_queue_init(nvme_device_t* dev, nvme_queue_t* q, uint16_t id, uint16_t depth) {
+    assert(depth <= NVME_IO_DEPTH);
+
+    size_t size = 2 * PAGE_SIZE + depth * NVME_PRP_LIST_SIZE;
+    mx_status_t status = io_buffer_init(&q->buffer, size, IO_BUFFER_RW);
+    if (status != NO_ERROR) {
+        xprintf("nvme: error %d allocating queue %u\n", status, id);
+        return status;
+    }
+    uint8_t* mem = io_buffer_virt(&q->buffer);
+    memset(mem, 0, size);
+
+    q->id = id;
+    q->depth = depth;
+    q->sq = (nvme_cmd_t*)mem;
+    q->cq = (nvme_cpl_t*)(mem + PAGE_SIZE);
+    q->prp_list = (uint64_t*)(mem + 2 * PAGE_SIZE);
+    q->prp_list_phys = io_buffer_phys(&q->buffer) + 2 * PAGE_SIZE;
+
+    uintptr_t doorbells = (uintptr_t)dev->regs + NVME_REG_DOORBELL_BASE;
+    q->sq_doorbell = (volatile uint32_t*)(doorbells + (2 * id) * dev->doorbell_stride);
+    q->cq_doorbell = (volatile uint32_t*)(doorbells + (2 * id + 1) * dev->doorbell_stride);
+    q->sq_tail = 0;
+    q->cq_head = 0;
+    q->cq_phase = NVME_CPL_PHASE;
+
+    mtx_init(&q->lock, mtx_plain);
+    list_initialize(&q->pending);
+    return NO_ERROR;
+}
+
+static inline mx_paddr_t nvme_sq_phys(nvme_queue_t* q) {
+    return io_buffer_phys(&q->buffer);
+}
+
+static inline mx_paddr_t nvme_cq_phys(nvme_queue_t* q) {
+    return io_buffer_phys(&q->buffer) + PAGE_SIZE;
+}
+
+// copy a command into the next submission slot; the doorbell is rung
+// separately so that a batch of commands costs a single register write
+static void nvme_sq_push(nvme_queue_t* q, const nvme_cmd_t* cmd) {
+    q->sq[q->sq_tail] = *cmd;
+    if (++q->sq_tail == q->depth) {
+        q->sq_tail = 0;
+    }
+}
+
+static void nvme_sq_ring(nvme_queue_t* q) {
+    hw_wmb();
+    pcie_write32(q->sq_doorbell, q->sq_tail);
+}
+
+// returns the next posted completion, or NULL
+static nvme_cpl_t* nvme_cq_peek(nvme_queue_t* q) {
+    nvme_cpl_t* cpl = &q->cq[q->cq_head];
+    if ((*(volatile uint16_t*)&cpl->status & NVME_CPL_PHASE) != q->cq_phase) {
+        return NULL;
+    }
+    hw_rmb();
+    return cpl;
+}
+
+static void nvme_cq_advance(nvme_queue_t* q) {
+    if (++q->cq_head == q->depth) {
+        q->cq_head = 0;
+        q->cq_phase ^= NVME_CPL_PHASE;
+    }
+}
+
+// Admin commands are only issued during init, one at a time, and are
+// polled for rather than waited on with interrupts.
+static mx_status_t nvme_admin_cmd(nvme_device_t* dev, nvme_cmd_t* cmd, uint32_t* result) {
+    nvme_queue_t* q = &dev->admin;
+
+    mtx_lock(&q->lock);
+    uint16_t cid = q->sq_tail;
+    cmd->cdw0 |= NVME_CMD_CID(cid);
+    nvme_sq_push(q, cmd);
+    nvme_sq_ring(q);
+
+    mx_status_t status = ERR_TIMED_OUT;
+    mx_time_t start_time = mx_time_get(MX_CLOCK_MONOTONIC);
+    while (mx_time_get(MX_CLOCK_MONOTONIC) - start_time < NVME_ADMIN_TIMEOUT) {
+        nvme_cpl_t* cpl = nvme_cq_peek(q);
+        if (cpl == NULL) {
+            usleep(100);
+            continue;
+        }
+        uint16_t cpl_cid = cpl->cid;
+        uint16_t cpl_status = cpl->status;
+        uint32_t cpl_result = cpl->result;
+        nvme_cq_advance(q);
+        pcie_write32(q->cq_doorbell, q->cq_head);
+
+        if (cpl_cid != cid) {
+            // late completion of a command that timed out
+            continue;
+        }
+        if (NVME_CPL_STATUS(cpl_status)) {
+            xprintf("nvme: admin opcode %#x failed, status %#x\n",
+                    cmd->cdw0 & 0xff, NVME_CPL_STATUS(cpl_status));
+            status = ERR_IO;
+        } else {
+            status = NO_ERROR;
+            if (result) {
+                *result = cpl_result;
+            }
+        }
+        break;
+    }
+    mtx_unlock(&q->lock);
+    return status;
+}
+
+static mx_status_t nvme_identify(nvme_device_t* dev, uint32_t cns, uint32_t nsid, io_buffer_t* buf) {
+    nvme_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cdw0 = NVME_ADMIN_IDENTIFY;
+    cmd.nsid = nsid;
+    cmd.dptr.prp.prp1 = io_buffer_phys(buf);
+    cmd.cdw10 = cns;
+    return nvme_admin_cmd(dev, &cmd, NULL);
+}
+
+static mx_status_t nvme_create_queue_pair(nvme_device_t* dev, nvme_queue_t* q, uint32_t vector) {
+    nvme_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cdw0 = NVME_ADMIN_CREATE_CQ;
+    cmd.dptr.prp.prp1 = nvme_cq_phys(q);
+    cmd.cdw10 = ((uint32_t)(q->depth - 1) << 16) | q->id;
+    cmd.cdw11 = (vector << 16) | NVME_QUEUE_IEN | NVME_QUEUE_PC;
+    mx_status_t status = nvme_admin_cmd(dev, &cmd, NULL);
+    if (status != NO_ERROR) {
+        xprintf("nvme: error %d creating completion queue %u\n", status, q->id);
+        return status;
+    }
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cdw0 = NVME_ADMIN_CREATE_SQ;
+    cmd.dptr.prp.prp1 = nvme_sq_phys(q);
+    cmd.cdw10 = ((uint32_t)(q->depth - 1) << 16) | q->id;
+    cmd.cdw11 = ((uint32_t)q->id << 16) | NVME_QUEUE_PC;
+    status = nvme_admin_cmd(dev, &cmd, NULL);
+    if (status != NO_ERROR) {
+        xprintf("nvme: error %d creating submission queue %u\n", status, q->id);
+    }
+    return status;
+}
+
+// io path:
+//
+// An iotxn larger than one command can carry is split into several commands
+// on the same queue.  While an iotxn is with the driver, txn->context points
+// at its namespace, txn->actual counts the bytes already handed to commands
+// and txn->status holds the first error.  The iotxn completes once all of it
+// has been submitted and no command still refers to it.
+
+static nvme_queue_t* nvme_pick_queue(nvme_device_t* dev) {
+    if (dev->queue_count == 1) {
+        return &dev->queues[0];
+    }
+    // Userspace has no cheap way to learn its current cpu, so hash the
+    // submitting thread instead.  Each thread sticks to one queue pair,
+    // which also keeps its requests in order.
+    uint64_t hash = (uintptr_t)thrd_current() * 0x9e3779b97f4a7c15ull;
+    return &dev->queues[(hash >> 32) % dev->queue_count];
+}
+
+static bool nvme_txn_in_flight(nvme_queue_t* q, iotxn_t* txn) {
+    for (uint16_t cid = 0; cid < q->depth; cid++) {
+        if (q->txns[cid] == txn) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// build and queue the next command of txn, covering as much of the rest of
+// it as one command can
+static void nvme_submit_cmd(nvme_device_t* dev, nvme_queue_t* q, uint16_t cid, iotxn_t* txn) {
+    nvme_ns_t* ns = txn->context;
+
+    nvme_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cdw0 = NVME_CMD_CID(cid);
+    cmd.nsid = ns->nsid;
+
+    q->busy |= 1ull << cid;
+    q->txns[cid] = txn;
+
+    if (txn->opcode == NVME_IOTXN_OP_FLUSH) {
+        cmd.cdw0 |= NVME_CMD_FLUSH;
+        nvme_sq_push(q, &cmd);
+        return;
+    }
+
+    uint64_t done = txn->actual;
+    size_t len = MIN(txn->length - done, dev->max_xfer);
+    txn->actual += len;
+
+    mx_paddr_t phys;
+    txn->ops->physmap(txn, &phys);
+    phys += done;
+
+    uint64_t lba = (txn->offset + done) >> ns->lba_shift;
+    cmd.cdw0 |= (txn->opcode == IOTXN_OP_WRITE) ? NVME_CMD_WRITE : NVME_CMD_READ;
+    cmd.cdw10 = (uint32_t)lba;
+    cmd.cdw11 = (uint32_t)(lba >> 32);
+    cmd.cdw12 = (uint32_t)((len >> ns->lba_shift) - 1);
+
+    if (dev->sgl) {
+        // the iotxn's buffer is physically contiguous, so a single data
+        // block descriptor describes it
+        cmd.cdw0 |= NVME_CMD_PSDT_SGL;
+        cmd.dptr.sgl.addr = phys;
+        cmd.dptr.sgl.length = (uint32_t)len;
+        cmd.dptr.sgl.type = NVME_SGL_DATA_BLOCK;
+    } else {
+        mx_paddr_t end = phys + len;
+        mx_paddr_t page = (phys & ~((mx_paddr_t)PAGE_SIZE - 1)) + PAGE_SIZE;
+        cmd.dptr.prp.prp1 = phys;
+        if (end > page + PAGE_SIZE) {
+            uint64_t* list = q->prp_list + cid * NVME_PRP_LIST_ENTRIES;
+            for (size_t i = 0; page < end; i++, page += PAGE_SIZE) {
+                assert(i < NVME_PRP_LIST_ENTRIES);
+                list[i] = page;
+            }
+            cmd.dptr.prp.prp2 = q->prp_list_phys + cid * NVME_PRP_LIST_SIZE;
+        } else if (end > page) {
+            cmd.dptr.prp.prp2 = page;
+        }
+    }
+
+    nvme_sq_push(q, &cmd);
+}
+
+// submit pending work while there are free command ids, ringing the doorbell
+// once at the end; called with the queue lock held
+static void nvme_queue_pump(nvme_device_t* dev, nvme_queue_t* q) {
+    // one submission queue slot always stays empty
+    const uint64_t cids = (1ull << (q->depth - 1)) - 1;
+    bool submitted = false;
+
+    iotxn_t* txn;
+    while ((txn = list_peek_head_type(&q->pending, iotxn_t, node)) != NULL) {
+        do {
+            uint64_t free = ~q->busy & cids;
+            if (free == 0) {
+                goto done;
+            }
+            nvme_submit_cmd(dev, q, (uint16_t)__builtin_ctzll(free), txn);
+            submitted = true;
+        } while (txn->actual < txn->length);
+        list_delete(&txn->node);
+    }
+done:
+    if (submitted) {
+        nvme_sq_ring(q);
+    }
+}
+
+// collect completions, moving finished iotxns to done; called with the
+// queue lock held
+static void nvme_queue_reap(nvme_queue_t* q, list_node_t* done) {
+    bool reaped = false;
+
+    nvme_cpl_t* cpl;
+    while ((cpl = nvme_cq_peek(q)) != NULL) {
+        uint16_t cid = cpl->cid;
+        uint16_t status = cpl->status;
+        nvme_cq_advance(q);
+        reaped = true;
+
+        if ((cid >= q->depth) || !(q->busy & (1ull << cid))) {
+            xprintf("nvme: queue %u: completion for idle command %u\n", q->id, cid);
+            continue;
+        }
+        iotxn_t* txn = q->txns[cid];
+        q->txns[cid] = NULL;
+        q->busy &= ~(1ull << cid);
+
+        if (NVME_CPL_STATUS(status)) {
+            xprintf("nvme: queue %u: command %u failed, status %#x\n",
+                    q->id, cid, NVME_CPL_STATUS(status));
+            txn->status = ERR_IO;
+        }
+        if ((txn->actual == txn->length) && !nvme_txn_in_flight(q, txn)) {
+            list_add_tail(done, &txn->node);
+        }
+    }
+
+    if (reaped) {
+        pcie_write32(q->cq_doorbell, q->cq_head);
+    }
+}
+
+static void nvme_queue_service(nvme_device_t* dev, nvme_queue_t* q) {
+    list_node_t done = LIST_INITIAL_VALUE(done);
+
+    mtx_lock(&q->lock);
+    nvme_queue_reap(q, &done);
+    nvme_queue_pump(dev, q);
+    mtx_unlock(&q->lock);
+
+    // completion callbacks may queue more io, so run them unlocked
+    iotxn_t* txn;
+    iotxn_t* temp;
+    list_for_every_entry_safe (&done, txn, temp, iotxn_t, node) {
+        list_delete(&txn->node);
+        txn->ops->complete(txn, txn->status, (txn->status == NO_ERROR) ? txn->length : 0);
+    }
+}
+
+static int nvme_irq_thread(void* arg) {
+    nvme_irq_t* irq = arg;
+    nvme_device_t* dev = irq->dev;
+    bool level = (dev->irq_mode == MX_PCIE_IRQ_MODE_LEGACY);
+
+    for (;;) {
+        mx_status_t status = mx_interrupt_wait(irq->handle);
+        if (atomic_load(&dev->shutdown)) {
+            break;
+        }
+        if (status != NO_ERROR) {
+            xprintf("nvme: error %d waiting for interrupt\n", status);
+            continue;
+        }
+        // a legacy interrupt stays asserted until the completion queues are
+        // drained, so mask it at the controller while they are serviced
+        if (level) {
+            nvme_write32(dev, NVME_REG_INTMS, 1u << irq->vector);
+        }
+        mx_interrupt_complete(irq->handle);
+
+        for (uint32_t i = irq->vector; i < dev->queue_count; i += dev->irq_count) {
+            nvme_queue_service(dev, &dev->queues[i]);
+        }
+
+        if (level) {
+            nvme_write32(dev, NVME_REG_INTMC, 1u << irq->vector);
+        }
+    }
+    return 0;
+}
+
+// implement device protocol:
+
+static void nvme_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
+    nvme_ns_t* ns = get_nvme_ns(dev);
+
+    if (txn->opcode != NVME_IOTXN_OP_FLUSH) {
+        if ((txn->opcode != IOTXN_OP_READ) && (txn->opcode != IOTXN_OP_WRITE)) {
+            txn->ops->complete(txn, ERR_NOT_SUPPORTED, 0);
+            return;
+        }
+
+        // offset and length must be aligned to block size
+        if ((txn->offset % ns->block_size) || (txn->length % ns->block_size)) {
+            txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+            return;
+        }
+        if (txn->offset > ns->capacity) {
+            txn->ops->complete(txn, ERR_OUT_OF_RANGE, 0);
+            return;
+        }
+
+        // constrain to device capacity
+        txn->length = MIN(txn->length, ns->capacity - txn->offset);
+        if (txn->length == 0) {
+            txn->ops->complete(txn, NO_ERROR, 0);
+            return;
+        }
+    }
+
+    txn->context = ns;
+    txn->status = NO_ERROR;
+    txn->actual = 0;
+
+    nvme_queue_t* q = nvme_pick_queue(ns->ctrl);
+    mtx_lock(&q->lock);
+    list_add_tail(&q->pending, &txn->node);
+    nvme_queue_pump(ns->ctrl, q);
+    mtx_unlock(&q->lock);
+}
+
+static void nvme_sync_complete(iotxn_t* txn, void* cookie) {
+    completion_signal((completion_t*)cookie);
+}
+
+// A flush covers every write completed before it, whichever queue the
+// write went through, so one is enough.
+static mx_status_t nvme_ns_flush(nvme_ns_t* ns) {
+    iotxn_t* txn;
+    mx_status_t status = iotxn_alloc(&txn, 0, 0, 0);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    completion_t completion = COMPLETION_INIT;
+    txn->opcode = NVME_IOTXN_OP_FLUSH;
+    txn->offset = 0;
+    txn->length = 0;
+    txn->complete_cb = nvme_sync_complete;
+    txn->cookie = &completion;
+    nvme_iotxn_queue(&ns->device, txn);
+    completion_wait(&completion, MX_TIME_INFINITE);
+    status = txn->status;
+    txn->ops->release(txn);
+    return status;
+}
+
+static ssize_t nvme_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t cmdlen, void* reply, size_t max) {
+    nvme_ns_t* ns = get_nvme_ns(dev);
+    switch (op) {
+    case IOCTL_BLOCK_GET_SIZE: {
+        uint64_t* size = reply;
+        if (max < sizeof(*size)) return ERR_BUFFER_TOO_SMALL;
+        *size = ns->capacity;
+        return sizeof(*size);
+    }
+    case IOCTL_BLOCK_GET_BLOCKSIZE: {
+        uint64_t* blksize = reply;
+        if (max < sizeof(*blksize)) return ERR_BUFFER_TOO_SMALL;
+        *blksize = ns->block_size;
+        return sizeof(*blksize);
+    }
+    case IOCTL_BLOCK_RR_PART: {
+        // rebind to reread the partition table
+        return device_rebind(dev);
+    }
+    case IOCTL_DEVICE_SYNC:
+        return nvme_ns_flush(ns);
+    default:
+        return ERR_NOT_SUPPORTED;
+    }
+}
+
+static mx_off_t nvme_getsize(mx_device_t* dev) {
+    nvme_ns_t* ns = get_nvme_ns(dev);
+    return ns->capacity;
+}
+
+static mx_status_t nvme_ns_release(mx_device_t* dev) {
+    nvme_ns_t* ns = get_nvme_ns(dev);
+    free(ns);
+    return NO_ERROR;
+}
+
+static mx_protocol_device_t nvme_ns_device_proto = {
+    .ioctl = nvme_ioctl,
+    .iotxn_queue = nvme_iotxn_queue,
+    .get_size = nvme_getsize,
+    .release = nvme_ns_release,
+};
+
+static void nvme_fifo_set_callbacks(mx_device_t* dev, block_callbacks_t* cb) {
+    nvme_ns_t* ns = get_nvme_ns(dev);
+    ns->callbacks = cb;
+}
+
+static void nvme_fifo_complete(iotxn_t* txn, void* cookie) {
+    nvme_ns_t* ns;
+    memcpy(&ns, txn->extra, sizeof(nvme_ns_t*));
+    ns->callbacks->complete(cookie, txn->status);
+    txn->ops->release(txn);
+}
+
+static void nvme_fifo_queue(mx_device_t* dev, uint32_t opcode, mx_handle_t vmo, uint64_t length,
+                            uint64_t vmo_offset, uint64_t dev_offset, void* cookie) {
+    nvme_ns_t* ns = get_nvme_ns(dev);
+
+    mx_status_t status;
+    iotxn_t* txn;
+    if ((status = iotxn_alloc_vmo(&txn, vmo, length, vmo_offset, sizeof(nvme_ns_t*))) != NO_ERROR) {
+        ns->callbacks->complete(cookie, status);
+        return;
+    }
+
+    txn->opcode = opcode;
+    txn->offset = dev_offset;
+    txn->length = length;
+    txn->complete_cb = nvme_fifo_complete;
+    txn->cookie = cookie;
+    memcpy(txn->extra, &ns, sizeof(nvme_ns_t*));
+
+    nvme_iotxn_queue(dev, txn);
+}
+
+static void nvme_fifo_read(mx_device_t* dev, mx_handle_t vmo, uint64_t length,
+                           uint64_t vmo_offset, uint64_t dev_offset, void* cookie) {
+    nvme_fifo_queue(dev, IOTXN_OP_READ, vmo, length, vmo_offset, dev_offset, cookie);
+}
+
+static void nvme_fifo_write(mx_device_t* dev, mx_handle_t vmo, uint64_t length,
+                            uint64_t vmo_offset, uint64_t dev_offset, void* cookie) {
+    nvme_fifo_queue(dev, IOTXN_OP_WRITE, vmo, length, vmo_offset, dev_offset, cookie);
+}
+
+static block_ops_t nvme_block_ops = {
+    .set_callbacks = nvme_fifo_set_callbacks,
+    .read = nvme_fifo_read,
+    .write = nvme_fifo_write,
+};
+
+// disable the controller and release what nvme_bind and the init thread acquired
+static void nvme_release_resources(nvme_device_t* dev) {
+    if (dev->regs) {
+        uint32_t cc = nvme_read32(dev, NVME_REG_CC);
+        if (cc & NVME_CC_EN) {
+            nvme_write32(dev, NVME_REG_CC, cc & ~NVME_CC_EN);
+            nvme_wait_ready(dev, false);
+        }
+    }
+    dev->pci->enable_bus_master(dev->pcidev, false);
+
+    for (uint32_t i = 0; i < countof(dev->queues); i++) {
+        io_buffer_release(&dev->queues[i].buffer);
+    }
+    io_buffer_release(&dev->admin.buffer);
+
+    for (uint32_t i = 0; i < countof(dev->irqs); i++) {
+        if (dev->irqs[i].handle != MX_HANDLE_INVALID) {
+            mx_handle_close(dev->irqs[i].handle);
+        }
+    }
+    dev->pci->set_irq_mode(dev->pcidev, MX_PCIE_IRQ_MODE_DISABLED, 0);
+
+    // closing the io mapping handle unmaps the register window
+    if (dev->regs_handle != MX_HANDLE_INVALID) {
+        mx_handle_close(dev->regs_handle);
+    }
+}
+
+static mx_status_t nvme_release(mx_device_t* dev) {
+    nvme_device_t* device = get_nvme_device(dev);
+    nvme_release_resources(device);
+    free(device);
+    return NO_ERROR;
+}
+
+static mx_protocol_device_t nvme_device_proto = {
+    .release = nvme_release,
+};
+
+// init:
+
+static mx_status_t nvme_ns_add(nvme_device_t* dev, uint32_t nsid, io_buffer_t* buf) {
+    mx_status_t status = nvme_identify(dev, NVME_IDENTIFY_NS, nsid, buf);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    const uint8_t* id = io_buffer_virt(buf);
+
+    uint64_t nsze;
+    memcpy(&nsze, id + NVME_ID_NS_NSZE, sizeof(nsze));
+    if (nsze == 0) {
+        // inactive namespace
+        return NO_ERROR;
+    }
+
+    uint32_t lbaf;
+    memcpy(&lbaf, id + NVME_ID_NS_LBAF + sizeof(lbaf) * (id[NVME_ID_NS_FLBAS] & 0xf), sizeof(lbaf));
+    uint32_t shift = NVME_LBAF_LBADS(lbaf);
+    if (NVME_LBAF_MS(lbaf) || (shift < 9) || ((1u << shift) > PAGE_SIZE)) {
+        xprintf("nvme: namespace %u has unsupported format %#x\n", nsid, lbaf);
+        return ERR_NOT_SUPPORTED;
+    }
+
+    nvme_ns_t* ns = calloc(1, sizeof(nvme_ns_t));
+    if (!ns) {
+        xprintf("nvme: out of memory\n");
+        return ERR_NO_MEMORY;
+    }
+    ns->ctrl = dev;
+    ns->nsid = nsid;
+    ns->lba_shift = shift;
+    ns->block_size = 1ull << shift;
+    ns->capacity = nsze << shift;
+
+    char name[16];
+    snprintf(name, sizeof(name), "nvme-ns%u", nsid);
+    device_init(&ns->device, dev->device.driver, name, &nvme_ns_device_proto);
+    ns->device.protocol_id = MX_PROTOCOL_BLOCK_CORE;
+    ns->device.protocol_ops = &nvme_block_ops;
+
+    xprintf("nvme: namespace %u: %" PRIu64 " blocks of %" PRIu64 " bytes\n", nsid, nsze, ns->block_size);
+
+    status = device_add(&ns->device, &dev->device);
+    if (status != NO_ERROR) {
+        free(ns);
+    }
+    return status;
+}
+
+static int nvme_init_thread(void* arg) {
+    nvme_device_t* dev = arg;
+    io_buffer_t id_buf = {};
+    mx_status_t status;
+
+    dev->cap = nvme_read64(dev, NVME_REG_CAP);
+    dev->doorbell_stride = 4u << NVME_CAP_DSTRD(dev->cap);
+    uint32_t irq_threads = 0;
+    if (NVME_CAP_MPSMIN(dev->cap) > 0) {
+        xprintf("nvme: controller does not support %u byte pages\n", PAGE_SIZE);
+        status = ERR_NOT_SUPPORTED;
+        goto done;
+    }
+
+    // disable the controller before setting up the admin queue
+    uint32_t cc = nvme_read32(dev, NVME_REG_CC);
+    if (cc & NVME_CC_EN) {
+        nvme_write32(dev, NVME_REG_CC, cc & ~NVME_CC_EN);
+    }
+    if ((status = nvme_wait_ready(dev, false)) != NO_ERROR) {
+        xprintf("nvme: error %d disabling controller\n", status);
+        goto done;
+    }
+
+    if ((status = nvme_queue_init(dev, &dev->admin, 0, NVME_ADMIN_DEPTH)) != NO_ERROR) {
+        goto done;
+    }
+    nvme_write32(dev, NVME_REG_AQA, ((NVME_ADMIN_DEPTH - 1) << 16) | (NVME_ADMIN_DEPTH - 1));
+    nvme_write64(dev, NVME_REG_ASQ, nvme_sq_phys(&dev->admin));
+    nvme_write64(dev, NVME_REG_ACQ, nvme_cq_phys(&dev->admin));
+
+    cc = NVME_CC_EN | NVME_CC_CSS_NVM | NVME_CC_MPS(12) | NVME_CC_AMS_RR |
+         NVME_CC_IOSQES(NVME_SQES_SHIFT) | NVME_CC_IOCQES(NVME_CQES_SHIFT);
+    nvme_write32(dev, NVME_REG_CC, cc);
+    if ((status = nvme_wait_ready(dev, true)) != NO_ERROR) {
+        xprintf("nvme: error %d enabling controller\n", status);
+        goto done;
+    }
+
+    // identify controller
+    if ((status = io_buffer_init(&id_buf, PAGE_SIZE, IO_BUFFER_RW)) != NO_ERROR) {
+        xprintf("nvme: error %d allocating identify buffer\n", status);
+        goto done;
+    }
+    if ((status = nvme_identify(dev, NVME_IDENTIFY_CTRL, 0, &id_buf)) != NO_ERROR) {
+        goto done;
+    }
+    const uint8_t* id = io_buffer_virt(&id_buf);
+    xprintf("nvme: model %.*s serial %.*s firmware %.*s\n",
+            NVME_ID_CTRL_MN_LEN, (const char*)id + NVME_ID_CTRL_MN,
+            NVME_ID_CTRL_SN_LEN, (const char*)id + NVME_ID_CTRL_SN,
+            NVME_ID_CTRL_FR_LEN, (const char*)id + NVME_ID_CTRL_FR);
+
+    uint8_t mdts = id[NVME_ID_CTRL_MDTS];
+    uint32_t nn;
+    uint32_t sgls;
+    memcpy(&nn, id + NVME_ID_CTRL_NN, sizeof(nn));
+    memcpy(&sgls, id + NVME_ID_CTRL_SGLS, sizeof(sgls));
+
+    dev->sgl = NVME_SGLS_SUPPORTED(sgls);
+    dev->max_xfer = dev->sgl ? NVME_SGL_MAX_XFER : NVME_PRP_LIST_ENTRIES * PAGE_SIZE;
+    if (mdts) {
+        dev->max_xfer = MIN(dev->max_xfer, (size_t)PAGE_SIZE << mdts);
+    }
+
+    // ask for a queue pair per cpu and settle for what the controller grants
+    uint32_t want = MIN(mx_system_get_num_cpus(), NVME_MAX_QUEUES);
+    nvme_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cdw0 = NVME_ADMIN_SET_FEATURES;
+    cmd.cdw10 = NVME_FEATURE_NUM_QUEUES;
+    cmd.cdw11 = ((want - 1) << 16) | (want - 1);
+    uint32_t granted;
+    if ((status = nvme_admin_cmd(dev, &cmd, &granted)) != NO_ERROR) {
+        goto done;
+    }
+    dev->queue_count = MIN(want, MIN((granted & 0xffff) + 1, (granted >> 16) + 1));
+    dev->irq_count = MIN(dev->irq_count, dev->queue_count);
+
+    uint16_t depth = (uint16_t)MIN(NVME_IO_DEPTH, NVME_CAP_MQES(dev->cap) + 1);
+    xprintf("nvme: %u queue pairs of %u entries, %u interrupts, %s, %zu bytes per command\n",
+            dev->queue_count, depth, dev->irq_count, dev->sgl ? "sgl" : "prp", dev->max_xfer);
+
+    for (uint32_t i = 0; i < dev->queue_count; i++) {
+        nvme_queue_t* q = &dev->queues[i];
+        if ((status = nvme_queue_init(dev, q, (uint16_t)(i + 1), depth)) != NO_ERROR) {
+            goto done;
+        }
+        if ((status = nvme_create_queue_pair(dev, q, i % dev->irq_count)) != NO_ERROR) {
+            goto done;
+        }
+    }
+
+    for (; irq_threads < dev->irq_count; irq_threads++) {
+        nvme_irq_t* irq = &dev->irqs[irq_threads];
+        int ret = thrd_create_with_name(&irq->thread, nvme_irq_thread, irq, "nvme-irq");
+        if (ret != thrd_success) {
+            xprintf("nvme: error %d in irq thread create\n", ret);
+            status = ERR_NO_RESOURCES;
+            goto done;
+        }
+    }
+    for (uint32_t i = 0; i < irq_threads; i++) {
+        thrd_detach(dev->irqs[i].thread);
+    }
+
+    for (uint32_t nsid = 1; nsid <= MIN(nn, NVME_MAX_NAMESPACES); nsid++) {
+        nvme_ns_add(dev, nsid, &id_buf);
+    }
+
+done:
+    io_buffer_release(&id_buf);
+    if (status != NO_ERROR) {
+        // stop the irq threads that did start, then remove the controller
+        // device; its release hook frees everything else
+        atomic_store(&dev->shutdown, true);
+        for (uint32_t i = 0; i < irq_threads; i++) {
+            mx_interrupt_signal(dev->irqs[i].handle);
+            thrd_join(dev->irqs[i].thread, NULL);
+        }
+        device_remove(&dev->device);
+    }
+    return status;
+}
+
+// implement driver object:
+
+static mx_status_t nvme_setup_irqs(nvme_device_t* device) {
+    pci_protocol_t* pci = device->pci;
+    mx_device_t* dev = device->pcidev;
+
+    // a vector per queue pair if the device has enough, otherwise they share
+    static const mx_pci_irq_mode_t modes[] = {
+        MX_PCIE_IRQ_MODE_MSI_X,
+        MX_PCIE_IRQ_MODE_MSI,
+        MX_PCIE_IRQ_MODE_LEGACY,
+    };
+    uint32_t want = MIN(mx_system_get_num_cpus(), NVME_MAX_VECTORS);
+    mx_status_t status = ERR_NOT_SUPPORTED;
+    for (size_t i = 0; i < countof(modes); i++) {
+        uint32_t max;
+        if ((pci->query_irq_mode_caps(dev, modes[i], &max) != NO_ERROR) || (max == 0)) {
+            continue;
+        }
+        uint32_t count = MIN(want, max);
+        if (modes[i] == MX_PCIE_IRQ_MODE_MSI) {
+            // multi-message msi hands out a power of two vectors
+            count = 1u << (31 - __builtin_clz(count));
+        } else if (modes[i] == MX_PCIE_IRQ_MODE_LEGACY) {
+            count = 1;
+        }
+        if ((status = pci->set_irq_mode(dev, modes[i], count)) == NO_ERROR) {
+            device->irq_mode = modes[i];
+            device->irq_count = count;
+            break;
+        }
+    }
+    if (status != NO_ERROR) {
+        xprintf("nvme: error %d setting irq mode\n", status);
+        return status;
+    }
+
+    for (uint32_t i = 0; i < device->irq_count; i++) {
+        nvme_irq_t* irq = &device->irqs[i];
+        irq->dev = device;
+        irq->vector = i;
+        status = pci->map_interrupt(dev, i, &irq->handle);
+        if (status != NO_ERROR) {
+            xprintf("nvme: error %d getting irq handle %u\n", status, i);
+            return status;
+        }
+    }
+    return NO_ERROR;
+}
+
+static mx_status_t nvme_bind(mx_driver_t* drv, mx_device_t* dev, void** cookie) {
+    pci_protocol_t* pci;
+    if (device_get_protocol(dev, MX_PROTOCOL_PCI, (void**)&pci)) return ERR_NOT_SUPPORTED;
+
+    mx_status_t status = pci->claim_device(dev);
+    if (status < 0) {
+        xprintf("nvme: error %d claiming pci device\n", status);
+        return status;
+    }
+
+    nvme_device_t* device = calloc(1, sizeof(nvme_device_t));
+    if (!device) {
+        xprintf("nvme: out of memory\n");
+        return ERR_NO_MEMORY;
+    }
+    device->pcidev = dev;
+    device->pci = pci;
+
+    device_init(&device->device, drv, "nvme", &nvme_device_proto);
+    atomic_init(&device->shutdown, false);
+
+    // map register window
+    status = pci->map_mmio(dev, 0, MX_CACHE_POLICY_UNCACHED_DEVICE, &device->regs, &device->regs_size, &device->regs_handle);
+    if (status != NO_ERROR) {
+        xprintf("nvme: error %d mapping register window\n", status);
+        goto fail;
+    }
+
+    status = pci->enable_bus_master(dev, true);
+    if (status < 0) {
+        xprintf("nvme: error %d in enable bus master\n", status);
+        goto fail;
+    }
+
+    if ((status = nvme_setup_irqs(device)) != NO_ERROR) {
+        goto fail;
+    }
+
+    // add the device for the controller
+    if ((status = device_add(&device->device, dev)) != NO_ERROR) {
+        xprintf("nvme: error %d adding device\n", status);
+        goto fail;
+    }
+
+    // reset the controller and find namespaces
+    thrd_t t;
+    int ret = thrd_create_with_name(&t, nvme_init_thread, device, "nvme-init");
+    if (ret != thrd_success) {
+        xprintf("nvme: error %d in init thread create\n", ret);
+        // the device is published, so its release hook cleans up
+        device_remove(&device->device);
+        return ERR_NO_RESOURCES;
+    }
+    thrd_detach(t);
+
+    return NO_ERROR;
+fail:
+    nvme_release_resources(device);
+    free(device);
+    return status;
+}
+
+mx_driver_t _driver_nvme = {
+    .ops = {
+        .bind = nvme_bind,
+    },
+};
+
+// clang-format off
+MAGENTA_DRIVER_BEGIN(_driver_nvme, "nvme", "magenta", "0.1", 4)
+    BI_ABORT_IF(NE, BIND_PROTOCOL, MX_PROTOCOL_PCI),
+    BI_ABORT_IF(NE, BIND_PCI_CLASS, 0x01),     // mass storage
+    BI_ABORT_IF(NE, BIND_PCI_SUBCLASS, 0x08),  // non-volatile memory
+    BI_MATCH_IF(EQ, BIND_PCI_INTERFACE, 0x02), // nvm express
+MAGENTA_DRIVER_END(_driver_nvme)
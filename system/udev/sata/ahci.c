@@ -217,33 +217,69 @@ static bool cmd_is_queued(uint8_t cmd) {
     return (cmd == SATA_CMD_READ_FPDMA_QUEUED) || (cmd == SATA_CMD_WRITE_FPDMA_QUEUED);
 }
 
-static void ahci_port_complete_txn(ahci_device_t* dev, ahci_port_t* port, mx_status_t status) {
-    iotxn_t* txn;
-    uint32_t sact = ahci_read(&port->regs->sact);
-    for (int i = 0; i < AHCI_MAX_COMMANDS; i++) {
-        txn = port->commands[i];
-        if (txn == NULL) {
-            continue;
+// Releases the command slots in |mask|, moving their txns onto |done| so they
+// can be completed once the port lock is dropped. Called with the port lock
+// held.
+static void ahci_port_release_slots_locked(ahci_port_t* port, uint32_t mask, list_node_t* done) {
+    while (mask) {
+        int slot = __builtin_ctz(mask);
+        mask &= mask - 1;
+        iotxn_t* txn = port->commands[slot];
+        port->commands[slot] = NULL;
+        port->running &= ~(1u << slot);
+        if (txn != NULL) {
+            list_add_tail(done, &txn->node);
         }
-        if (!(sact & (1 << i))) {
-            mtx_lock(&port->lock);
-            // clear state before calling the complete() hook
-            port->running &= ~(1 << i);
-            port->commands[i] = NULL;
+    }
 
-            // resume the port if paused for sync and no outstanding transactions
-            if ((port->flags & AHCI_PORT_FLAG_SYNC_PAUSED) && !port->running) {
-                port->flags &= ~AHCI_PORT_FLAG_SYNC_PAUSED;
-            }
-            mtx_unlock(&port->lock);
+    // resume the port if paused for sync and no outstanding transactions
+    if ((port->flags & AHCI_PORT_FLAG_SYNC_PAUSED) && !port->running) {
+        port->flags &= ~AHCI_PORT_FLAG_SYNC_PAUSED;
+    }
+}
 
-            txn->ops->complete(txn, status, txn->length);
-        }
+static void ahci_complete_list(list_node_t* done, mx_status_t status) {
+    iotxn_t* txn;
+    while ((txn = list_remove_head_type(done, iotxn_t, node)) != NULL) {
+        txn->ops->complete(txn, status, status == NO_ERROR ? txn->length : 0);
     }
+}
+
+static void ahci_port_complete_txn(ahci_device_t* dev, ahci_port_t* port) {
+    list_node_t done = LIST_INITIAL_VALUE(done);
+    mtx_lock(&port->lock);
+    // Queued commands finish in whatever order the device chooses. A slot is
+    // done once the device has cleared it from both the active and the issue
+    // masks.
+    uint32_t active = ahci_read(&port->regs->sact) | ahci_read(&port->regs->ci);
+    ahci_port_release_slots_locked(port, port->running & ~active, &done);
+    mtx_unlock(&port->lock);
+
+    ahci_complete_list(&done, NO_ERROR);
     // hit the worker thread to do the next txn
     completion_signal(&dev->worker_completion);
 }
 
+// Recovers from a port error or a command timeout. Commands the device has
+// already finished complete normally, then the port is reset, which aborts
+// everything still outstanding. With NCQ there is no cheap way to tell
+// which command failed, so those all complete with |status|.
+static void ahci_port_fail(ahci_device_t* dev, ahci_port_t* port, mx_status_t status) {
+    list_node_t done = LIST_INITIAL_VALUE(done);
+    list_node_t failed = LIST_INITIAL_VALUE(failed);
+    mtx_lock(&port->lock);
+    uint32_t active = ahci_read(&port->regs->sact) | ahci_read(&port->regs->ci);
+    ahci_port_release_slots_locked(port, port->running & ~active, &done);
+    ahci_port_reset(port);
+    ahci_port_release_slots_locked(port, port->running, &failed);
+    ahci_write(&port->regs->is, ahci_read(&port->regs->is));
+    mtx_unlock(&port->lock);
+
+    ahci_complete_list(&done, NO_ERROR);
+    ahci_complete_list(&failed, status);
+    completion_signal(&dev->worker_completion);
+}
+
 static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot, iotxn_t* txn) {
     assert(slot < AHCI_MAX_COMMANDS);
     assert(!ahci_port_cmd_busy(port, slot));
@@ -264,14 +300,6 @@ static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
     mx_paddr_t phys;
     txn->ops->physmap(txn, &phys);
 
-    if (dev->cap & AHCI_CAP_NCQ) {
-        if (pdata->cmd == SATA_CMD_READ_DMA_EXT) {
-            pdata->cmd = SATA_CMD_READ_FPDMA_QUEUED;
-        } else if (pdata->cmd == SATA_CMD_WRITE_DMA_EXT) {
-            pdata->cmd = SATA_CMD_WRITE_FPDMA_QUEUED;
-        }
-    }
-
     //xprintf("ahci.%d: do_txn slot=%d cmd=0x%x device=0x%x lba=0x%lx count=%u phys=0x%lx data_sz=0x%lx offset=0x%lx\n", port->nr, slot, pdata->cmd, pdata->device, pdata->lba, pdata->count, phys, txn->length, txn->offset);
 
     // build the command
@@ -329,11 +357,12 @@ static mx_status_t ahci_do_txn(ahci_device_t* dev, ahci_port_t* port, int slot,
     port->running |= (1 << slot);
     port->commands[slot] = txn;
 
-    // start command
+    // start command; zero bits written to sact and ci are ignored, so
+    // other slots are not disturbed
     if (cmd_is_queued(pdata->cmd)) {
-        ahci_write(&port->regs->sact, ahci_read(&port->regs->sact) | (1 << slot));
+        ahci_write(&port->regs->sact, 1u << slot);
     }
-    ahci_write(&port->regs->ci, ahci_read(&port->regs->ci) | (1 << slot));
+    ahci_write(&port->regs->ci, 1u << slot);
 
     // set the watchdog
     // TODO: general timeout mechanism
@@ -447,6 +476,15 @@ void ahci_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     assert(pdata->port < AHCI_MAX_PORTS);
     assert(port->flags & (AHCI_PORT_FLAG_IMPLEMENTED | AHCI_PORT_FLAG_PRESENT));
 
+    // fall back to non-queued commands if the hba does not support NCQ
+    if (!(device->cap & AHCI_CAP_NCQ)) {
+        if (pdata->cmd == SATA_CMD_READ_FPDMA_QUEUED) {
+            pdata->cmd = SATA_CMD_READ_DMA_EXT;
+        } else if (pdata->cmd == SATA_CMD_WRITE_FPDMA_QUEUED) {
+            pdata->cmd = SATA_CMD_WRITE_DMA_EXT;
+        }
+    }
+
     // put the cmd on the queue
     mtx_lock(&port->lock);
     list_add_tail(&port->txn_list, &txn->node);
@@ -458,57 +496,64 @@ void ahci_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
 
 // worker thread (for iotxn queue):
 
+static int ahci_port_find_slot(ahci_device_t* dev, ahci_port_t* port, int max_cmd) {
+    int max = MIN(max_cmd, (int)((dev->cap >> 8) & 0x1f));
+    uint32_t mask = (max >= AHCI_MAX_COMMANDS - 1) ? 0xffffffff : ((1u << (max + 1)) - 1);
+    uint32_t free = ~port->running & mask;
+    return free ? __builtin_ctz(free) : -1;
+}
+
+// Issues txns from the head of the port's queue until it runs out of txns or
+// free command slots. Called with the port lock held.
+static void ahci_port_issue_locked(ahci_device_t* dev, ahci_port_t* port) {
+    iotxn_t* txn;
+    while ((txn = list_peek_head_type(&port->txn_list, iotxn_t, node)) != NULL) {
+        if (port->flags & AHCI_PORT_FLAG_SYNC_PAUSED) {
+            return;
+        }
+
+        // Queued and non-queued commands may not be outstanding at the same
+        // time, so a non-queued command waits for the port to go idle and
+        // holds it until it completes, just like IOTXN_SYNC_BEFORE/AFTER.
+        sata_pdata_t* pdata = sata_iotxn_pdata(txn);
+        bool queued = cmd_is_queued(pdata->cmd);
+        if ((!queued || (txn->flags & IOTXN_SYNC_BEFORE)) && port->running) {
+            port->flags |= AHCI_PORT_FLAG_SYNC_PAUSED;
+            return;
+        }
+
+        int slot = ahci_port_find_slot(dev, port, pdata->max_cmd);
+        if (slot < 0) {
+            return;
+        }
+
+        list_delete(&txn->node);
+        if (!queued || (txn->flags & IOTXN_SYNC_AFTER)) {
+            port->flags |= AHCI_PORT_FLAG_SYNC_PAUSED;
+        }
+        // run the command
+        ahci_do_txn(dev, port, slot, txn);
+    }
+}
+
 static int ahci_worker_thread(void* arg) {
     ahci_device_t* dev = (ahci_device_t*)arg;
-    ahci_port_t* port;
-    iotxn_t* txn;
     for (;;) {
+        // reset before looking at the queues, so a signal that arrives while
+        // they are being serviced is not lost
+        completion_reset(&dev->worker_completion);
+
         // iterate all the ports and run commands
         for (int i = 0; i < AHCI_MAX_PORTS; i++) {
-            port = &dev->ports[i];
+            ahci_port_t* port = &dev->ports[i];
             mtx_lock(&port->lock);
-            if (!(port->flags & (AHCI_PORT_FLAG_IMPLEMENTED | AHCI_PORT_FLAG_PRESENT))) {
-                goto next;
+            if (port->flags & (AHCI_PORT_FLAG_IMPLEMENTED | AHCI_PORT_FLAG_PRESENT)) {
+                ahci_port_issue_locked(dev, port);
             }
-            if (port->flags & AHCI_PORT_FLAG_SYNC_PAUSED) {
-                goto next;
-            }
-
-            txn = list_peek_head_type(&port->txn_list, iotxn_t, node);
-            if (!txn) {
-                goto next;
-            }
-
-            // if IOTXN_SYNC_BEFORE, pause the port if there are transactions in flight
-            if ((txn->flags & IOTXN_SYNC_BEFORE) && port->running) {
-                port->flags |= AHCI_PORT_FLAG_SYNC_PAUSED;
-                goto next;
-            }
-
-            // find a free command tag
-            sata_pdata_t* pdata = sata_iotxn_pdata(txn);
-            int max = MIN(pdata->max_cmd, (int)((dev->cap >> 8) & 0x1f));
-            int i = 0;
-            for (i = 0; i <= max; i++) {
-                if (!ahci_port_cmd_busy(port, i)) break;
-            }
-            if (i > max) {
-                goto next;
-            }
-
-            list_delete(&txn->node);
-            // if IOTXN_SYNC_AFTER, pause the port until this command is complete
-            if (txn->flags & IOTXN_SYNC_AFTER) {
-                port->flags |= AHCI_PORT_FLAG_SYNC_PAUSED;
-            }
-            // run the command
-            ahci_do_txn(dev, port, i, txn);
-next:
             mtx_unlock(&port->lock);
         }
-        // wait here until more commands are queued, or a port becomes idle
+        // wait here until more commands are queued, or a slot frees up
         completion_wait(&dev->worker_completion, MX_TIME_INFINITE);
-        completion_reset(&dev->worker_completion);
     }
     return 0;
 }
@@ -524,6 +569,7 @@ static int ahci_watchdog_thread(void* arg) {
                 continue;
             }
 
+            bool timed_out = false;
             mtx_lock(&port->lock);
             if (port->running) {
                 idle = false;
@@ -533,18 +579,18 @@ static int ahci_watchdog_thread(void* arg) {
                     }
                     sata_pdata_t* pdata = sata_iotxn_pdata(port->commands[j]);
                     if (pdata->timeout < now) {
-                        // time out
-                        printf("ahci: txn time out on port %d\n", port->nr);
-                        iotxn_t* txn = port->commands[i];
-                        port->running &= ~(1 << i);
-                        port->commands[i] = NULL;
-                        mtx_unlock(&port->lock);
-                        txn->ops->complete(txn, ERR_TIMED_OUT, 0);
-                        mtx_lock(&port->lock);
+                        timed_out = true;
+                        break;
                     }
                 }
             }
             mtx_unlock(&port->lock);
+
+            if (timed_out) {
+                // the slot cannot be reused until the device lets go of it
+                printf("ahci: txn time out on port %d\n", port->nr);
+                ahci_port_fail(dev, port, ERR_TIMED_OUT);
+            }
         }
 
         // no need to run the watchdog if there are no active xfers
@@ -562,22 +608,17 @@ static void ahci_port_irq(ahci_device_t* dev, int nr) {
     uint32_t is = ahci_read(&port->regs->is);
     ahci_write(&port->regs->is, is);
 
-    if (is & AHCI_PORT_INT_DHR) { // RFIS received
-        ahci_port_complete_txn(dev, port, NO_ERROR);
-    }
-    if (is & AHCI_PORT_INT_PS) { // PSFIS rcv
-        ahci_port_complete_txn(dev, port, NO_ERROR);
-    }
-    if (is & AHCI_PORT_INT_SDB) { // SDBFIS
-        ahci_port_complete_txn(dev, port, NO_ERROR);
-    }
     if (is & AHCI_PORT_INT_PRC) { // PhyRdy change
         uint32_t serr = ahci_read(&port->regs->serr);
         ahci_write(&port->regs->serr, serr & ~0x1);
     }
     if (is & AHCI_PORT_INT_TFE) { // taskfile error
-        xprintf("tfe error\n");
-        ahci_port_complete_txn(dev, port, ERR_INTERNAL);
+        xprintf("ahci.%d: tfe error\n", port->nr);
+        ahci_port_fail(dev, port, ERR_INTERNAL);
+    } else if (is & (AHCI_PORT_INT_DHR | AHCI_PORT_INT_PS | AHCI_PORT_INT_SDB)) {
+        // RFIS, PSFIS or SDBFIS (NCQ) received; one pass picks up every
+        // command that has finished
+        ahci_port_complete_txn(dev, port);
     }
 }
 
@@ -36,6 +36,7 @@
 
 #define SATA_FLAG_DMA   (1 << 0)
 #define SATA_FLAG_LBA48 (1 << 1)
+#define SATA_FLAG_NCQ   (1 << 2)
 
 typedef struct sata_device {
     mx_device_t device;
@@ -130,7 +131,13 @@ static mx_status_t sata_device_identify(sata_device_t* dev, mx_device_t* control
     } else {
         xprintf(" PIO");
     }
-    dev->max_cmd = *(devinfo + SATA_DEVINFO_QUEUE_DEPTH);
+    if (*(devinfo + SATA_DEVINFO_SATA_CAP) & (1 << 8)) {
+        flags |= SATA_FLAG_NCQ;
+        dev->max_cmd = *(devinfo + SATA_DEVINFO_QUEUE_DEPTH) & 0x1f;
+        xprintf(" NCQ");
+    } else {
+        dev->max_cmd = 0;
+    }
     xprintf(" %d commands\n", dev->max_cmd + 1);
     if (cap & (1 << 9)) {
         dev->sector_sz = 512; // default
@@ -177,7 +184,12 @@ static void sata_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     txn->length = MIN(txn->length, device->capacity - txn->offset);
 
     sata_pdata_t* pdata = sata_iotxn_pdata(txn);
-    pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_DMA_EXT : SATA_CMD_WRITE_DMA_EXT;
+    if (device->flags & SATA_FLAG_NCQ) {
+        pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_FPDMA_QUEUED
+                                                  : SATA_CMD_WRITE_FPDMA_QUEUED;
+    } else {
+        pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_DMA_EXT : SATA_CMD_WRITE_DMA_EXT;
+    }
     pdata->device = 0x40;
     pdata->lba = txn->offset / device->sector_sz;
     pdata->count = txn->length / device->sector_sz;
@@ -8,6 +8,7 @@
 #include <ddk/common/usb.h>
 #include <magenta/hw/usb.h>
 #include <magenta/listnode.h>
+#include <magenta/syscalls.h>
 #include <sync/completion.h>
 #include <ddk/protocol/block.h>
 
@@ -16,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <threads.h>
 #include <unistd.h>
 
@@ -25,6 +27,18 @@
 #define WRITE_REQ_COUNT 3
 #define USB_BUF_SIZE 0x8000
 
+// Block reads and writes are pipelined: up to UMS_QUEUE_DEPTH commands have
+// their CBW, data and CSW requests queued at once, so the device finds the
+// next command waiting as soon as it has sent the status of the last one.
+#define UMS_QUEUE_DEPTH 4
+// iotxns which continue where the one before ends are merged into one
+// command, up to this many of them and UMS_MAX_COMMAND_SIZE bytes
+#define UMS_MAX_MERGE 16
+#define UMS_MAX_COMMAND_SIZE 0x100000
+// iotxns too big for a single USB request are moved through a bounce
+// buffer, at most this much per command
+#define UMS_BOUNCE_SIZE 0x10000
+
 // comment the next line if you don't want debug messages
 #define DEBUG 0
 #ifdef DEBUG
@@ -35,15 +49,50 @@
 
 // used to implement IOCTL_DEVICE_SYNC
 typedef struct {
-    // iotxn we are waiting to complete
-    iotxn_t* iotxn;
+    // wait until this many iotxns have been completed
+    uint64_t count;
     // completion for IOCTL_DEVICE_SYNC to wait on
     completion_t completion;
     // node for ums_t.sync_nodes list
     list_node_t node;
 } ums_sync_node_t;
 
+struct ums;
+
+// a READ or WRITE command and the USB requests which carry it out
 typedef struct {
+    struct ums* msd;
+    // node for ums_t.free_cmds or ums_t.active_cmds
+    list_node_t node;
+
+    iotxn_t* cbw;
+    iotxn_t* csw;
+    // data of a command which uses the bounce buffer
+    iotxn_t* bounce;
+
+    // the iotxns the command is for, in device order
+    iotxn_t* txns[UMS_MAX_MERGE];
+    // clones of txns which move their data without copying
+    iotxn_t* clones[UMS_MAX_MERGE];
+    uint32_t txn_count;
+
+    // set if the command moves a piece of txns[0] through the bounce buffer
+    bool use_bounce;
+    bool last_piece;        // whether the piece is the end of txns[0]
+    mx_off_t bounce_offset; // where the piece starts in txns[0]
+
+    uint32_t opcode;
+    uint32_t tag;
+    mx_off_t offset;        // on the device, in bytes
+    mx_off_t length;
+
+    mx_time_t issued;
+    // requests not completed yet, and the first error of those that are
+    uint32_t pending;
+    mx_status_t status;
+} ums_cmd_t;
+
+typedef struct ums {
     mx_device_t device;
     mx_device_t* udev;
     mx_driver_t* driver;
@@ -57,16 +106,34 @@ typedef struct {
 
     bool use_read_write_16; // use READ16 and WRITE16 if total_blocks > 0xFFFFFFFF
 
+    uint8_t interface_number;
     uint8_t bulk_in_addr;
     uint8_t bulk_out_addr;
+    uint16_t max_packet;    // of the bulk endpoints
+    size_t max_transfer;    // largest request the host controller takes
+    size_t bounce_size;
 
     // pool of free USB requests
     list_node_t free_csw_reqs;
     list_node_t free_read_reqs;
     list_node_t free_write_reqs;
 
-    // list of queued io transactions
+    // list of queued io transactions not yet part of a command
     list_node_t queued_iotxns;
+    // bytes of the head of queued_iotxns already issued through the bounce buffer
+    mx_off_t head_issued;
+
+    // commands, with the ones issued to the device oldest first
+    ums_cmd_t cmds[UMS_QUEUE_DEPTH];
+    list_node_t free_cmds;
+    list_node_t active_cmds;
+    // set when a request of a command failed or a CSW was bad, so the device
+    // is out of step with the commands and needs reset recovery
+    bool recover;
+
+    // iotxns queued and completed, for IOCTL_DEVICE_SYNC
+    uint64_t txns_queued;
+    uint64_t txns_completed;
 
     // list of active ums_sync_node_t
     list_node_t sync_nodes;
@@ -75,12 +142,20 @@ typedef struct {
     list_node_t completed_reads;
     list_node_t completed_csws;
 
+    block_device_stats_t stats;
+
+    // issues the commands and completes the iotxns once the device is
+    // added; signalled whenever there is work for it
+    thrd_t worker;
+    bool worker_running;
+    bool dead;
+    completion_t worker_completion;
+
     mtx_t mutex;
 } ums_t;
 #define get_ums(dev) containerof(dev, ums_t, device)
 
-static void ums_csw_complete(iotxn_t* csw_request, void* cookie);
-static csw_status_t ums_verify_csw(ums_t* msd, iotxn_t* csw_request);
+static csw_status_t ums_verify_csw(iotxn_t* csw_request, uint32_t tag);
 
 static inline uint16_t read16be(uint8_t* ptr) {
     return betoh16(*((uint16_t*)ptr));
@@ -108,16 +183,16 @@ static inline void write64be(uint8_t* ptr, uint64_t n) {
 
 static mx_status_t ums_reset(ums_t* msd) {
     // for all these control requests, data is null, length is 0 because nothing is passed back
-    // value and index not used for first command, though index is supposed to be set to interface number
-    // TODO: check interface number, see if index needs to be set
+    // the reset goes to the interface, and then the halt of each bulk endpoint is cleared
     DEBUG_PRINT(("UMS: performing reset recovery\n"));
     mx_status_t status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_CLASS
-                                            | USB_RECIP_INTERFACE, USB_REQ_RESET, 0x00, 0x00, NULL, 0);
-    status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_CLASS
-                                           | USB_RECIP_INTERFACE, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
+                                            | USB_RECIP_INTERFACE, USB_REQ_RESET, 0x00,
+                                            msd->interface_number, NULL, 0);
+    status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_STANDARD
+                                           | USB_RECIP_ENDPOINT, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
                                            msd->bulk_in_addr, NULL, 0);
-    status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_CLASS
-                                           | USB_RECIP_INTERFACE, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
+    status = usb_control(msd->udev, USB_DIR_OUT | USB_TYPE_STANDARD
+                                           | USB_RECIP_ENDPOINT, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
                                            msd->bulk_out_addr, NULL, 0);
     return status;
 }
@@ -140,19 +215,15 @@ static void ums_queue_request(ums_t* msd, iotxn_t* txn) {
     iotxn_queue(msd->udev, txn);
 }
 
-static mx_status_t ums_send_cbw(ums_t* msd, uint32_t transfer_length, uint8_t flags,
-                                uint8_t command_len, void* command) {
-    iotxn_t* txn = get_free_write(msd);
-    if (!txn) {
-        return ERR_BUFFER_TOO_SMALL;
-    }
+static void ums_fill_cbw(ums_t* msd, iotxn_t* txn, uint32_t tag, uint32_t transfer_length,
+                         uint8_t flags, uint8_t command_len, void* command) {
     // CBWs always have 31 bytes
     txn->length = 31;
 
     // first three blocks are 4 byte
     uint32_t buf_32[3];
     buf_32[0] = htole32(CBW_SIGNATURE);
-    buf_32[1] = htole32(msd->tag_send++);
+    buf_32[1] = htole32(tag);
     buf_32[2] = htole32(transfer_length);
     txn->ops->copyto(txn, buf_32, sizeof(buf_32), 0);
 
@@ -165,20 +236,16 @@ static mx_status_t ums_send_cbw(ums_t* msd, uint32_t transfer_length, uint8_t fl
 
     // copy command_len bytes from the command passed in into the command_len
     txn->ops->copyto(txn, command, command_len, sizeof(buf_32) + sizeof(buf_8));
-    ums_queue_request(msd, txn);
-    return NO_ERROR;
 }
 
-static mx_status_t ums_queue_csw(ums_t* msd) {
-    list_node_t* csw_node = list_remove_head(&msd->free_csw_reqs);
-    if (!csw_node) {
-        DEBUG_PRINT(("UMS:error, no CSW reqs left\n"));
+static mx_status_t ums_send_cbw(ums_t* msd, uint32_t transfer_length, uint8_t flags,
+                                uint8_t command_len, void* command) {
+    iotxn_t* txn = get_free_write(msd);
+    if (!txn) {
         return ERR_BUFFER_TOO_SMALL;
     }
-    iotxn_t* csw_request = containerof(csw_node, iotxn_t, node);
-    csw_request->complete_cb = ums_csw_complete;
-    csw_request->cookie = msd;
-    ums_queue_request(msd, csw_request);
+    ums_fill_cbw(msd, txn, msd->tag_send++, transfer_length, flags, command_len, command);
+    ums_queue_request(msd, txn);
     return NO_ERROR;
 }
 
@@ -200,7 +267,7 @@ static mx_status_t ums_read_csw(ums_t* msd) {
     ums_queue_request(msd, csw_request);
     completion_wait(&completion, MX_TIME_INFINITE);
 
-    csw_status_t csw_error = ums_verify_csw(msd, csw_request);
+    csw_status_t csw_error = ums_verify_csw(csw_request, msd->tag_receive++);
     list_add_tail(&msd->free_csw_reqs, &csw_request->node);
 
     if (csw_error == CSW_SUCCESS) {
@@ -229,22 +296,7 @@ static mx_status_t ums_queue_read(ums_t* msd, uint16_t transfer_length) {
     return NO_ERROR;
 }
 
-static mx_status_t ums_queue_write(ums_t* msd, uint16_t transfer_length, iotxn_t* txn) {
-    list_node_t* write_node = list_remove_head(&msd->free_write_reqs);
-    if (!write_node) {
-        DEBUG_PRINT(("UMS:error, no write reqs left\n"));
-        return ERR_BUFFER_TOO_SMALL;
-    }
-    iotxn_t* write_request = containerof(write_node, iotxn_t, node);
-    write_request->length = transfer_length;
-    void* buffer;
-    write_request->ops->mmap(write_request, &buffer);
-    txn->ops->copyfrom(txn, buffer, (size_t)transfer_length, 0);
-    ums_queue_request(msd, write_request);
-    return NO_ERROR;
-}
-
-static csw_status_t ums_verify_csw(ums_t* msd, iotxn_t* csw_request) {
+static csw_status_t ums_verify_csw(iotxn_t* csw_request, uint32_t tag) {
     uint8_t buffer[UMS_COMMAND_STATUS_WRAPPER_SIZE];
     csw_request->ops->copyfrom(csw_request, buffer, sizeof(buffer), 0);
 
@@ -254,9 +306,9 @@ static csw_status_t ums_verify_csw(ums_t* msd, iotxn_t* csw_request) {
         DEBUG_PRINT(("UMS:invalid csw sig, expected:%08x got:%08x \n", CSW_SIGNATURE, letoh32(ptr_32[0])));
         return CSW_INVALID;
     }
-    // check if tag matches the tag of last CBW
-    if (letoh32(ptr_32[1]) != msd->tag_receive++) {
-        DEBUG_PRINT(("UMS:csw tag mismatch, expected:%08x got in csw:%08x \n", msd->tag_receive - 1, letoh32(ptr_32[1])));
+    // check if tag matches the tag of the CBW
+    if (letoh32(ptr_32[1]) != tag) {
+        DEBUG_PRINT(("UMS:csw tag mismatch, expected:%08x got in csw:%08x \n", tag, letoh32(ptr_32[1])));
         return CSW_TAG_MISMATCH;
     }
     // check if success is true or not?
@@ -283,57 +335,6 @@ static iotxn_t* pop_completed_read(ums_t* msd) {
     return containerof(node, iotxn_t, node);
 }
 
-static void ums_csw_complete(iotxn_t* csw_request, void* cookie) {
-    ums_t* msd = (ums_t*)cookie;
-
-    // TODO: handle error case for CSW by setting iotxn to error and returning
-    iotxn_t* curr_txn = list_remove_head_type(&msd->queued_iotxns, iotxn_t, node);
-
-    // unblock calls to IOCTL_DEVICE_SYNC that are waiting for curr_txn to complete
-    mtx_lock(&msd->mutex);
-    ums_sync_node_t* sync_node;
-    list_for_every_entry(&msd->sync_nodes, sync_node, ums_sync_node_t, node) {
-        if (sync_node->iotxn == curr_txn) {
-            list_delete(&sync_node->node);
-            completion_signal(&sync_node->completion);
-        }
-    }
-    mtx_unlock(&msd->mutex);
-
-    csw_status_t csw_error = ums_verify_csw(msd, csw_request);
-    if (csw_error) {
-        // print error and then reset device due to it
-        DEBUG_PRINT(("UMS: CSW verify returned error. Check ums-hw.h csw_status_t for enum = %d\n", csw_error));
-        if (csw_error != CSW_FAILED) {
-            ums_reset(msd);
-        }
-        list_add_tail(&msd->free_csw_reqs, &csw_request->node);
-        curr_txn->ops->complete(curr_txn, ERR_BAD_STATE, 0);
-        return;
-    }
-    // if head of iotxn list is a read iotxn and CSW reports success, then set its buffer to that
-    // of the latest read request, with limited length based on data residue field in CSW
-    if (curr_txn->opcode == IOTXN_OP_READ) {
-        iotxn_t* read_request = pop_completed_read(msd);
-        if (!read_request) {
-            list_add_tail(&msd->free_csw_reqs, &csw_request->node);
-            return;
-        }
-        // data residue field is the 3rd uint32_t in csw buffer
-        uint32_t temp;
-        csw_request->ops->copyfrom(csw_request, &temp, sizeof(temp), 2 * sizeof(temp));
-        uint32_t residue = letoh32(temp);
-        uint32_t length = read_request->actual - residue;
-        void* buffer;
-        curr_txn->ops->mmap(curr_txn, &buffer);
-        read_request->ops->copyfrom(read_request, buffer, length, 0);
-        list_add_tail(&msd->free_read_reqs, &read_request->node);
-    }
-
-    list_add_tail(&msd->free_csw_reqs, &csw_request->node);
-    curr_txn->ops->complete(curr_txn, NO_ERROR, curr_txn->length);
-}
-
 static void ums_write_complete(iotxn_t* txn, void* cookie) {
     ums_t* msd = (ums_t*)cookie;
     // FIXME what to do with error here?
@@ -515,137 +516,405 @@ static mx_status_t ums_read_capacity16(ums_t* msd, uint8_t* out_data) {
     return status;
 }
 
-static mx_status_t ums_read(mx_device_t* device, iotxn_t* txn) {
-    if (txn->length > UINT32_MAX) return ERR_INVALID_ARGS;
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-
-    uint64_t lba = txn->offset/msd->block_size;
-    uint32_t num_blocks = txn->length/msd->block_size;
-    uint32_t transfer_length = txn->length;
+static size_t ums_latency_bucket(mx_time_t latency) {
+    uint64_t usec = latency / MX_USEC(1);
+    size_t bucket = 0;
+    while ((usec >>= 1) != 0 && bucket < BLOCK_LATENCY_BUCKETS - 1) {
+        bucket++;
+    }
+    return bucket;
+}
 
-    // CBW Configuration
+// fills in the READ or WRITE command for cmd and returns its length
+static uint8_t ums_rw_command(ums_t* msd, ums_cmd_t* cmd, uint8_t* command) {
+    bool read = (cmd->opcode == IOTXN_OP_READ);
+    uint64_t lba = cmd->offset / msd->block_size;
+    uint32_t num_blocks = cmd->length / msd->block_size;
 
     if (msd->use_read_write_16) {
-        uint8_t command[UMS_READ16_COMMAND_LENGTH];
         memset(command, 0, UMS_READ16_COMMAND_LENGTH);
         // set command type
-        command[0] = UMS_READ16;
+        command[0] = (read ? UMS_READ16 : UMS_WRITE16);
         // set lba
         write64be(command + 2, lba);
         // set transfer length in blocks
         write32be(command + 10, num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_IN,
-                                UMS_READ16_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
-        }
+        return UMS_READ16_COMMAND_LENGTH;
     } else if (num_blocks <= UINT16_MAX) {
-        uint8_t command[UMS_READ10_COMMAND_LENGTH];
         memset(command, 0, UMS_READ10_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_READ10;
-        // set lba
+        command[0] = (read ? UMS_READ10 : UMS_WRITE10);
         write32be(command + 2, lba);
-        // set transfer length in blocks
         write16be(command + 7, num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_IN, UMS_READ10_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
-        }
+        return UMS_READ10_COMMAND_LENGTH;
     } else {
-        uint8_t command[UMS_READ12_COMMAND_LENGTH];
         memset(command, 0, UMS_READ12_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_READ12;
-        // set lba
+        command[0] = (read ? UMS_READ12 : UMS_WRITE12);
         write32be(command + 2, lba);
-        // set transfer length in blocks
         write32be(command + 6, num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_IN,
-            UMS_READ12_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
+        return UMS_READ12_COMMAND_LENGTH;
+    }
+}
+
+// completion callback for every request of a command
+static void ums_request_complete(iotxn_t* txn, void* cookie) {
+    ums_cmd_t* cmd = (ums_cmd_t*)cookie;
+    ums_t* msd = cmd->msd;
+
+    // Only the data phase may end early, in its last request, since the CSW
+    // comes next either way. Any other short request has taken what the
+    // device meant for the one after it.
+    mx_status_t status = txn->status;
+    iotxn_t* last_data = (cmd->use_bounce ? cmd->bounce : cmd->clones[cmd->txn_count - 1]);
+    if (status == NO_ERROR && txn->actual < txn->length && txn != last_data) {
+        DEBUG_PRINT(("UMS: short request for command %u\n", cmd->tag));
+        status = ERR_IO;
+    }
+
+    mtx_lock(&msd->mutex);
+    if (status != NO_ERROR) {
+        if (cmd->status == NO_ERROR) {
+            cmd->status = status;
         }
+        msd->recover = true;
     }
+    bool done = (--cmd->pending == 0);
+    mtx_unlock(&msd->mutex);
 
-    // read request sense response
-    status = ums_queue_read(msd, transfer_length);
-    if (status == ERR_BUFFER_TOO_SMALL) {
+    if (done || status != NO_ERROR) {
+        completion_signal(&msd->worker_completion);
+    }
+}
+
+// clones txn to move its data straight to or from its buffer
+static mx_status_t ums_clone_txn(ums_t* msd, ums_cmd_t* cmd, iotxn_t* txn, iotxn_t** out) {
+    iotxn_t* clone;
+    mx_status_t status = txn->ops->clone(txn, &clone, 0);
+    if (status != NO_ERROR) {
         return status;
     }
+    clone->protocol = MX_PROTOCOL_USB;
+    usb_protocol_data_t* proto_data = iotxn_pdata(clone, usb_protocol_data_t);
+    memset(proto_data, 0, sizeof(*proto_data));
+    proto_data->ep_address = (txn->opcode == IOTXN_OP_READ ? msd->bulk_in_addr
+                                                           : msd->bulk_out_addr);
+    clone->complete_cb = ums_request_complete;
+    clone->cookie = cmd;
+    *out = clone;
+    return NO_ERROR;
+}
 
-    // receive CSW
-    return ums_queue_csw(msd);
+// whether next can join cmd, whose last iotxn is prev
+static bool ums_can_merge(ums_t* msd, ums_cmd_t* cmd, iotxn_t* prev, iotxn_t* next) {
+    return next != NULL &&
+           cmd->txn_count < UMS_MAX_MERGE &&
+           next->opcode == cmd->opcode &&
+           next->offset == cmd->offset + cmd->length &&
+           next->length <= msd->max_transfer &&
+           cmd->length + next->length <= UMS_MAX_COMMAND_SIZE &&
+           // each iotxn's data is a USB request of its own, so all but the
+           // last one of a command have to end on a packet boundary
+           prev->length % msd->max_packet == 0;
 }
 
-static mx_status_t ums_write(mx_device_t* device, iotxn_t* txn) {
-    if (txn->length > UINT32_MAX) return ERR_INVALID_ARGS;
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
+// takes the iotxns for the next command off queued_iotxns, if there is a
+// free command for them. called with the mutex held
+static ums_cmd_t* ums_next_command(ums_t* msd) {
+    iotxn_t* txn = list_peek_head_type(&msd->queued_iotxns, iotxn_t, node);
+    if (!txn || list_is_empty(&msd->free_cmds)) {
+        return NULL;
+    }
+    ums_cmd_t* cmd = list_remove_head_type(&msd->free_cmds, ums_cmd_t, node);
+    cmd->opcode = txn->opcode;
+    cmd->txn_count = 0;
+    cmd->use_bounce = false;
+    cmd->status = NO_ERROR;
+
+    if (msd->head_issued == 0 && txn->length <= msd->max_transfer &&
+        ums_clone_txn(msd, cmd, txn, &cmd->clones[0]) == NO_ERROR) {
+        cmd->offset = txn->offset;
+        cmd->length = 0;
+        for (;;) {
+            list_delete(&txn->node);
+            cmd->txns[cmd->txn_count++] = txn;
+            cmd->length += txn->length;
+
+            iotxn_t* next = list_peek_head_type(&msd->queued_iotxns, iotxn_t, node);
+            if (!ums_can_merge(msd, cmd, txn, next) ||
+                ums_clone_txn(msd, cmd, next, &cmd->clones[cmd->txn_count]) != NO_ERROR) {
+                break;
+            }
+            msd->stats.merged++;
+            txn = next;
+        }
+    } else {
+        // too big for one request (or no memory for a clone), so the
+        // iotxn is moved a bounce buffer's worth at a time
+        size_t piece = msd->bounce_size - msd->bounce_size % msd->block_size;
+        cmd->use_bounce = true;
+        cmd->txns[cmd->txn_count++] = txn;
+        cmd->bounce_offset = msd->head_issued;
+        cmd->offset = txn->offset + msd->head_issued;
+        cmd->length = MIN(piece, txn->length - msd->head_issued);
+        msd->head_issued += cmd->length;
+        cmd->last_piece = (msd->head_issued == txn->length);
+        if (cmd->last_piece) {
+            list_delete(&txn->node);
+            msd->head_issued = 0;
+        }
+    }
 
-    uint64_t lba = txn->offset/msd->block_size;
-    uint32_t num_blocks = txn->length/msd->block_size;
-    uint32_t transfer_length = txn->length;
+    cmd->tag = msd->tag_send++;
+    // the CBW, the data and the CSW
+    cmd->pending = 2 + (cmd->use_bounce ? 1 : cmd->txn_count);
+    list_add_tail(&msd->active_cmds, &cmd->node);
 
-    if (msd->use_read_write_16) {
-        uint8_t command[UMS_WRITE16_COMMAND_LENGTH];
-        memset(command, 0, UMS_WRITE16_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_WRITE16;
-        // set lba
-        uint64_t* lba_ptr = (uint64_t*)&(command[2]);
-        *lba_ptr = htobe64(lba);
-        // set transfer length
-        uint32_t* transfer_len_ptr = (uint32_t*)&(command[10]);
-        *transfer_len_ptr = htobe32(num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_OUT,
-                                UMS_WRITE16_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
+    msd->stats.commands++;
+    if (++msd->stats.in_flight > msd->stats.max_in_flight) {
+        msd->stats.max_in_flight = msd->stats.in_flight;
+    }
+    return cmd;
+}
+
+// queues the CBW, data and CSW requests of cmd. The device works through
+// the commands in order, so this need not wait for the commands before it.
+static void ums_issue_command(ums_t* msd, ums_cmd_t* cmd) {
+    bool read = (cmd->opcode == IOTXN_OP_READ);
+    uint8_t command[UMS_READ16_COMMAND_LENGTH];
+    uint8_t command_len = ums_rw_command(msd, cmd, command);
+    ums_fill_cbw(msd, cmd->cbw, cmd->tag, cmd->length, (read ? USB_DIR_IN : USB_DIR_OUT),
+                 command_len, command);
+
+    iotxn_t* bounce = cmd->bounce;
+    if (cmd->use_bounce) {
+        usb_protocol_data_t* proto_data = iotxn_pdata(bounce, usb_protocol_data_t);
+        proto_data->ep_address = (read ? msd->bulk_in_addr : msd->bulk_out_addr);
+        bounce->length = cmd->length;
+        if (!read) {
+            void* buffer;
+            bounce->ops->mmap(bounce, &buffer);
+            cmd->txns[0]->ops->copyfrom(cmd->txns[0], buffer, cmd->length, cmd->bounce_offset);
         }
-    } else if (num_blocks <= UINT16_MAX) {
-        uint8_t command[UMS_WRITE10_COMMAND_LENGTH];
-        memset(command, 0, UMS_WRITE10_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_WRITE10;
-        // set lba
-        uint32_t* lba_ptr = (uint32_t*)&(command[2]);
-        *lba_ptr = htobe32(lba);
-        // set transfer length in blocks
-        uint16_t* transfer_len_ptr = (uint16_t*)&(command[7]);
-        *transfer_len_ptr = htobe16(num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_OUT,
-                                UMS_WRITE10_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
+    }
+
+    cmd->issued = mx_time_get(MX_CLOCK_MONOTONIC);
+    ums_queue_request(msd, cmd->cbw);
+    if (cmd->use_bounce) {
+        ums_queue_request(msd, bounce);
+    } else {
+        for (uint32_t i = 0; i < cmd->txn_count; i++) {
+            ums_queue_request(msd, cmd->clones[i]);
+        }
+    }
+    ums_queue_request(msd, cmd->csw);
+}
+
+static void ums_complete_txn(ums_t* msd, iotxn_t* txn, mx_status_t status) {
+    mtx_lock(&msd->mutex);
+    msd->stats.requests++;
+    if (status != NO_ERROR) {
+        msd->stats.errors++;
+    } else if (txn->opcode == IOTXN_OP_READ) {
+        msd->stats.bytes_read += txn->length;
+    } else {
+        msd->stats.bytes_written += txn->length;
+    }
+    mtx_unlock(&msd->mutex);
+
+    txn->ops->complete(txn, status, (status == NO_ERROR ? txn->length : 0));
+}
+
+// completes the iotxns of a command the device is done with, and returns
+// how many it completed
+static uint32_t ums_finish_command(ums_t* msd, ums_cmd_t* cmd) {
+    bool read = (cmd->opcode == IOTXN_OP_READ);
+    mx_status_t status = cmd->status;
+    mx_off_t done = 0;
+
+    if (status == NO_ERROR) {
+        csw_status_t csw_error = ums_verify_csw(cmd->csw, cmd->tag);
+        if (csw_error == CSW_SUCCESS) {
+            // data residue field is the 3rd uint32_t in csw buffer
+            uint32_t temp;
+            cmd->csw->ops->copyfrom(cmd->csw, &temp, sizeof(temp), 2 * sizeof(temp));
+            done = cmd->length - MIN(letoh32(temp), cmd->length);
+        } else {
+            // print error and then recover from it, unless the command merely failed
+            DEBUG_PRINT(("UMS: CSW verify returned error. Check ums-hw.h csw_status_t for enum = %d\n", csw_error));
+            if (csw_error != CSW_FAILED) {
+                mtx_lock(&msd->mutex);
+                msd->recover = true;
+                mtx_unlock(&msd->mutex);
+            }
+            status = ERR_IO;
         }
     } else {
-        uint8_t command[UMS_WRITE12_COMMAND_LENGTH];
-        memset(command, 0, UMS_WRITE12_COMMAND_LENGTH);
-        // set command type
-        command[0] = UMS_WRITE12;
-        // set lba
-        uint32_t* lba_ptr = (uint32_t*)&(command[2]);
-        *lba_ptr = htobe32(lba);
-        // set transfer length
-        uint32_t* transfer_len_ptr = (uint32_t*)&(command[6]);
-        *transfer_len_ptr = htobe32(num_blocks);
-        status = ums_send_cbw(msd, transfer_length, USB_DIR_OUT,
-                                UMS_WRITE12_COMMAND_LENGTH, command);
-        if (status == ERR_BUFFER_TOO_SMALL) {
-            return status;
+        DEBUG_PRINT(("UMS: request for command %u failed: %d\n", cmd->tag, status));
+    }
+
+    if (cmd->use_bounce) {
+        iotxn_t* txn = cmd->txns[0];
+        if (status == NO_ERROR && done < cmd->length) {
+            status = ERR_IO;
+        }
+        if (status == NO_ERROR && read) {
+            void* buffer;
+            cmd->bounce->ops->mmap(cmd->bounce, &buffer);
+            txn->ops->copyto(txn, buffer, cmd->length, cmd->bounce_offset);
+        }
+        if (status != NO_ERROR) {
+            // kept until the last piece completes the iotxn
+            txn->status = status;
+        }
+        if (!cmd->last_piece) {
+            return 0;
         }
+        ums_complete_txn(msd, txn, txn->status);
+        return 1;
     }
 
-    //write response
-    status = ums_queue_write(msd, transfer_length, txn);
-    if (status == ERR_BUFFER_TOO_SMALL) {
-        return status;
+    for (uint32_t i = 0; i < cmd->txn_count; i++) {
+        iotxn_t* txn = cmd->txns[i];
+        // the clone has to go before the iotxn it was cloned from
+        cmd->clones[i]->ops->release(cmd->clones[i]);
+        mx_status_t txn_status = status;
+        if (txn_status == NO_ERROR && done < txn->length) {
+            txn_status = ERR_IO;
+        }
+        done -= MIN(done, txn->length);
+        ums_complete_txn(msd, txn, txn_status);
     }
+    return cmd->txn_count;
+}
 
-    // receive CSW
-    return ums_queue_csw(msd);
+// finishes the commands the device is done with, oldest first. Once
+// recovery is needed, the rest wait for it.
+static void ums_retire_commands(ums_t* msd) {
+    for (;;) {
+        mtx_lock(&msd->mutex);
+        ums_cmd_t* cmd = list_peek_head_type(&msd->active_cmds, ums_cmd_t, node);
+        if (!cmd || cmd->pending || msd->recover) {
+            mtx_unlock(&msd->mutex);
+            return;
+        }
+        list_delete(&cmd->node);
+        mtx_unlock(&msd->mutex);
+
+        mx_time_t latency = mx_time_get(MX_CLOCK_MONOTONIC) - cmd->issued;
+        uint32_t completed = ums_finish_command(msd, cmd);
+
+        mtx_lock(&msd->mutex);
+        msd->stats.in_flight--;
+        msd->stats.latency[ums_latency_bucket(latency)]++;
+        list_add_tail(&msd->free_cmds, &cmd->node);
+
+        // unblock calls to IOCTL_DEVICE_SYNC that are waiting for these iotxns
+        msd->txns_completed += completed;
+        ums_sync_node_t* sync_node;
+        ums_sync_node_t* temp;
+        list_for_every_entry_safe(&msd->sync_nodes, sync_node, temp, ums_sync_node_t, node) {
+            if (sync_node->count <= msd->txns_completed) {
+                list_delete(&sync_node->node);
+                completion_signal(&sync_node->completion);
+            }
+        }
+        mtx_unlock(&msd->mutex);
+    }
+}
+
+// brings the device back in step with the commands after a request failed
+// or a CSW was bad. Every request still queued is cancelled, the commands
+// from the first one which failed on are failed, as the device's answers to
+// them cannot be trusted, and the device gets reset recovery. Called on the
+// worker thread, which issues no commands meanwhile.
+static void ums_recover(ums_t* msd) {
+    DEBUG_PRINT(("UMS: recovering from a failed command\n"));
+    usb_reset_endpoint(msd->udev, msd->bulk_in_addr);
+    usb_reset_endpoint(msd->udev, msd->bulk_out_addr);
+
+    // if the host controller cannot reset the endpoints, the requests only
+    // complete once the device goes away
+    ums_cmd_t* cmd;
+    for (;;) {
+        completion_reset(&msd->worker_completion);
+        bool busy = false;
+        mtx_lock(&msd->mutex);
+        list_for_every_entry(&msd->active_cmds, cmd, ums_cmd_t, node) {
+            busy = busy || cmd->pending > 0;
+        }
+        mtx_unlock(&msd->mutex);
+        if (!busy) {
+            break;
+        }
+        completion_wait(&msd->worker_completion, MX_TIME_INFINITE);
+    }
+
+    mtx_lock(&msd->mutex);
+    // if no command has failed, a bad CSW was the trouble and its command
+    // is already gone
+    ums_cmd_t* first = NULL;
+    list_for_every_entry(&msd->active_cmds, cmd, ums_cmd_t, node) {
+        if (cmd->status != NO_ERROR) {
+            first = cmd;
+            break;
+        }
+    }
+    bool failed = (first == NULL);
+    list_for_every_entry(&msd->active_cmds, cmd, ums_cmd_t, node) {
+        failed = failed || (cmd == first);
+        if (failed && cmd->status == NO_ERROR) {
+            cmd->status = ERR_IO;
+        }
+    }
+    msd->recover = false;
+    mtx_unlock(&msd->mutex);
+
+    // clearing the halts resets the device's data toggles, including that
+    // of an endpoint which never stalled, so the host's are reset again to
+    // match
+    ums_reset(msd);
+    usb_reset_endpoint(msd->udev, msd->bulk_in_addr);
+    usb_reset_endpoint(msd->udev, msd->bulk_out_addr);
+}
+
+static void ums_issue_commands(ums_t* msd) {
+    for (;;) {
+        mtx_lock(&msd->mutex);
+        ums_cmd_t* cmd = (msd->dead || msd->recover ? NULL : ums_next_command(msd));
+        mtx_unlock(&msd->mutex);
+        if (!cmd) {
+            return;
+        }
+        ums_issue_command(msd, cmd);
+    }
+}
+
+static int ums_worker_thread(void* arg) {
+    ums_t* msd = (ums_t*)arg;
+
+    for (;;) {
+        completion_wait(&msd->worker_completion, MX_TIME_INFINITE);
+        completion_reset(&msd->worker_completion);
+
+        ums_retire_commands(msd);
+
+        mtx_lock(&msd->mutex);
+        bool recover = msd->recover;
+        mtx_unlock(&msd->mutex);
+        if (recover) {
+            ums_recover(msd);
+            ums_retire_commands(msd);
+        }
+
+        ums_issue_commands(msd);
+
+        // once the device goes away, wait only for the commands in flight
+        mtx_lock(&msd->mutex);
+        bool done = (msd->dead && list_is_empty(&msd->active_cmds));
+        mtx_unlock(&msd->mutex);
+        if (done) {
+            return 0;
+        }
+    }
 }
 
 static mx_status_t ums_toggle_removable(mx_device_t* device, bool removable) {
@@ -674,7 +943,24 @@ static void ums_unbind(mx_device_t* device) {
 
 static mx_status_t ums_release(mx_device_t* device) {
     ums_t* msd = get_ums(device);
+    if (msd->worker_running) {
+        mtx_lock(&msd->mutex);
+        msd->dead = true;
+        mtx_unlock(&msd->mutex);
+        completion_signal(&msd->worker_completion);
+        thrd_join(msd->worker, NULL);
+    }
+
     iotxn_t* txn;
+    while ((txn = list_remove_head_type(&msd->queued_iotxns, iotxn_t, node)) != NULL) {
+        txn->ops->complete(txn, ERR_REMOTE_CLOSED, 0);
+    }
+    for (int i = 0; i < UMS_QUEUE_DEPTH; i++) {
+        ums_cmd_t* cmd = &msd->cmds[i];
+        if (cmd->cbw) cmd->cbw->ops->release(cmd->cbw);
+        if (cmd->csw) cmd->csw->ops->release(cmd->csw);
+        if (cmd->bounce) cmd->bounce->ops->release(cmd->bounce);
+    }
     while ((txn = list_remove_head_type(&msd->free_csw_reqs, iotxn_t, node)) != NULL) {
         txn->ops->release(txn);
     }
@@ -691,38 +977,44 @@ static mx_status_t ums_release(mx_device_t* device) {
 
 static void ums_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     ums_t* msd = get_ums(dev);
-    mtx_lock(&msd->mutex);
 
     uint32_t block_size = msd->block_size;
     // offset must be aligned to block size
     if (txn->offset % block_size) {
         DEBUG_PRINT(("UMS:offset on iotxn (%" PRIu64 ") not aligned to block size(%d)\n", txn->offset, block_size));
         txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
-        goto out;
+        return;
     }
 
     if (txn->length % block_size) {
         DEBUG_PRINT(("UMS:length on iotxn (%" PRIu64 ") not aligned to block size(%d)\n", txn->length, block_size));
         txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
-        goto out;
+        return;
     }
 
-    mx_status_t status;
-    if (txn->opcode == IOTXN_OP_READ) {
-        status = ums_read(dev, txn);
-    }else if (txn->opcode == IOTXN_OP_WRITE) {
-        status = ums_write(dev, txn);
-    } else {
-        status = ERR_INVALID_ARGS;
+    if (txn->opcode != IOTXN_OP_READ && txn->opcode != IOTXN_OP_WRITE) {
+        txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+        return;
     }
-    if (status == NO_ERROR) {
-        list_add_tail(&msd->queued_iotxns, &txn->node);
-    } else {
-        txn->ops->complete(txn, status, 0);
+    if (txn->length == 0) {
+        txn->ops->complete(txn, NO_ERROR, 0);
+        return;
     }
 
-out:
+    mtx_lock(&msd->mutex);
+    if (msd->dead) {
+        mtx_unlock(&msd->mutex);
+        txn->ops->complete(txn, ERR_REMOTE_CLOSED, 0);
+        return;
+    }
+    // the status is only used by an iotxn split over several commands,
+    // to remember that one of them failed
+    txn->status = NO_ERROR;
+    list_add_tail(&msd->queued_iotxns, &txn->node);
+    msd->txns_queued++;
     mtx_unlock(&msd->mutex);
+
+    completion_signal(&msd->worker_completion);
 }
 
 static ssize_t ums_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t cmdlen, void* reply, size_t max) {
@@ -741,16 +1033,25 @@ static ssize_t ums_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t
          *blksize = msd->block_size;
          return sizeof(*blksize);
     }
+    case IOCTL_BLOCK_GET_DEVICE_STATS: {
+        block_device_stats_t* stats = reply;
+        if (max < sizeof(*stats)) return ERR_BUFFER_TOO_SMALL;
+        mtx_lock(&msd->mutex);
+        *stats = msd->stats;
+        mtx_unlock(&msd->mutex);
+        return sizeof(*stats);
+    }
     case IOCTL_DEVICE_SYNC: {
         ums_sync_node_t node;
 
         mtx_lock(&msd->mutex);
-        if (list_is_empty(&msd->queued_iotxns)) {
+        if (msd->txns_completed == msd->txns_queued) {
             mtx_unlock(&msd->mutex);
             return NO_ERROR;
         }
-        // queue a stack allocated sync node on ums_t.sync_nodes
-        node.iotxn = list_peek_tail_type(&msd->queued_iotxns, iotxn_t, node);
+        // queue a stack allocated sync node on ums_t.sync_nodes, to be
+        // signalled once every iotxn queued so far has completed
+        node.count = msd->txns_queued;
         completion_reset(&node.completion);
         list_add_head(&msd->sync_nodes, &node.node);
         mtx_unlock(&msd->mutex);
@@ -840,6 +1141,18 @@ static int ums_start_thread(void* arg) {
     DEBUG_PRINT(("UMS:block size is: 0x%08x\n", msd->block_size));
     DEBUG_PRINT(("UMS:total blocks is: %" PRId64 "\n", msd->total_blocks));
     DEBUG_PRINT(("UMS:total size is: %" PRId64 "\n", msd->total_blocks * msd->block_size));
+
+    if (msd->block_size == 0 || msd->block_size > msd->bounce_size) {
+        printf("UMS: unsupported block size %u\n", msd->block_size);
+        status = ERR_NOT_SUPPORTED;
+        goto fail;
+    }
+    if (thrd_create_with_name(&msd->worker, ums_worker_thread, msd, "ums_worker") != thrd_success) {
+        status = ERR_NO_RESOURCES;
+        goto fail;
+    }
+    msd->worker_running = true;
+
     msd->device.protocol_id = MX_PROTOCOL_BLOCK;
     status = device_add(&msd->device, msd->udev);
     if (status == NO_ERROR) return NO_ERROR;
@@ -866,19 +1179,23 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device, void** coo
         usb_desc_iter_release(&iter);
         return ERR_NOT_SUPPORTED;
     }
+    uint8_t interface_number = intf->bInterfaceNumber;
 
     uint8_t bulk_in_addr = 0;
     uint8_t bulk_out_addr = 0;
+    uint16_t max_packet = 0;
 
    usb_endpoint_descriptor_t* endp = usb_desc_iter_next_endpoint(&iter);
     while (endp) {
         if (usb_ep_direction(endp) == USB_ENDPOINT_OUT) {
             if (usb_ep_type(endp) == USB_ENDPOINT_BULK) {
                 bulk_out_addr = endp->bEndpointAddress;
+                max_packet = MAX(max_packet, usb_ep_max_packet(endp));
             }
         } else {
             if (usb_ep_type(endp) == USB_ENDPOINT_BULK) {
                 bulk_in_addr = endp->bEndpointAddress;
+                max_packet = MAX(max_packet, usb_ep_max_packet(endp));
             } else if (usb_ep_type(endp) == USB_ENDPOINT_INTERRUPT) {
                 DEBUG_PRINT(("UMS:bulk interrupt endpoint found. \nHowever CBI still needs to be implemented so this device probably wont work\n"));
             }
@@ -887,7 +1204,7 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device, void** coo
     }
     usb_desc_iter_release(&iter);
 
-    if (!bulk_in_addr || !bulk_out_addr) {
+    if (!bulk_in_addr || !bulk_out_addr || !max_packet) {
         DEBUG_PRINT(("UMS:ums_bind could not find endpoints\n"));
         return ERR_NOT_SUPPORTED;
     }
@@ -905,11 +1222,20 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device, void** coo
     list_initialize(&msd->completed_reads);
     list_initialize(&msd->completed_csws);
     list_initialize(&msd->sync_nodes);
+    list_initialize(&msd->free_cmds);
+    list_initialize(&msd->active_cmds);
+    msd->worker_completion = COMPLETION_INIT;
 
     msd->udev = device;
     msd->driver = driver;
+    msd->interface_number = interface_number;
     msd->bulk_in_addr = bulk_in_addr;
     msd->bulk_out_addr = bulk_out_addr;
+    msd->max_packet = max_packet;
+    msd->max_transfer = MIN(usb_get_max_transfer_size(device, bulk_in_addr),
+                            usb_get_max_transfer_size(device, bulk_out_addr));
+    msd->bounce_size = MIN(msd->max_transfer, UMS_BOUNCE_SIZE);
+    msd->stats.queue_depth = UMS_QUEUE_DEPTH;
 
     mx_status_t status = NO_ERROR;
     for (int i = 0; i < READ_REQ_COUNT; i++) {
@@ -942,6 +1268,26 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device, void** coo
         txn->cookie = msd;
         list_add_head(&msd->free_write_reqs, &txn->node);
     }
+    for (int i = 0; i < UMS_QUEUE_DEPTH; i++) {
+        ums_cmd_t* cmd = &msd->cmds[i];
+        cmd->msd = msd;
+        cmd->cbw = usb_alloc_iotxn(bulk_out_addr, UMS_COMMAND_BLOCK_WRAPPER_SIZE, 0);
+        cmd->csw = usb_alloc_iotxn(bulk_in_addr, UMS_COMMAND_STATUS_WRAPPER_SIZE, 0);
+        // the endpoint is set each time the bounce buffer is used
+        cmd->bounce = usb_alloc_iotxn(bulk_in_addr, msd->bounce_size, 0);
+        if (!cmd->cbw || !cmd->csw || !cmd->bounce) {
+            status = ERR_NO_MEMORY;
+            goto fail;
+        }
+        cmd->csw->length = UMS_COMMAND_STATUS_WRAPPER_SIZE;
+        cmd->cbw->complete_cb = ums_request_complete;
+        cmd->cbw->cookie = cmd;
+        cmd->csw->complete_cb = ums_request_complete;
+        cmd->csw->cookie = cmd;
+        cmd->bounce->complete_cb = ums_request_complete;
+        cmd->bounce->cookie = cmd;
+        list_add_tail(&msd->free_cmds, &cmd->node);
+    }
 
     uint8_t lun = 0;
     ums_get_max_lun(msd, (void*)&lun);
@@ -134,11 +134,14 @@ size_t xhci_get_max_transfer_size(mx_device_t* device, uint32_t device_id, uint8
         // control requests have uint16 length field
         return UINT16_MAX;
     }
-    // non-control transfers consist of normal transfer TRBs plus one data event TRB
-    // Assuming contiguous data buffers here.
-    // This will need to change when we add scatter/gather support.
-    // Subtract 1 to reserve a TRB for data event.
-    return XHCI_MAX_DATA_BUFFER * (TRANSFER_RING_SIZE - 1);
+    // non-control transfers consist of normal transfer TRBs plus one data event TRB.
+    // A physically scattered buffer may need a TRB for every page it touches,
+    // one more page than its length if it does not start on a page boundary.
+    // The ring has TRANSFER_RING_SIZE - 1 usable TRBs after the link TRB, and one
+    // of those is always kept free so a full ring is not mistaken for an empty one.
+    // Subtract 1 for the link TRB, 1 for the free TRB, 1 for the data event TRB
+    // and 1 for the extra page of an unaligned buffer.
+    return PAGE_SIZE * (TRANSFER_RING_SIZE - 4);
 }
 
 usb_hci_protocol_t xhci_hci_protocol = {
@@ -4,6 +4,7 @@
 
 #include <magenta/hw/usb.h>
 #include <stdio.h>
+#include <string.h>
 #include <threads.h>
 #include <ddk/protocol/usb.h>
 
@@ -29,41 +30,143 @@ static void print_trb(xhci_t* xhci, xhci_transfer_ring_t* ring, xhci_trb_t* trb)
 // reads a range of bits from an integer
 #define READ_FIELD(i, start, bits) (((i) >> (start)) & ((1 << (bits)) - 1))
 
-mx_status_t xhci_reset_endpoint(xhci_t* xhci, uint32_t slot_id, uint32_t endpoint) {
-    xprintf("xhci_reset_endpoint %d %d\n", slot_id, endpoint);
-
-    xhci_slot_t* slot = &xhci->slots[slot_id];
-    xhci_endpoint_t* ep = &slot->eps[endpoint];
-    xhci_transfer_ring_t* transfer_ring = &ep->transfer_ring;
+// A transfer never has more physically contiguous runs than there are
+// TRBs in its ring, as each run takes at least one.
+#define XHCI_MAX_SG TRANSFER_RING_SIZE
 
-    mtx_lock(&ep->lock);
+// returns the number of TRBs needed for a physically contiguous run,
+// as a TRB's buffer may not cross a 64K boundary
+static size_t xhci_run_trbs(mx_paddr_t paddr, size_t length) {
+    mx_paddr_t last = paddr + length - 1;
+    return (last / XHCI_MAX_DATA_BUFFER) - (paddr / XHCI_MAX_DATA_BUFFER) + 1;
+}
 
-    // first reset the endpoint
+static int xhci_endpoint_command(xhci_t* xhci, uint32_t slot_id, uint32_t endpoint,
+                                 uint32_t command_type, uint64_t ptr) {
     xhci_sync_command_t command;
     xhci_sync_command_init(&command);
     // command expects device context index, so increment endpoint by 1
     uint32_t control = (slot_id << TRB_SLOT_ID_START) | ((endpoint + 1) << TRB_ENDPOINT_ID_START);
-    xhci_post_command(xhci, TRB_CMD_RESET_ENDPOINT, 0, control, &command.context);
+    xhci_post_command(xhci, command_type, ptr, control, &command.context);
+    return xhci_sync_command_wait(&command);
+}
+
+// Drops the stopped endpoint and adds it back as it was, with its dequeue
+// pointer at |ptr|. Reset Endpoint only applies to a halted endpoint, so
+// this is how the data toggle, or sequence number, of one that is not
+// halted goes back to 0.
+static int xhci_reconfigure_endpoint(xhci_t* xhci, uint32_t slot_id, uint32_t endpoint,
+                                     uint64_t ptr) {
+    xhci_slot_t* slot = &xhci->slots[slot_id];
+    xhci_endpoint_context_t* epc = slot->eps[endpoint].epc;
+
+    // xhci->input_context belongs to the device manager thread
+    size_t size = xhci->context_size * (endpoint + 3);
+    io_buffer_t buffer;
+    if (io_buffer_init(&buffer, size, IO_BUFFER_RW) != NO_ERROR) {
+        return TRB_CC_RESOURCE_ERROR;
+    }
+    uint8_t* input_context = (uint8_t*)io_buffer_virt(&buffer);
+    memset(input_context, 0, size);
+
+    xhci_input_control_context_t* icc = (xhci_input_control_context_t*)input_context;
+    xhci_slot_context_t* sc = (xhci_slot_context_t*)&input_context[1 * xhci->context_size];
+    xhci_endpoint_context_t* iepc =
+        (xhci_endpoint_context_t*)&input_context[(endpoint + 2) * xhci->context_size];
+
+    XHCI_WRITE32(&icc->drop_context_flags, XHCI_ICC_EP_FLAG(endpoint));
+    XHCI_WRITE32(&icc->add_context_flags, XHCI_ICC_SLOT_FLAG | XHCI_ICC_EP_FLAG(endpoint));
+    XHCI_WRITE32(&sc->sc0, XHCI_READ32(&slot->sc->sc0));
+    XHCI_WRITE32(&sc->sc1, XHCI_READ32(&slot->sc->sc1));
+    XHCI_WRITE32(&sc->sc2, XHCI_READ32(&slot->sc->sc2));
+
+    XHCI_WRITE32(&iepc->epc0, XHCI_READ32(&epc->epc0));
+    XHCI_SET_BITS32(&iepc->epc0, EP_CTX_EP_STATE_START, EP_CTX_EP_STATE_BITS, 0);
+    XHCI_WRITE32(&iepc->epc1, XHCI_READ32(&epc->epc1));
+    XHCI_WRITE32(&iepc->epc2, ((uint32_t)ptr & EP_CTX_TR_DEQUEUE_LO_MASK) | (ptr & EP_CTX_DCS));
+    XHCI_WRITE32(&iepc->tr_dequeue_hi, (uint32_t)(ptr >> 32));
+    XHCI_WRITE32(&iepc->epc4, XHCI_READ32(&epc->epc4));
+
+    xhci_sync_command_t command;
+    xhci_sync_command_init(&command);
+    xhci_post_command(xhci, TRB_CMD_CONFIGURE_EP, io_buffer_phys(&buffer),
+                      (slot_id << TRB_SLOT_ID_START), &command.context);
     int cc = xhci_sync_command_wait(&command);
 
-    if (cc != TRB_CC_SUCCESS) {
+    io_buffer_release(&buffer);
+    return cc;
+}
+
+// Stops the endpoint, or resets it if it is halted, and drops every iotxn
+// queued on it, completing them with ERR_CANCELED. iotxns queued meanwhile
+// are deferred until the endpoint runs again. Either way the endpoint's
+// data toggle, or sequence number, goes back to 0, as it does on the
+// device when CLEAR_FEATURE(ENDPOINT_HALT) is sent to it.
+mx_status_t xhci_reset_endpoint(xhci_t* xhci, uint32_t slot_id, uint32_t endpoint) {
+    xprintf("xhci_reset_endpoint %d %d\n", slot_id, endpoint);
+
+    xhci_slot_t* slot = &xhci->slots[slot_id];
+    xhci_endpoint_t* ep = &slot->eps[endpoint];
+    xhci_transfer_ring_t* transfer_ring = &ep->transfer_ring;
+
+    list_node_t canceled;
+    list_initialize(&canceled);
+    list_node_t* node;
+
+    mtx_lock(&ep->lock);
+    if (!ep->enabled || ep->resetting) {
         mtx_unlock(&ep->lock);
-        return ERR_INTERNAL;
+        return ERR_BAD_STATE;
     }
+    ep->resetting = true;
+    // the iotxns deferred so far were queued before the reset
+    while ((node = list_remove_head(&ep->deferred_txns)) != NULL) {
+        list_add_tail(&canceled, node);
+    }
+    uint32_t state = XHCI_GET_BITS32(&ep->epc->epc0, EP_CTX_EP_STATE_START, EP_CTX_EP_STATE_BITS);
+    mtx_unlock(&ep->lock);
 
-    // then move transfer ring's dequeue pointer passed the failed transaction
-    xhci_sync_command_init(&command);
+    // The commands are waited for without the endpoint lock, which the
+    // event thread needs for any transfer event that comes before them.
+    // Nothing new goes on the ring meanwhile.
+    int cc = TRB_CC_SUCCESS;
+    if (state == 1 /* running */) {
+        cc = xhci_endpoint_command(xhci, slot_id, endpoint, TRB_CMD_STOP_ENDPOINT, 0);
+        if (cc == TRB_CC_CONTEXT_STATE_ERROR) {
+            // it halted before it could be stopped
+            state = 2;
+        }
+    }
+
+    // the dequeue pointer moves past everything queued
     uint64_t ptr = xhci_transfer_ring_current_phys(transfer_ring);
     ptr |= transfer_ring->pcs;
-    // command expects device context index, so increment endpoint by 1
-    control = (slot_id << TRB_SLOT_ID_START) | ((endpoint + 1) << TRB_ENDPOINT_ID_START);
-    xhci_post_command(xhci, TRB_CMD_SET_TR_DEQUEUE, ptr, control, &command.context);
-    cc = xhci_sync_command_wait(&command);
-
-    transfer_ring->dequeue_ptr = transfer_ring->current;
+    if (state == 2 /* halted */) {
+        // this clears the data toggle too
+        cc = xhci_endpoint_command(xhci, slot_id, endpoint, TRB_CMD_RESET_ENDPOINT, 0);
+        if (cc == TRB_CC_SUCCESS) {
+            cc = xhci_endpoint_command(xhci, slot_id, endpoint, TRB_CMD_SET_TR_DEQUEUE, ptr);
+        }
+    } else if (cc == TRB_CC_SUCCESS) {
+        cc = xhci_reconfigure_endpoint(xhci, slot_id, endpoint, ptr);
+    }
 
+    mtx_lock(&ep->lock);
+    if (cc == TRB_CC_SUCCESS) {
+        transfer_ring->dequeue_ptr = transfer_ring->current;
+        while ((node = list_remove_head(&ep->pending_requests)) != NULL) {
+            list_add_tail(&canceled, node);
+        }
+    }
+    ep->resetting = false;
     mtx_unlock(&ep->lock);
 
+    iotxn_t* txn;
+    while ((txn = list_remove_head_type(&canceled, iotxn_t, node)) != NULL) {
+        txn->ops->complete(txn, ERR_CANCELED, 0);
+    }
+    xhci_process_deferred_txns(xhci, ep, false);
+
     return (cc == TRB_CC_SUCCESS ? NO_ERROR : ERR_INTERNAL);
 }
 
@@ -93,10 +196,27 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, iotxn_t* txn) {
         return ERR_INVALID_ARGS;
     }
 
+    // the buffer need not be physically contiguous; the data stage gets a
+    // chain of TRBs for each of its runs
     size_t length = txn->length;
-    mx_paddr_t phys_addr = 0;
+    iotxn_sg_t sg[XHCI_MAX_SG];
+    size_t sg_count = 0;
+    size_t data_trbs = 0;
     if (length > 0) {
-        txn->ops->physmap(txn, &phys_addr);
+        mx_status_t status = txn->ops->physmap_sg(txn, 0, length, sg, countof(sg), &sg_count);
+        if (status != NO_ERROR) {
+            return status;
+        }
+        size_t mapped = 0;
+        for (size_t i = 0; i < sg_count; i++) {
+            mapped += sg[i].length;
+            data_trbs += xhci_run_trbs(sg[i].paddr, sg[i].length);
+        }
+        if (mapped != length) {
+            // too scattered to ever fit in the ring
+            printf("xhci_queue_transfer: buffer has more than %zu runs\n", countof(sg));
+            return ERR_INVALID_ARGS;
+        }
     }
     uint64_t frame = proto_data->frame;
     uint8_t direction;
@@ -118,12 +238,12 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, iotxn_t* txn) {
     }
 
     uint32_t interruptor_target = 0;
-    size_t data_packets = (length + XHCI_MAX_DATA_BUFFER - 1) / XHCI_MAX_DATA_BUFFER;
-    size_t required_trbs = data_packets + 1;   // add 1 for event data TRB
+    size_t required_trbs = data_trbs + 1;   // add 1 for event data TRB
     if (setup) {
         required_trbs += 2;
     }
-    if (required_trbs > ring->size) {
+    // one TRB is always left free (see below), so only ring->size - 1 are usable
+    if (required_trbs >= ring->size) {
         // no way this will ever succeed
         printf("required_trbs %zu ring->size %zu\n", required_trbs, ring->size);
         return ERR_INVALID_ARGS;
@@ -133,13 +253,13 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, iotxn_t* txn) {
     if (ep_type >= 4) ep_type -= 4;
     bool isochronous = (ep_type == USB_ENDPOINT_ISOCHRONOUS);
     if (isochronous) {
-        if (!phys_addr || !length) return ERR_INVALID_ARGS;
+        if (!length) return ERR_INVALID_ARGS;
         // we currently do not support isoch buffers that span page boundaries
         // Section 3.2.11 in the XHCI spec describes how to handle this, but since
         // iotxn buffers are always close to the beginning of a page, this shouldn't be necessary.
-        mx_paddr_t start_page = phys_addr & ~(xhci->page_size - 1);
-        mx_paddr_t end_page = (phys_addr + length - 1) & ~(xhci->page_size - 1);
-        if (start_page != end_page) {
+        mx_paddr_t start_page = sg[0].paddr & ~(xhci->page_size - 1);
+        mx_paddr_t end_page = (sg[0].paddr + length - 1) & ~(xhci->page_size - 1);
+        if (sg_count != 1 || start_page != end_page) {
             printf("isoch buffer spans page boundary in xhci_queue_transfer\n");
             return ERR_INVALID_ARGS;
         }
@@ -165,8 +285,12 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, iotxn_t* txn) {
 
     mtx_lock(&ep->lock);
 
-    // don't allow queueing new requests if we have deferred requests
-    if (!list_is_empty(&ep->deferred_txns) || required_trbs > xhci_transfer_ring_free_trbs(ring)) {
+    // don't allow queueing new requests if we have deferred requests, or
+    // while the endpoint is being reset.
+    // Keep one TRB free: a completely full ring would have current == dequeue_ptr
+    // and be indistinguishable from an empty one.
+    if (ep->resetting || !list_is_empty(&ep->deferred_txns) ||
+        required_trbs >= xhci_transfer_ring_free_trbs(ring)) {
         list_add_tail(&ep->deferred_txns, &txn->node);
         mtx_unlock(&ep->lock);
         return ERR_BUFFER_TOO_SMALL;
@@ -196,43 +320,70 @@ mx_status_t xhci_queue_transfer(xhci_t* xhci, iotxn_t* txn) {
 
     // Data Stage
     if (length > 0) {
-        size_t remaining = length;
+        // TD Size is the number of max packet size packets still to go
+        // after each TRB
+        size_t max_packet = XHCI_GET_BITS32(&epc->epc1, EP_CTX_MAX_PACKET_SIZE_START,
+                                            EP_CTX_MAX_PACKET_SIZE_BITS);
+        if (max_packet == 0) {
+            max_packet = 1;
+        }
+        size_t td_packets = (length + max_packet - 1) / max_packet;
+        size_t transferred = 0;
 
-        for (size_t i = 0; i < data_packets; i++) {
-            size_t transfer_size = (remaining > XHCI_MAX_DATA_BUFFER ? XHCI_MAX_DATA_BUFFER : remaining);
-            remaining -= transfer_size;
+        for (size_t i = 0; i < sg_count; i++) {
+            mx_paddr_t paddr = sg[i].paddr;
+            size_t remaining = sg[i].length;
 
-            xhci_trb_t* trb = ring->current;
-            xhci_clear_trb(trb);
-            XHCI_WRITE64(&trb->ptr, phys_addr + (i * XHCI_MAX_DATA_BUFFER));
-            XHCI_SET_BITS32(&trb->status, XFER_TRB_XFER_LENGTH_START, XFER_TRB_XFER_LENGTH_BITS, transfer_size);
-            uint32_t td_size = data_packets - i - 1;
-            XHCI_SET_BITS32(&trb->status, XFER_TRB_TD_SIZE_START, XFER_TRB_TD_SIZE_BITS, td_size);
-            XHCI_SET_BITS32(&trb->status, XFER_TRB_INTR_TARGET_START, XFER_TRB_INTR_TARGET_BITS, interruptor_target);
+            while (remaining > 0) {
+                size_t transfer_size = XHCI_MAX_DATA_BUFFER - (paddr & (XHCI_MAX_DATA_BUFFER - 1));
+                if (transfer_size > remaining) {
+                    transfer_size = remaining;
+                }
+                bool first = (transferred == 0);
+                transferred += transfer_size;
+                uint32_t td_size = 0;
+                if (transferred < length) {
+                    td_size = td_packets - transferred / max_packet;
+                    if (td_size > 31) {
+                        td_size = 31;
+                    }
+                }
 
-            uint32_t control_bits = TRB_CHAIN;
-            if (td_size == 0) {
-                control_bits |= XFER_TRB_ENT;
-            }
-            if (setup && i == 0) {
-                // use TRB_TRANSFER_DATA for first data packet on setup requests
-                control_bits |= (direction == USB_DIR_IN ? XFER_TRB_DIR_IN : XFER_TRB_DIR_OUT);
-                trb_set_control(trb, TRB_TRANSFER_DATA, control_bits);
-            } else if (isochronous) {
-                if (frame == 0) {
-                    // set SIA bit to schedule packet ASAP
-                    control_bits |= XFER_TRB_SIA;
+                xhci_trb_t* trb = ring->current;
+                xhci_clear_trb(trb);
+                XHCI_WRITE64(&trb->ptr, paddr);
+                XHCI_SET_BITS32(&trb->status, XFER_TRB_XFER_LENGTH_START, XFER_TRB_XFER_LENGTH_BITS, transfer_size);
+                XHCI_SET_BITS32(&trb->status, XFER_TRB_TD_SIZE_START, XFER_TRB_TD_SIZE_BITS, td_size);
+                XHCI_SET_BITS32(&trb->status, XFER_TRB_INTR_TARGET_START, XFER_TRB_INTR_TARGET_BITS, interruptor_target);
+
+                uint32_t control_bits = TRB_CHAIN;
+                if (transferred == length) {
+                    control_bits |= XFER_TRB_ENT;
+                }
+                if (setup && first) {
+                    // use TRB_TRANSFER_DATA for first data packet on setup requests
+                    control_bits |= (direction == USB_DIR_IN ? XFER_TRB_DIR_IN : XFER_TRB_DIR_OUT);
+                    trb_set_control(trb, TRB_TRANSFER_DATA, control_bits);
+                } else if (isochronous && first) {
+                    if (frame == 0) {
+                        // set SIA bit to schedule packet ASAP
+                        control_bits |= XFER_TRB_SIA;
+                    } else {
+                        // schedule packet for specified frame
+                        control_bits |= (((frame % 2048) << XFER_TRB_FRAME_ID_START) &
+                                         XHCI_MASK(XFER_TRB_FRAME_ID_START, XFER_TRB_FRAME_ID_BITS));
+                    }
+                    trb_set_control(trb, TRB_TRANSFER_ISOCH, control_bits);
                 } else {
-                    // schedule packet for specified frame
-                    control_bits |= (((frame % 2048) << XFER_TRB_FRAME_ID_START) &
-                                     XHCI_MASK(XFER_TRB_FRAME_ID_START, XFER_TRB_FRAME_ID_BITS));
-               }
-                trb_set_control(trb, TRB_TRANSFER_ISOCH, control_bits);
-            } else {
-                trb_set_control(trb, TRB_TRANSFER_NORMAL, control_bits);
+                    // the rest of a TD is normal TRBs, whatever its type
+                    trb_set_control(trb, TRB_TRANSFER_NORMAL, control_bits);
+                }
+                print_trb(xhci, ring, trb);
+                xhci_increment_ring(ring);
+
+                paddr += transfer_size;
+                remaining -= transfer_size;
             }
-            print_trb(xhci, ring, trb);
-            xhci_increment_ring(ring);
         }
 
         // Follow up with event data TRB
@@ -366,8 +517,10 @@ void xhci_handle_transfer_event(xhci_t* xhci, xhci_trb_t* trb) {
         if (control & EVT_TRB_ED) {
             txn = (iotxn_t *)trb_get_ptr(trb);
         } else {
+            // the event data TRB follows the data stage, which may be a
+            // long chain
             trb = xhci_read_trb_ptr(ring, trb);
-            for (int i = 0; i < 5 && trb; i++) {
+            for (size_t i = 0; i < ring->size && trb; i++) {
                 if (trb_get_type(trb) == TRB_TRANSFER_EVENT_DATA) {
                     txn = (iotxn_t *)trb_get_ptr(trb);
                     break;
@@ -23,6 +23,9 @@
 
 #define PAGE_ROUNDUP(x) ((x + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
 
+// interrupt moderation interval, 40us in 250ns units
+#define XHCI_IMODI 160
+
 uint8_t xhci_endpoint_index(uint8_t ep_address) {
     if (ep_address == 0) return 0;
     uint32_t index = 2 * (ep_address & ~USB_ENDPOINT_DIR_MASK);
@@ -367,6 +370,7 @@ mx_status_t xhci_endpoint_init(xhci_endpoint_t* ep, int ring_count) {
     list_initialize(&ep->pending_requests);
     list_initialize(&ep->deferred_txns);
     mtx_init(&ep->lock, mtx_plain);
+    ep->resetting = false;
     return NO_ERROR;
 }
 
@@ -386,6 +390,11 @@ static void xhci_interruptor_init(xhci_t* xhci, int interruptor) {
 
     xhci_update_erdp(xhci, interruptor);
 
+    // Hold interrupts off for a little while after each one, so that the
+    // completions of transfers queued together are handled together.  This
+    // is well under the 1ms the register resets to, which would otherwise
+    // delay the completion of every lone transfer.
+    XHCI_SET_BITS32(&intr_regs->imod, IMODI_START, IMODI_BITS, XHCI_IMODI);
     XHCI_SET32(&intr_regs->iman, IMAN_IE, IMAN_IE);
     XHCI_SET32(&intr_regs->erstsz, ERSTSZ_MASK, ERST_ARRAY_SIZE);
     XHCI_WRITE64(&intr_regs->erstba, xhci->erst_arrays_phys[interruptor]);
@@ -500,6 +509,7 @@ uint64_t xhci_get_current_frame(xhci_t* xhci) {
 
 static void xhci_handle_events(xhci_t* xhci, int interruptor) {
     xhci_event_ring_t* er = &xhci->event_rings[interruptor];
+    size_t handled = 0;
 
     // process all TRBs with cycle bit matching our CCS
     while ((XHCI_READ32(&er->current->control) & TRB_C) == er->ccs) {
@@ -527,6 +537,13 @@ static void xhci_handle_events(xhci_t* xhci, int interruptor) {
             er->current = er->start;
             er->ccs ^= TRB_C;
         }
+        // give event ring space back now and then during a long batch,
+        // rather than after every event
+        if (++handled % (EVENT_RING_SIZE / 4) == 0) {
+            xhci_update_erdp(xhci, interruptor);
+        }
+    }
+    if (handled % (EVENT_RING_SIZE / 4) != 0) {
         xhci_update_erdp(xhci, interruptor);
     }
 }
@@ -38,6 +38,7 @@ typedef struct xhci_endpoint {
     list_node_t deferred_txns;      // used by upper layer to defer iotxns when ring is full
     mtx_t lock;
     bool enabled;
+    bool resetting;                 // new iotxns are deferred while set
 } xhci_endpoint_t;
 
 typedef struct xhci_slot {
@@ -8,10 +8,13 @@
 #include <hexdump/hexdump.h>
 #include <inttypes.h>
 #include <magenta/compiler.h>
+#include <magenta/new.h>
+#include <magenta/syscalls.h>
 #include <mxtl/auto_lock.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/param.h>
+#include <threads.h>
 
 #include "trace.h"
 #include "utils.h"
@@ -29,6 +32,7 @@
 #define VIRTIO_BLK_F_FLUSH    (1<<9)
 #define VIRTIO_BLK_F_TOPOLOGY (1<<10)
 #define VIRTIO_BLK_F_CONFIG_WCE (1<<11)
+#define VIRTIO_BLK_F_MQ       (1<<12)
 
 #define VIRTIO_BLK_T_IN         0
 #define VIRTIO_BLK_T_OUT        1
@@ -128,36 +132,48 @@ mx_status_t BlockDevice::Init() {
     LTRACEF("size_max %#x\n", config_.size_max);
     LTRACEF("seg_max  %#x\n", config_.seg_max);
     LTRACEF("blk_size %#x\n", config_.blk_size);
+    LTRACEF("num_queues %u\n", config_.num_queues);
 
     // ack and set the driver status bit
     StatusAcknowledgeDriver();
 
-    // XXX check features bits and ack/nak them
-
-    // allocate the main vring
-    auto err = vring_.Init(0, 128); // 128 matches legacy pci
-    if (err < 0) {
-        VIRTIO_ERROR("failed to allocate vring\n");
-        return err;
-    }
-
-    // allocate a queue of block requests
-    size_t size = sizeof(virtio_blk_req) * blk_req_count + sizeof(uint8_t) * blk_req_count;
-
-    mx_status_t r = map_contiguous_memory(size, (uintptr_t*)&blk_req_, &blk_req_pa_);
-    if (r < 0) {
-        VIRTIO_ERROR("cannot alloc blk_req buffers %d\n", r);
-        return r;
+    // negotiate features
+    uint32_t features = ReadDeviceFeatures();
+    LTRACEF("device features %#x\n", features);
+    features &= VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_MQ |
+                (1u << VIRTIO_RING_F_INDIRECT_DESC) | (1u << VIRTIO_RING_F_EVENT_IDX);
+    WriteDriverFeatures(features);
+
+    if (!(features & VIRTIO_BLK_F_BLK_SIZE))
+        config_.blk_size = 512;
+
+    indirect_ = !!(features & (1u << VIRTIO_RING_F_INDIRECT_DESC));
+    bool event_idx = !!(features & (1u << VIRTIO_RING_F_EVENT_IDX));
+
+    // the header and status byte take a descriptor each
+    max_segs_ = indirect_count - 2;
+    if ((features & VIRTIO_BLK_F_SEG_MAX) && config_.seg_max > 0)
+        max_segs_ = (uint16_t)MIN(max_segs_, config_.seg_max);
+    max_seg_size_ = UINT32_MAX;
+    if ((features & VIRTIO_BLK_F_SIZE_MAX) && config_.size_max > 0)
+        max_seg_size_ = config_.size_max;
+
+    // one queue per cpu, as far as the device allows
+    uint32_t queues = 1;
+    if ((features & VIRTIO_BLK_F_MQ) && config_.num_queues > 0)
+        queues = config_.num_queues;
+    queues = MIN(queues, mx_system_get_num_cpus());
+    num_queues_ = (uint16_t)MIN(queues, max_queues);
+
+    LTRACEF("%u queues, indirect %d, event idx %d, %u segments of up to %#x\n",
+            num_queues_, indirect_, event_idx, max_segs_, max_seg_size_);
+
+    for (uint16_t i = 0; i < num_queues_; i++) {
+        mx_status_t r = InitQueue(i, event_idx);
+        if (r < 0)
+            return r;
     }
 
-    LTRACEF("allocated blk request at %p, physical address %#" PRIxPTR "\n", blk_req_, blk_req_pa_);
-
-    // responses are 32 words at the end of the allocated block
-    blk_res_pa_ = blk_req_pa_ + sizeof(virtio_blk_req) * blk_req_count;
-    blk_res_ = (uint8_t*)((uintptr_t)blk_req_ + sizeof(virtio_blk_req) * blk_req_count);
-
-    LTRACEF("allocated blk responses at %p, physical address %#" PRIxPTR "\n", blk_res_, blk_res_pa_);
-
     // start the interrupt thread
     StartIrqThread();
 
@@ -181,50 +197,119 @@ mx_status_t BlockDevice::Init() {
     return NO_ERROR;
 }
 
+mx_status_t BlockDevice::InitQueue(uint16_t index, bool event_idx) {
+    AllocChecker ac;
+    mxtl::unique_ptr<Queue> q(new (&ac) Queue(this));
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    auto err = q->ring.Init(index, ring_size);
+    if (err < 0) {
+        VIRTIO_ERROR("failed to allocate vring %u\n", index);
+        return err;
+    }
+    if (event_idx)
+        q->ring.EnableEventIdx();
+
+    // allocate the per request indirect tables, headers and responses
+    size_t table_size = sizeof(vring_desc) * indirect_count * ring_size;
+    size_t size = table_size + sizeof(virtio_blk_req) * ring_size + sizeof(uint8_t) * ring_size;
+
+    mx_status_t r = map_contiguous_memory(size, &q->mem, &q->mem_pa);
+    if (r < 0) {
+        VIRTIO_ERROR("cannot alloc blk_req buffers %d\n", r);
+        return r;
+    }
+
+    q->indirect = reinterpret_cast<vring_desc*>(q->mem);
+    q->req = reinterpret_cast<virtio_blk_req*>(q->mem + table_size);
+    q->res = reinterpret_cast<uint8_t*>(q->req + ring_size);
+
+    LTRACEF("queue %u requests at %#" PRIxPTR ", physical address %#" PRIxPTR "\n",
+            index, q->mem, q->mem_pa);
+
+    queues_[index] = mxtl::move(q);
+    return NO_ERROR;
+}
+
+BlockDevice::Queue* BlockDevice::PickQueue() {
+    if (num_queues_ == 1)
+        return queues_[0].get();
+
+    // There is no cheap way to ask which cpu we are running on, so spread the
+    // submitting threads over the queues instead.  A given thread always
+    // lands on the same queue, which keeps its requests in order.
+    uint64_t hash = reinterpret_cast<uintptr_t>(thrd_current()) * 0x9e3779b97f4a7c15ull;
+    return queues_[(hash >> 32) % num_queues_].get();
+}
+
 void BlockDevice::IrqRingUpdate() {
     LTRACE_ENTRY;
 
-    // parse our descriptor chain, add back to the free queue
-    auto free_chain = [this](vring_used_elem* used_elem) {
-        uint32_t i = (uint16_t)used_elem->id;
-        struct vring_desc* desc = vring_.DescFromIndex((uint16_t)i);
-        auto head_desc = desc; // save the first element
-        for (;;) {
-            int next;
+    // there is a single interrupt for all of the queues
+    for (uint16_t i = 0; i < num_queues_; i++) {
+        QueueRingUpdate(queues_[i].get());
+    }
+}
+
+void BlockDevice::QueueRingUpdate(Queue* q) {
+    list_node done = LIST_INITIAL_VALUE(done);
+
+    {
+        mxtl::AutoLock lock(&q->lock);
+
+        // parse our descriptor chain, add back to the free queue
+        auto free_chain = [q, &done](vring_used_elem* used_elem) {
+            uint16_t id = (uint16_t)used_elem->id;
 
 #if LOCAL_TRACE > 0
-            virtio_dump_desc(desc);
+            virtio_dump_desc(q->ring.DescFromIndex(id));
 #endif
 
-            if (desc->flags & VRING_DESC_F_NEXT) {
-                next = desc->next;
-            } else {
-                /* end of chain */
-                next = -1;
+            q->ring.FreeDescChain(id);
+
+            iotxn_t* txn = q->txns[id];
+            q->txns[id] = nullptr;
+            if (txn == nullptr) {
+                TRACEF("used chain %u has no txn\n", id);
+                return;
             }
 
-            vring_.FreeDesc((uint16_t)i);
+            LTRACEF("completes txn %p, status %u\n", txn, q->res[id]);
+            if (q->res[id] == VIRTIO_BLK_S_OK) {
+                txn->status = NO_ERROR;
+                txn->actual = txn->length;
+            } else {
+                txn->status = ERR_IO;
+                txn->actual = 0;
+            }
+            list_add_tail(&done, &txn->node);
+        };
 
-            if (next < 0)
-                break;
-            i = next;
-            desc = vring_.DescFromIndex((uint16_t)i);
-        }
+        // tell the ring to find free chains and hand it back to our lambda
+        q->ring.IrqRingUpdate(free_chain);
 
-        // search our pending txn list to see if this completes it
+        // start whatever was waiting for descriptors, with a single kick
+        bool submitted = false;
         iotxn_t* txn;
-        list_for_every_entry (&iotxn_list, txn, iotxn_t, node) {
-            if (txn->context == head_desc) {
-                LTRACEF("completes txn %p\n", txn);
-                list_delete(&txn->node);
-                txn->ops->complete(txn, NO_ERROR, txn->length);
+        while ((txn = list_peek_head_type(&q->pending, iotxn_t, node)) != nullptr) {
+            if (!SubmitTxn(q, txn))
                 break;
-            }
+            list_delete(&txn->node);
+            submitted = true;
         }
-    };
+        if (submitted)
+            q->ring.Kick();
+    }
 
-    // tell the ring to find free chains and hand it back to our lambda
-    vring_.IrqRingUpdate(free_chain);
+    // complete outside of the queue lock, since completion callbacks may
+    // queue more io
+    iotxn_t* txn;
+    iotxn_t* temp;
+    list_for_every_entry_safe (&done, txn, temp, iotxn_t, node) {
+        list_delete(&txn->node);
+        txn->ops->complete(txn, txn->status, txn->actual);
+    }
 }
 
 void BlockDevice::IrqConfigChange() {
@@ -234,10 +319,6 @@ void BlockDevice::IrqConfigChange() {
 void BlockDevice::QueueReadWriteTxn(iotxn_t* txn) {
     LTRACEF("txn %p\n", txn);
 
-    mxtl::AutoLock lock(&lock_);
-
-    bool write = (txn->opcode == IOTXN_OP_WRITE);
-
     // offset must be aligned to block size
     if (txn->offset % config_.blk_size) {
         TRACEF("offset %#" PRIx64 " is not aligned to sector size %u!\n", txn->offset, config_.blk_size);
@@ -248,68 +329,120 @@ void BlockDevice::QueueReadWriteTxn(iotxn_t* txn) {
     // constrain to device capacity
     txn->length = MIN(txn->length, GetSize() - txn->offset);
 
-    // allocate and start filling out a block request
-    auto index = alloc_blk_req();
-    LTRACEF("request index %u\n", index);
-    auto req = &blk_req_[index];
+    // a transaction must fit in a single request; completing a shortened one
+    // would look like success to the caller
+    uint64_t max_transfer = (uint64_t)max_segs_ * max_seg_size_;
+    max_transfer -= max_transfer % config_.blk_size;
+    if (txn->length > max_transfer) {
+        TRACEF("length %#" PRIx64 " exceeds max transfer %#" PRIx64 "\n", txn->length, max_transfer);
+        txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+        return;
+    }
+
+    if (txn->length == 0) {
+        txn->ops->complete(txn, NO_ERROR, 0);
+        return;
+    }
+
+    Queue* q = PickQueue();
+
+    mxtl::AutoLock lock(&q->lock);
+
+    // keep requests in order behind anything already waiting
+    if (!list_is_empty(&q->pending) || !SubmitTxn(q, txn)) {
+        LTRACEF("out of descriptors, txn %p waits\n", txn);
+        list_add_tail(&q->pending, &txn->node);
+        return;
+    }
+
+    /* kick it off */
+    q->ring.Kick();
+}
+
+// Put together a request for txn and add it to the available ring.  With
+// indirect descriptors the request takes a single slot in the ring and the
+// chain lives in the request's own table.  Returns false if the ring is out
+// of descriptors.  Called with the queue lock held.
+bool BlockDevice::SubmitTxn(Queue* q, iotxn_t* txn) {
+    bool write = (txn->opcode == IOTXN_OP_WRITE);
+
+    uint64_t segs = (txn->length + max_seg_size_ - 1) / max_seg_size_;
+    uint16_t count = (uint16_t)(segs + 2);
+
+    uint16_t head;
+    auto desc = q->ring.AllocDescChain(indirect_ ? 1 : count, &head);
+    if (desc == nullptr)
+        return false;
+    LTRACEF("after alloc chain desc %p, head %u, count %u\n", desc, head, count);
+
+    // fill out the block request
+    auto req = &q->req[head];
     req->type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
     req->ioprio = 0;
     req->sector = txn->offset / 512;
     LTRACEF("blk_req type %u ioprio %u sector %" PRIu64 "\n",
             req->type, req->ioprio, req->sector);
+    q->res[head] = VIRTIO_BLK_S_IOERR;
 
-    /* put together a transfer */
-    uint16_t i;
-    auto desc = vring_.AllocDescChain(3, &i);
-    LTRACEF("after alloc chain desc %p, i %u\n", desc, i);
+    if (indirect_) {
+        vring_desc* table = &q->indirect[head * indirect_count];
+        for (uint16_t i = 0; i < count; i++) {
+            table[i].flags = VRING_DESC_F_NEXT;
+            table[i].next = (uint16_t)(i + 1);
+        }
+        table[count - 1].flags = 0;
 
-    /* point the iotxn at this head descriptor */
-    txn->context = desc;
+        desc->addr = q->indirect_pa(head);
+        desc->len = (uint32_t)(count * sizeof(vring_desc));
+        desc->flags = VRING_DESC_F_INDIRECT;
+        desc = table;
+    }
+
+    // in the indirect table the chain is laid out in order
+    auto next_desc = [this, q](vring_desc* d) {
+        return indirect_ ? d + 1 : q->ring.DescFromIndex(d->next);
+    };
 
     /* set up the descriptor pointing to the head */
-    desc->addr = blk_req_pa_ + index * sizeof(virtio_blk_req);
-    desc->len = sizeof(struct virtio_blk_req);
-    desc->flags |= VRING_DESC_F_NEXT;
+    desc->addr = q->req_pa(head);
+    desc->len = sizeof(virtio_blk_req);
 
 #if LOCAL_TRACE > 0
     virtio_dump_desc(desc);
 #endif
 
-    /* set up the descriptor pointing to the buffer */
-    desc = vring_.DescFromIndex(desc->next);
-
+    /* set up the descriptors pointing to the buffer */
     mx_paddr_t pa;
     txn->ops->physmap(txn, &pa);
 
-    desc->addr = (uint64_t)pa;
-    desc->len = (uint32_t)txn->length;
-
-    if (!write)
-        desc->flags |= VRING_DESC_F_WRITE; /* mark buffer as write-only if its a block read */
-    desc->flags |= VRING_DESC_F_NEXT;
+    for (uint64_t offset = 0; offset < txn->length; offset += max_seg_size_) {
+        desc = next_desc(desc);
+        desc->addr = (uint64_t)pa + offset;
+        desc->len = (uint32_t)MIN(txn->length - offset, max_seg_size_);
+        if (!write)
+            desc->flags |= VRING_DESC_F_WRITE; /* mark buffer as write-only if its a block read */
 
 #if LOCAL_TRACE > 0
-    virtio_dump_desc(desc);
+        virtio_dump_desc(desc);
 #endif
+    }
 
     /* set up the descriptor pointing to the response */
-    desc = vring_.DescFromIndex(desc->next);
-    desc->addr = blk_res_pa_ + index;
+    desc = next_desc(desc);
+    desc->addr = q->res_pa(head);
     desc->len = 1;
-    desc->flags = VRING_DESC_F_WRITE;
+    desc->flags |= VRING_DESC_F_WRITE;
 
 #if LOCAL_TRACE > 0
     virtio_dump_desc(desc);
 #endif
 
-    // save the iotxn in a list
-    list_add_tail(&iotxn_list, &txn->node);
+    q->txns[head] = txn;
 
     /* submit the transfer */
-    vring_.SubmitChain(i);
+    q->ring.SubmitChain(head);
 
-    /* kick it off */
-    vring_.Kick();
+    return true;
 }
 
 } // namespace virtio
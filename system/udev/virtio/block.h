@@ -7,6 +7,8 @@
 #include "ring.h"
 
 #include <magenta/compiler.h>
+#include <mxtl/mutex.h>
+#include <mxtl/unique_ptr.h>
 #include <stdlib.h>
 
 namespace virtio {
@@ -36,9 +38,6 @@ private:
 
     void QueueReadWriteTxn(iotxn_t* txn);
 
-    // the main virtio ring
-    Ring vring_ = {this};
-
     // saved block device configuration out of the pci config BAR
     struct virtio_blk_config {
         uint64_t capacity;
@@ -50,6 +49,15 @@ private:
             uint8_t sectors;
         } geometry;
         uint32_t blk_size;
+        struct virtio_blk_topology {
+            uint8_t physical_block_exp;
+            uint8_t alignment_offset;
+            uint16_t min_io_size;
+            uint32_t opt_io_size;
+        } topology;
+        uint8_t writeback;
+        uint8_t unused0;
+        uint16_t num_queues;
     } config_ __PACKED = {};
 
     struct virtio_blk_req {
@@ -58,29 +66,62 @@ private:
         uint64_t sector;
     } __PACKED;
 
-    // a queue of block request/responses
-    static const size_t blk_req_count = 32;
-
-    mx_paddr_t blk_req_pa_ = 0;
-    virtio_blk_req* blk_req_ = nullptr;
-
-    mx_paddr_t blk_res_pa_ = 0;
-    uint8_t* blk_res_ = nullptr;
-
-    uint32_t blk_req_bitmap_ = 0;
-
-    unsigned int alloc_blk_req() {
-        unsigned int i = 31 - __builtin_clz(blk_req_bitmap_);
-        blk_req_bitmap_ |= (1 << i);
-        return i;
-    }
-
-    void free_blk_req(unsigned int i) {
-        blk_req_bitmap_ &= ~(1 << i);
-    }
-
-    // pending iotxns
-    list_node iotxn_list = LIST_INITIAL_VALUE(iotxn_list);
+    // descriptors per virtqueue; 128 matches legacy pci
+    static const uint16_t ring_size = 128;
+
+    // descriptors in each request's indirect table: the request header,
+    // up to 14 data segments and the status byte
+    static const uint16_t indirect_count = 16;
+
+    static const size_t max_queues = 16;
+
+    // A virtqueue and the requests in flight on it.  Each queue has its own
+    // lock, so requests submitted from different threads do not contend.
+    struct Queue {
+        explicit Queue(Device* device)
+            : ring(device) {}
+
+        mxtl::Mutex lock;
+        Ring ring;
+
+        // Per request state, indexed by the head descriptor of the request's
+        // chain in the ring.  Headers, status bytes and indirect tables all
+        // live in one physically contiguous allocation.
+        mx_paddr_t mem_pa = 0;
+        uintptr_t mem = 0;
+        vring_desc* indirect = nullptr;
+        virtio_blk_req* req = nullptr;
+        uint8_t* res = nullptr;
+        iotxn_t* txns[ring_size] = {};
+
+        // iotxns waiting for free descriptors
+        list_node pending = LIST_INITIAL_VALUE(pending);
+
+        mx_paddr_t indirect_pa(uint16_t i) const {
+            return mem_pa + i * indirect_count * sizeof(vring_desc);
+        }
+        mx_paddr_t req_pa(uint16_t i) const {
+            return mem_pa + (uintptr_t)&req[i] - mem;
+        }
+        mx_paddr_t res_pa(uint16_t i) const {
+            return mem_pa + (uintptr_t)&res[i] - mem;
+        }
+    };
+
+    mx_status_t InitQueue(uint16_t index, bool event_idx);
+    Queue* PickQueue();
+    bool SubmitTxn(Queue* q, iotxn_t* txn);
+    void QueueRingUpdate(Queue* q);
+
+    mxtl::unique_ptr<Queue> queues_[max_queues];
+    uint16_t num_queues_ = 0;
+
+    // negotiated VIRTIO_RING_F_INDIRECT_DESC
+    bool indirect_ = false;
+
+    // largest number of data segments in a request, and largest segment
+    uint16_t max_segs_ = 0;
+    uint32_t max_seg_size_ = 0;
 };
 
 } // namespace virtio
@@ -194,9 +194,8 @@ void Device::IrqWorker() {
         if (irq_status == 0)
             continue;
 
-        // grab the mutex for the duration of the irq handlers
-        mxtl::AutoLock lock(&lock_);
-
+        // the handlers do their own locking, so that they can call out of
+        // the driver without holding any of its locks
         if (irq_status & 0x1) { /* used ring update */
             IrqRingUpdate();
         }
@@ -297,6 +296,22 @@ void Device::SetRing(uint16_t index, uint16_t count, mx_paddr_t pa_desc, mx_padd
     }
 }
 
+uint16_t Device::GetRingSize(uint16_t index) {
+    if (trans_) {
+        if (bar0_pio_base_) {
+            outpw((bar0_pio_base_ + VIRTIO_PCI_QUEUE_SELECT) & 0xffff, index);
+            return inpw((bar0_pio_base_ + VIRTIO_PCI_QUEUE_SIZE) & 0xffff);
+        } else {
+            // XXX implement
+            assert(0);
+            return 0;
+        }
+    } else {
+        mmio_regs_.common_config->queue_select = index;
+        return mmio_regs_.common_config->queue_size;
+    }
+}
+
 void Device::RingKick(uint16_t ring_index) {
     LTRACEF("index %u\n", ring_index);
     if (trans_) {
@@ -331,6 +346,36 @@ void Device::StatusAcknowledgeDriver() {
     }
 }
 
+uint32_t Device::ReadDeviceFeatures() {
+    if (trans_) {
+        if (bar0_pio_base_) {
+            return inpd((bar0_pio_base_ + VIRTIO_PCI_DEVICE_FEATURES) & 0xffff);
+        } else {
+            // XXX implement
+            assert(0);
+            return 0;
+        }
+    } else {
+        mmio_regs_.common_config->device_feature_select = 0;
+        return mmio_regs_.common_config->device_feature;
+    }
+}
+
+void Device::WriteDriverFeatures(uint32_t features) {
+    LTRACEF("features %#x\n", features);
+    if (trans_) {
+        if (bar0_pio_base_) {
+            outpd((bar0_pio_base_ + VIRTIO_PCI_DRIVER_FEATURES) & 0xffff, features);
+        } else {
+            // XXX implement
+            assert(0);
+        }
+    } else {
+        mmio_regs_.common_config->driver_feature_select = 0;
+        mmio_regs_.common_config->driver_feature = features;
+    }
+}
+
 void Device::StatusDriverOK() {
     if (trans_) {
         uint8_t val = ReadConfigBar(VIRTIO_PCI_DEVICE_STATUS);
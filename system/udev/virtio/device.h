@@ -30,7 +30,8 @@ public:
 
     void StartIrqThread();
 
-    // interrupt cases that devices may override
+    // interrupt cases that devices may override, called on the irq thread
+    // with no lock held
     virtual void IrqRingUpdate() {}
     virtual void IrqConfigChange() {}
 
@@ -48,6 +49,14 @@ protected:
     void StatusAcknowledgeDriver();
     void StatusDriverOK();
 
+    // number of descriptors the device has for a virtqueue; a legacy device
+    // only works with exactly this many
+    uint16_t GetRingSize(uint16_t index);
+
+    // feature bit negotiation, low 32 feature bits only
+    uint32_t ReadDeviceFeatures();
+    void WriteDriverFeatures(uint32_t features);
+
     static int IrqThreadEntry(void* arg);
     void IrqWorker();
 
@@ -0,0 +1,542 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ethernet.h"
+
+#include <inttypes.h>
+#include <magenta/compiler.h>
+#include <magenta/new.h>
+#include <magenta/syscalls.h>
+#include <mxtl/auto_lock.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "trace.h"
+#include "utils.h"
+
+#define LOCAL_TRACE 0
+
+// clang-format off
+#define VIRTIO_NET_F_MAC        (1<<5)
+#define VIRTIO_NET_F_MRG_RXBUF  (1<<15)
+#define VIRTIO_NET_F_STATUS     (1<<16)
+#define VIRTIO_NET_F_CTRL_VQ    (1<<17)
+#define VIRTIO_NET_F_MQ         (1<<22)
+
+#define VIRTIO_NET_S_LINK_UP    1
+
+#define VIRTIO_NET_OK           0
+#define VIRTIO_NET_ERR          1
+
+#define VIRTIO_NET_CTRL_MQ      4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET 0
+// clang-format on
+
+namespace virtio {
+
+const uint16_t EthernetDevice::max_ring_size;
+const size_t EthernetDevice::buf_size;
+const size_t EthernetDevice::max_frame_size;
+const size_t EthernetDevice::max_pairs;
+
+// DDK level ops
+
+mx_status_t EthernetDevice::virtio_net_query(mx_device_t* dev, uint32_t options, ethmac_info_t* info) {
+    EthernetDevice* ed = static_cast<EthernetDevice*>(dev->ctx);
+
+    if (options)
+        return ERR_INVALID_ARGS;
+
+    memset(info, 0, sizeof(*info));
+    info->mtu = 1500;
+    memcpy(info->mac, ed->config_.mac, sizeof(info->mac));
+    return NO_ERROR;
+}
+
+void EthernetDevice::virtio_net_stop(mx_device_t* dev) {
+    EthernetDevice* ed = static_cast<EthernetDevice*>(dev->ctx);
+
+    // The ethernet layer calls stop() holding the lock its callbacks take,
+    // so this cannot wait for a callback already under way.  Such a late
+    // callback is harmless: the cookie outlives the ethermac, and no client
+    // is running by then.
+    mxtl::AutoLock lock(&ed->ifc_lock_);
+    ed->ifc_ = nullptr;
+    ed->cookie_ = nullptr;
+}
+
+mx_status_t EthernetDevice::virtio_net_start(mx_device_t* dev, ethmac_ifc_t* ifc, void* cookie) {
+    EthernetDevice* ed = static_cast<EthernetDevice*>(dev->ctx);
+
+    mxtl::AutoLock lock(&ed->ifc_lock_);
+    if (ed->ifc_)
+        return ERR_BAD_STATE;
+    ed->ifc_ = ifc;
+    ed->cookie_ = cookie;
+    return NO_ERROR;
+}
+
+void EthernetDevice::virtio_net_send(mx_device_t* dev, uint32_t options, void* data, size_t length) {
+    EthernetDevice* ed = static_cast<EthernetDevice*>(dev->ctx);
+
+    ed->Send(data, length);
+}
+
+ethmac_protocol_t EthernetDevice::ethmac_ops_ = {
+    .query = &EthernetDevice::virtio_net_query,
+    .stop = &EthernetDevice::virtio_net_stop,
+    .start = &EthernetDevice::virtio_net_start,
+    .send = &EthernetDevice::virtio_net_send,
+    .queue_tx = nullptr,
+    .queue_rx = nullptr,
+};
+
+EthernetDevice::EthernetDevice(mx_driver_t* driver, mx_device_t* bus_device)
+    : Device(driver, bus_device) {
+    // so that Bind() knows how much io space to allocate
+    bar0_size_ = 0x20;
+}
+
+EthernetDevice::~EthernetDevice() {
+    // TODO: clean up allocated physical memory
+}
+
+mx_status_t EthernetDevice::Init() {
+    LTRACE_ENTRY;
+
+    // reset the device
+    Reset();
+
+    // read our configuration
+    CopyDeviceConfig(&config_, sizeof(config_));
+
+    // ack and set the driver status bit
+    StatusAcknowledgeDriver();
+
+    // negotiate features
+    uint32_t features = ReadDeviceFeatures();
+    LTRACEF("device features %#x\n", features);
+    features &= VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS |
+                VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ | (1u << VIRTIO_RING_F_EVENT_IDX);
+    // the number of queue pairs is set through the control virtqueue
+    if (!(features & VIRTIO_NET_F_CTRL_VQ) || !(features & VIRTIO_NET_F_MQ))
+        features &= ~(VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ);
+    WriteDriverFeatures(features);
+    features_ = features;
+
+    if (!(features & VIRTIO_NET_F_MAC)) {
+        // make up a locally administered address
+        size_t actual;
+        mx_cprng_draw(config_.mac, sizeof(config_.mac), &actual);
+        config_.mac[0] = (uint8_t)((config_.mac[0] & ~0x01) | 0x02);
+    }
+    online_ = LinkUp();
+
+    mrg_rxbuf_ = !!(features & VIRTIO_NET_F_MRG_RXBUF);
+    bool event_idx = !!(features & (1u << VIRTIO_RING_F_EVENT_IDX));
+
+    // num_buffers is only part of the header with mergeable buffers
+    hdr_len_ = sizeof(virtio_net_hdr);
+    if (!mrg_rxbuf_)
+        hdr_len_ -= sizeof(uint16_t);
+
+    // one queue pair per cpu, as far as the device allows
+    uint32_t pairs = 1;
+    if ((features & VIRTIO_NET_F_MQ) && config_.max_virtqueue_pairs > 0)
+        pairs = config_.max_virtqueue_pairs;
+    pairs = MIN(pairs, mx_system_get_num_cpus());
+    num_pairs_ = (uint16_t)MIN(pairs, max_pairs);
+
+    LTRACEF("mac %02x:%02x:%02x:%02x:%02x:%02x, %u queue pairs, mergeable rx %d, event idx %d\n",
+            config_.mac[0], config_.mac[1], config_.mac[2], config_.mac[3], config_.mac[4],
+            config_.mac[5], num_pairs_, mrg_rxbuf_, event_idx);
+
+    // the device must have all of its virtqueues before DRIVER_OK
+    if (num_pairs_ > 1) {
+        mx_status_t r = InitCtrlQueue((uint16_t)(2 * config_.max_virtqueue_pairs));
+        if (r < 0) {
+            VIRTIO_ERROR("cannot set up the control virtqueue %d\n", r);
+            num_pairs_ = 1;
+        }
+    }
+
+    // receive queue i is virtqueue 2 * i, its transmit queue the one after
+    for (uint16_t i = 0; i < num_pairs_; i++) {
+        mx_status_t r = InitQueue(&rx_[i], (uint16_t)(2 * i), event_idx);
+        if (r < 0)
+            return r;
+        r = InitQueue(&tx_[i], (uint16_t)(2 * i + 1), event_idx);
+        if (r < 0)
+            return r;
+        FillRx(rx_[i].get());
+    }
+
+    // set DRIVER_OK
+    StatusDriverOK();
+
+    // the device starts out using only the first pair
+    if (num_pairs_ > 1) {
+        mx_status_t r = SetQueuePairs(num_pairs_);
+        if (r < 0) {
+            VIRTIO_ERROR("cannot enable %u queue pairs %d\n", num_pairs_, r);
+            num_pairs_ = 1;
+        }
+    }
+
+    // let the device have the receive buffers; from now on the receive
+    // queues belong to the irq thread
+    for (uint16_t i = 0; i < num_pairs_; i++) {
+        rx_[i]->ring.Kick();
+    }
+
+    // start the interrupt thread
+    StartIrqThread();
+
+    // initialize the mx_device and publish us
+    device_init(&device_, driver_, "virtio-net", &device_ops_);
+
+    // point the ctx of our embedded device structure at ourself
+    device_.ctx = this;
+
+    device_.protocol_id = MX_PROTOCOL_ETHERMAC;
+    device_.protocol_ops = &ethmac_ops_;
+    auto status = device_add(&device_, bus_device_);
+    if (status < 0)
+        return status;
+
+    return NO_ERROR;
+}
+
+mx_status_t EthernetDevice::InitQueue(mxtl::unique_ptr<Queue>* out, uint16_t index, bool event_idx) {
+    AllocChecker ac;
+    mxtl::unique_ptr<Queue> q(new (&ac) Queue(this));
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    // a legacy device decides the size of its virtqueues
+    uint16_t size = GetRingSize(index);
+    if (!trans_)
+        size = MIN(size, max_ring_size);
+    if (size == 0 || size > max_ring_size || (size & (size - 1))) {
+        VIRTIO_ERROR("unsupported size %u of vring %u\n", size, index);
+        return ERR_NOT_SUPPORTED;
+    }
+    q->size = size;
+
+    auto err = q->ring.Init(index, size);
+    if (err < 0) {
+        VIRTIO_ERROR("failed to allocate vring %u\n", index);
+        return err;
+    }
+    if (event_idx)
+        q->ring.EnableEventIdx();
+
+    mx_status_t r = map_contiguous_memory(size * buf_size, &q->mem, &q->mem_pa);
+    if (r < 0) {
+        VIRTIO_ERROR("cannot alloc buffers of vring %u %d\n", index, r);
+        return r;
+    }
+
+    LTRACEF("queue %u buffers at %#" PRIxPTR ", physical address %#" PRIxPTR "\n",
+            index, q->mem, q->mem_pa);
+
+    *out = mxtl::move(q);
+    return NO_ERROR;
+}
+
+mx_status_t EthernetDevice::InitCtrlQueue(uint16_t index) {
+    AllocChecker ac;
+    ctrl_.reset(new (&ac) Ring(this));
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    uint16_t size = GetRingSize(index);
+    if (!trans_)
+        size = MIN(size, max_ring_size);
+    auto err = ctrl_->Init(index, size);
+    if (err < 0) {
+        VIRTIO_ERROR("failed to allocate vring %u\n", index);
+        return err;
+    }
+
+    return map_contiguous_memory(sizeof(virtio_net_ctrl), &ctrl_mem_, &ctrl_mem_pa_);
+}
+
+// Tells the device to spread the traffic over the first 'pairs' queue pairs.
+// This is only done once, during Init(), so rather than involve the irq
+// thread it polls the control virtqueue for the answer.
+mx_status_t EthernetDevice::SetQueuePairs(uint16_t pairs) {
+    auto ctrl = reinterpret_cast<virtio_net_ctrl*>(ctrl_mem_);
+    ctrl->class_ = VIRTIO_NET_CTRL_MQ;
+    ctrl->command = VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET;
+    ctrl->virtqueue_pairs = pairs;
+    ctrl->ack = VIRTIO_NET_ERR;
+
+    // the command, its data and the ack each take a descriptor
+    uint16_t head;
+    auto desc = ctrl_->AllocDescChain(3, &head);
+    if (desc == nullptr)
+        return ERR_NO_RESOURCES;
+    desc->addr = ctrl_mem_pa_;
+    desc->len = offsetof(virtio_net_ctrl, virtqueue_pairs);
+    desc = ctrl_->DescFromIndex(desc->next);
+    desc->addr = ctrl_mem_pa_ + offsetof(virtio_net_ctrl, virtqueue_pairs);
+    desc->len = sizeof(ctrl->virtqueue_pairs);
+    desc = ctrl_->DescFromIndex(desc->next);
+    desc->addr = ctrl_mem_pa_ + offsetof(virtio_net_ctrl, ack);
+    desc->len = sizeof(ctrl->ack);
+    desc->flags |= VRING_DESC_F_WRITE;
+
+    ctrl_->SubmitChain(head);
+    ctrl_->Kick();
+
+    bool done = false;
+    auto free_chain = [this, &done](vring_used_elem* used_elem) {
+        ctrl_->FreeDescChain((uint16_t)used_elem->id);
+        done = true;
+    };
+    for (int i = 0; i < 100; i++) {
+        ctrl_->IrqRingUpdate(free_chain);
+        if (done)
+            break;
+        mx_nanosleep(MX_MSEC(1));
+    }
+    if (!done)
+        return ERR_TIMED_OUT;
+
+    uint8_t ack = *(volatile uint8_t*)&ctrl->ack;
+    return (ack == VIRTIO_NET_OK) ? NO_ERROR : ERR_NOT_SUPPORTED;
+}
+
+bool EthernetDevice::LinkUp() const {
+    // without the status feature the link is always up
+    if (!(features_ & VIRTIO_NET_F_STATUS))
+        return true;
+    return !!(config_.status & VIRTIO_NET_S_LINK_UP);
+}
+
+// Posts a receive buffer in every free descriptor of q.  With mergeable
+// buffers a buffer is a single descriptor which the header shares with the
+// frame; otherwise the header has a descriptor of its own.  Returns whether
+// anything was posted; the caller kicks the ring.
+bool EthernetDevice::FillRx(Queue* q) {
+    uint16_t count = mrg_rxbuf_ ? 1 : 2;
+    bool posted = false;
+
+    uint16_t head;
+    vring_desc* desc;
+    while ((desc = q->ring.AllocDescChain(count, &head)) != nullptr) {
+        desc->addr = q->buf_pa(head);
+        desc->len = (uint32_t)(mrg_rxbuf_ ? buf_size : hdr_len_);
+        desc->flags |= VRING_DESC_F_WRITE;
+        if (!mrg_rxbuf_) {
+            desc = q->ring.DescFromIndex(desc->next);
+            desc->addr = q->buf_pa(head) + hdr_len_;
+            desc->len = (uint32_t)(buf_size - hdr_len_);
+            desc->flags |= VRING_DESC_F_WRITE;
+        }
+        q->ring.SubmitChain(head);
+        posted = true;
+    }
+    return posted;
+}
+
+// FNV-1a
+static uint32_t hash_bytes(uint32_t hash, const uint8_t* p, size_t len) {
+    while (len-- > 0) {
+        hash ^= *p++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Spreads the flows over the transmit queues.  The frames of a flow, that is
+// of a pair of addresses and, for TCP and UDP, ports, always go out on the
+// same queue, which keeps them in order.  Anything else is spread by its mac
+// addresses.
+EthernetDevice::Queue* EthernetDevice::PickTxQueue(const uint8_t* frame, size_t length) {
+    if (num_pairs_ == 1)
+        return tx_[0].get();
+
+    const size_t mac_len = 2 * ETH_MAC_SIZE;
+    uint32_t hash = hash_bytes(2166136261u, frame, MIN(length, mac_len));
+
+    // skip a vlan tag
+    size_t off = mac_len;
+    uint16_t type = 0;
+    if (length >= off + 2)
+        type = (uint16_t)(frame[off] << 8 | frame[off + 1]);
+    if (type == 0x8100 && length >= off + 6) {
+        off += 4;
+        type = (uint16_t)(frame[off] << 8 | frame[off + 1]);
+    }
+    off += 2;
+
+    const uint8_t* ip = frame + off;
+    size_t ip_len = length - MIN(length, off);
+    uint8_t proto = 0;
+    size_t ports = 0;
+    if (type == 0x0800 && ip_len >= 20) {
+        // the ports are only in the first fragment
+        hash = hash_bytes(2166136261u, ip + 12, 8);
+        if ((ip[6] & 0x3f) == 0 && ip[7] == 0) {
+            proto = ip[9];
+            ports = (ip[0] & 0x0f) * 4u;
+        }
+    } else if (type == 0x86dd && ip_len >= 40) {
+        // extension headers are not looked into
+        hash = hash_bytes(2166136261u, ip + 8, 32);
+        proto = ip[6];
+        ports = 40;
+    }
+    if ((proto == 6 || proto == 17) && ip_len >= ports + 4) {
+        hash = hash_bytes(hash, &proto, 1);
+        hash = hash_bytes(hash, ip + ports, 4);
+    }
+
+    return tx_[hash % num_pairs_].get();
+}
+
+void EthernetDevice::IrqRingUpdate() {
+    LTRACE_ENTRY;
+
+    ethmac_ifc_t* ifc;
+    void* cookie;
+    {
+        mxtl::AutoLock lock(&ifc_lock_);
+        ifc = ifc_;
+        cookie = cookie_;
+    }
+
+    // there is a single interrupt for all of the queues
+    for (uint16_t i = 0; i < num_pairs_; i++) {
+        RxRingUpdate(rx_[i].get(), ifc, cookie);
+
+        Queue* q = tx_[i].get();
+        mxtl::AutoLock lock(&q->lock);
+        TxRingUpdateLocked(q);
+    }
+}
+
+// Hands the frames received on q to the ethernet layer through ifc, if there
+// is one.  The receive queues are only used from the irq thread, so they need
+// no lock.
+void EthernetDevice::RxRingUpdate(Queue* q, ethmac_ifc_t* ifc, void* cookie) {
+    auto rx_chain = [this, q, ifc, cookie](vring_used_elem* used_elem) {
+        uint16_t id = (uint16_t)used_elem->id;
+        uint8_t* data = q->buf(id);
+        size_t len = MIN(used_elem->len, buf_size);
+
+        if (q->merge_left == 0) {
+            // the first buffer of a frame starts with the header, which
+            // says how many buffers the frame spans
+            auto hdr = reinterpret_cast<virtio_net_hdr*>(data);
+            q->merge_left = mrg_rxbuf_ ? hdr->num_buffers : 1;
+            q->merge_error = (len < hdr_len_) || (q->merge_left == 0);
+            if (q->merge_left == 0)
+                q->merge_left = 1;
+            q->frame_len = 0;
+            data += hdr_len_;
+            len = (len < hdr_len_) ? 0 : len - hdr_len_;
+        }
+
+        if (q->merge_left == 1 && q->frame_len == 0) {
+            // the whole frame is in this buffer, so it needs no copy
+            if (!q->merge_error && ifc)
+                ifc->recv(cookie, data, len, 0);
+        } else if (q->frame_len + len <= sizeof(q->frame)) {
+            memcpy(q->frame + q->frame_len, data, len);
+            q->frame_len += len;
+            if (q->merge_left == 1 && !q->merge_error && ifc)
+                ifc->recv(cookie, q->frame, q->frame_len, 0);
+        } else {
+            q->merge_error = true;
+        }
+        q->merge_left--;
+
+        q->ring.FreeDescChain(id);
+    };
+
+    q->ring.IrqRingUpdate(rx_chain);
+
+    // give the buffers back with a single kick
+    if (FillRx(q))
+        q->ring.Kick();
+}
+
+// Frees the descriptors of frames the device has sent.  Called with the
+// queue lock held.
+void EthernetDevice::TxRingUpdateLocked(Queue* q) {
+    auto free_chain = [q](vring_used_elem* used_elem) {
+        q->ring.FreeDescChain((uint16_t)used_elem->id);
+    };
+    q->ring.IrqRingUpdate(free_chain);
+}
+
+void EthernetDevice::IrqConfigChange() {
+    LTRACE_ENTRY;
+
+    CopyDeviceConfig(&config_, sizeof(config_));
+    bool online = LinkUp();
+    if (online == online_)
+        return;
+    online_ = online;
+
+    ethmac_ifc_t* ifc;
+    void* cookie;
+    {
+        mxtl::AutoLock lock(&ifc_lock_);
+        ifc = ifc_;
+        cookie = cookie_;
+    }
+    if (ifc)
+        ifc->status(cookie, online ? ETHMAC_STATUS_ONLINE : 0);
+}
+
+void EthernetDevice::Send(const void* data, size_t length) {
+    LTRACEF("length %zu\n", length);
+
+    if (length > max_frame_size) {
+        TRACEF("frame of %zu bytes is too long\n", length);
+        return;
+    }
+
+    Queue* q = PickTxQueue(static_cast<const uint8_t*>(data), length);
+
+    mxtl::AutoLock lock(&q->lock);
+
+    // the header and the frame each take a descriptor
+    uint16_t head;
+    auto desc = q->ring.AllocDescChain(2, &head);
+    if (desc == nullptr) {
+        // don't wait for the interrupt to free up sent frames
+        TxRingUpdateLocked(q);
+        desc = q->ring.AllocDescChain(2, &head);
+        if (desc == nullptr) {
+            LTRACEF("out of descriptors, frame dropped\n");
+            return;
+        }
+    }
+
+    uint8_t* buf = q->buf(head);
+    memset(buf, 0, hdr_len_);
+    memcpy(buf + hdr_len_, data, length);
+
+    desc->addr = q->buf_pa(head);
+    desc->len = (uint32_t)hdr_len_;
+    desc = q->ring.DescFromIndex(desc->next);
+    desc->addr = q->buf_pa(head) + hdr_len_;
+    desc->len = (uint32_t)length;
+
+    q->ring.SubmitChain(head);
+
+    // with event indexes the kick is skipped while the device is still
+    // working through earlier frames
+    q->ring.Kick();
+}
+
+} // namespace virtio
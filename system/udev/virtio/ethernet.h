@@ -0,0 +1,139 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#pragma once
+
+#include "device.h"
+#include "ring.h"
+
+#include <ddk/protocol/ethernet.h>
+#include <magenta/compiler.h>
+#include <mxtl/mutex.h>
+#include <mxtl/unique_ptr.h>
+#include <stdlib.h>
+
+namespace virtio {
+
+class Ring;
+
+class EthernetDevice : public Device {
+public:
+    EthernetDevice(mx_driver_t* driver, mx_device_t* device);
+    virtual ~EthernetDevice();
+
+    virtual mx_status_t Init();
+
+    virtual void IrqRingUpdate();
+    virtual void IrqConfigChange();
+
+private:
+    // DDK ethermac hooks
+    static mx_status_t virtio_net_query(mx_device_t* dev, uint32_t options, ethmac_info_t* info);
+    static void virtio_net_stop(mx_device_t* dev);
+    static mx_status_t virtio_net_start(mx_device_t* dev, ethmac_ifc_t* ifc, void* cookie);
+    static void virtio_net_send(mx_device_t* dev, uint32_t options, void* data, size_t length);
+
+    static ethmac_protocol_t ethmac_ops_;
+
+    // saved network device configuration out of the pci config BAR
+    struct virtio_net_config {
+        uint8_t mac[ETH_MAC_SIZE];
+        uint16_t status;
+        uint16_t max_virtqueue_pairs;
+    } config_ __PACKED = {};
+
+    // precedes every frame; num_buffers is only there with
+    // VIRTIO_NET_F_MRG_RXBUF
+    struct virtio_net_hdr {
+        uint8_t flags;
+        uint8_t gso_type;
+        uint16_t hdr_len;
+        uint16_t gso_size;
+        uint16_t csum_start;
+        uint16_t csum_offset;
+        uint16_t num_buffers;
+    } __PACKED;
+
+    // a command on the control virtqueue and its ack
+    struct virtio_net_ctrl {
+        uint8_t class_;
+        uint8_t command;
+        uint16_t virtqueue_pairs;
+        uint8_t ack;
+    } __PACKED;
+
+    // descriptors per virtqueue, at most
+    static const uint16_t max_ring_size = 256;
+
+    // every descriptor has a buffer of this size, which holds a header and
+    // a full frame
+    static const size_t buf_size = 2048;
+    // a frame of the 1500 byte mtu with a vlan tag
+    static const size_t max_frame_size = 1518;
+
+    static const size_t max_pairs = 4;
+
+    // A receive or transmit virtqueue and its buffers.  The buffer of a
+    // chain of descriptors is the one of its head.
+    struct Queue {
+        explicit Queue(Device* device)
+            : ring(device) {}
+
+        mxtl::Mutex lock;
+        Ring ring;
+        uint16_t size = 0;
+
+        mx_paddr_t mem_pa = 0;
+        uintptr_t mem = 0;
+
+        // a received frame which spans several buffers is gathered here
+        uint16_t merge_left = 0;
+        bool merge_error = false;
+        size_t frame_len = 0;
+        uint8_t frame[max_frame_size];
+
+        uint8_t* buf(uint16_t i) const {
+            return reinterpret_cast<uint8_t*>(mem + i * buf_size);
+        }
+        mx_paddr_t buf_pa(uint16_t i) const {
+            return mem_pa + i * buf_size;
+        }
+    };
+
+    mx_status_t InitQueue(mxtl::unique_ptr<Queue>* out, uint16_t index, bool event_idx);
+    mx_status_t InitCtrlQueue(uint16_t index);
+    mx_status_t SetQueuePairs(uint16_t pairs);
+    Queue* PickTxQueue(const uint8_t* frame, size_t length);
+    bool FillRx(Queue* q);
+    void RxRingUpdate(Queue* q, ethmac_ifc_t* ifc, void* cookie);
+    void TxRingUpdateLocked(Queue* q);
+    void Send(const void* data, size_t length);
+    bool LinkUp() const;
+
+    mxtl::unique_ptr<Queue> rx_[max_pairs];
+    mxtl::unique_ptr<Queue> tx_[max_pairs];
+    uint16_t num_pairs_ = 0;
+
+    // the control virtqueue, only set up to enable more than one pair
+    mxtl::unique_ptr<Ring> ctrl_;
+    uintptr_t ctrl_mem_ = 0;
+    mx_paddr_t ctrl_mem_pa_ = 0;
+
+    // negotiated features
+    uint32_t features_ = 0;
+    bool mrg_rxbuf_ = false;
+
+    // length of virtio_net_hdr with the negotiated features
+    size_t hdr_len_ = 0;
+
+    // callback interface to the ethernet layer.  The callbacks are made
+    // without holding ifc_lock_, or any other lock of the driver.
+    mxtl::Mutex ifc_lock_;
+    ethmac_ifc_t* ifc_ = nullptr;
+    void* cookie_ = nullptr;
+
+    // only used from the irq thread
+    bool online_ = false;
+};
+
+} // namespace virtio
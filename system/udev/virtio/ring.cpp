@@ -149,14 +149,30 @@ void Ring::SubmitChain(uint16_t desc_index) {
     struct vring_avail* avail = ring_.avail;
 
     avail->ring[avail->idx & ring_.num_mask] = desc_index;
-    //mb();
-    avail->idx++;
+    hw_wmb();
+    *(volatile uint16_t*)&avail->idx = (uint16_t)(avail->idx + 1);
 }
 
 void Ring::Kick() {
     LTRACE_ENTRY;
 
-    device_->RingKick(index_);
+    // Make the new avail index visible before looking at what the device
+    // asked for, then skip the (trapping) notify if it does not need one:
+    // either it has not yet reached the event index it published, or it
+    // has set NO_NOTIFY because it is already polling the ring.
+    hw_mb();
+    uint16_t new_idx = ring_.avail->idx;
+    uint16_t old_idx = kicked_idx_;
+    kicked_idx_ = new_idx;
+
+    bool needed;
+    if (event_idx_) {
+        needed = vring_need_event(*(volatile uint16_t*)&vring_avail_event(&ring_), new_idx, old_idx);
+    } else {
+        needed = !(*(volatile uint16_t*)&ring_.used->flags & VRING_USED_F_NO_NOTIFY);
+    }
+    if (needed)
+        device_->RingKick(index_);
 }
 
 } // namespace virtio
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 #pragma once
 
+#include <hw/arch_ops.h>
 #include <magenta/types.h>
 #include <stddef.h>
 
@@ -27,6 +28,12 @@ public:
     void SubmitChain(uint16_t desc_index);
     void Kick();
 
+    // Use the VIRTIO_RING_F_EVENT_IDX protocol for kick and interrupt
+    // suppression.  Only call this if the feature was negotiated.
+    void EnableEventIdx() { event_idx_ = true; }
+
+    uint16_t FreeCount() const { return ring_.free_count; }
+
     struct vring_desc* DescFromIndex(uint16_t index) {
         return &ring_.desc[index];
     }
@@ -43,6 +50,11 @@ private:
 
     uint16_t index_ = 0;
 
+    bool event_idx_ = false;
+
+    // avail index as of the last call to Kick()
+    uint16_t kicked_idx_ = 0;
+
     vring ring_ = {};
 };
 
@@ -52,18 +64,29 @@ inline void Ring::IrqRingUpdate(T free_chain) {
     //TRACEF("used flags 0x%hhx idx 0x%hhx last_used %u\n",
     //        ring_.used->flags, ring_.used->idx, ring_.last_used);
 
-    // find a new free chain of descriptors
-    unsigned int cur_idx = ring_.used->idx;
-    for (unsigned int i = ring_.last_used; i != (cur_idx & ring_.num_mask); i = (i + 1) & ring_.num_mask) {
-        //TRACEF("looking at idx %u\n", i);
-
-        struct vring_used_elem* used_elem = &ring_.used->ring[i];
-        //TRACEF("used chain id %u, len %u\n", used_elem->id, used_elem->len);
-
-        // free the chain
-        free_chain(used_elem);
-
-        ring_.last_used = ((ring_.last_used + 1) & ring_.num_mask) & 0xffff;
+    for (;;) {
+        // find a new free chain of descriptors
+        uint16_t cur_idx = *(volatile uint16_t*)&ring_.used->idx;
+        hw_rmb();
+        while (ring_.last_used != cur_idx) {
+            struct vring_used_elem* used_elem = &ring_.used->ring[ring_.last_used & ring_.num_mask];
+            //TRACEF("used chain id %u, len %u\n", used_elem->id, used_elem->len);
+
+            // free the chain
+            free_chain(used_elem);
+
+            ring_.last_used++;
+        }
+
+        if (!event_idx_)
+            break;
+
+        // ask for an interrupt on the next completion, then look again in
+        // case one slipped in before the device saw the new event index
+        *(volatile uint16_t*)&vring_used_event(&ring_) = ring_.last_used;
+        hw_mb();
+        if (*(volatile uint16_t*)&ring_.used->idx == ring_.last_used)
+            break;
     }
 }
 
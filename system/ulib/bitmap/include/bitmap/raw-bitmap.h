@@ -5,6 +5,7 @@
 #pragma once
 
 #include <bitmap/bitmap.h>
+#include <bitmap/storage.h>
 
 #include <limits.h>
 #include <stddef.h>
@@ -21,6 +22,13 @@ namespace bitmap {
 //      To allocate |size| bytes of storage.
 //   - void* GetData()
 //      To access the underlying storage.
+//
+// Alongside the bits, the bitmap keeps an in-memory summary: one bit per
+// word recording whether the word has any bit set, one recording whether it
+// has any bit clear, and further levels summarizing each of those 64 words
+// at a time.  Scans use it to skip over runs of uninteresting words, so
+// finding a free bit in a large, mostly full bitmap does not touch every
+// word.  The summary lives outside |Storage|; see RebuildSummary().
 template <typename Storage>
 class RawBitmapGeneric final : public Bitmap {
 public:
@@ -77,7 +85,27 @@ public:
     // be called on the bitmap while the pointer returned from data() is alive.
     const Storage* StorageUnsafe() const { return &bits_; }
 
+    // Recomputes the summary from the bits.  Must be called after the bits
+    // are modified through StorageUnsafe() rather than Set or Clear, e.g.
+    // after loading the bitmap from disk.
+    void RebuildSummary();
+
 private:
+    // Summary kinds: words with at least one bit clear, and words with at
+    // least one bit set.
+    enum { kHasClear = 0, kHasSet = 1, kSummaryKinds = 2 };
+    // Enough levels to summarize any bitmap addressable with a size_t.
+    static constexpr size_t kMaxSummaryLevels = 12;
+
+    size_t* SummaryLevel(size_t kind, size_t level) const;
+
+    // Brings the summary up to date for the words [first_idx, last_idx].
+    void UpdateSummary(size_t first_idx, size_t last_idx);
+
+    // Returns the index of the first word at or after |idx| that might hold
+    // a bit which is not |is_set|, or SIZE_MAX if there is none.
+    size_t NextWord(size_t idx, bool is_set) const;
+
     // The size of this bitmap, in bits.
     size_t size_;
 
@@ -85,6 +113,21 @@ private:
     Storage bits_;
     // Owned by bits_, cached
     size_t* data_;
+    // The number of words in bits_.
+    size_t words_;
+
+    // The summary, as kSummaryKinds * summary_levels_ arrays of bits.  Level 0
+    // has a bit per word of the bitmap, and each level above has a bit per
+    // word of the level below.  The top level is a single word.
+    DefaultStorage summary_;
+    size_t summary_levels_;
+    size_t summary_words_[kMaxSummaryLevels];
+    size_t summary_offset_[kSummaryKinds][kMaxSummaryLevels];
+
+    // The first clear bit, or at least size_ if there is none.  Searches for
+    // a clear bit start there.  Only Set, Clear and the like move it, so the
+    // const methods never write to the bitmap.
+    size_t first_clear_;
 };
 
 } // namespace bitmap
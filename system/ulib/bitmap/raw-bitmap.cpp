@@ -7,6 +7,7 @@
 
 #include <limits.h>
 #include <stddef.h>
+#include <string.h>
 
 #include <magenta/types.h>
 #include <mxtl/algorithm.h>
@@ -62,21 +63,58 @@ constexpr size_t LastIdx(size_t bitmax) {
 size_t CountZeros(size_t idx, size_t value) {
     return idx * kBits + CTZ(value);
 }
+
+// Returns the index of the first set bit at or after |bit| in an array of
+// |words| words, or SIZE_MAX.  |levels| are the summary arrays, lowest first,
+// each with a bit set for every non-zero word of the one below.
+size_t FindNextSet(size_t* const* levels, const size_t* words, size_t level,
+                   size_t nlevels, size_t bit) {
+    size_t idx = bit / kBits;
+    if (idx >= words[level]) {
+        return SIZE_MAX;
+    }
+    size_t value = levels[level][idx] & (~static_cast<size_t>(0) << (bit % kBits));
+    if (value == 0) {
+        if (level + 1 == nlevels) {
+            return SIZE_MAX;
+        }
+        // ask the level above for the next non-zero word
+        idx = FindNextSet(levels, words, level + 1, nlevels, idx + 1);
+        if (idx == SIZE_MAX) {
+            return SIZE_MAX;
+        }
+        value = levels[level][idx];
+    }
+    return CountZeros(idx, value);
+}
 #undef CTZ
 
+void AssignBit(size_t* array, size_t bit, bool value) {
+    size_t mask = static_cast<size_t>(1) << (bit % kBits);
+    if (value) {
+        array[bit / kBits] |= mask;
+    } else {
+        array[bit / kBits] &= ~mask;
+    }
+}
+
 } // namespace
 
 namespace bitmap {
 
 template <typename Storage>
-RawBitmapGeneric<Storage>::RawBitmapGeneric() : size_(0), data_(nullptr) {}
+RawBitmapGeneric<Storage>::RawBitmapGeneric()
+    : size_(0), data_(nullptr), words_(0), summary_levels_(0), first_clear_(0) {}
 
 // Resets the bitmap; clearing and resizing it.
 template <typename Storage>
 mx_status_t RawBitmapGeneric<Storage>::Reset(size_t size) {
     size_ = size;
+    first_clear_ = 0;
     if (size_ == 0) {
         data_ = nullptr;
+        words_ = 0;
+        summary_levels_ = 0;
         return NO_ERROR;
     }
     size_t last_idx = LastIdx(size);
@@ -85,6 +123,33 @@ mx_status_t RawBitmapGeneric<Storage>::Reset(size_t size) {
         return status;
     }
     data_ = static_cast<size_t*>(bits_.GetData());
+    words_ = last_idx + 1;
+
+    // Lay out the summary levels, until one word covers the level below.
+    size_t levels = 0;
+    size_t total = 0;
+    size_t bits = words_;
+    do {
+        size_t words = (bits + kBits - 1) / kBits;
+        summary_words_[levels++] = words;
+        total += words;
+        bits = words;
+    } while (bits > 1);
+    summary_levels_ = levels;
+    size_t offset = 0;
+    for (size_t kind = 0; kind < kSummaryKinds; kind++) {
+        for (size_t level = 0; level < levels; level++) {
+            summary_offset_[kind][level] = offset;
+            offset += summary_words_[level];
+        }
+    }
+    if ((status = summary_.Allocate(sizeof(size_t) * total * kSummaryKinds)) != NO_ERROR) {
+        return status;
+    }
+    // UpdateSummary never touches the bits past the last word of the level
+    // below, and a search would follow a stray one off the end of it.
+    memset(summary_.GetData(), 0, sizeof(size_t) * total * kSummaryKinds);
+
     ClearAll();
     return NO_ERROR;
 }
@@ -98,18 +163,68 @@ mx_status_t RawBitmapGeneric<Storage>::Shrink(size_t size) {
     return NO_ERROR;
 }
 
+template <typename Storage>
+size_t* RawBitmapGeneric<Storage>::SummaryLevel(size_t kind, size_t level) const {
+    return static_cast<size_t*>(summary_.GetData()) + summary_offset_[kind][level];
+}
+
+template <typename Storage>
+void RawBitmapGeneric<Storage>::UpdateSummary(size_t first_idx, size_t last_idx) {
+    for (size_t kind = 0; kind < kSummaryKinds; kind++) {
+        size_t* level0 = SummaryLevel(kind, 0);
+        for (size_t i = first_idx; i <= last_idx; i++) {
+            AssignBit(level0, i, kind == kHasSet ? data_[i] != 0 : ~data_[i] != 0);
+        }
+        // The words of the level below that changed are bits of this one.
+        size_t lo = first_idx;
+        size_t hi = last_idx;
+        for (size_t level = 1; level < summary_levels_; level++) {
+            lo /= kBits;
+            hi /= kBits;
+            const size_t* below = SummaryLevel(kind, level - 1);
+            size_t* above = SummaryLevel(kind, level);
+            for (size_t i = lo; i <= hi; i++) {
+                AssignBit(above, i, below[i] != 0);
+            }
+        }
+    }
+}
+
+template <typename Storage>
+void RawBitmapGeneric<Storage>::RebuildSummary() {
+    first_clear_ = 0;
+    if (words_ != 0) {
+        UpdateSummary(0, words_ - 1);
+    }
+    first_clear_ = Scan(0, size_, true);
+}
+
+template <typename Storage>
+size_t RawBitmapGeneric<Storage>::NextWord(size_t idx, bool is_set) const {
+    // Looking for a bit that isn't |is_set|: a clear bit among set ones, or
+    // a set bit among clear ones.
+    size_t kind = is_set ? kHasClear : kHasSet;
+    size_t* levels[kMaxSummaryLevels];
+    for (size_t level = 0; level < summary_levels_; level++) {
+        levels[level] = SummaryLevel(kind, level);
+    }
+    return FindNextSet(levels, summary_words_, 0, summary_levels_, idx);
+}
+
 template <typename Storage>
 size_t RawBitmapGeneric<Storage>::Scan(size_t bitoff, size_t bitmax, bool is_set) const {
     bitmax = mxtl::min(bitmax, size_);
+    if (is_set) {
+        bitoff = mxtl::max(bitoff, first_clear_);
+    }
     if (bitoff >= bitmax) {
         return bitmax;
     }
     size_t first_idx = FirstIdx(bitoff);
     size_t last_idx = LastIdx(bitmax);
-    size_t i = first_idx;
-    size_t value = 0;
-    for (i = first_idx; i <= last_idx; ++i) {
-        value = GetMask(i == first_idx, i == last_idx, bitoff, bitmax);
+    size_t result = bitmax;
+    for (size_t i = first_idx; i <= last_idx; i = NextWord(i + 1, is_set)) {
+        size_t value = GetMask(i == first_idx, i == last_idx, bitoff, bitmax);
         if (is_set) {
             // If is_set=true, invert the mask, OR it with the value, and invert
             // it again to hopefully get all zeros.
@@ -120,10 +235,11 @@ size_t RawBitmapGeneric<Storage>::Scan(size_t bitoff, size_t bitmax, bool is_set
             value &= data_[i];
         }
         if (value != 0) {
+            result = mxtl::min(bitmax, CountZeros(i, value));
             break;
         }
     }
-    return mxtl::min(bitmax, CountZeros(i, value));
+    return result;
 }
 
 template <typename Storage>
@@ -169,6 +285,12 @@ mx_status_t RawBitmapGeneric<Storage>::Set(size_t bitoff, size_t bitmax) {
         data_[i] |=
                 GetMask(i == first_idx, i == last_idx, bitoff, bitmax);
     }
+    UpdateSummary(first_idx, last_idx);
+    if (bitoff <= first_clear_ && first_clear_ < bitmax) {
+        // the first clear bit, if any, is now past the range
+        first_clear_ = bitmax;
+        first_clear_ = Scan(bitmax, size_, true);
+    }
     return NO_ERROR;
 }
 
@@ -186,6 +308,8 @@ mx_status_t RawBitmapGeneric<Storage>::Clear(size_t bitoff, size_t bitmax) {
         data_[i] &=
                 ~(GetMask(i == first_idx, i == last_idx, bitoff, bitmax));
     }
+    UpdateSummary(first_idx, last_idx);
+    first_clear_ = mxtl::min(first_clear_, bitoff);
     return NO_ERROR;
 }
 
@@ -198,6 +322,7 @@ void RawBitmapGeneric<Storage>::ClearAll() {
     for (size_t i = 0; i <= last_idx; ++i) {
         data_[i] = 0;
     }
+    RebuildSummary();
 }
 
 #ifdef __Fuchsia__
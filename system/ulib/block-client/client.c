@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <magenta/compiler.h>
@@ -90,25 +91,16 @@ void block_fifo_release_client(fifo_client_t* client) {
     free(client);
 }
 
-mx_status_t block_fifo_txn(fifo_client_t* client, block_fifo_request_t* requests, size_t count) {
-    if (count == 0) {
-        return NO_ERROR;
-    } else if (count > MAX_TXN_MESSAGES) {
-        return ERR_INVALID_ARGS;
-    }
-
-    txnid_t txnid = requests[0].txnid;
+// Sends |count| fifo entries making up one txn, the last with BLOCKIO_TXN_END
+// set, and waits for the response.
+static mx_status_t do_txn(fifo_client_t* client, txnid_t txnid,
+                          block_fifo_request_t* entries, size_t count) {
     assert(txnid < MAX_TXN_COUNT);
     completion_reset(&client->txns[txnid].completion);
     client->txns[txnid].status = ERR_IO;
 
     mx_status_t status;
-    for (size_t i = 0; i < count; i++) {
-        assert(requests[i].txnid == txnid);
-        requests[i].opcode = (requests[i].opcode & BLOCKIO_OP_MASK) |
-                             (i == count - 1 ? BLOCKIO_TXN_END : 0);
-    }
-    if ((status = do_write(client->fifo, &requests[0], count)) != NO_ERROR) {
+    if ((status = do_write(client->fifo, &entries[0], count)) != NO_ERROR) {
         return status;
     }
 
@@ -129,3 +121,57 @@ mx_status_t block_fifo_txn(fifo_client_t* client, block_fifo_request_t* requests
 
     return client->txns[txnid].status;
 }
+
+mx_status_t block_fifo_txn(fifo_client_t* client, block_fifo_request_t* requests, size_t count) {
+    if (count == 0) {
+        return NO_ERROR;
+    } else if (count > MAX_TXN_MESSAGES) {
+        return ERR_INVALID_ARGS;
+    }
+
+    txnid_t txnid = requests[0].txnid;
+    for (size_t i = 0; i < count; i++) {
+        assert(requests[i].txnid == txnid);
+        requests[i].opcode = (requests[i].opcode & ~BLOCKIO_TXN_END) |
+                             (i == count - 1 ? BLOCKIO_TXN_END : 0);
+        requests[i].segments = 0;
+    }
+    return do_txn(client, txnid, requests, count);
+}
+
+mx_status_t block_fifo_txn_sg(fifo_client_t* client, txnid_t txnid, uint16_t opcode,
+                              uint64_t dev_offset, const block_sg_t* ranges, size_t count) {
+    uint16_t op = opcode & BLOCKIO_OP_MASK;
+    if (count == 0 || count > MAX_TXN_MESSAGES ||
+        (op != BLOCKIO_READ && op != BLOCKIO_WRITE)) {
+        return ERR_INVALID_ARGS;
+    }
+
+    // The first range goes in the request itself, the rest two per entry.
+    block_fifo_request_t entries[1 + MAX_TXN_MESSAGES / 2];
+    memset(entries, 0, sizeof(entries));
+    entries[0].txnid = txnid;
+    entries[0].vmoid = ranges[0].vmoid;
+    entries[0].opcode = opcode & ~BLOCKIO_TXN_END;
+    entries[0].segments = (uint16_t)(count - 1);
+    entries[0].length = ranges[0].length;
+    entries[0].vmo_offset = ranges[0].vmo_offset;
+    entries[0].dev_offset = dev_offset;
+
+    size_t n = 1;
+    for (size_t i = 1; i < count; i += 2, n++) {
+        block_fifo_sg_t* sg = (block_fifo_sg_t*)&entries[n];
+        sg->txnid = txnid;
+        sg->opcode = BLOCKIO_SG;
+        sg->vmoid0 = ranges[i].vmoid;
+        sg->length0 = ranges[i].length;
+        sg->vmo_offset0 = ranges[i].vmo_offset;
+        if (i + 1 < count) {
+            sg->vmoid1 = ranges[i + 1].vmoid;
+            sg->length1 = ranges[i + 1].length;
+            sg->vmo_offset1 = ranges[i + 1].vmo_offset;
+        }
+    }
+    entries[n - 1].opcode |= BLOCKIO_TXN_END;
+    return do_txn(client, txnid, entries, n);
+}
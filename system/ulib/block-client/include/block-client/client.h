@@ -30,11 +30,24 @@ void block_fifo_release_client(fifo_client_t* client);
 // FIELD                                    OPS
 // --------------------------------------   -----------------
 // txnid                                    All  (must be the same for all requests)
-// vmoid                                    All
-// opcode (BLOCKIO_OP_MASK bits only)       All
+// vmoid                                    read, write, close_vmo
+// opcode (BLOCKIO_TXN_END is set for you)  All
 // length                                   read, write
 // vmo_offset                               read, write
 // dev_offset                               read, write
 mx_status_t block_fifo_txn(fifo_client_t* client, block_fifo_request_t* requests, size_t count);
 
+// One vmo range of a scatter/gather request.
+typedef struct block_sg {
+    vmoid_t vmoid;
+    uint32_t length;
+    uint64_t vmo_offset;
+} block_sg_t;
+
+// Sends a single read or write, as its own txn, of the contiguous device range
+// starting at 'dev_offset', split over 'count' vmo ranges in order, and waits
+// for a response. 'opcode' may include BLOCKIO_FUA and BLOCKIO_BARRIER.
+mx_status_t block_fifo_txn_sg(fifo_client_t* client, txnid_t txnid, uint16_t opcode,
+                              uint64_t dev_offset, const block_sg_t* ranges, size_t count);
+
 __END_CDECLS
@@ -0,0 +1,404 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <bootdata/decompress.h>
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <magenta/boot/bootdata.h>
+#include <magenta/syscalls.h>
+
+#include "private.h"
+
+#define MAX_DECOMPRESS_THREADS 16
+
+// Bootfs directory records: namelength, filesize, fileoffset, namedata.
+#define BOOTFS_DIRENT_HDR_SIZE (3 * sizeof(uint32_t))
+#define BOOTFS_MAX_NAME_LEN 256
+
+// Build a table of the blocks in the LZ4 frame of the bootfs item at |data|.
+static mx_status_t lz4_frame_index(const uint8_t* data, lz4_block_t** out,
+                                   size_t* count, const char** err) {
+    const bootdata_t* hdr = (const bootdata_t*)data;
+    const uint8_t* blocks;
+    mx_status_t status = lz4_frame_start(data, &blocks, err);
+    if (status < 0) {
+        return status;
+    }
+
+    // Since every block but the last is full size, the outsize bounds the
+    // number of blocks in the frame.
+    size_t max = (hdr->extra - sizeof(bootdata_t) + MX_LZ4_BLOCK_SIZE - 1) / MX_LZ4_BLOCK_SIZE;
+    lz4_block_t* index = malloc((max ? max : 1) * sizeof(lz4_block_t));
+    if (index == NULL) {
+        *err = "out of memory indexing lz4 blocks";
+        return ERR_NO_MEMORY;
+    }
+
+    size_t n = 0;
+    lz4_block_t block;
+    while (lz4_block_next(&blocks, &block)) {
+        if (n == max) {
+            free(index);
+            *err = "bootdata outsize too small for lz4 decompression";
+            return ERR_INVALID_ARGS;
+        }
+        index[n++] = block;
+    }
+    *out = index;
+    *count = n;
+    return NO_ERROR;
+}
+
+// Decompress block |n| of |index| into its slot in |dst|, which holds |len|
+// bytes of decompressed bootfs content.
+static mx_status_t decompress_block_at(const lz4_block_t* index, size_t count, size_t n,
+                                       uint8_t* dst, size_t len, size_t* actual,
+                                       const char** err) {
+    size_t off = n * MX_LZ4_BLOCK_SIZE;
+    if (off >= len) {
+        *err = "bootdata outsize too small for lz4 decompression";
+        return ERR_INVALID_ARGS;
+    }
+    size_t room = len - off;
+    bool last = (n + 1 == count);
+    if (!last && (room > MX_LZ4_BLOCK_SIZE)) {
+        room = MX_LZ4_BLOCK_SIZE;
+    }
+    mx_status_t status = lz4_block_decompress(&index[n], dst + off, room, actual, err);
+    if (status < 0) {
+        return status;
+    }
+    if (!last && (*actual != MX_LZ4_BLOCK_SIZE)) {
+        *err = "short lz4 block in the middle of a bootfs frame";
+        return ERR_INVALID_ARGS;
+    }
+    return NO_ERROR;
+}
+
+typedef struct {
+    const lz4_block_t* index;
+    size_t count;
+    uint8_t* dst;
+    size_t len;
+
+    atomic_size_t next;
+    atomic_int status;
+    const char* err;
+    size_t tail;
+} decompress_job_t;
+
+static int decompress_worker(void* arg) {
+    decompress_job_t* job = arg;
+    size_t n;
+    while ((n = atomic_fetch_add(&job->next, 1)) < job->count) {
+        if (atomic_load(&job->status) != NO_ERROR) {
+            break;
+        }
+        size_t actual;
+        const char* err;
+        mx_status_t status = decompress_block_at(job->index, job->count, n,
+                                                 job->dst, job->len, &actual, &err);
+        if (status < 0) {
+            int expected = NO_ERROR;
+            if (atomic_compare_exchange_strong(&job->status, &expected, status)) {
+                job->err = err;
+            }
+            break;
+        }
+        if (n + 1 == job->count) {
+            job->tail = actual;
+        }
+    }
+    return 0;
+}
+
+static mx_status_t decompress_bootfs_parallel(mx_handle_t vmar, const uint8_t* data,
+                                              size_t nthreads, mx_handle_t* out,
+                                              const char** err) {
+    const bootdata_t* hdr = (const bootdata_t*)data;
+
+    lz4_block_t* index;
+    size_t count;
+    mx_status_t status = lz4_frame_index(data, &index, &count, err);
+    if (status < 0) {
+        return status;
+    }
+
+    mx_handle_t dst_vmo;
+    uintptr_t dst_addr;
+    size_t newsize;
+    status = bootdata_create_output_vmo(vmar, hdr, &dst_vmo, &dst_addr, &newsize, err);
+    if (status < 0) {
+        free(index);
+        return status;
+    }
+
+    decompress_job_t job = {
+        .index = index,
+        .count = count,
+        .dst = (uint8_t*)dst_addr + sizeof(bootdata_t),
+        .len = newsize - sizeof(bootdata_t),
+        .err = "none",
+        .tail = 0,
+    };
+    atomic_init(&job.next, 0);
+    atomic_init(&job.status, NO_ERROR);
+
+    if (nthreads == 0) {
+        nthreads = mx_system_get_num_cpus();
+    }
+    if (nthreads > MAX_DECOMPRESS_THREADS) {
+        nthreads = MAX_DECOMPRESS_THREADS;
+    }
+    if (nthreads > count) {
+        nthreads = count;
+    }
+
+    // The calling thread does its share of the blocks too. If we can't
+    // create as many helpers as we'd like, we just get less parallelism.
+    thrd_t threads[MAX_DECOMPRESS_THREADS];
+    size_t started = 0;
+    while (started + 1 < nthreads) {
+        if (thrd_create_with_name(&threads[started], decompress_worker, &job,
+                                  "bootfs-decompress") != thrd_success) {
+            break;
+        }
+        started++;
+    }
+    decompress_worker(&job);
+    for (size_t i = 0; i < started; i++) {
+        thrd_join(threads[i], NULL);
+    }
+    free(index);
+
+    status = atomic_load(&job.status);
+    if (status == NO_ERROR) {
+        size_t produced = count ? (count - 1) * MX_LZ4_BLOCK_SIZE + job.tail : 0;
+        // Sanity check: as in the sequential path, the outsize should match
+        // the decompressed size to within the page we rounded up to.
+        if (job.len - produced > 4095) {
+            job.err = "bootdata size error; outsize does not match decompressed size";
+            status = ERR_INVALID_ARGS;
+        }
+    }
+
+    mx_vmar_unmap(vmar, dst_addr, newsize);
+    if (status < 0) {
+        *err = job.err;
+        mx_handle_close(dst_vmo);
+        return status;
+    }
+    *out = dst_vmo;
+    return NO_ERROR;
+}
+
+mx_status_t decompress_bootdata_parallel(mx_handle_t vmar, mx_handle_t vmo,
+                                         size_t offset, size_t length,
+                                         size_t nthreads,
+                                         mx_handle_t* out, const char** err) {
+    *err = "none";
+
+    uintptr_t addr, base;
+    mx_status_t status = bootdata_map_item(vmar, vmo, offset, length, &addr, &base, &length, err);
+    if (status < 0) {
+        return status;
+    }
+
+    const bootdata_t* hdr = (bootdata_t*)addr;
+    switch (hdr->type) {
+    case BOOTDATA_BOOTFS_BOOT:
+    case BOOTDATA_BOOTFS_SYSTEM:
+        if (hdr->flags & BOOTDATA_BOOTFS_FLAG_COMPRESSED) {
+            status = decompress_bootfs_parallel(vmar, (const uint8_t*)addr, nthreads, out, err);
+        }
+        break;
+    default:
+        *err = "unknown bootdata type, not attempting decompression\n";
+        status = ERR_NOT_SUPPORTED;
+        break;
+    }
+    mx_vmar_unmap(vmar, base, length);
+
+    return status;
+}
+
+struct bootdata_lazy {
+    mtx_t lock;
+    mx_handle_t vmar;
+
+    // The compressed item, which must stay mapped for as long as there are
+    // blocks left to decompress.
+    uintptr_t src_base;
+    size_t src_len;
+
+    uintptr_t dst_addr;
+    size_t dst_len;
+
+    lz4_block_t* index;
+    size_t count;
+    // One byte per block, set once the block has been decompressed.
+    uint8_t* done;
+};
+
+// Decompress blocks [first, last]. Must be called with the lock held.
+static mx_status_t lazy_commit_blocks_locked(bootdata_lazy_t* lz, size_t first, size_t last,
+                                             const char** err) {
+    uint8_t* dst = (uint8_t*)lz->dst_addr + sizeof(bootdata_t);
+    size_t len = lz->dst_len - sizeof(bootdata_t);
+    for (size_t n = first; n <= last; n++) {
+        if (lz->done[n]) {
+            continue;
+        }
+        size_t actual;
+        mx_status_t status = decompress_block_at(lz->index, lz->count, n, dst, len, &actual, err);
+        if (status < 0) {
+            return status;
+        }
+        lz->done[n] = 1;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t bootdata_lazy_commit(bootdata_lazy_t* lz, size_t off, size_t len) {
+    // The bootdata header is never compressed.
+    size_t end = off + len;
+    if ((len == 0) || (end <= sizeof(bootdata_t)) || (lz->count == 0)) {
+        return NO_ERROR;
+    }
+    size_t start = (off > sizeof(bootdata_t)) ? off - sizeof(bootdata_t) : 0;
+    end -= sizeof(bootdata_t);
+
+    size_t first = start / MX_LZ4_BLOCK_SIZE;
+    size_t last = (end - 1) / MX_LZ4_BLOCK_SIZE;
+    if (first >= lz->count) {
+        return NO_ERROR;
+    }
+    if (last >= lz->count) {
+        last = lz->count - 1;
+    }
+
+    const char* err;
+    mtx_lock(&lz->lock);
+    mx_status_t status = lazy_commit_blocks_locked(lz, first, last, &err);
+    mtx_unlock(&lz->lock);
+    return status;
+}
+
+// Decompress enough blocks to cover the whole bootfs directory, so that it
+// can be walked with plain VMO reads.
+static mx_status_t lazy_commit_directory(bootdata_lazy_t* lz, const char** err) {
+    const uint8_t* dst = (const uint8_t*)lz->dst_addr;
+    size_t pos = sizeof(bootdata_t);
+    size_t committed = sizeof(bootdata_t);
+    size_t n = 0;
+    for (;;) {
+        if (pos + BOOTFS_DIRENT_HDR_SIZE <= committed) {
+            uint32_t namelen = *(const uint32_t*)(dst + pos);
+            if ((namelen == 0) || (namelen > BOOTFS_MAX_NAME_LEN)) {
+                // End of the directory, or a bogus record that
+                // bootfs_parse() will complain about.
+                return NO_ERROR;
+            }
+            if (pos + BOOTFS_DIRENT_HDR_SIZE + namelen <= committed) {
+                pos += BOOTFS_DIRENT_HDR_SIZE + namelen;
+                continue;
+            }
+        }
+        if (n == lz->count) {
+            return NO_ERROR;
+        }
+        mx_status_t status = lazy_commit_blocks_locked(lz, n, n, err);
+        if (status < 0) {
+            return status;
+        }
+        n++;
+        committed += MX_LZ4_BLOCK_SIZE;
+    }
+}
+
+void bootdata_lazy_destroy(bootdata_lazy_t* lz) {
+    mx_vmar_unmap(lz->vmar, lz->dst_addr, lz->dst_len);
+    mx_vmar_unmap(lz->vmar, lz->src_base, lz->src_len);
+    mtx_destroy(&lz->lock);
+    free(lz->done);
+    free(lz->index);
+    free(lz);
+}
+
+mx_status_t decompress_bootdata_lazy(mx_handle_t vmar, mx_handle_t vmo,
+                                     size_t offset, size_t length,
+                                     bootdata_lazy_t** out_lazy,
+                                     mx_handle_t* out, const char** err) {
+    *err = "none";
+
+    uintptr_t addr, base;
+    mx_status_t status = bootdata_map_item(vmar, vmo, offset, length, &addr, &base, &length, err);
+    if (status < 0) {
+        return status;
+    }
+
+    const bootdata_t* hdr = (bootdata_t*)addr;
+    if ((hdr->type != BOOTDATA_BOOTFS_BOOT) && (hdr->type != BOOTDATA_BOOTFS_SYSTEM)) {
+        *err = "unknown bootdata type, not attempting decompression\n";
+        status = ERR_NOT_SUPPORTED;
+        goto fail_unmap;
+    }
+    if (!(hdr->flags & BOOTDATA_BOOTFS_FLAG_COMPRESSED)) {
+        *err = "bootfs is not compressed";
+        status = ERR_INVALID_ARGS;
+        goto fail_unmap;
+    }
+
+    bootdata_lazy_t* lz = calloc(1, sizeof(bootdata_lazy_t));
+    if (lz == NULL) {
+        *err = "out of memory for lazy bootfs";
+        status = ERR_NO_MEMORY;
+        goto fail_unmap;
+    }
+    mtx_init(&lz->lock, mtx_plain);
+    lz->vmar = vmar;
+    lz->src_base = base;
+    lz->src_len = length;
+
+    if ((status = lz4_frame_index((const uint8_t*)addr, &lz->index, &lz->count, err)) < 0) {
+        goto fail_free;
+    }
+    if ((lz->done = calloc(lz->count ? lz->count : 1, 1)) == NULL) {
+        *err = "out of memory for lazy bootfs";
+        status = ERR_NO_MEMORY;
+        goto fail_free;
+    }
+
+    mx_handle_t dst_vmo;
+    status = bootdata_create_output_vmo(vmar, hdr, &dst_vmo, &lz->dst_addr, &lz->dst_len, err);
+    if (status < 0) {
+        goto fail_free;
+    }
+
+    mtx_lock(&lz->lock);
+    status = lazy_commit_directory(lz, err);
+    mtx_unlock(&lz->lock);
+    if (status < 0) {
+        mx_handle_close(dst_vmo);
+        bootdata_lazy_destroy(lz);
+        return status;
+    }
+
+    *out_lazy = lz;
+    *out = dst_vmo;
+    return NO_ERROR;
+
+fail_free:
+    free(lz->done);
+    free(lz->index);
+    mtx_destroy(&lz->lock);
+    free(lz);
+fail_unmap:
+    mx_vmar_unmap(vmar, base, length);
+    return status;
+}
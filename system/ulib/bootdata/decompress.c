@@ -13,6 +13,8 @@
 
 #include <lz4/lz4.h>
 
+#include "private.h"
+
 // The LZ4 Frame format is used to compress a bootfs image, but we cannot use
 // the LZ4 library's decompression functions in userboot. The following
 // definitions are used in the reimplementation of LZ4 Frame decompression, with
@@ -85,10 +87,9 @@ static mx_status_t check_lz4_frame(const lz4_frame_desc* fd,
     return NO_ERROR;
 }
 
-static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar,
-                                         const uint8_t* data, mx_handle_t* out,
-                                         const char** err) {
-    const bootdata_t* hdr = (bootdata_t*)data;
+mx_status_t lz4_frame_start(const uint8_t* data, const uint8_t** blocks,
+                            const char** err) {
+    const bootdata_t* hdr = (const bootdata_t*)data;
 
     // Skip past the bootdata header
     data += sizeof(bootdata_t);
@@ -99,11 +100,41 @@ static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar,
     }
     data += sizeof(uint32_t);
 
-    size_t newsize = hdr->extra;
-    check_lz4_frame((const lz4_frame_desc*)data, newsize - sizeof(bootdata_t), err);
+    check_lz4_frame((const lz4_frame_desc*)data, hdr->extra - sizeof(bootdata_t), err);
     data += sizeof(lz4_frame_desc);
 
-    newsize = (newsize + 4095) & ~4095;
+    *blocks = data;
+    return NO_ERROR;
+}
+
+mx_status_t lz4_block_decompress(const lz4_block_t* block, uint8_t* dst,
+                                 size_t remaining, size_t* actual,
+                                 const char** err) {
+    size_t len;
+    if (block->blocksize & MX_LZ4_BLOCK_UNCOMPRESSED) {
+        len = block->blocksize & ~MX_LZ4_BLOCK_UNCOMPRESSED;
+        if (len > remaining) {
+            *err = "bootdata outsize too small for lz4 decompression";
+            return ERR_INVALID_ARGS;
+        }
+        memcpy(dst, block->data, len);
+    } else {
+        int dcmp = LZ4_decompress_safe((const char*)block->data, (char*)dst,
+                                       block->blocksize, remaining);
+        if (dcmp < 0) {
+            *err = "lz4 decompression failed";
+            return ERR_BAD_STATE;
+        }
+        len = dcmp;
+    }
+    *actual = len;
+    return NO_ERROR;
+}
+
+mx_status_t bootdata_create_output_vmo(mx_handle_t vmar, const bootdata_t* hdr,
+                                       mx_handle_t* vmo, uintptr_t* addr,
+                                       size_t* size, const char** err) {
+    size_t newsize = (hdr->extra + 4095) & ~4095;
     if (newsize < hdr->extra) {
         // newsize wrapped, which means the outsize was too large
         *err = "lz4 output size too large";
@@ -121,54 +152,53 @@ static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar,
             MX_VM_FLAG_PERM_READ|MX_VM_FLAG_PERM_WRITE, &dst_addr);
     if (status < 0) {
         *err = "mx_vmar_map failed on bootfs vmo during decompression";
+        mx_handle_close(dst_vmo);
         return status;
     }
 
-    size_t remaining = newsize;
-    uint8_t* dst = (uint8_t*)dst_addr;
-
-    bootdata_t* boothdr = (bootdata_t*)dst;
+    bootdata_t* boothdr = (bootdata_t*)dst_addr;
     // Copy the bootdata header but mark it as not compressed
     *boothdr = *hdr;
     boothdr->length = hdr->extra;
     boothdr->flags &= ~BOOTDATA_BOOTFS_FLAG_COMPRESSED;
-    dst += sizeof(bootdata_t);
-    remaining -= sizeof(bootdata_t);
 
-    // Read each LZ4 block and decompress it. Block sizes are 32 bits.
-    uint32_t blocksize = *(const uint32_t*)data;
-    data += sizeof(uint32_t);
-    while (blocksize) {
-        // If the data is uncompressed, the high bit is 1.
-        if (blocksize >> 31) {
-            uint32_t actual = blocksize & 0x7fffffff;
-            memcpy(dst, data, actual);
-            dst += actual;
-            data += actual;
-            if (remaining - actual > remaining) {
-                // Remaining wrapped around (would be negative if signed)
-                *err = "bootdata outsize too small for lz4 decompression";
-                return ERR_INVALID_ARGS;
-            }
-            remaining -= actual;
-        } else {
-            int dcmp = LZ4_decompress_safe((const char*)data, (char*)dst, blocksize, remaining);
-            if (dcmp < 0) {
-                *err = "lz4 decompression failed";
-                return ERR_BAD_STATE;
-            }
-            dst += dcmp;
-            data += blocksize;
-            if (remaining - dcmp > remaining) {
-                // Remaining wrapped around (would be negative if signed)
-                *err = "bootdata outsize too small for lz4 decompression";
-                return ERR_INVALID_ARGS;
-            }
-            remaining -= dcmp;
-        }
+    *vmo = dst_vmo;
+    *addr = dst_addr;
+    *size = newsize;
+    return NO_ERROR;
+}
 
-        blocksize = *(uint32_t*)data;
-        data += sizeof(uint32_t);
+static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar,
+                                         const uint8_t* data, mx_handle_t* out,
+                                         const char** err) {
+    const bootdata_t* hdr = (bootdata_t*)data;
+
+    mx_status_t status = lz4_frame_start(data, &data, err);
+    if (status < 0) {
+        return status;
+    }
+
+    mx_handle_t dst_vmo;
+    uintptr_t dst_addr;
+    size_t newsize;
+    status = bootdata_create_output_vmo(vmar, hdr, &dst_vmo, &dst_addr, &newsize, err);
+    if (status < 0) {
+        return status;
+    }
+
+    size_t remaining = newsize - sizeof(bootdata_t);
+    uint8_t* dst = (uint8_t*)dst_addr + sizeof(bootdata_t);
+
+    // Read each LZ4 block and decompress it.
+    lz4_block_t block;
+    while (lz4_block_next(&data, &block)) {
+        size_t actual;
+        status = lz4_block_decompress(&block, dst, remaining, &actual, err);
+        if (status < 0) {
+            return status;
+        }
+        dst += actual;
+        remaining -= actual;
     }
 
     // Sanity check: verify that we didn't have more than one page leftover.
@@ -188,26 +218,38 @@ static mx_status_t decompress_bootfs_vmo(mx_handle_t vmar,
     return NO_ERROR;
 }
 
-mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
-                                size_t offset, size_t length,
-                                mx_handle_t* out, const char** err) {
-    *err = "none";
-
+mx_status_t bootdata_map_item(mx_handle_t vmar, mx_handle_t vmo,
+                              size_t offset, size_t length,
+                              uintptr_t* addr, uintptr_t* base, size_t* maplen,
+                              const char** err) {
     if (length > SIZE_MAX) {
         *err = "bootfs VMO too large to map";
         return ERR_BUFFER_TOO_SMALL;
     }
 
-    uintptr_t addr = 0;
     size_t aligned_offset = offset & ~(PAGE_SIZE - 1);
     size_t align_shift = offset - aligned_offset;
     length += align_shift;
-    mx_status_t status = mx_vmar_map(vmar, 0, vmo, aligned_offset, length, MX_VM_FLAG_PERM_READ, &addr);
+    mx_status_t status = mx_vmar_map(vmar, 0, vmo, aligned_offset, length, MX_VM_FLAG_PERM_READ, base);
     if (status < 0) {
         *err = "mx_vmar_map failed on bootfs vmo";
         return status;
     }
-    addr += align_shift;
+    *addr = *base + align_shift;
+    *maplen = length;
+    return NO_ERROR;
+}
+
+mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
+                                size_t offset, size_t length,
+                                mx_handle_t* out, const char** err) {
+    *err = "none";
+
+    uintptr_t addr, base;
+    mx_status_t status = bootdata_map_item(vmar, vmo, offset, length, &addr, &base, &length, err);
+    if (status < 0) {
+        return status;
+    }
 
     const bootdata_t* hdr = (bootdata_t*)addr;
     switch (hdr->type) {
@@ -222,7 +264,7 @@ mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
         status = ERR_NOT_SUPPORTED;
         break;
     }
-    mx_vmar_unmap(vmar, addr, length);
+    mx_vmar_unmap(vmar, base, length);
 
     return status;
 }
@@ -4,10 +4,15 @@
 
 #pragma once
 
+// A bootfs that is decompressed on demand.  Declared outside the hidden
+// region so C++ classes can hold a pointer to one without a visibility
+// mismatch.
+typedef struct bootdata_lazy bootdata_lazy_t;
 
 #pragma GCC visibility push(hidden)
 
 #include <magenta/types.h>
+#include <stddef.h>
 
 // Decompress bootdata at offset of total size length into a new VMO
 // On failure, errmsg is a human readable error description to provide
@@ -16,4 +21,31 @@ mx_status_t decompress_bootdata(mx_handle_t vmar, mx_handle_t vmo,
                                 size_t offset, size_t length,
                                 mx_handle_t* out, const char** errmsg);
 
+// The functions below need threads and malloc, so unlike decompress_bootdata()
+// they are not available to userboot.
+
+// Like decompress_bootdata(), but the independent LZ4 blocks are spread
+// across |nthreads| threads (or one per CPU, if |nthreads| is 0).
+mx_status_t decompress_bootdata_parallel(mx_handle_t vmar, mx_handle_t vmo,
+                                         size_t offset, size_t length,
+                                         size_t nthreads,
+                                         mx_handle_t* out, const char** errmsg);
+
+// Set up on-demand decompression of a bootfs item. Only the bootfs
+// directory is decompressed up front; the rest of the returned VMO reads
+// as zeros until the range is committed with bootdata_lazy_commit(). The
+// source VMO stays mapped until bootdata_lazy_destroy().
+mx_status_t decompress_bootdata_lazy(mx_handle_t vmar, mx_handle_t vmo,
+                                     size_t offset, size_t length,
+                                     bootdata_lazy_t** lazy,
+                                     mx_handle_t* out, const char** errmsg);
+
+// Make sure bytes [off, off + len) of the decompressed VMO are valid.
+// Safe to call from multiple threads.
+mx_status_t bootdata_lazy_commit(bootdata_lazy_t* lazy, size_t off, size_t len);
+
+// Release the mappings held by |lazy|. Ranges that were not committed stay
+// zero-filled in the output VMO.
+void bootdata_lazy_destroy(bootdata_lazy_t* lazy);
+
 #pragma GCC visibility pop
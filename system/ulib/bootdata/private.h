@@ -0,0 +1,71 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <magenta/boot/bootdata.h>
+#include <magenta/compiler.h>
+#include <magenta/types.h>
+
+__BEGIN_CDECLS
+
+// Every block but the last in a bootfs LZ4 frame decompresses to exactly
+// this many bytes (mkbootfs only emits short blocks at the end of a frame).
+// This is what lets us find the output offset of any block without first
+// decompressing all of the blocks in front of it.
+#define MX_LZ4_BLOCK_SIZE (64 * 1024)
+
+// Block sizes are 32 bits. If the high bit is set, the block is stored
+// uncompressed.
+#define MX_LZ4_BLOCK_UNCOMPRESSED (1u << 31)
+
+typedef struct lz4_block {
+    const uint8_t* data;
+    uint32_t blocksize;
+} lz4_block_t;
+
+// Validate the bootdata header and LZ4 frame descriptor of a compressed
+// bootfs item at |data|, and return a pointer to the first block size
+// word in |blocks|.
+mx_status_t lz4_frame_start(const uint8_t* data, const uint8_t** blocks,
+                            const char** err);
+
+// Decompress (or copy, if stored) a single block into |dst|, which has
+// |remaining| bytes of room. The number of bytes produced is returned in
+// |actual|.
+mx_status_t lz4_block_decompress(const lz4_block_t* block, uint8_t* dst,
+                                 size_t remaining, size_t* actual,
+                                 const char** err);
+
+// Fill in |out| with the next block and advance |*data| past it. Returns
+// false at the end-of-frame marker.
+static inline bool lz4_block_next(const uint8_t** data, lz4_block_t* out) {
+    uint32_t blocksize = *(const uint32_t*)*data;
+    if (blocksize == 0) {
+        return false;
+    }
+    out->blocksize = blocksize;
+    out->data = *data + sizeof(uint32_t);
+    *data = out->data + (blocksize & ~MX_LZ4_BLOCK_UNCOMPRESSED);
+    return true;
+}
+
+// Create and map a VMO large enough to hold the decompressed form of the
+// bootfs item described by |hdr|, and fill in its (uncompressed) header.
+mx_status_t bootdata_create_output_vmo(mx_handle_t vmar, const bootdata_t* hdr,
+                                       mx_handle_t* vmo, uintptr_t* addr,
+                                       size_t* size, const char** err);
+
+// Map the bootdata item at |offset| of |vmo| read-only. |*addr| points at
+// the item header; |*base| and |*maplen| describe the mapping to unmap.
+mx_status_t bootdata_map_item(mx_handle_t vmar, mx_handle_t vmo,
+                              size_t offset, size_t length,
+                              uintptr_t* addr, uintptr_t* base, size_t* maplen,
+                              const char** err);
+
+__END_CDECLS
@@ -36,6 +36,9 @@ mx_status_t usb_clear_feature(mx_device_t* device, uint8_t request_type, int fea
 // resets an endpoint that is in a halted state. endpoints will be halted if the device returns
 // a STALL in response to a USB transaction. When that occurs, the transaction will fail with
 // ERR_IO_REFUSED. usb_reset_endpoint() returns a halted endpoint to normal running state.
+// Any transactions still queued on the endpoint, halted or not, fail with ERR_CANCELED.
+// The host's data toggle for the endpoint is reset too, as the device's is when the
+// endpoint's halt feature is cleared.
 mx_status_t usb_reset_endpoint(mx_device_t* device, uint8_t ep_address);
 
 // returns the maximum amount of data that can be transferred on an endpoint in a single transaction.
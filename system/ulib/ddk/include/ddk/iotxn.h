@@ -54,6 +54,12 @@ typedef struct iotxn_ops iotxn_ops_t;
 
 typedef uint64_t iotxn_proto_data_t[6];
 
+// a physically contiguous run of an iotxn's buffer, see physmap_sg()
+typedef struct iotxn_sg {
+    mx_paddr_t paddr;
+    size_t length;
+} iotxn_sg_t;
+
 struct iotxn {
     // basic request data
     // (filled in by requestor, read by processor)
@@ -143,6 +149,15 @@ struct iotxn_ops {
     // be the buffer itself, or a temporary, depending on conditions.
     void (*physmap)(iotxn_t* txn, mx_paddr_t* addr);
 
+    // physmap_sg() describes length bytes of the iotxn's buffer, from
+    // offset, as up to sg_count physically contiguous runs, and returns
+    // the number of runs used in *out_count.  If they do not all fit, the
+    // runs cover only the start of the range.  Unlike physmap(), this
+    // works whether or not the buffer is physically contiguous, and never
+    // uses a temporary buffer.
+    mx_status_t (*physmap_sg)(iotxn_t* txn, size_t offset, size_t length,
+                              iotxn_sg_t* sg, size_t sg_count, size_t* out_count);
+
     // mmap() returns a void* pointing at the data in the iotxn's buffer.
     // This may have to do an expensive memory map operation or copy data
     // to a local buffer.  copyfrom(), copyto(), or physmap() are almost
@@ -23,24 +23,49 @@ typedef struct ethernet_protocol {
 //
 // The FEATURE_?X_QUEUE flags indicate the use of the zero-copy
 // interface (which is selectable independently for transmit and
-// receive)
+// receive).  With it the ethermac DMAs directly to and from
+// buffers provided by the ethernet driver:
 //
-// TODO: Implement zero-copy interface in the ethernet common
-// middle layer driver.  Currently ethermac drivers that request
-// these will not be loaded.
+// - queue_tx() queues one frame of length bytes.  pa0 is the physical
+//   address of its start and, if the frame crosses a page boundary,
+//   pa1 is the physical address of the rest of it (otherwise 0).
+// - queue_rx() queues a physically contiguous receive buffer of at
+//   least info.mtu bytes at pa0 (pa1 is always 0).
+// - complete_tx() and complete_rx() report frames sent and buffers
+//   filled, in the order they were queued.
+// - At most info.tx_depth frames and info.rx_depth buffers are queued
+//   at any time.
+// - stop() abandons everything still queued.  None of it is completed,
+//   and the ethermac does not touch the memory once stop() returns.
+// - stop() waits for any complete_?x() call in progress, so it must not
+//   be called with a lock those callbacks take.
 //
 // The FEATURE_WLAN flag indicates a device that supports wlan operations.
+//
+// The FEATURE_?X_CSUM flags indicate checksum offload for the UDP and
+// ICMPv6 payloads of IPv6 frames:
+// - With FEATURE_TX_CSUM, send() and queue_tx() compute the checksum of a
+//   frame passed the ETHMAC_TX_CSUM option, whose checksum field is 0.
+// - With FEATURE_RX_CSUM, recv() and complete_rx() are passed the
+//   ETHMAC_RX_CSUM_OK flag for a frame whose checksum was verified.
 
 #define ETHMAC_FEATURE_RX_QUEUE (1u)
 #define ETHMAC_FEATURE_TX_QUEUE (2u)
 #define ETHMAC_FEATURE_WLAN     (4u)
+#define ETHMAC_FEATURE_TX_CSUM  (8u)
+#define ETHMAC_FEATURE_RX_CSUM  (16u)
+
+#define ETHMAC_TX_CSUM          (1u)
+#define ETHMAC_RX_CSUM_OK       (1u)
 
 typedef struct ethmac_info {
     uint32_t features;
     uint32_t mtu;
     uint8_t mac[ETH_MAC_SIZE];
     uint8_t reserved0[2];
-    uint32_t reserved1[4];
+    uint32_t tx_depth; // with FEATURE_TX_QUEUE
+    uint32_t rx_depth; // with FEATURE_RX_QUEUE
+    uint32_t reserved1[2];
 } ethmac_info_t;
 
 #define ETHMAC_STATUS_ONLINE (1u)
@@ -52,6 +77,7 @@ typedef struct ethmac_ifc_virt {
     void (*recv)(void* cookie, void* data, size_t length, uint32_t flags);
 
     // complete_?x() is invoked when FEATURE_?X_QUEUE is present
+    // complete_rx() reports a length of 0 for a frame received in error
     void (*complete_rx)(void* cookie, uint32_t length, uint32_t flags);
     void (*complete_tx)(void* cookie, uint32_t count);
 } ethmac_ifc_t;
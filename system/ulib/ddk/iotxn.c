@@ -28,6 +28,7 @@
 #define IOTXN_FLAG_CLONE (1 << 0)
 #define IOTXN_FLAG_FREE  (1 << 1)   // for double-free checking
 #define IOTXN_FLAG_DEAD  (1 << 2)   // buffer is no longer valid
+#define IOTXN_FLAG_CONTIG (1 << 3)  // buffer is physically contiguous
 
 typedef struct iotxn_priv iotxn_priv_t;
 
@@ -100,6 +101,69 @@ static void iotxn_physmap(iotxn_t* txn, mx_paddr_t* addr) {
     *addr = io_buffer_phys(&priv->buffer);
 }
 
+static mx_status_t iotxn_physmap_sg(iotxn_t* txn, size_t offset, size_t length,
+                                    iotxn_sg_t* sg, size_t sg_count, size_t* out_count) {
+    iotxn_priv_t* priv = get_priv(txn);
+    ASSERT_BUFFER_VALID(priv);
+    if ((offset > priv->data_size) || (length > priv->data_size - offset)) {
+        return ERR_OUT_OF_RANGE;
+    }
+
+    size_t n = 0;
+    if (length == 0 || sg_count == 0) {
+        *out_count = 0;
+        return NO_ERROR;
+    }
+    if (priv->flags & IOTXN_FLAG_CONTIG) {
+        sg[0].paddr = io_buffer_phys(&priv->buffer) + offset;
+        sg[0].length = length;
+        *out_count = 1;
+        return NO_ERROR;
+    }
+
+    // look the pages up a batch at a time, merging the ones which happen
+    // to be next to each other
+    mx_paddr_t pages[16];
+    mx_off_t pos = priv->buffer.offset + offset;
+    while (length > 0) {
+        mx_off_t first = pos & ~((mx_off_t)PAGE_SIZE - 1);
+        size_t span = MIN(roundup(pos + length, PAGE_SIZE) - first, countof(pages) * PAGE_SIZE);
+        mx_status_t status = mx_vmo_op_range(priv->buffer.vmo_handle, MX_VMO_OP_LOOKUP,
+                                             first, span, pages, sizeof(pages));
+        if (status == ERR_NO_MEMORY) {
+            // pages which were never touched are not there to look up yet
+            status = mx_vmo_op_range(priv->buffer.vmo_handle, MX_VMO_OP_COMMIT,
+                                     first, span, NULL, 0);
+            if (status == NO_ERROR) {
+                status = mx_vmo_op_range(priv->buffer.vmo_handle, MX_VMO_OP_LOOKUP,
+                                         first, span, pages, sizeof(pages));
+            }
+        }
+        if (status != NO_ERROR) {
+            return status;
+        }
+        for (size_t i = 0; i < span / PAGE_SIZE && length > 0; i++) {
+            size_t page_offset = pos & (PAGE_SIZE - 1);
+            size_t len = MIN(PAGE_SIZE - page_offset, length);
+            mx_paddr_t paddr = pages[i] + page_offset;
+            if (n > 0 && sg[n - 1].paddr + sg[n - 1].length == paddr) {
+                sg[n - 1].length += len;
+            } else if (n < sg_count) {
+                sg[n].paddr = paddr;
+                sg[n].length = len;
+                n++;
+            } else {
+                *out_count = n;
+                return NO_ERROR;
+            }
+            pos += len;
+            length -= len;
+        }
+    }
+    *out_count = n;
+    return NO_ERROR;
+}
+
 static void iotxn_mmap(iotxn_t* txn, void** data) {
     iotxn_priv_t* priv = get_priv(txn);
     ASSERT_BUFFER_VALID(priv);
@@ -177,6 +241,7 @@ static mx_status_t iotxn_clone(iotxn_t* txn, iotxn_t** out, size_t extra_size) {
     // that the clone will be completed before the source txn.
     memcpy(&cpriv->buffer, &priv->buffer, sizeof(cpriv->buffer));
     cpriv->data_size = priv->data_size;
+    cpriv->flags = (cpriv->flags & ~IOTXN_FLAG_CONTIG) | (priv->flags & IOTXN_FLAG_CONTIG);
     memcpy(&cpriv->txn, txn, sizeof(iotxn_t));
     cpriv->txn.complete_cb = NULL; // clear the complete cb
 
@@ -198,6 +263,7 @@ static iotxn_ops_t ops = {
     .copyfrom = iotxn_copyfrom,
     .copyto = iotxn_copyto,
     .physmap = iotxn_physmap,
+    .physmap_sg = iotxn_physmap_sg,
     .mmap = iotxn_mmap,
     .clone = iotxn_clone,
     .release = iotxn_release,
@@ -239,6 +305,7 @@ mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t
             free(priv);
             return status;
         }
+        priv->flags |= IOTXN_FLAG_CONTIG;
     }
 
     // layout is iotxn_priv_t | extra_size
@@ -258,6 +325,7 @@ mx_status_t iotxn_alloc_vmo(iotxn_t** out, mx_handle_t vmo_handle, size_t data_s
 
     io_buffer_init_vmo(&priv->buffer, vmo_handle, data_offset, IO_BUFFER_RW);
     priv->data_size = data_size;
+    priv->flags &= ~IOTXN_FLAG_CONTIG;
 
     priv->txn.ops = &ops;
     *out = &priv->txn;
@@ -229,6 +229,16 @@ struct Vfs {
 mx_status_t vfs_fill_dirent(vdirent_t* de, size_t delen,
                             const char* name, size_t len, uint32_t type);
 
+// Lookup cache (vfs-cache.cpp)
+//
+// Calls vndir->Lookup, unless the result of an earlier call is cached.
+mx_status_t vfs_lookup(Vnode* vndir, Vnode** out, const char* name, size_t len);
+// Forgets what is known about name in vndir. Filesystems which add or remove
+// entries other than through Vfs operations must call this.
+void vfs_cache_invalidate(Vnode* vndir, const char* name, size_t len);
+// Forgets every entry which refers to vn, as a directory or as a result.
+void vfs_cache_purge(Vnode* vn);
+
 } // namespace fs
 
 using Vnode = fs::Vnode;
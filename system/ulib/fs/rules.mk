@@ -11,6 +11,7 @@ MODULE_TYPE := userlib
 MODULE_SRCS += \
     $(LOCAL_DIR)/mapped-vmo.cpp \
     $(LOCAL_DIR)/vfs.cpp \
+    $(LOCAL_DIR)/vfs-cache.cpp \
     $(LOCAL_DIR)/vfs-mount.cpp \
     $(LOCAL_DIR)/vfs-unmount.cpp \
     $(LOCAL_DIR)/vfs-rpc.cpp \
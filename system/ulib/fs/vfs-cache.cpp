@@ -0,0 +1,259 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __Fuchsia__
+#include <threads.h>
+#endif
+
+#include <magenta/listnode.h>
+
+#include "vfs-internal.h"
+
+// The lookup cache remembers the result of recent Vnode::Lookup calls, both
+// the vnodes found and the names which were not, so that walking the same
+// paths again does not go back to the filesystem.
+//
+// Positive entries hold a reference to both the directory and the vnode,
+// negative entries to the directory alone. Any change to a directory which
+// does not go through the Vfs operations must be reported to the cache with
+// vfs_cache_invalidate or vfs_cache_purge.
+//
+// Lookups and changes to a directory must be serialized by the caller, as
+// the vfs_lock does; the cache lock only protects the cache itself.
+
+namespace fs {
+namespace {
+
+constexpr size_t kCacheEntries = 256;
+constexpr size_t kCacheBuckets = 64;
+// Long enough for a blobstore digest
+constexpr size_t kCacheNameMax = 64;
+
+static_assert((kCacheBuckets & (kCacheBuckets - 1)) == 0,
+              "Expected kCacheBuckets to be a power of two");
+
+struct CacheEntry {
+    list_node_t lru_node;  // entry in the lru list, or the free list
+    list_node_t hash_node; // entry in a bucket
+    Vnode* dir;
+    Vnode* vn;             // nullptr if the name does not exist
+    uint32_t hash;
+    uint32_t len;
+    char name[kCacheNameMax];
+};
+
+CacheEntry cache_entries[kCacheEntries];
+list_node_t cache_buckets[kCacheBuckets];
+list_node_t cache_lru = LIST_INITIAL_VALUE(cache_lru);  // oldest first
+list_node_t cache_free = LIST_INITIAL_VALUE(cache_free);
+bool cache_initialized = false;
+
+#ifdef __Fuchsia__
+mtx_t cache_lock = MTX_INIT;
+#define CACHE_LOCK() mtx_lock(&cache_lock)
+#define CACHE_UNLOCK() mtx_unlock(&cache_lock)
+#else
+#define CACHE_LOCK()
+#define CACHE_UNLOCK()
+#endif
+
+void cache_init_locked() {
+    if (cache_initialized) {
+        return;
+    }
+    for (size_t i = 0; i < kCacheBuckets; i++) {
+        list_initialize(&cache_buckets[i]);
+    }
+    for (size_t i = 0; i < kCacheEntries; i++) {
+        list_add_tail(&cache_free, &cache_entries[i].lru_node);
+    }
+    cache_initialized = true;
+}
+
+// "." and ".." are cheap to resolve, and ".." changes when its directory
+// is renamed.
+bool cache_name_ok(const char* name, size_t len) {
+    if ((len == 0) || (len > kCacheNameMax)) {
+        return false;
+    }
+    if ((name[0] == '.') && ((len == 1) || ((len == 2) && (name[1] == '.')))) {
+        return false;
+    }
+    return true;
+}
+
+// FNV-1a, seeded with the directory
+uint32_t cache_hash(const Vnode* dir, const char* name, size_t len) {
+    uint64_t p = reinterpret_cast<uintptr_t>(dir);
+    uint32_t n = 2166136261u ^ static_cast<uint32_t>(p ^ (p >> 32));
+    while (len-- > 0) {
+        n = (n ^ static_cast<uint8_t>(*name++)) * 16777619u;
+    }
+    return n;
+}
+
+list_node_t* cache_bucket(uint32_t hash) {
+    return &cache_buckets[hash & (kCacheBuckets - 1)];
+}
+
+CacheEntry* cache_find_locked(const Vnode* dir, const char* name, size_t len, uint32_t hash) {
+    CacheEntry* e;
+    list_for_every_entry(cache_bucket(hash), e, CacheEntry, hash_node) {
+        if ((e->hash == hash) && (e->dir == dir) && (e->len == len) &&
+            (memcmp(e->name, name, len) == 0)) {
+            return e;
+        }
+    }
+    return nullptr;
+}
+
+// Moves an entry to 'dead'; its references are dropped by cache_release.
+void cache_remove_locked(CacheEntry* e, list_node_t* dead) {
+    list_delete(&e->hash_node);
+    list_delete(&e->lru_node);
+    list_add_tail(dead, &e->lru_node);
+}
+
+// Removes every entry which refers to 'vn'.
+void cache_remove_vnode_locked(const Vnode* vn, list_node_t* dead) {
+    CacheEntry* e;
+    CacheEntry* tmp;
+    list_for_every_entry_safe(&cache_lru, e, tmp, CacheEntry, lru_node) {
+        if ((e->dir == vn) || (e->vn == vn)) {
+            cache_remove_locked(e, dead);
+        }
+    }
+}
+
+// Releasing a vnode may call back into its filesystem, so this is done
+// without the cache lock held.
+void cache_release(list_node_t* dead) {
+    if (list_is_empty(dead)) {
+        return;
+    }
+    CacheEntry* e;
+    list_for_every_entry(dead, e, CacheEntry, lru_node) {
+        if (e->vn != nullptr) {
+            e->vn->RefRelease();
+        }
+        e->dir->RefRelease();
+        e->dir = nullptr;
+        e->vn = nullptr;
+    }
+    CACHE_LOCK();
+    while ((e = list_remove_head_type(dead, CacheEntry, lru_node)) != nullptr) {
+        list_add_tail(&cache_free, &e->lru_node);
+    }
+    CACHE_UNLOCK();
+}
+
+void cache_insert(Vnode* dir, const char* name, size_t len, uint32_t hash, Vnode* vn) {
+    Vnode* old_dir = nullptr;
+    Vnode* old_vn = nullptr;
+    CACHE_LOCK();
+    if (cache_find_locked(dir, name, len, hash) == nullptr) {
+        CacheEntry* e = list_peek_head_type(&cache_free, CacheEntry, lru_node);
+        if (e == nullptr) {
+            // Recycle the least recently used entry.
+            e = list_peek_head_type(&cache_lru, CacheEntry, lru_node);
+            list_delete(&e->hash_node);
+            old_dir = e->dir;
+            old_vn = e->vn;
+        }
+        list_delete(&e->lru_node);
+        dir->RefAcquire();
+        if (vn != nullptr) {
+            vn->RefAcquire();
+        }
+        e->dir = dir;
+        e->vn = vn;
+        e->hash = hash;
+        e->len = static_cast<uint32_t>(len);
+        memcpy(e->name, name, len);
+        list_add_tail(cache_bucket(hash), &e->hash_node);
+        list_add_tail(&cache_lru, &e->lru_node);
+    }
+    CACHE_UNLOCK();
+
+    if (old_vn != nullptr) {
+        old_vn->RefRelease();
+    }
+    if (old_dir != nullptr) {
+        old_dir->RefRelease();
+    }
+}
+
+} // namespace anonymous
+
+mx_status_t vfs_lookup(Vnode* vndir, Vnode** out, const char* name, size_t len) {
+    if (!cache_name_ok(name, len)) {
+        return vndir->Lookup(out, name, len);
+    }
+
+    uint32_t hash = cache_hash(vndir, name, len);
+    CACHE_LOCK();
+    cache_init_locked();
+    CacheEntry* e = cache_find_locked(vndir, name, len, hash);
+    if (e != nullptr) {
+        list_delete(&e->lru_node);
+        list_add_tail(&cache_lru, &e->lru_node);
+        Vnode* vn = e->vn;
+        if (vn != nullptr) {
+            vn->RefAcquire();
+        }
+        CACHE_UNLOCK();
+        if (vn == nullptr) {
+            return ERR_NOT_FOUND;
+        }
+        *out = vn;
+        return NO_ERROR;
+    }
+    CACHE_UNLOCK();
+
+    Vnode* vn;
+    mx_status_t r = vndir->Lookup(&vn, name, len);
+    if (r == NO_ERROR) {
+        cache_insert(vndir, name, len, hash, vn);
+        *out = vn;
+    } else if (r == ERR_NOT_FOUND) {
+        cache_insert(vndir, name, len, hash, nullptr);
+    }
+    return r;
+}
+
+void vfs_cache_invalidate(Vnode* vndir, const char* name, size_t len) {
+    if (!cache_name_ok(name, len)) {
+        return;
+    }
+
+    uint32_t hash = cache_hash(vndir, name, len);
+    list_node_t dead = LIST_INITIAL_VALUE(dead);
+    CACHE_LOCK();
+    CacheEntry* e;
+    if (cache_initialized && ((e = cache_find_locked(vndir, name, len, hash)) != nullptr)) {
+        Vnode* vn = e->vn;
+        cache_remove_locked(e, &dead);
+        if (vn != nullptr) {
+            // The vnode may now be unreachable; don't let names within it
+            // keep it alive.
+            cache_remove_vnode_locked(vn, &dead);
+        }
+    }
+    CACHE_UNLOCK();
+    cache_release(&dead);
+}
+
+void vfs_cache_purge(Vnode* vn) {
+    list_node_t dead = LIST_INITIAL_VALUE(dead);
+    CACHE_LOCK();
+    if (cache_initialized) {
+        cache_remove_vnode_locked(vn, &dead);
+    }
+    CACHE_UNLOCK();
+    cache_release(&dead);
+}
+
+} // namespace fs
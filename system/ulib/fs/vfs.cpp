@@ -99,6 +99,9 @@ mx_status_t Vfs::Open(Vnode* vndir, Vnode** out, const char* path,
         if (must_be_dir && !S_ISDIR(mode)) {
             return ERR_INVALID_ARGS;
         }
+        // Drop any cached entry first, so that it does not hold on to
+        // whatever is being replaced.
+        vfs_cache_invalidate(vndir, path, len);
         if ((r = vndir->Create(&vn, path, len, mode)) < 0) {
             if ((r == ERR_ALREADY_EXISTS) && (!(flags & O_EXCL))) {
                 goto try_open;
@@ -115,7 +118,7 @@ mx_status_t Vfs::Open(Vnode* vndir, Vnode** out, const char* path,
         }
     } else {
     try_open:
-        r = vndir->Lookup(&vn, path, len);
+        r = vfs_lookup(vndir, &vn, path, len);
         vndir->RefRelease();
         if (r < 0) {
             return r;
@@ -168,7 +171,9 @@ mx_status_t Vfs::Unlink(Vnode* vndir, const char* path, size_t len) {
     if ((r = vfs_name_trim(path, len, &len, &must_be_dir)) != NO_ERROR) {
         return r;
     }
-    return vndir->Unlink(path, len, must_be_dir);
+    r = vndir->Unlink(path, len, must_be_dir);
+    vfs_cache_invalidate(vndir, path, len);
+    return r;
 }
 
 mx_status_t Vfs::Link(Vnode* vndir, const char* oldpath, const char* newpath,
@@ -212,10 +217,11 @@ mx_status_t Vfs::Link(Vnode* vndir, const char* oldpath, const char* newpath,
 
         // Look up the target vnode
         Vnode* target;
-        if ((r = oldparent->Lookup(&target, oldpath, oldlen)) < 0) { // target: +1
+        if ((r = vfs_lookup(oldparent, &target, oldpath, oldlen)) < 0) { // target: +1
             goto done;
         }
         r = newparent->Link(newpath, newlen, target);
+        vfs_cache_invalidate(newparent, newpath, newlen);
         target->RefRelease(); // target: +0
     } else {
         // Remote filesystem -- forward the request
@@ -263,6 +269,8 @@ mx_status_t Vfs::Rename(Vnode* vndir, const char* oldpath, const char* newpath,
         }
         r = oldparent->Rename(newparent, oldpath, oldlen, newpath, newlen,
                               old_must_be_dir, new_must_be_dir);
+        vfs_cache_invalidate(oldparent, oldpath, oldlen);
+        vfs_cache_invalidate(newparent, newpath, newlen);
     } else {
         // Remote filesystem -- forward the request
         *oldpathout = oldpath;
@@ -411,7 +419,7 @@ mx_status_t Vfs::Walk(Vnode* vn, Vnode** out, const char* path, const char** pat
             // traverse to the next segment
             size_t len = nextpath - path;
             nextpath++;
-            r = vn->Lookup(&vn, path, len);
+            r = vfs_lookup(vn, &vn, path, len);
             assert(r <= 0);
             if (oldvn) {
                 // release the old vnode, even if there was an error
@@ -0,0 +1,335 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <threads.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "gfx-simd.h"
+
+// The vector kernels do the bulk of each row and leave the last few pixels
+// to the plain C ones.  SSE2 and NEON are always there on x86-64 and arm64;
+// AVX2 is used if both the cpu and the kernel support it.
+//
+// Blending works on 16 bit lanes, one per channel, with the source alpha
+// plus one spread over the lanes of its pixel, so that it can compute the
+// same (s * a) / 256 + (d * (255 - a)) / 256 as alpha32_add_ignore_destalpha.
+// Pixels whose source is fully opaque or fully clear are then replaced with
+// the source or the dest, as the C version does.
+
+static void fill_c(void* _dest, uint32_t pattern, size_t len) {
+    uint8_t* dest = _dest;
+    while (len >= 4) {
+        memcpy(dest, &pattern, 4);
+        dest += 4;
+        len -= 4;
+    }
+    if (len) {
+        memcpy(dest, &pattern, len);
+    }
+}
+
+static void blend32_c(uint32_t* dest, const uint32_t* src, size_t count) {
+    while (count-- > 0) {
+        *dest = alpha32_add_ignore_destalpha(*dest, *src++);
+        dest++;
+    }
+}
+
+static inline uint16_t x888_to_565_pixel(uint32_t in) {
+    return ((in >> 3) & 0x1f) | ((in >> 5) & 0x7e0) | ((in >> 8) & 0xf800);
+}
+
+static void x888_to_565_c(uint16_t* dest, const uint32_t* src, size_t count) {
+    while (count-- > 0) {
+        *dest++ = x888_to_565_pixel(*src++);
+    }
+}
+
+#if defined(__x86_64__)
+
+static void fill_sse2(void* _dest, uint32_t pattern, size_t len) {
+    uint8_t* dest = _dest;
+    const __m128i v = _mm_set1_epi32(pattern);
+    while (len >= 32) {
+        _mm_storeu_si128((__m128i*)dest, v);
+        _mm_storeu_si128((__m128i*)(dest + 16), v);
+        dest += 32;
+        len -= 32;
+    }
+    fill_c(dest, pattern, len);
+}
+
+static inline __m128i blend_lanes_sse2(__m128i s, __m128i d) {
+    const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xff), 0xff);
+    a = _mm_add_epi16(a, _mm_set1_epi16(1));
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), a);
+    __m128i r = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(s, a), 8),
+                              _mm_srli_epi16(_mm_mullo_epi16(d, inv), 8));
+    // the alpha of the result is the source alpha plus one
+    return _mm_or_si128(_mm_andnot_si128(alpha_lanes, r), _mm_and_si128(alpha_lanes, a));
+}
+
+static inline __m128i select_sse2(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static void blend32_sse2(uint32_t* dest, const uint32_t* src, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    while (count >= 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)src);
+        __m128i sa = _mm_and_si128(s, alpha);
+        __m128i opaque = _mm_cmpeq_epi32(sa, alpha);
+        __m128i clear = _mm_cmpeq_epi32(sa, zero);
+        if (_mm_movemask_epi8(opaque) == 0xffff) {
+            _mm_storeu_si128((__m128i*)dest, s);
+        } else if (_mm_movemask_epi8(clear) != 0xffff) {
+            __m128i d = _mm_loadu_si128((const __m128i*)dest);
+            __m128i lo = blend_lanes_sse2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+            __m128i hi = blend_lanes_sse2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+            __m128i r = _mm_packus_epi16(lo, hi);
+            r = select_sse2(opaque, s, r);
+            r = select_sse2(clear, d, r);
+            _mm_storeu_si128((__m128i*)dest, r);
+        }
+        dest += 4;
+        src += 4;
+        count -= 4;
+    }
+    blend32_c(dest, src, count);
+}
+
+static inline __m128i x888_to_565_lanes_sse2(__m128i p) {
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x1f));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x7e0));
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+    __m128i v = _mm_or_si128(_mm_or_si128(b, g), r);
+    // sign extend, so that the signed saturating pack keeps all 16 bits
+    return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+static void x888_to_565_sse2(uint16_t* dest, const uint32_t* src, size_t count) {
+    while (count >= 8) {
+        __m128i lo = x888_to_565_lanes_sse2(_mm_loadu_si128((const __m128i*)src));
+        __m128i hi = x888_to_565_lanes_sse2(_mm_loadu_si128((const __m128i*)(src + 4)));
+        _mm_storeu_si128((__m128i*)dest, _mm_packs_epi32(lo, hi));
+        dest += 8;
+        src += 8;
+        count -= 8;
+    }
+    x888_to_565_c(dest, src, count);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+static AVX2 void fill_avx2(void* _dest, uint32_t pattern, size_t len) {
+    uint8_t* dest = _dest;
+    const __m256i v = _mm256_set1_epi32(pattern);
+    while (len >= 64) {
+        _mm256_storeu_si256((__m256i*)dest, v);
+        _mm256_storeu_si256((__m256i*)(dest + 32), v);
+        dest += 64;
+        len -= 64;
+    }
+    fill_c(dest, pattern, len);
+}
+
+static inline AVX2 __m256i blend_lanes_avx2(__m256i s, __m256i d) {
+    const __m256i alpha_lanes = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0,
+                                                 -1, 0, 0, 0, -1, 0, 0, 0);
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xff), 0xff);
+    a = _mm256_add_epi16(a, _mm256_set1_epi16(1));
+    __m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+    __m256i r = _mm256_add_epi16(_mm256_srli_epi16(_mm256_mullo_epi16(s, a), 8),
+                                 _mm256_srli_epi16(_mm256_mullo_epi16(d, inv), 8));
+    return _mm256_blendv_epi8(r, a, alpha_lanes);
+}
+
+static AVX2 void blend32_avx2(uint32_t* dest, const uint32_t* src, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    while (count >= 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)src);
+        __m256i sa = _mm256_and_si256(s, alpha);
+        __m256i opaque = _mm256_cmpeq_epi32(sa, alpha);
+        __m256i clear = _mm256_cmpeq_epi32(sa, zero);
+        if (_mm256_movemask_epi8(opaque) == -1) {
+            _mm256_storeu_si256((__m256i*)dest, s);
+        } else if (_mm256_movemask_epi8(clear) != -1) {
+            __m256i d = _mm256_loadu_si256((const __m256i*)dest);
+            // unpacking and packing both work within each 128 bit half, so
+            // the pixels come back out in order
+            __m256i lo = blend_lanes_avx2(_mm256_unpacklo_epi8(s, zero),
+                                          _mm256_unpacklo_epi8(d, zero));
+            __m256i hi = blend_lanes_avx2(_mm256_unpackhi_epi8(s, zero),
+                                          _mm256_unpackhi_epi8(d, zero));
+            __m256i r = _mm256_packus_epi16(lo, hi);
+            r = _mm256_blendv_epi8(r, s, opaque);
+            r = _mm256_blendv_epi8(r, d, clear);
+            _mm256_storeu_si256((__m256i*)dest, r);
+        }
+        dest += 8;
+        src += 8;
+        count -= 8;
+    }
+    blend32_sse2(dest, src, count);
+}
+
+static inline AVX2 __m256i x888_to_565_lanes_avx2(__m256i p) {
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 3), _mm256_set1_epi32(0x1f));
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), _mm256_set1_epi32(0x7e0));
+    __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 8), _mm256_set1_epi32(0xf800));
+    return _mm256_or_si256(_mm256_or_si256(b, g), r);
+}
+
+static AVX2 void x888_to_565_avx2(uint16_t* dest, const uint32_t* src, size_t count) {
+    while (count >= 16) {
+        __m256i lo = x888_to_565_lanes_avx2(_mm256_loadu_si256((const __m256i*)src));
+        __m256i hi = x888_to_565_lanes_avx2(_mm256_loadu_si256((const __m256i*)(src + 8)));
+        // the pack interleaves the 128 bit halves of its inputs
+        __m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);
+        _mm256_storeu_si256((__m256i*)dest, v);
+        dest += 16;
+        src += 16;
+        count -= 16;
+    }
+    x888_to_565_sse2(dest, src, count);
+}
+
+static bool cpu_has_avx2(void) {
+    uint32_t a, b, c, d;
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return false;
+    }
+    __cpuid(1, a, b, c, d);
+    if (!(c & bit_OSXSAVE)) {
+        return false;
+    }
+    // the kernel must save the ymm registers
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & bit_AVX2) != 0;
+}
+
+#elif defined(__aarch64__)
+
+static void fill_neon(void* _dest, uint32_t pattern, size_t len) {
+    uint8_t* dest = _dest;
+    const uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(pattern));
+    while (len >= 32) {
+        vst1q_u8(dest, v);
+        vst1q_u8(dest + 16, v);
+        dest += 32;
+        len -= 32;
+    }
+    fill_c(dest, pattern, len);
+}
+
+static inline uint16x8_t blend_lanes_neon(uint16x8_t s, uint16x8_t d, uint16x8_t a) {
+    static const uint16_t alpha_lanes[8] = { 0, 0, 0, 0xffff, 0, 0, 0, 0xffff };
+    uint16x8_t inv = vsubq_u16(vdupq_n_u16(255), a);
+    uint16x8_t r = vaddq_u16(vshrq_n_u16(vmulq_u16(s, a), 8),
+                             vshrq_n_u16(vmulq_u16(d, inv), 8));
+    return vbslq_u16(vld1q_u16(alpha_lanes), a, r);
+}
+
+static void blend32_neon(uint32_t* dest, const uint32_t* src, size_t count) {
+    static const uint8_t alpha_bytes[16] = {
+        3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15,
+    };
+    const uint8x16_t spread = vld1q_u8(alpha_bytes);
+    const uint16x8_t one = vdupq_n_u16(1);
+    while (count >= 4) {
+        uint32x4_t s = vld1q_u32(src);
+        uint32x4_t sa = vshrq_n_u32(s, 24);
+        uint32x4_t opaque = vceqq_u32(sa, vdupq_n_u32(255));
+        uint32x4_t clear = vceqq_u32(sa, vdupq_n_u32(0));
+        if (vminvq_u32(opaque) != 0) {
+            vst1q_u32(dest, s);
+        } else if (vminvq_u32(clear) == 0) {
+            uint32x4_t d = vld1q_u32(dest);
+            uint8x16_t s8 = vreinterpretq_u8_u32(s);
+            uint8x16_t d8 = vreinterpretq_u8_u32(d);
+            uint8x16_t a8 = vqtbl1q_u8(s8, spread);
+            uint16x8_t lo = blend_lanes_neon(vmovl_u8(vget_low_u8(s8)),
+                                             vmovl_u8(vget_low_u8(d8)),
+                                             vaddq_u16(vmovl_u8(vget_low_u8(a8)), one));
+            uint16x8_t hi = blend_lanes_neon(vmovl_high_u8(s8), vmovl_high_u8(d8),
+                                             vaddq_u16(vmovl_high_u8(a8), one));
+            uint32x4_t r = vreinterpretq_u32_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+            r = vbslq_u32(opaque, s, r);
+            r = vbslq_u32(clear, d, r);
+            vst1q_u32(dest, r);
+        }
+        dest += 4;
+        src += 4;
+        count -= 4;
+    }
+    blend32_c(dest, src, count);
+}
+
+static inline uint16x4_t x888_to_565_lanes_neon(uint32x4_t p) {
+    uint32x4_t b = vandq_u32(vshrq_n_u32(p, 3), vdupq_n_u32(0x1f));
+    uint32x4_t g = vandq_u32(vshrq_n_u32(p, 5), vdupq_n_u32(0x7e0));
+    uint32x4_t r = vandq_u32(vshrq_n_u32(p, 8), vdupq_n_u32(0xf800));
+    return vmovn_u32(vorrq_u32(vorrq_u32(b, g), r));
+}
+
+static void x888_to_565_neon(uint16_t* dest, const uint32_t* src, size_t count) {
+    while (count >= 8) {
+        uint16x4_t lo = x888_to_565_lanes_neon(vld1q_u32(src));
+        uint16x4_t hi = x888_to_565_lanes_neon(vld1q_u32(src + 4));
+        vst1q_u16(dest, vcombine_u16(lo, hi));
+        dest += 8;
+        src += 8;
+        count -= 8;
+    }
+    x888_to_565_c(dest, src, count);
+}
+
+#endif
+
+gfx_simd_t gfx_simd = {
+    .fill = fill_c,
+    .blend32 = blend32_c,
+    .x888_to_565 = x888_to_565_c,
+};
+
+static once_flag gfx_simd_once = ONCE_FLAG_INIT;
+
+static void gfx_simd_setup(void) {
+#if defined(__x86_64__)
+    if (cpu_has_avx2()) {
+        gfx_simd.fill = fill_avx2;
+        gfx_simd.blend32 = blend32_avx2;
+        gfx_simd.x888_to_565 = x888_to_565_avx2;
+    } else {
+        gfx_simd.fill = fill_sse2;
+        gfx_simd.blend32 = blend32_sse2;
+        gfx_simd.x888_to_565 = x888_to_565_sse2;
+    }
+#elif defined(__aarch64__)
+    gfx_simd.fill = fill_neon;
+    gfx_simd.blend32 = blend32_neon;
+    gfx_simd.x888_to_565 = x888_to_565_neon;
+#endif
+}
+
+void gfx_simd_init(void) {
+    call_once(&gfx_simd_once, gfx_simd_setup);
+}
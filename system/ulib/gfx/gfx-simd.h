@@ -0,0 +1,30 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Row kernels for the drawing operations which touch the most pixels.
+// gfx_simd_init() picks the fastest versions for the cpu it runs on; each
+// one gives exactly the same pixels as the plain C version.
+typedef struct gfx_simd {
+    // fill len bytes with the repeating 32 bit pattern, which must look the
+    // same from every pixel aligned offset
+    void (*fill)(void* dest, uint32_t pattern, size_t len);
+
+    // alpha blend count ARGB_8888 pixels over dest, ignoring dest alpha
+    void (*blend32)(uint32_t* dest, const uint32_t* src, size_t count);
+
+    // convert count RGB_x888 pixels to RGB_565
+    void (*x888_to_565)(uint16_t* dest, const uint32_t* src, size_t count);
+} gfx_simd_t;
+
+extern gfx_simd_t gfx_simd;
+
+// Safe to call any number of times, from any thread.
+void gfx_simd_init(void);
+
+uint32_t alpha32_add_ignore_destalpha(uint32_t dest, uint32_t src);
@@ -0,0 +1,92 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include <inet6/inet6.h>
+
+// The ones' complement sum of a buffer is the same whichever width of word
+// it is taken over, as long as the carries out of the top of each word are
+// added back in at the bottom.  So the buffer is summed 64 bits at a time,
+// or as 32-bit lanes of 64-bit vector accumulators which cannot overflow,
+// and only folded to 16 bits at the end.
+
+static inline uint64_t add64(uint64_t sum, uint64_t n) {
+    sum += n;
+    return sum + (sum < n);
+}
+
+static uint64_t sum_vector(const uint8_t** data, size_t* len, uint64_t sum) {
+    const uint8_t* p = *data;
+    size_t n = *len;
+#if defined(__x86_64__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero;
+    __m128i acc1 = zero;
+    while (n >= 32) {
+        __m128i v0 = _mm_loadu_si128((const __m128i*)p);
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(p + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+        p += 32;
+        n -= 32;
+    }
+    uint64_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, acc0);
+    _mm_storeu_si128((__m128i*)(lanes + 2), acc1);
+    for (int i = 0; i < 4; i++) {
+        sum = add64(sum, lanes[i]);
+    }
+#elif defined(__aarch64__)
+    uint64x2_t acc0 = vdupq_n_u64(0);
+    uint64x2_t acc1 = vdupq_n_u64(0);
+    while (n >= 32) {
+        acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(vld1q_u8(p)));
+        acc1 = vpadalq_u32(acc1, vreinterpretq_u32_u8(vld1q_u8(p + 16)));
+        p += 32;
+        n -= 32;
+    }
+    sum = add64(sum, vgetq_lane_u64(acc0, 0));
+    sum = add64(sum, vgetq_lane_u64(acc0, 1));
+    sum = add64(sum, vgetq_lane_u64(acc1, 0));
+    sum = add64(sum, vgetq_lane_u64(acc1, 1));
+#endif
+    *data = p;
+    *len = n;
+    return sum;
+}
+
+uint16_t ip6_checksum_add(const void* _data, size_t len, uint16_t _sum) {
+    const uint8_t* data = _data;
+    uint64_t sum = sum_vector(&data, &len, _sum);
+
+    while (len >= 8) {
+        uint64_t n;
+        memcpy(&n, data, 8);
+        sum = add64(sum, n);
+        data += 8;
+        len -= 8;
+    }
+    if (len) {
+        // an odd byte at the end is padded with zero
+        uint64_t n = 0;
+        memcpy(&n, data, len);
+        sum = add64(sum, n);
+    }
+
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
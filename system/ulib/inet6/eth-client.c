@@ -20,6 +20,7 @@
 void eth_destroy(eth_client_t* eth) {
     mx_handle_close(eth->rx_fifo);
     mx_handle_close(eth->tx_fifo);
+    free(eth->rx_pending);
     free(eth);
 }
 
@@ -39,6 +40,12 @@ mx_status_t eth_create(int fd, mx_handle_t io_vmo, void* io_mem, eth_client_t**
         return r;
     }
 
+    // there are never more rx buffers to hand over than fit in the fifo
+    if ((eth->rx_pending = calloc(fifos.rx_depth, sizeof(eth_fifo_entry_t))) == NULL) {
+        status = ERR_NO_MEMORY;
+        goto fail;
+    }
+
     mx_handle_t vmo;
     if ((status = mx_handle_duplicate(io_vmo, MX_RIGHT_SAME_RIGHTS, &vmo)) < 0) {
         fprintf(stderr, "eth_create: failed to duplicate vmo\n");
@@ -82,16 +89,40 @@ mx_status_t eth_queue_tx(eth_client_t* eth, void* cookie,
 
 mx_status_t eth_queue_rx(eth_client_t* eth, void* cookie,
                          void* data, size_t len, uint32_t options) {
-    eth_fifo_entry_t e = {
-        .offset = data - eth->iobuf,
-        .length = len,
-        .flags = options,
-        .cookie = cookie,
-    };
-    uint32_t actual;
+    if (eth->rx_pending_count == eth->rx_size) {
+        mx_status_t status;
+        if ((status = eth_flush_rx(eth)) < 0) {
+            return status;
+        }
+    }
+    eth_fifo_entry_t* e = &eth->rx_pending[eth->rx_pending_count++];
+    e->offset = data - eth->iobuf;
+    e->length = len;
+    e->flags = options;
+    e->cookie = cookie;
     IORING_TRACE("eth:rx+ c=%p o=%u l=%u f=%u\n",
-                 e.cookie, e.offset, e.length, e.flags);
-    return mx_fifo_write(eth->rx_fifo, &e, sizeof(e), &actual);
+                 e->cookie, e->offset, e->length, e->flags);
+    return NO_ERROR;
+}
+
+mx_status_t eth_flush_rx(eth_client_t* eth) {
+    if (eth->rx_pending_count == 0) {
+        return NO_ERROR;
+    }
+    mx_status_t status;
+    uint32_t actual;
+    if ((status = mx_fifo_write(eth->rx_fifo, eth->rx_pending,
+                                sizeof(eth_fifo_entry_t) * eth->rx_pending_count, &actual)) < 0) {
+        return status;
+    }
+    // the fifo has room for every buffer the client owns, so this only
+    // happens if buffers were queued twice
+    if (actual < eth->rx_pending_count) {
+        memmove(eth->rx_pending, eth->rx_pending + actual,
+                sizeof(eth_fifo_entry_t) * (eth->rx_pending_count - actual));
+    }
+    eth->rx_pending_count -= actual;
+    return NO_ERROR;
 }
 
 mx_status_t eth_complete_tx(eth_client_t* eth, void* ctx,
@@ -122,7 +153,7 @@ mx_status_t eth_complete_rx(eth_client_t* eth, void* ctx,
     uint32_t count;
     if ((status = mx_fifo_read(eth->rx_fifo, entries, sizeof(entries), &count)) < 0) {
         if (status == ERR_SHOULD_WAIT) {
-            return NO_ERROR;
+            return eth_flush_rx(eth);
         } else {
             return status;
         }
@@ -133,7 +164,7 @@ mx_status_t eth_complete_rx(eth_client_t* eth, void* ctx,
                      e->cookie, e->offset, e->length, e->flags);
         func(ctx, e->cookie, e->length, e->flags);
     }
-    return NO_ERROR;
+    return eth_flush_rx(eth);
 }
 
 
@@ -145,6 +176,11 @@ mx_status_t eth_wait_rx(eth_client_t* eth, mx_time_t timeout) {
     mx_status_t status;
     mx_signals_t signals;
 
+    // the driver cannot fill buffers it has not been given
+    if ((status = eth_flush_rx(eth)) < 0) {
+        return status;
+    }
+
     if ((status = mx_object_wait_one(eth->rx_fifo,
                                      MX_FIFO_READABLE | MX_FIFO_PEER_CLOSED,
                                      timeout, &signals)) < 0) {
@@ -16,6 +16,10 @@ typedef struct eth_client {
     uint32_t tx_size;
     uint32_t rx_size;
     void* iobuf;
+
+    // rx buffers queued with eth_queue_rx(), not yet written to the fifo
+    eth_fifo_entry_t* rx_pending;
+    uint32_t rx_pending_count;
 } eth_client_t;
 
 mx_status_t eth_create(int fd, mx_handle_t io_vmo, void* io_mem, eth_client_t** out);
@@ -31,10 +35,16 @@ mx_status_t eth_complete_tx(eth_client_t* eth, void* ctx,
                             void (*func)(void* ctx, void* cookie));
 
 // Enqueue a packet for reception.
+// The buffers are handed to the driver together, by eth_complete_rx(),
+// eth_wait_rx() or eth_flush_rx().
 mx_status_t eth_queue_rx(eth_client_t* eth, void* cookie,
                          void* data, size_t len, uint32_t options);
 
-// Process all received buffers
+// Hand the buffers enqueued for reception to the driver
+mx_status_t eth_flush_rx(eth_client_t* eth);
+
+// Process all received buffers, then flush the buffers enqueued for
+// reception, including those the callback enqueues
 mx_status_t eth_complete_rx(eth_client_t* eth, void* ctx,
                             void (*func)(void* ctx, void* cookie, size_t len, uint32_t flags));
 
@@ -128,9 +128,21 @@ static inline uint32_t _swap32(uint32_t n) {
 char* ip6toa(char* _out, void* ip6addr);
 #define IP6TOAMAX 40
 
+// Checksum offloads. Passed to ip6_init() for those the interface
+// supports, to eth_send() for a frame whose UDP or ICMPv6 checksum the
+// interface should compute, and to eth_recv() for a frame whose checksum
+// the interface has verified.
+#define ETH_CSUM_TX 1
+#define ETH_CSUM_RX 2
+
 // provided by inet6.c
-void ip6_init(void* macaddr);
-void eth_recv(void* data, size_t len);
+void ip6_init(void* macaddr, uint32_t csum);
+void eth_recv(void* data, size_t len, uint32_t flags);
+
+// provided by checksum.c
+// Returns the ones' complement sum of len bytes of data and sum, without
+// complementing it.
+uint16_t ip6_checksum_add(const void* data, size_t len, uint16_t sum);
 
 typedef struct eth_buffer eth_buffer_t;
 
@@ -138,7 +150,7 @@ typedef struct eth_buffer eth_buffer_t;
 int eth_get_buffer(size_t len, void** data, eth_buffer_t** out);
 void eth_put_buffer(eth_buffer_t* ethbuf);
 
-int eth_send(eth_buffer_t* ethbuf, size_t skip, size_t len);
+int eth_send(eth_buffer_t* ethbuf, size_t skip, size_t len, uint32_t flags);
 
 int eth_add_mcast_filter(const mac_addr_t* addr);
 
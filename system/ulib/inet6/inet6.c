@@ -103,14 +103,19 @@ ip6_addr_t ll_ip6_addr;
 mac_addr_t snm_mac_addr;
 ip6_addr_t snm_ip6_addr;
 
+// checksum offloads supported by the interface (ETH_CSUM_*)
+static uint32_t csum_offload;
+
 // cache for the last source addresses we've seen
 static mac_addr_t rx_mac_addr;
 static ip6_addr_t rx_ip6_addr;
 
-void ip6_init(void* macaddr) {
+void ip6_init(void* macaddr, uint32_t csum) {
     char tmp[IP6TOAMAX];
     mac_addr_t all;
 
+    csum_offload = csum;
+
     // save our ethernet MAC and synthesize link layer addresses
     memcpy(&ll_mac_addr, macaddr, 6);
     ll6addr_from_mac(&ll_ip6_addr, &ll_mac_addr);
@@ -149,22 +154,6 @@ static int resolve_ip6(mac_addr_t* _mac, const ip6_addr_t* _ip) {
     return -1;
 }
 
-static uint16_t checksum(const void* _data, size_t len, uint16_t _sum) {
-    uint32_t sum = _sum;
-    const uint16_t* data = _data;
-    while (len > 1) {
-        sum += *data++;
-        len -= 2;
-    }
-    if (len) {
-        sum += (*data & 0xFF);
-    }
-    while (sum > 0xFFFF) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-    return sum;
-}
-
 typedef struct {
     uint8_t eth[16];
     ip6_hdr_t ip6;
@@ -182,9 +171,9 @@ static unsigned ip6_checksum(ip6_hdr_t* ip, unsigned type, size_t length) {
     uint16_t sum;
 
     // length and protocol field for pseudo-header
-    sum = checksum(&ip->length, 2, htons(type));
+    sum = ip6_checksum_add(&ip->length, 2, htons(type));
     // src/dst for pseudo-header + payload
-    sum = checksum(&ip->src, 32 + length, sum);
+    sum = ip6_checksum_add(&ip->src, 32 + length, sum);
 
     // 0 is illegal, so 0xffff remains 0xffff
     if (sum != 0xffff) {
@@ -237,8 +226,11 @@ int udp6_send(const void* data, size_t dlen, const ip6_addr_t* daddr, uint16_t d
     p->udp.checksum = 0;
 
     memcpy(p->data, data, dlen);
+    if (csum_offload & ETH_CSUM_TX) {
+        return eth_send(ethbuf, 2, ETH_HDR_LEN + IP6_HDR_LEN + length, ETH_CSUM_TX);
+    }
     p->udp.checksum = ip6_checksum(&p->ip6, HDR_UDP, length);
-    return eth_send(ethbuf, 2, ETH_HDR_LEN + IP6_HDR_LEN + length);
+    return eth_send(ethbuf, 2, ETH_HDR_LEN + IP6_HDR_LEN + length, 0);
 
 fail:
     eth_put_buffer(ethbuf);
@@ -261,29 +253,35 @@ static int icmp6_send(const void* data, size_t length, const ip6_addr_t* daddr)
 
     icmp = (void*)p->data;
     memcpy(icmp, data, length);
+    if (csum_offload & ETH_CSUM_TX) {
+        icmp->checksum = 0;
+        return eth_send(ethbuf, 2, ETH_HDR_LEN + IP6_HDR_LEN + length, ETH_CSUM_TX);
+    }
     icmp->checksum = ip6_checksum(&p->ip6, HDR_ICMP6, length);
-    return eth_send(ethbuf, 2, ETH_HDR_LEN + IP6_HDR_LEN + length);
+    return eth_send(ethbuf, 2, ETH_HDR_LEN + IP6_HDR_LEN + length, 0);
 
 fail:
     eth_put_buffer(ethbuf);
     return -1;
 }
 
-void _udp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
+void _udp6_recv(ip6_hdr_t* ip, void* _data, size_t len, uint32_t flags) {
     udp_hdr_t* udp = _data;
     uint16_t sum, n;
 
     if (len < UDP_HDR_LEN)
         BAD("Bogus Header Len");
-    if (udp->checksum == 0)
-        BAD("Checksum Invalid");
-    if (udp->checksum == 0xFFFF)
-        udp->checksum = 0;
-
-    sum = checksum(&ip->length, 2, htons(HDR_UDP));
-    sum = checksum(&ip->src, 32 + len, sum);
-    if (sum != 0xFFFF)
-        BAD("Checksum Incorrect");
+    if (!(flags & ETH_CSUM_RX)) {
+        if (udp->checksum == 0)
+            BAD("Checksum Invalid");
+        if (udp->checksum == 0xFFFF)
+            udp->checksum = 0;
+
+        sum = ip6_checksum_add(&ip->length, 2, htons(HDR_UDP));
+        sum = ip6_checksum_add(&ip->src, 32 + len, sum);
+        if (sum != 0xFFFF)
+            BAD("Checksum Incorrect");
+    }
 
     n = ntohs(udp->length);
     if (n < UDP_HDR_LEN)
@@ -297,19 +295,21 @@ void _udp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
               (void*)&ip->src, ntohs(udp->src_port));
 }
 
-void icmp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
+void icmp6_recv(ip6_hdr_t* ip, void* _data, size_t len, uint32_t flags) {
     icmp6_hdr_t* icmp = _data;
     uint16_t sum;
 
-    if (icmp->checksum == 0)
-        BAD("Checksum Invalid");
-    if (icmp->checksum == 0xFFFF)
-        icmp->checksum = 0;
+    if (!(flags & ETH_CSUM_RX)) {
+        if (icmp->checksum == 0)
+            BAD("Checksum Invalid");
+        if (icmp->checksum == 0xFFFF)
+            icmp->checksum = 0;
 
-    sum = checksum(&ip->length, 2, htons(HDR_ICMP6));
-    sum = checksum(&ip->src, 32 + len, sum);
-    if (sum != 0xFFFF)
-        BAD("Checksum Incorrect");
+        sum = ip6_checksum_add(&ip->length, 2, htons(HDR_ICMP6));
+        sum = ip6_checksum_add(&ip->src, 32 + len, sum);
+        if (sum != 0xFFFF)
+            BAD("Checksum Incorrect");
+    }
 
     if (icmp->type == ICMP6_NDP_N_SOLICIT) {
         ndp_n_hdr_t* ndp = _data;
@@ -348,7 +348,7 @@ void icmp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
     }
 }
 
-void eth_recv(void* _data, size_t len) {
+void eth_recv(void* _data, size_t len, uint32_t flags) {
     uint8_t* data = _data;
     ip6_hdr_t* ip;
     uint32_t n;
@@ -389,10 +389,10 @@ void eth_recv(void* _data, size_t len) {
 
     switch (ip->next_header) {
     case HDR_ICMP6:
-        icmp6_recv(ip, data, len);
+        icmp6_recv(ip, data, len, flags);
         break;
     case HDR_UDP:
-        _udp6_recv(ip, data, len);
+        _udp6_recv(ip, data, len, flags);
         break;
     default:
         // do nothing
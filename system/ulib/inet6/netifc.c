@@ -162,7 +162,7 @@ static void tx_complete(void* ctx, void* cookie) {
     eth_put_buffer_locked(cookie, ETH_BUFFER_TX);
 }
 
-int eth_send(eth_buffer_t* ethbuf, size_t skip, size_t len) {
+int eth_send(eth_buffer_t* ethbuf, size_t skip, size_t len, uint32_t flags) {
     mtx_lock(&eth_lock);
 
     check_ethbuf(ethbuf, ETH_BUFFER_CLIENT);
@@ -185,7 +185,8 @@ int eth_send(eth_buffer_t* ethbuf, size_t skip, size_t len) {
     eth_complete_tx(eth, NULL, tx_complete);
 
     ethbuf->state = ETH_BUFFER_TX;
-    mx_status_t status = eth_queue_tx(eth, ethbuf, ethbuf->data + skip, len, 0);
+    uint32_t options = (flags & ETH_CSUM_TX) ? ETH_FIFO_TX_CSUM : 0;
+    mx_status_t status = eth_queue_tx(eth, ethbuf, ethbuf->data + skip, len, options);
     if (status < 0) {
         printf("eth_fifo_send: queue tx failed: %d\n", status);
         eth_put_buffer_locked(ethbuf, ETH_BUFFER_TX);
@@ -206,7 +207,7 @@ void netifc_send(const void* _data, size_t len) {
     eth_buffer_t* ethbuf;
     if (eth_get_buffer(len, &data, &ethbuf) == 0) {
         memcpy(data, _data, len);
-        eth_send(ethbuf, 0, len);
+        eth_send(ethbuf, 0, len, 0);
     }
 }
 
@@ -254,6 +255,13 @@ static mx_status_t netifc_open_cb(int dirfd, int event, const char* fn, void* co
     }
     memcpy(netmac, info.mac, sizeof(netmac));
     netmtu = info.mtu;
+    uint32_t csum = 0;
+    if (info.features & ETH_FEATURE_TX_CSUM) {
+        csum |= ETH_CSUM_TX;
+    }
+    if (info.features & ETH_FEATURE_RX_CSUM) {
+        csum |= ETH_CSUM_RX;
+    }
 
     mtx_lock(&eth_lock);
     mx_status_t status;
@@ -303,7 +311,7 @@ static mx_status_t netifc_open_cb(int dirfd, int event, const char* fn, void* co
         goto fail_destroy_client;
     }
 
-    ip6_init(netmac);
+    ip6_init(netmac, csum);
 
     // enqueue rx buffers
     for (unsigned n = 0; n < NET_BUFFERS; n++) {
@@ -380,7 +388,7 @@ void netifc_close(void) {
 static void rx_complete(void* ctx, void* cookie, size_t len, uint32_t flags) {
     eth_buffer_t* ethbuf = cookie;
     check_ethbuf(ethbuf, ETH_BUFFER_RX);
-    netifc_recv(ethbuf->data, len);
+    netifc_recv(ethbuf->data, len, (flags & ETH_FIFO_RX_CSUM_OK) ? ETH_CSUM_RX : 0);
     eth_queue_rx(eth, ethbuf, ethbuf->data, NET_BUFFERSZ, 0);
 }
 
@@ -43,7 +43,10 @@ struct mxio_dispatcher {
     list_node_t list;
     mx_handle_t ioport;
     mxio_dispatcher_cb_t default_cb;
-    thrd_t t;
+    bool started;
+    // Number of threads servicing ioport.  The last one to exit
+    // destroys the dispatcher.
+    uint32_t thread_count;
 };
 
 static void mxio_dispatcher_destroy(mxio_dispatcher_t* md) {
@@ -147,7 +150,12 @@ static int mxio_dispatcher_thread(void* _md) {
     }
 
     xprintf("dispatcher: FATAL ERROR, EXITING\n");
-    mxio_dispatcher_destroy(md);
+    mtx_lock(&md->lock);
+    bool last = (--md->thread_count == 0);
+    mtx_unlock(&md->lock);
+    if (last) {
+        mxio_dispatcher_destroy(md);
+    }
     return NO_ERROR;
 }
 
@@ -170,24 +178,55 @@ mx_status_t mxio_dispatcher_create(mxio_dispatcher_t** out, mxio_dispatcher_cb_t
 }
 
 mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md, const char* name) {
-    mx_status_t r;
+    return mxio_dispatcher_start_pool(md, name, 1);
+}
+
+mx_status_t mxio_dispatcher_start_pool(mxio_dispatcher_t* md, const char* name,
+                                       uint32_t nthreads) {
+#if !USE_WAIT_ONCE
+    // With repeating waits a channel could become readable again while
+    // one thread is still in its callback, and a second thread would pick
+    // it up, breaking per-channel ordering.
+    if (nthreads > 1) {
+        return ERR_NOT_SUPPORTED;
+    }
+#endif
+    if (nthreads == 0) {
+        return ERR_INVALID_ARGS;
+    }
+
     mtx_lock(&md->lock);
-    if (md->t == NULL) {
-        if (thrd_create_with_name(&md->t, mxio_dispatcher_thread, md, name) != thrd_success) {
-            mxio_dispatcher_destroy(md);
-            r = ERR_NO_RESOURCES;
-        } else {
-            thrd_detach(md->t);
-            r = NO_ERROR;
+    if (md->started) {
+        mtx_unlock(&md->lock);
+        return ERR_BAD_STATE;
+    }
+    uint32_t n;
+    for (n = 0; n < nthreads; n++) {
+        thrd_t t;
+        md->thread_count++;
+        if (thrd_create_with_name(&t, mxio_dispatcher_thread, md, name) != thrd_success) {
+            md->thread_count--;
+            break;
         }
-    } else {
-        r = ERR_BAD_STATE;
+        thrd_detach(t);
     }
+    md->started = (n > 0);
     mtx_unlock(&md->lock);
-    return r;
+
+    if (n == 0) {
+        mxio_dispatcher_destroy(md);
+        return ERR_NO_RESOURCES;
+    }
+    if (n < nthreads) {
+        printf("dispatcher: only started %u of %u threads\n", n, nthreads);
+    }
+    return NO_ERROR;
 }
 
 void mxio_dispatcher_run(mxio_dispatcher_t* md) {
+    mtx_lock(&md->lock);
+    md->thread_count++;
+    mtx_unlock(&md->lock);
     mxio_dispatcher_thread(md);
 }
 
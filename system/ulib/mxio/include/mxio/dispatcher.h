@@ -29,7 +29,19 @@ mx_status_t mxio_dispatcher_create(mxio_dispatcher_t** out, mxio_dispatcher_cb_t
 // create a thread for a dispatcher and start it running
 mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md, const char* name);
 
+// create a pool of |nthreads| threads for a dispatcher and start them running
+//
+// Each channel is serviced by at most one thread at a time, so messages
+// from any one channel are still handled in order, but a slow callback
+// for one channel no longer holds up the others.  Callbacks must be safe
+// to run concurrently for different channels.
+mx_status_t mxio_dispatcher_start_pool(mxio_dispatcher_t* md, const char* name,
+                                       uint32_t nthreads);
+
 // run the dispatcher loop on the current thread, never to return
+//
+// This may be combined with mxio_dispatcher_start_pool() to have the
+// current thread join the pool.
 void mxio_dispatcher_run(mxio_dispatcher_t* md);
 
 // add a channel to the dispatcher, using the default callback
@@ -91,6 +91,24 @@ mx_status_t mxrio_handler(mx_handle_t h, void* cb, void* cookie);
 void mxrio_txn_handoff(mx_handle_t server, mx_handle_t reply, mxrio_msg_t* msg);
 
 
+// Pipelined remoteio transactions.
+//
+// mxio_txn_begin() sends |msg| to the remoteio server behind |fd| without
+// waiting for the reply, and returns the transaction id in |txid|.  Any
+// handles in |msg| are consumed.  Several transactions may be outstanding
+// on one fd at a time; the server handles them in the order they were sent.
+//
+// mxio_txn_end() waits for the reply to |txid| and reads it into |msg|.
+// Replies may be collected in any order and from any thread.  On success
+// the return value is msg->arg and msg->hcount handles belong to the
+// caller; on error there are never any handles.
+//
+// Every transaction that was begun must be ended, or its reply is held
+// until the fd is closed.
+mx_status_t mxio_txn_begin(int fd, mxrio_msg_t* msg, mx_txid_t* txid);
+mx_status_t mxio_txn_end(int fd, mx_txid_t txid, mxrio_msg_t* msg);
+
+
 // OPEN and CLONE ops do not return a reply
 // Instead they receive a channel handle that they write their status
 // and (if successful) type, extra data, and handles to.
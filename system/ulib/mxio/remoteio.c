@@ -13,12 +13,14 @@
 #include <threads.h>
 
 #include <magenta/device/ioctl.h>
+#include <magenta/listnode.h>
 #include <magenta/processargs.h>
 #include <magenta/syscalls.h>
 
 #include <mxio/debug.h>
 #include <mxio/dispatcher.h>
 #include <mxio/io.h>
+#include <mxio/private.h>
 #include <mxio/remoteio.h>
 #include <mxio/socket.h>
 #include <mxio/util.h>
@@ -40,8 +42,26 @@ struct mxrio {
 
     // transaction id used for synchronous remoteio calls
     _Atomic mx_txid_t txid;
+
+    // protects the fields below (see mxrio_txn_recv)
+    mtx_t lock;
+    // replies to pipelined transactions that were read off the channel
+    // while waiting for a different transaction's reply
+    list_node_t replies;
+    // set while a thread waits on the channel with the lock dropped
+    bool reading;
+    // broadcast when a reply is set aside or the reading thread is done
+    cnd_t replies_changed;
 };
 
+typedef struct mxrio_reply {
+    list_node_t node;
+    mxrio_msg_t msg;
+} mxrio_reply_t;
+
+// Number of chunks that multi-chunk positional reads keep in flight.
+#define MXRIO_PIPELINE_DEPTH 4
+
 static pthread_key_t rchannel_key;
 
 static void rchannel_cleanup(void* data) {
@@ -231,6 +251,161 @@ fail_discard_handles:
     return r;
 }
 
+// Send a transaction without waiting for its reply.
+// The handles in msg are consumed, whether or not the send succeeds.
+static mx_status_t mxrio_txn_send(mxrio_t* rio, mxrio_msg_t* msg, mx_txid_t* txid) {
+    if (!is_message_valid(msg)) {
+        discard_handles(msg->handle, msg->hcount);
+        return ERR_INVALID_ARGS;
+    }
+
+    msg->txid = atomic_fetch_add(&rio->txid, 1);
+    xprintf("txn_send h=%x txid=%x op=%d len=%u\n", rio->h, msg->txid, msg->op, msg->datalen);
+
+    mx_status_t r;
+    if ((r = mx_channel_write(rio->h, 0, msg, MXRIO_HDR_SZ + msg->datalen,
+                              msg->handle, msg->hcount)) < 0) {
+        discard_handles(msg->handle, msg->hcount);
+        return r;
+    }
+    *txid = msg->txid;
+    return NO_ERROR;
+}
+
+// Wait for the reply to a transaction started by mxrio_txn_send().
+//
+// The server answers a channel's requests in order, but several threads
+// may be collecting replies on the same connection, so replies to other
+// transactions are set aside for their owners.  mxrio_txn() is not
+// affected: the kernel hands channel_call replies straight to the caller.
+//
+// Only one thread at a time waits on the channel, and it does so without
+// holding the lock; the others sleep until it sets a reply aside or stops
+// waiting, then look again.
+//
+// Same return and handle conventions as mxrio_txn().
+static mx_status_t mxrio_txn_recv(mxrio_t* rio, mx_txid_t txid, mxrio_msg_t* msg) {
+    mx_status_t r;
+    uint32_t dsize;
+
+    mtx_lock(&rio->lock);
+    for (;;) {
+        mxrio_reply_t* reply;
+        bool found = false;
+        list_for_every_entry (&rio->replies, reply, mxrio_reply_t, node) {
+            if (reply->msg.txid == txid) {
+                found = true;
+                break;
+            }
+        }
+        if (found) {
+            list_delete(&reply->node);
+            dsize = MXRIO_HDR_SZ + reply->msg.datalen;
+            memcpy(msg, &reply->msg, dsize);
+            free(reply);
+            break;
+        }
+
+        if (rio->reading) {
+            cnd_wait(&rio->replies_changed, &rio->lock);
+            continue;
+        }
+
+        msg->hcount = MXIO_MAX_HANDLES;
+        r = mx_channel_read(rio->h, 0, msg, MXRIO_HDR_SZ + MXIO_CHUNK_SIZE, &dsize,
+                            msg->handle, msg->hcount, &msg->hcount);
+        if (r == ERR_SHOULD_WAIT) {
+            // a slow reply must not hold up callers that only need the lock
+            rio->reading = true;
+            mtx_unlock(&rio->lock);
+            mx_signals_t pending;
+            r = mx_object_wait_one(rio->h, MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED,
+                                   MX_TIME_INFINITE, &pending);
+            mtx_lock(&rio->lock);
+            rio->reading = false;
+            cnd_broadcast(&rio->replies_changed);
+            if ((r == NO_ERROR) && !(pending & MX_CHANNEL_READABLE)) {
+                r = ERR_REMOTE_CLOSED;
+            }
+            if (r < 0) {
+                mtx_unlock(&rio->lock);
+                msg->hcount = 0;
+                return r;
+            }
+            continue;
+        }
+        if (r < 0) {
+            mtx_unlock(&rio->lock);
+            msg->hcount = 0;
+            return r;
+        }
+        if (msg->txid == txid) {
+            break;
+        }
+        // Someone else's reply.
+        if (!is_message_reply_valid(msg, dsize) ||
+            ((reply = malloc(sizeof(mxrio_reply_t) - MXIO_CHUNK_SIZE + msg->datalen)) == NULL)) {
+            discard_handles(msg->handle, msg->hcount);
+            continue;
+        }
+        memcpy(&reply->msg, msg, dsize);
+        list_add_tail(&rio->replies, &reply->node);
+        cnd_broadcast(&rio->replies_changed);
+    }
+    mtx_unlock(&rio->lock);
+
+    // check for protocol errors
+    if (!is_message_reply_valid(msg, dsize) ||
+        (MXRIO_OP(msg->op) != MXRIO_STATUS)) {
+        r = ERR_IO;
+        goto fail_discard_handles;
+    }
+    // check for remote error
+    if ((r = msg->arg) < 0) {
+        goto fail_discard_handles;
+    }
+    return r;
+
+fail_discard_handles:
+    discard_handles(msg->handle, msg->hcount);
+    msg->hcount = 0;
+    return r;
+}
+
+static bool is_rio(mxio_t* io);
+
+mx_status_t mxio_txn_begin(int fd, mxrio_msg_t* msg, mx_txid_t* txid) {
+    mxio_t* io = __mxio_fd_to_io(fd);
+    if (io == NULL) {
+        discard_handles(msg->handle, msg->hcount);
+        return ERR_BAD_HANDLE;
+    }
+    mx_status_t r;
+    if (!is_rio(io)) {
+        discard_handles(msg->handle, msg->hcount);
+        r = ERR_NOT_SUPPORTED;
+    } else {
+        r = mxrio_txn_send((mxrio_t*)io, msg, txid);
+    }
+    mxio_release(io);
+    return r;
+}
+
+mx_status_t mxio_txn_end(int fd, mx_txid_t txid, mxrio_msg_t* msg) {
+    mxio_t* io = __mxio_fd_to_io(fd);
+    if (io == NULL) {
+        return ERR_BAD_HANDLE;
+    }
+    mx_status_t r;
+    if (!is_rio(io)) {
+        r = ERR_NOT_SUPPORTED;
+    } else {
+        r = mxrio_txn_recv((mxrio_t*)io, txid, msg);
+    }
+    mxio_release(io);
+    return r;
+}
+
 static ssize_t mxrio_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
                            size_t in_len, void* out_buf, size_t out_len) {
     mxrio_t* rio = (mxrio_t*)io;
@@ -410,11 +585,89 @@ static ssize_t read_common(uint32_t op, mxio_t* io, void* _data, size_t len, off
     return count ? count : r;
 }
 
+// Positional reads larger than a chunk keep up to MXRIO_PIPELINE_DEPTH
+// requests in flight, rather than paying a round trip per chunk.
+static ssize_t read_at_pipelined(mxio_t* io, void* _data, size_t len, off_t offset) {
+    mxrio_t* rio = (mxrio_t*)io;
+    uint8_t* data = _data;
+    ssize_t count = 0;
+    mx_status_t r = 0;
+    mxrio_msg_t msg;
+
+    // chunks that have been requested, but not yet collected
+    struct {
+        mx_txid_t txid;
+        size_t xfer;
+    } inflight[MXRIO_PIPELINE_DEPTH];
+    size_t head = 0, tail = 0;
+    size_t requested = 0;
+    // no more requests are sent once a send fails or a reply comes up
+    // short; replies behind a short or failed one are thrown away
+    bool sending = true;
+    bool consuming = true;
+
+    for (;;) {
+        // Keep the pipeline full.
+        while (sending && (requested < len) && (tail - head < MXRIO_PIPELINE_DEPTH)) {
+            size_t xfer = len - requested;
+            if (xfer > MXIO_CHUNK_SIZE) {
+                xfer = MXIO_CHUNK_SIZE;
+            }
+            memset(&msg, 0, MXRIO_HDR_SZ);
+            msg.op = MXRIO_READ_AT;
+            msg.arg = xfer;
+            msg.arg2.off = offset + requested;
+            size_t slot = tail % MXRIO_PIPELINE_DEPTH;
+            if ((r = mxrio_txn_send(rio, &msg, &inflight[slot].txid)) < 0) {
+                sending = false;
+                break;
+            }
+            inflight[slot].xfer = xfer;
+            requested += xfer;
+            tail++;
+        }
+        if (head == tail) {
+            break;
+        }
+
+        // Collect the oldest outstanding chunk.
+        size_t slot = head % MXRIO_PIPELINE_DEPTH;
+        head++;
+        mx_status_t rr = mxrio_txn_recv(rio, inflight[slot].txid, &msg);
+        if (rr >= 0) {
+            discard_handles(msg.handle, msg.hcount);
+        }
+        if (!consuming) {
+            continue;
+        }
+        if ((r = rr) < 0) {
+            sending = consuming = false;
+            continue;
+        }
+        if ((r > (int)msg.datalen) || ((size_t)r > inflight[slot].xfer)) {
+            r = ERR_IO;
+            sending = consuming = false;
+            continue;
+        }
+        memcpy(data, msg.data, r);
+        count += r;
+        data += r;
+        // stop at short read
+        if ((size_t)r < inflight[slot].xfer) {
+            sending = consuming = false;
+        }
+    }
+    return count ? count : r;
+}
+
 static ssize_t mxrio_read(mxio_t* io, void* _data, size_t len) {
     return read_common(MXRIO_READ, io, _data, len, 0);
 }
 
 static ssize_t mxrio_read_at(mxio_t* io, void* _data, size_t len, mx_off_t offset) {
+    if (len > MXIO_CHUNK_SIZE) {
+        return read_at_pipelined(io, _data, len, offset);
+    }
     return read_common(MXRIO_READ_AT, io, _data, len, offset);
 }
 
@@ -457,6 +710,15 @@ static mx_status_t mxrio_close(mxio_t* io) {
         mx_handle_close(h);
     }
 
+    // drop any pipelined replies nobody collected
+    mxrio_reply_t* reply;
+    mtx_lock(&rio->lock);
+    while ((reply = list_remove_head_type(&rio->replies, mxrio_reply_t, node)) != NULL) {
+        discard_handles(reply->msg.handle, reply->msg.hcount);
+        free(reply);
+    }
+    mtx_unlock(&rio->lock);
+
     return r;
 }
 
@@ -740,6 +1002,10 @@ static mxio_ops_t mx_remote_ops = {
     .posix_ioctl = mxio_default_posix_ioctl,
 };
 
+static bool is_rio(mxio_t* io) {
+    return io->ops == &mx_remote_ops;
+}
+
 mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e) {
     mxrio_t* rio = calloc(1, sizeof(*rio));
     if (rio == NULL)
@@ -749,6 +1015,9 @@ mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e) {
     atomic_init(&rio->io.refcount, 1);
     rio->h = h;
     rio->h2 = e;
+    mtx_init(&rio->lock, mtx_plain);
+    cnd_init(&rio->replies_changed);
+    list_initialize(&rio->replies);
     return &rio->io;
 }
 
@@ -1212,6 +1481,9 @@ mxio_t* mxio_socket_create(mx_handle_t h, mx_handle_t s) {
     rio->io.flags |= MXIO_FLAG_SOCKET;
     rio->h = h;
     rio->h2 = s;
+    mtx_init(&rio->lock, mtx_plain);
+    cnd_init(&rio->replies_changed);
+    list_initialize(&rio->replies);
     return &rio->io;
 }
 
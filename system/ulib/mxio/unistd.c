@@ -588,46 +588,73 @@ int mxio_status_to_errno(mx_status_t status) {
 // The functions from here on provide implementations of fd and path
 // centric posix-y io operations.
 
-ssize_t readv(int fd, const struct iovec* iov, int num) {
+// Vectored io coalesces runs of small iovecs through a bounce buffer, so
+// that they cost one transfer per MXIO_CHUNK_SIZE rather than one per iovec.
+// Large iovecs are transferred directly.
+static ssize_t vec_io(int fd, const struct iovec* iov, int num, off_t ofs,
+                      bool positional, bool is_write) {
+    uint8_t buf[MXIO_CHUNK_SIZE];
     ssize_t count = 0;
     ssize_t r;
     while (num > 0) {
-        if (iov->iov_len != 0) {
-            r = read(fd, iov->iov_base, iov->iov_len);
-            if (r < 0) {
-                return count ? count : r;
+        size_t len;
+        int n;
+        if (iov->iov_len >= MXIO_CHUNK_SIZE) {
+            len = iov->iov_len;
+            n = 1;
+            if (is_write) {
+                r = positional ? pwrite(fd, iov->iov_base, len, ofs) :
+                                 write(fd, iov->iov_base, len);
+            } else {
+                r = positional ? pread(fd, iov->iov_base, len, ofs) :
+                                 read(fd, iov->iov_base, len);
             }
-            if ((size_t)r < iov->iov_len) {
-                return count + r;
+        } else {
+            len = 0;
+            for (n = 0; (n < num) && (iov[n].iov_len < MXIO_CHUNK_SIZE) &&
+                        (len + iov[n].iov_len <= MXIO_CHUNK_SIZE); n++) {
+                if (is_write) {
+                    memcpy(buf + len, iov[n].iov_base, iov[n].iov_len);
+                }
+                len += iov[n].iov_len;
             }
-            count += r;
+            if (len == 0) {
+                r = 0;
+            } else if (is_write) {
+                r = positional ? pwrite(fd, buf, len, ofs) : write(fd, buf, len);
+            } else {
+                r = positional ? pread(fd, buf, len, ofs) : read(fd, buf, len);
+                size_t off = 0;
+                for (int i = 0; (i < n) && (r > 0) && (off < (size_t)r); i++) {
+                    size_t xfer = (size_t)r - off;
+                    if (xfer > iov[i].iov_len) {
+                        xfer = iov[i].iov_len;
+                    }
+                    memcpy(iov[i].iov_base, buf + off, xfer);
+                    off += xfer;
+                }
+            }
+        }
+        if (r < 0) {
+            return count ? count : r;
         }
-        iov++;
-        num--;
+        count += r;
+        ofs += r;
+        if ((size_t)r < len) {
+            return count;
+        }
+        iov += n;
+        num -= n;
     }
     return count;
 }
 
+ssize_t readv(int fd, const struct iovec* iov, int num) {
+    return vec_io(fd, iov, num, 0, false, false);
+}
 ssize_t writev(int fd, const struct iovec* iov, int num) {
-    ssize_t count = 0;
-    ssize_t r;
-    while (num > 0) {
-        if (iov->iov_len != 0) {
-            r = write(fd, iov->iov_base, iov->iov_len);
-            if (r < 0) {
-                return count ? count : r;
-            }
-            if ((size_t)r < iov->iov_len) {
-                return count + r;
-            }
-            count += r;
-        }
-        iov++;
-        num--;
-    }
-    return count;
+    return vec_io(fd, iov, num, 0, false, true);
 }
-
 int unlinkat(int dirfd, const char* path, int flags) {
     const char* name;
     mxio_t* io;
@@ -684,26 +711,8 @@ ssize_t write(int fd, const void* buf, size_t count) {
 }
 
 ssize_t preadv(int fd, const struct iovec* iov, int count, off_t ofs) {
-    ssize_t iov_count = 0;
-    ssize_t r;
-    while (count > 0) {
-        if (iov->iov_len != 0) {
-            r = pread(fd, iov->iov_base, iov->iov_len, ofs);
-            if (r < 0) {
-                return iov_count ? iov_count : r;
-            }
-            if ((size_t)r < iov->iov_len) {
-                return iov_count + r;
-            }
-            iov_count += r;
-            ofs += r;
-        }
-        iov++;
-        count--;
-    }
-    return iov_count;
+    return vec_io(fd, iov, count, ofs, true, false);
 }
-
 ssize_t pread(int fd, void* buf, size_t size, off_t ofs) {
     if (buf == NULL) {
         return ERRNO(EINVAL);
@@ -726,26 +735,8 @@ ssize_t pread(int fd, void* buf, size_t size, off_t ofs) {
 }
 
 ssize_t pwritev(int fd, const struct iovec* iov, int count, off_t ofs) {
-    ssize_t iov_count = 0;
-    ssize_t r;
-    while (count > 0) {
-        if (iov->iov_len != 0) {
-            r = pwrite(fd, iov->iov_base, iov->iov_len, ofs);
-            if (r < 0) {
-                return iov_count ? iov_count : r;
-            }
-            if ((size_t)r < iov->iov_len) {
-                return iov_count + r;
-            }
-            iov_count += r;
-            ofs += r;
-        }
-        iov++;
-        count--;
-    }
-    return iov_count;
+    return vec_io(fd, iov, count, ofs, true, true);
 }
-
 ssize_t pwrite(int fd, const void* buf, size_t size, off_t ofs) {
     if (buf == NULL) {
         return ERRNO(EINVAL);
@@ -0,0 +1,80 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <bitmap/raw-bitmap.h>
+#include <bitmap/storage.h>
+#include <magenta/syscalls.h>
+#include <mxtl/algorithm.h>
+
+#include "bench.h"
+
+namespace {
+
+using RawBitmap = bitmap::RawBitmapGeneric<bitmap::DefaultStorage>;
+
+template <typename T>
+mx_time_t time_it(T func) {
+    mx_time_t t = mx_time_get(MX_CLOCK_MONOTONIC);
+    func();
+    return mx_time_get(MX_CLOCK_MONOTONIC) - t;
+}
+
+// Allocates single bits and short runs out of a large bitmap, first fit from
+// bit zero, the way blobstore and minfs do.  |fill| is the fraction, in
+// percent, of the bitmap that is already allocated, in scattered runs.
+int bench_alloc(size_t size, unsigned fill, size_t run_len) {
+    RawBitmap bitmap;
+    if (bitmap.Reset(size) != NO_ERROR) {
+        printf("\tfailed to allocate bitmap\n");
+        return -1;
+    }
+
+    srand(4);
+    size_t target = size / 100 * fill;
+    for (size_t set = 0; set < target;) {
+        size_t off = rand() % size;
+        size_t len = mxtl::min(static_cast<size_t>(1 + rand() % 64), size - off);
+        size_t first_unset;
+        if (!bitmap.Get(off, off + len, &first_unset)) {
+            bitmap.Set(off, off + len);
+            set += len;
+        }
+    }
+
+    const size_t kAllocs = 1000;
+    size_t done = 0;
+    mx_time_t t = time_it([&]() {
+        for (; done < kAllocs; done++) {
+            size_t out;
+            if (bitmap.Find(false, 0, bitmap.size(), run_len, &out) != NO_ERROR) {
+                break;
+            }
+            bitmap.Set(out, out + run_len);
+        }
+    });
+    printf("\t%zu bits, %u%% full: %zu allocations of %zu bits took %" PRIu64 " nsecs\n",
+           size, fill, done, run_len, t);
+    return 0;
+}
+
+} // namespace
+
+int bitmap_run_benchmark(void) {
+    printf("starting bitmap benchmark\n");
+
+    const size_t kSizes[] = {1u << 16, 1u << 20, 1u << 24};
+    const unsigned kFills[] = {10, 50, 90};
+    for (size_t size : kSizes) {
+        for (unsigned fill : kFills) {
+            if (bench_alloc(size, fill, 1) < 0 || bench_alloc(size, fill, 16) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
@@ -335,6 +335,65 @@ static bool SetOutOfOrder(void) {
     END_TEST;
 }
 
+template <typename RawBitmap>
+static bool FindLarge(void) {
+    BEGIN_TEST;
+
+    // Large enough for three summary levels.
+    const size_t kSize = 64 * 64 * 64 * 4;
+    RawBitmap bitmap;
+    ASSERT_EQ(bitmap.Reset(kSize), NO_ERROR, "");
+
+    // Fill all but a few scattered holes.
+    EXPECT_EQ(bitmap.Set(0, kSize), NO_ERROR, "set all");
+    const size_t holes[] = {kSize / 3, kSize / 2, kSize - 1};
+    for (size_t hole : holes) {
+        EXPECT_EQ(bitmap.ClearOne(hole), NO_ERROR, "clear hole");
+    }
+
+    size_t bitoff_start;
+    for (size_t hole : holes) {
+        EXPECT_EQ(bitmap.Find(false, 0, kSize, 1, &bitoff_start), NO_ERROR, "find hole");
+        EXPECT_EQ(bitoff_start, hole, "check returned arg");
+        EXPECT_EQ(bitmap.SetOne(bitoff_start), NO_ERROR, "fill hole");
+    }
+    EXPECT_EQ(bitmap.Find(false, 0, kSize, 1, &bitoff_start), ERR_NO_RESOURCES, "full");
+    EXPECT_EQ(bitmap.Scan(0, kSize, true), kSize, "scan full");
+
+    // Set bits are found as quickly in a sea of clear ones.
+    EXPECT_EQ(bitmap.Clear(0, kSize), NO_ERROR, "clear all");
+    EXPECT_EQ(bitmap.SetOne(kSize / 2 + 7), NO_ERROR, "set one");
+    EXPECT_EQ(bitmap.Scan(1, kSize, false), kSize / 2 + 7, "scan for set bit");
+    EXPECT_EQ(bitmap.Find(true, 0, kSize, 1, &bitoff_start), NO_ERROR, "find set bit");
+    EXPECT_EQ(bitoff_start, kSize / 2 + 7, "check returned arg");
+
+    END_TEST;
+}
+
+template <typename RawBitmap>
+static bool RawWriteRebuild(void) {
+    BEGIN_TEST;
+
+    const size_t kSize = 64 * 64 * 8;
+    RawBitmap bitmap;
+    ASSERT_EQ(bitmap.Reset(kSize), NO_ERROR, "");
+
+    // Write the bits directly, as a filesystem loading its bitmap does.
+    size_t* data = static_cast<size_t*>(bitmap.StorageUnsafe()->GetData());
+    const size_t kWords = kSize / (sizeof(size_t) * 8);
+    for (size_t i = 0; i < kWords; i++) {
+        data[i] = ~static_cast<size_t>(0);
+    }
+    data[kWords - 2] &= ~static_cast<size_t>(2);
+    bitmap.RebuildSummary();
+
+    size_t bitoff_start;
+    EXPECT_EQ(bitmap.Find(false, 0, kSize, 1, &bitoff_start), NO_ERROR, "find");
+    EXPECT_EQ(bitoff_start, (kWords - 2) * sizeof(size_t) * 8 + 1, "check returned arg");
+
+    END_TEST;
+}
+
 #define RUN_TEMPLATIZED_TEST(test, specialization) RUN_TEST(test<specialization>)
 #define ALL_TESTS(specialization)                           \
     RUN_TEMPLATIZED_TEST(InitializedEmpty, specialization)  \
@@ -347,7 +406,9 @@ static bool SetOutOfOrder(void) {
     RUN_TEMPLATIZED_TEST(ClearSubrange, specialization)     \
     RUN_TEMPLATIZED_TEST(BoundaryArguments, specialization) \
     RUN_TEMPLATIZED_TEST(ClearAll, specialization)          \
-    RUN_TEMPLATIZED_TEST(SetOutOfOrder, specialization)
+    RUN_TEMPLATIZED_TEST(SetOutOfOrder, specialization)     \
+    RUN_TEMPLATIZED_TEST(FindLarge, specialization)         \
+    RUN_TEMPLATIZED_TEST(RawWriteRebuild, specialization)
 
 BEGIN_TEST_CASE(raw_bitmap_tests)
 ALL_TESTS(RawBitmapGeneric<DefaultStorage>)
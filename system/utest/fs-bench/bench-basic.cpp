@@ -90,6 +90,42 @@ bool benchmark_write_read(void) {
     END_TEST;
 }
 
+constexpr size_t kAppendSize = 100;
+constexpr size_t kNumAppends = 10000;
+
+// Many small appends, as a log would see. Each one extends the file, so this
+// mostly measures how cheaply the filesystem grows a file.
+bool benchmark_append(void) {
+    BEGIN_TEST;
+    printf("\nBenchmarking Append\n");
+    int fd = open(MOUNT_POINT "/logfile", O_CREAT | O_RDWR | O_APPEND, 0644);
+    ASSERT_GT(fd, 0, "Cannot create file (FS benchmarks assume mounted FS exists at '/benchmark')");
+
+    uint8_t data[kAppendSize];
+    memset(data, kMagicByte, kAppendSize);
+
+    uint64_t start, end;
+    size_t count;
+    uint64_t ticks_per_msec = mx_ticks_per_second() / 1000;
+
+    start = mx_ticks_get();
+    count = kNumAppends;
+    while (count--) {
+        ASSERT_EQ(write(fd, data, kAppendSize), kAppendSize, "");
+    }
+    end = mx_ticks_get();
+    printf("Benchmark append: [%10lu] msec\n", (end - start) / ticks_per_msec);
+
+    struct stat st;
+    ASSERT_EQ(fstat(fd, &st), 0, "");
+    ASSERT_EQ(st.st_size, static_cast<off_t>(kAppendSize * kNumAppends), "");
+
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(unlink(MOUNT_POINT "/logfile"), 0, "");
+
+    END_TEST;
+}
+
 #define START_STRING "/aaa"
 
 size_t constexpr cStrlen(const char* str) {
@@ -183,5 +219,6 @@ bool benchmark_path_walk(void) {
 
 BEGIN_TEST_CASE(basic_benchmarks)
 RUN_TEST_PERFORMANCE(benchmark_write_read)
+RUN_TEST_PERFORMANCE(benchmark_append)
 RUN_TEST_PERFORMANCE(benchmark_path_walk)
 END_TEST_CASE(basic_benchmarks)
@@ -18,6 +18,7 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/test-attr.c \
     $(LOCAL_DIR)/test-append.c \
     $(LOCAL_DIR)/test-basic.c \
+    $(LOCAL_DIR)/test-bootfs.c \
     $(LOCAL_DIR)/test-directory.c \
     $(LOCAL_DIR)/test-link.c \
     $(LOCAL_DIR)/test-maxfile.c \
@@ -29,6 +30,7 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/test-sync.c \
     $(LOCAL_DIR)/test-truncate.c \
     $(LOCAL_DIR)/test-unlink.c \
+    $(LOCAL_DIR)/test-vectored.c \
 
 MODULE_LDFLAGS := --wrap open --wrap unlink --wrap stat --wrap mkdir
 MODULE_LDFLAGS += --wrap rename --wrap truncate --wrap opendir
@@ -0,0 +1,92 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <unittest/unittest.h>
+
+// bootfs is not one of the filesystems under test, so these run against
+// /boot directly.  With bootfs.lazy set, its files are decompressed on
+// demand, a range at a time.
+
+#define BOOTFS_DIR "/boot/bin"
+#define MAX_FILES 8
+
+// Not a multiple of the page size or of the decompressor's block size, so
+// chunks straddle both.
+#define CHUNK_SIZE 3000
+
+// Reads the first MAX_FILES files of BOOTFS_DIR back to front, a chunk at a
+// time, and checks the chunks against a sequential read of the whole file.
+bool test_bootfs_scattered_reads(void) {
+    BEGIN_TEST;
+
+    DIR* dir = opendir(BOOTFS_DIR);
+    ASSERT_NONNULL(dir, "");
+
+    struct dirent* de;
+    int files = 0;
+    while ((files < MAX_FILES) && (de = readdir(dir)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", BOOTFS_DIR, de->d_name);
+        int fd = open(path, O_RDONLY);
+        ASSERT_GT(fd, 0, "");
+
+        struct stat st;
+        ASSERT_EQ(fstat(fd, &st), 0, "");
+        if (!S_ISREG(st.st_mode) || (st.st_size == 0)) {
+            ASSERT_EQ(close(fd), 0, "");
+            continue;
+        }
+        size_t size = st.st_size;
+
+        uint8_t* whole = malloc(size);
+        uint8_t* chunk = malloc(CHUNK_SIZE);
+        ASSERT_NONNULL(whole, "");
+        ASSERT_NONNULL(chunk, "");
+
+        // work backwards from the last chunk
+        size_t off = ((size - 1) / CHUNK_SIZE) * CHUNK_SIZE;
+        for (;;) {
+            size_t len = (size - off < CHUNK_SIZE) ? size - off : CHUNK_SIZE;
+            ASSERT_EQ(pread(fd, chunk, CHUNK_SIZE, off), (ssize_t)len, "");
+            memcpy(whole + off, chunk, len);
+            if (off == 0) {
+                break;
+            }
+            off -= CHUNK_SIZE;
+        }
+        ASSERT_EQ(pread(fd, chunk, CHUNK_SIZE, size), 0, "");
+
+        uint8_t* seq = malloc(size);
+        ASSERT_NONNULL(seq, "");
+        ASSERT_EQ(pread(fd, seq, size, 0), (ssize_t)size, "");
+        ASSERT_EQ(memcmp(whole, seq, size), 0, "scattered reads differ from sequential read");
+
+        free(seq);
+        free(chunk);
+        free(whole);
+        ASSERT_EQ(close(fd), 0, "");
+        files++;
+    }
+    ASSERT_EQ(closedir(dir), 0, "");
+    ASSERT_GT(files, 0, "no files found in " BOOTFS_DIR);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(bootfs_tests)
+RUN_TEST(test_bootfs_scattered_reads)
+END_TEST_CASE(bootfs_tests)
@@ -295,6 +295,90 @@ bool test_directory_rewind(void) {
     END_TEST;
 }
 
+bool test_directory_readdir_unlink(void) {
+    BEGIN_TEST;
+
+    // Create enough entries that readdir needs several calls to return them.
+    const int num_entries = 200;
+    bool seen[num_entries];
+    char path[PATH_MAX];
+    ASSERT_EQ(mkdir("::dir", 0755), 0, "");
+    for (int i = 0; i < num_entries; i++) {
+        snprintf(path, sizeof(path), "::dir/entry_with_a_long_name_%03d", i);
+        int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        ASSERT_GT(fd, 0, "");
+        ASSERT_EQ(close(fd), 0, "");
+        seen[i] = false;
+    }
+
+    // Removing each entry as soon as it has been returned must not make
+    // readdir skip or repeat any of the others.
+    DIR* dir = opendir("::dir");
+    ASSERT_NEQ(dir, NULL, "");
+    struct dirent* de;
+    int count = 0;
+    while ((de = readdir(dir)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+        int i;
+        ASSERT_EQ(sscanf(de->d_name, "entry_with_a_long_name_%03d", &i), 1, "");
+        ASSERT_TRUE(i >= 0 && i < num_entries, "Saw an unexpected dirent");
+        ASSERT_FALSE(seen[i], "Direntry seen twice");
+        seen[i] = true;
+        count++;
+        snprintf(path, sizeof(path), "::dir/%s", de->d_name);
+        ASSERT_EQ(unlink(path), 0, "");
+    }
+    ASSERT_EQ(count, num_entries, "Didn't see all expected direntries");
+    ASSERT_EQ(closedir(dir), 0, "");
+    ASSERT_EQ(rmdir("::dir"), 0, "");
+
+    END_TEST;
+}
+
+// Repeated lookups of the same names must see every change made to them.
+bool test_directory_lookup_after_change(void) {
+    BEGIN_TEST;
+
+    struct stat st;
+    ASSERT_EQ(mkdir("::dir", 0755), 0, "");
+    ASSERT_EQ(stat("::dir/a", &st), -1, "");
+    ASSERT_EQ(stat("::dir/a", &st), -1, "");
+
+    int fd = open("::dir/a", O_RDWR | O_CREAT | O_EXCL, 0644);
+    ASSERT_GT(fd, 0, "");
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(stat("::dir/a", &st), 0, "");
+    ASSERT_TRUE(S_ISREG(st.st_mode), "");
+
+    ASSERT_EQ(stat("::dir/b", &st), -1, "");
+    ASSERT_EQ(rename("::dir/a", "::dir/b"), 0, "");
+    ASSERT_EQ(stat("::dir/a", &st), -1, "");
+    ASSERT_EQ(stat("::dir/b", &st), 0, "");
+
+    ASSERT_EQ(unlink("::dir/b"), 0, "");
+    ASSERT_EQ(stat("::dir/b", &st), -1, "");
+    ASSERT_EQ(mkdir("::dir/b", 0755), 0, "");
+    ASSERT_EQ(stat("::dir/b", &st), 0, "");
+    ASSERT_TRUE(S_ISDIR(st.st_mode), "");
+
+    // Moving a directory keeps the names within it.
+    ASSERT_EQ(mkdir("::dir/b/c", 0755), 0, "");
+    ASSERT_EQ(stat("::dir/b/c", &st), 0, "");
+    ASSERT_EQ(rename("::dir/b", "::dir/a"), 0, "");
+    ASSERT_EQ(stat("::dir/b/c", &st), -1, "");
+    ASSERT_EQ(stat("::dir/a/c", &st), 0, "");
+
+    ASSERT_EQ(rmdir("::dir/a/c"), 0, "");
+    ASSERT_EQ(stat("::dir/a/c", &st), -1, "");
+    ASSERT_EQ(rmdir("::dir/a"), 0, "");
+    ASSERT_EQ(stat("::dir/a", &st), -1, "");
+    ASSERT_EQ(rmdir("::dir"), 0, "");
+
+    END_TEST;
+}
+
 bool test_directory_after_rmdir(void) {
     BEGIN_TEST;
 
@@ -345,6 +429,8 @@ RUN_FOR_ALL_FILESYSTEMS(directory_tests,
     RUN_TEST_MEDIUM(test_directory_trailing_slash)
     RUN_TEST_MEDIUM(test_directory_readdir)
     RUN_TEST_MEDIUM(test_directory_rewind)
+    RUN_TEST_MEDIUM(test_directory_readdir_unlink)
+    RUN_TEST_MEDIUM(test_directory_lookup_after_change)
     RUN_TEST_MEDIUM(test_directory_after_rmdir)
 )
 
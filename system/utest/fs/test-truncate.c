@@ -82,6 +82,52 @@ bool test_truncate_small(void) {
     END_TEST;
 }
 
+// Test that holes left by writing past the end of a file read back as
+// zeroes, and that nothing can be read beyond the end
+bool test_truncate_sparse(void) {
+    BEGIN_TEST;
+
+    const char* str = "Hello, World!\n";
+    const char* filename = "::alpha";
+    const off_t hole = 3 * 4096 + 5;
+    char buf[4096];
+
+    int fd = open(filename, O_RDWR | O_CREAT, 0644);
+    ASSERT_GT(fd, 0, "");
+    ASSERT_STREAM_ALL(write, fd, str, strlen(str));
+    ASSERT_EQ(lseek(fd, hole, SEEK_SET), hole, "");
+    ASSERT_STREAM_ALL(write, fd, str, strlen(str));
+
+    struct stat st;
+    ASSERT_EQ(fstat(fd, &st), 0, "");
+    ASSERT_EQ(st.st_size, hole + (off_t)strlen(str), "");
+    ASSERT_EQ(read(fd, buf, sizeof(buf)), 0, "Read past the end of the file");
+
+    // Everything between the two writes is zero
+    ASSERT_EQ(lseek(fd, strlen(str), SEEK_SET), (off_t)strlen(str), "");
+    for (off_t off = strlen(str); off < hole; off += sizeof(buf)) {
+        size_t len = hole - off < (off_t)sizeof(buf) ? hole - off : sizeof(buf);
+        ASSERT_STREAM_ALL(read, fd, buf, len);
+        for (size_t n = 0; n < len; n++) {
+            ASSERT_EQ(buf[n], 0, "");
+        }
+    }
+
+    // Shrinking and regrowing the file does not bring old data back
+    ASSERT_EQ(ftruncate(fd, 5), 0, "");
+    ASSERT_EQ(ftruncate(fd, hole + strlen(str)), 0, "");
+    ASSERT_EQ(lseek(fd, hole, SEEK_SET), hole, "");
+    ASSERT_STREAM_ALL(read, fd, buf, strlen(str));
+    for (size_t n = 0; n < strlen(str); n++) {
+        ASSERT_EQ(buf[n], 0, "");
+    }
+
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(unlink(filename), 0, "");
+
+    END_TEST;
+}
+
 #define BUFSIZE 1048576
 static_assert(BUFSIZE == ((BUFSIZE / sizeof(uint64_t)) * sizeof(uint64_t)),
               "BUFSIZE not multiple of sizeof(uint64_t)");
@@ -164,5 +210,6 @@ bool test_truncate_large(void) {
 
 RUN_FOR_ALL_FILESYSTEMS(truncate_tests,
     RUN_TEST_MEDIUM(test_truncate_small)
+    RUN_TEST_MEDIUM(test_truncate_sparse)
     RUN_TEST_LARGE(test_truncate_large)
 )
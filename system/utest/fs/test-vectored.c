@@ -0,0 +1,123 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <mxio/remoteio.h>
+
+#include "filesystems.h"
+#include "misc.h"
+
+#define NUM_IOVECS 64
+#define IOVEC_SIZE 100
+
+bool test_vectored_small_iovecs(void) {
+    BEGIN_TEST;
+
+    static uint8_t src[NUM_IOVECS][IOVEC_SIZE];
+    static uint8_t dst[NUM_IOVECS][IOVEC_SIZE];
+    struct iovec iov[NUM_IOVECS];
+    for (size_t i = 0; i < NUM_IOVECS; i++) {
+        memset(src[i], (int)i, IOVEC_SIZE);
+        iov[i].iov_base = src[i];
+        iov[i].iov_len = IOVEC_SIZE;
+    }
+
+    int fd = open("::vectored", O_RDWR | O_CREAT, 0644);
+    ASSERT_GT(fd, 0, "");
+    ASSERT_EQ(writev(fd, iov, NUM_IOVECS), NUM_IOVECS * IOVEC_SIZE, "");
+
+    for (size_t i = 0; i < NUM_IOVECS; i++) {
+        iov[i].iov_base = dst[i];
+    }
+    ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0, "");
+    ASSERT_EQ(readv(fd, iov, NUM_IOVECS), NUM_IOVECS * IOVEC_SIZE, "");
+    ASSERT_EQ(memcmp(src, dst, sizeof(src)), 0, "readv data mismatch");
+
+    // Positional, starting part way into the file, running past its end.
+    memset(dst, 0, sizeof(dst));
+    ASSERT_EQ(preadv(fd, iov, NUM_IOVECS, IOVEC_SIZE), (NUM_IOVECS - 1) * IOVEC_SIZE, "");
+    ASSERT_EQ(memcmp(src[1], dst[0], (NUM_IOVECS - 1) * IOVEC_SIZE), 0, "preadv data mismatch");
+
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(unlink("::vectored"), 0, "");
+    END_TEST;
+}
+
+bool test_pipelined_pread(void) {
+    BEGIN_TEST;
+
+    // Several chunks, with a partial chunk at the end.
+    const size_t len = 5 * 8192 + 123;
+    uint8_t* src = malloc(len);
+    uint8_t* dst = malloc(len);
+    ASSERT_NONNULL(src, "");
+    ASSERT_NONNULL(dst, "");
+    for (size_t i = 0; i < len; i++) {
+        src[i] = (uint8_t)(i * 7);
+    }
+
+    int fd = open("::pipelined", O_RDWR | O_CREAT, 0644);
+    ASSERT_GT(fd, 0, "");
+    ASSERT_STREAM_ALL(write, fd, src, len);
+
+    ASSERT_EQ(pread(fd, dst, len, 0), (ssize_t)len, "");
+    ASSERT_EQ(memcmp(src, dst, len), 0, "");
+
+    // A read running past the end of the file comes up short.
+    memset(dst, 0, len);
+    ASSERT_EQ(pread(fd, dst, len, 1000), (ssize_t)(len - 1000), "");
+    ASSERT_EQ(memcmp(src + 1000, dst, len - 1000), 0, "");
+
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(unlink("::pipelined"), 0, "");
+    free(src);
+    free(dst);
+    END_TEST;
+}
+
+bool test_txn_out_of_order(void) {
+    BEGIN_TEST;
+
+    int fd = open("::txn", O_RDWR | O_CREAT, 0644);
+    ASSERT_GT(fd, 0, "");
+    uint8_t data[4];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(0xa0 + i);
+    }
+    ASSERT_STREAM_ALL(write, fd, data, sizeof(data));
+
+    static mxrio_msg_t msg;
+    mx_txid_t txid[sizeof(data)];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        memset(&msg, 0, MXRIO_HDR_SZ);
+        msg.op = MXRIO_READ_AT;
+        msg.arg = 1;
+        msg.arg2.off = i;
+        ASSERT_EQ(mxio_txn_begin(fd, &msg, &txid[i]), NO_ERROR, "");
+    }
+    // Collect the replies backwards.
+    for (size_t i = sizeof(data); i-- > 0;) {
+        ASSERT_EQ(mxio_txn_end(fd, txid[i], &msg), 1, "");
+        ASSERT_EQ(msg.datalen, 1u, "");
+        ASSERT_EQ(msg.data[0], data[i], "");
+    }
+
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(unlink("::txn"), 0, "");
+    END_TEST;
+}
+
+RUN_FOR_ALL_FILESYSTEMS(vectored_tests,
+    RUN_TEST_MEDIUM(test_vectored_small_iovecs)
+    RUN_TEST_MEDIUM(test_pipelined_pread)
+    RUN_TEST_MEDIUM(test_txn_out_of_order)
+)
@@ -0,0 +1,201 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gfx/gfx.h>
+#include <unittest/unittest.h>
+
+// The drawing operations work a row at a time, with vector code for the
+// bulk of each row, so they are checked against one pixel at a time
+// versions over many widths and offsets.
+
+#define WIDTH 67
+#define HEIGHT 9
+#define STRIDE 72
+
+static uint32_t blend_ref(uint32_t dest, uint32_t src) {
+    uint32_t a = src >> 24;
+    if (a == 0) {
+        return dest;
+    } else if (a == 255) {
+        return src;
+    }
+    a++;
+    uint32_t out = a << 24;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t s = (src >> shift) & 0xff;
+        uint32_t d = (dest >> shift) & 0xff;
+        out |= (((s * a) / 256) + ((d * (255 - a)) / 256)) << shift;
+    }
+    return out;
+}
+
+static uint32_t random_pixel(void) {
+    uint32_t p = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    // plenty of fully opaque and fully clear pixels, in runs
+    switch ((rand() >> 4) % 4) {
+    case 0:
+        return p | 0xff000000;
+    case 1:
+        return p & 0x00ffffff;
+    default:
+        return p;
+    }
+}
+
+static void randomize(gfx_surface* s) {
+    uint8_t* p = s->ptr;
+    for (size_t i = 0; i < s->len; i++) {
+        p[i] = (uint8_t)rand();
+    }
+    if (s->pixelsize == 4) {
+        for (size_t i = 0; i < s->len / 4; i++) {
+            ((uint32_t*)s->ptr)[i] = random_pixel();
+        }
+    }
+}
+
+static bool blend_test(void) {
+    BEGIN_TEST;
+    gfx_surface* src = gfx_create_surface(NULL, WIDTH, HEIGHT, STRIDE, MX_PIXEL_FORMAT_ARGB_8888, 0);
+    gfx_surface* dst = gfx_create_surface(NULL, WIDTH, HEIGHT, STRIDE, MX_PIXEL_FORMAT_ARGB_8888, 0);
+    ASSERT_NONNULL(src, "");
+    ASSERT_NONNULL(dst, "");
+    uint32_t* expect = malloc(dst->len);
+    ASSERT_NONNULL(expect, "");
+
+    srand(4);
+    for (unsigned width = 1; width <= WIDTH; width++) {
+        unsigned srcx = rand() % (WIDTH - width + 1);
+        unsigned destx = rand() % (WIDTH - width + 1);
+        randomize(src);
+        randomize(dst);
+        memcpy(expect, dst->ptr, dst->len);
+        for (unsigned y = 0; y < HEIGHT - 1; y++) {
+            for (unsigned x = 0; x < width; x++) {
+                uint32_t* d = &expect[(y + 1) * STRIDE + destx + x];
+                *d = blend_ref(*d, ((uint32_t*)src->ptr)[y * STRIDE + srcx + x]);
+            }
+        }
+        gfx_blend(dst, src, srcx, 0, width, HEIGHT - 1, destx, 1);
+        ASSERT_EQ(memcmp(dst->ptr, expect, dst->len), 0, "blend mismatch");
+    }
+
+    free(expect);
+    gfx_surface_destroy(src);
+    gfx_surface_destroy(dst);
+    END_TEST;
+}
+
+static bool convert_test(void) {
+    BEGIN_TEST;
+    gfx_surface* src = gfx_create_surface(NULL, WIDTH, HEIGHT, STRIDE, MX_PIXEL_FORMAT_RGB_x888, 0);
+    gfx_surface* dst = gfx_create_surface(NULL, WIDTH, HEIGHT, STRIDE, MX_PIXEL_FORMAT_RGB_565, 0);
+    ASSERT_NONNULL(src, "");
+    ASSERT_NONNULL(dst, "");
+    uint16_t* expect = malloc(dst->len);
+    ASSERT_NONNULL(expect, "");
+
+    srand(5);
+    for (unsigned width = 1; width <= WIDTH; width++) {
+        unsigned srcx = rand() % (WIDTH - width + 1);
+        unsigned destx = rand() % (WIDTH - width + 1);
+        randomize(src);
+        randomize(dst);
+        memcpy(expect, dst->ptr, dst->len);
+        for (unsigned y = 0; y < HEIGHT; y++) {
+            for (unsigned x = 0; x < width; x++) {
+                uint32_t p = ((uint32_t*)src->ptr)[y * STRIDE + srcx + x];
+                expect[y * STRIDE + destx + x] = (uint16_t)dst->translate_color(p);
+            }
+        }
+        gfx_blend(dst, src, srcx, 0, width, HEIGHT, destx, 0);
+        ASSERT_EQ(memcmp(dst->ptr, expect, dst->len), 0, "conversion mismatch");
+    }
+
+    free(expect);
+    gfx_surface_destroy(src);
+    gfx_surface_destroy(dst);
+    END_TEST;
+}
+
+static bool fill_test(void) {
+    BEGIN_TEST;
+    static const unsigned formats[] = {
+        MX_PIXEL_FORMAT_RGB_x888, MX_PIXEL_FORMAT_RGB_565, MX_PIXEL_FORMAT_RGB_332,
+    };
+    srand(6);
+    for (size_t f = 0; f < countof(formats); f++) {
+        gfx_surface* s = gfx_create_surface(NULL, WIDTH, HEIGHT, STRIDE, formats[f], 0);
+        ASSERT_NONNULL(s, "");
+        for (unsigned width = 1; width <= WIDTH; width++) {
+            unsigned x = rand() % (WIDTH - width + 1);
+            uint32_t color = random_pixel();
+            randomize(s);
+            gfx_surface* expect = gfx_create_surface(NULL, WIDTH, HEIGHT, STRIDE, formats[f], 0);
+            ASSERT_NONNULL(expect, "");
+            memcpy(expect->ptr, s->ptr, s->len);
+            for (unsigned y = 2; y < HEIGHT; y++) {
+                for (unsigned i = 0; i < width; i++) {
+                    gfx_putpixel(expect, x + i, y, color);
+                }
+            }
+            gfx_fillrect(s, x, 2, width, HEIGHT, color);
+            ASSERT_EQ(memcmp(s->ptr, expect->ptr, s->len), 0, "fill mismatch");
+            gfx_surface_destroy(expect);
+        }
+        gfx_surface_destroy(s);
+    }
+    END_TEST;
+}
+
+static bool copyrect_test(void) {
+    BEGIN_TEST;
+    gfx_surface* s = gfx_create_surface(NULL, WIDTH, HEIGHT, STRIDE, MX_PIXEL_FORMAT_RGB_565, 0);
+    ASSERT_NONNULL(s, "");
+    uint16_t* before = malloc(s->len);
+    uint16_t* expect = malloc(s->len);
+    ASSERT_NONNULL(before, "");
+    ASSERT_NONNULL(expect, "");
+
+    // overlapping copies in every direction
+    srand(7);
+    for (int n = 0; n < 500; n++) {
+        unsigned w = 1 + rand() % WIDTH;
+        unsigned h = 1 + rand() % HEIGHT;
+        unsigned x = rand() % (WIDTH - w + 1);
+        unsigned y = rand() % (HEIGHT - h + 1);
+        unsigned x2 = rand() % (WIDTH - w + 1);
+        unsigned y2 = rand() % (HEIGHT - h + 1);
+        randomize(s);
+        memcpy(before, s->ptr, s->len);
+        memcpy(expect, s->ptr, s->len);
+        for (unsigned j = 0; j < h; j++) {
+            for (unsigned i = 0; i < w; i++) {
+                expect[(y2 + j) * STRIDE + x2 + i] = before[(y + j) * STRIDE + x + i];
+            }
+        }
+        gfx_copyrect(s, x, y, w, h, x2, y2);
+        ASSERT_EQ(memcmp(s->ptr, expect, s->len), 0, "copyrect mismatch");
+    }
+
+    free(before);
+    free(expect);
+    gfx_surface_destroy(s);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(gfx_tests)
+RUN_TEST(blend_test)
+RUN_TEST(convert_test)
+RUN_TEST(fill_test)
+RUN_TEST(copyrect_test)
+END_TEST_CASE(gfx_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
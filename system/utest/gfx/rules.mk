@@ -0,0 +1,20 @@
+# Copyright 2017 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := usertest
+
+MODULE_SRCS += \
+    $(LOCAL_DIR)/gfx.c
+
+MODULE_NAME := gfx-test
+
+MODULE_STATIC_LIBS := ulib/gfx
+
+MODULE_LIBS := ulib/unittest ulib/mxio ulib/magenta ulib/c
+
+include make/module.mk
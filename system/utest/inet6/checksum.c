@@ -0,0 +1,93 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <inet6/inet6.h>
+#include <unittest/unittest.h>
+
+// The original 16 bits at a time checksum, which ip6_checksum_add must
+// agree with exactly.
+static uint16_t checksum_ref(const void* _data, size_t len, uint16_t _sum) {
+    uint32_t sum = _sum;
+    const uint8_t* data = _data;
+    while (len > 1) {
+        uint16_t n;
+        memcpy(&n, data, sizeof(n));
+        sum += n;
+        data += 2;
+        len -= 2;
+    }
+    if (len) {
+        sum += *data;
+    }
+    while (sum > 0xFFFF) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return sum;
+}
+
+#define BUFSZ 2048
+// leaves room to start the data at any alignment
+static uint8_t buf[BUFSZ + 64];
+
+static bool check_all(const char* what) {
+    BEGIN_HELPER;
+    for (size_t align = 0; align < 64; align += 7) {
+        for (size_t len = 0; len <= BUFSZ; len += (len < 80) ? 1 : 61) {
+            uint16_t sum = (uint16_t)(len * 40503u);
+            uint16_t expected = checksum_ref(buf + align, len, sum);
+            uint16_t actual = ip6_checksum_add(buf + align, len, sum);
+            if (expected != actual) {
+                unittest_printf("%s: align %zu len %zu: expected %04x, got %04x\n",
+                                what, align, len, expected, actual);
+            }
+            ASSERT_EQ(expected, actual, what);
+        }
+    }
+    END_HELPER;
+}
+
+static bool checksum_random_test(void) {
+    BEGIN_TEST;
+    srand(4);
+    for (int pass = 0; pass < 16; pass++) {
+        for (size_t i = 0; i < sizeof(buf); i++) {
+            buf[i] = rand();
+        }
+        ASSERT_TRUE(check_all("random data"), "");
+    }
+    END_TEST;
+}
+
+static bool checksum_edge_test(void) {
+    BEGIN_TEST;
+    // every carry taken
+    memset(buf, 0xff, sizeof(buf));
+    ASSERT_TRUE(check_all("all ones"), "");
+    memset(buf, 0, sizeof(buf));
+    ASSERT_TRUE(check_all("all zeroes"), "");
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (i & 1) ? 0xff : 0x00;
+    }
+    ASSERT_TRUE(check_all("alternating bytes"), "");
+
+    // folding to 0xffff, never to 0
+    uint16_t ones = 0xffff;
+    EXPECT_EQ(ip6_checksum_add(&ones, sizeof(ones), 0), 0xffff, "");
+    EXPECT_EQ(ip6_checksum_add(&ones, sizeof(ones), 0xffff), 0xffff, "");
+    EXPECT_EQ(ip6_checksum_add(NULL, 0, 0), 0, "");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(inet6_checksum_tests)
+RUN_TEST(checksum_random_test)
+RUN_TEST(checksum_edge_test)
+END_TEST_CASE(inet6_checksum_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -0,0 +1,143 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <magenta/syscalls.h>
+#include <mxio/dispatcher.h>
+#include <unittest/unittest.h>
+
+#define NUM_CHANNELS 8
+#define NUM_MESSAGES 64
+
+typedef struct {
+    uint32_t next_seq;
+    atomic_int busy;
+    atomic_int handled;
+    atomic_int errors;
+    // If valid, the callback blocks until this event is signaled.
+    mx_handle_t gate;
+} channel_state_t;
+
+static mx_status_t test_cb(mx_handle_t h, void* func, void* cookie) {
+    channel_state_t* cs = cookie;
+    if (h == MX_HANDLE_INVALID) {
+        // channel closed
+        return NO_ERROR;
+    }
+
+    // Only one thread may be servicing a given channel at a time.
+    if (atomic_fetch_add(&cs->busy, 1) != 0) {
+        atomic_fetch_add(&cs->errors, 1);
+    }
+
+    uint32_t seq;
+    uint32_t actual;
+    mx_status_t r = mx_channel_read(h, 0, &seq, sizeof(seq), &actual, NULL, 0, NULL);
+    if (r == ERR_SHOULD_WAIT) {
+        atomic_fetch_sub(&cs->busy, 1);
+        return ERR_DISPATCHER_NO_WORK;
+    }
+    if ((r < 0) || (actual != sizeof(seq))) {
+        atomic_fetch_add(&cs->errors, 1);
+        atomic_fetch_sub(&cs->busy, 1);
+        return ERR_IO;
+    }
+    if (cs->gate != MX_HANDLE_INVALID) {
+        mx_object_wait_one(cs->gate, MX_EVENT_SIGNALED, MX_TIME_INFINITE, NULL);
+    }
+    if (seq != cs->next_seq) {
+        atomic_fetch_add(&cs->errors, 1);
+    }
+    cs->next_seq = seq + 1;
+
+    atomic_fetch_sub(&cs->busy, 1);
+    atomic_fetch_add(&cs->handled, 1);
+    return NO_ERROR;
+}
+
+static bool wait_for_handled(channel_state_t* cs, int count) {
+    for (int i = 0; i < 5000; i++) {
+        if (atomic_load(&cs->handled) >= count) {
+            return true;
+        }
+        mx_nanosleep(MX_MSEC(1));
+    }
+    return false;
+}
+
+bool pool_ordering_test(void) {
+    BEGIN_TEST;
+
+    mxio_dispatcher_t* md;
+    ASSERT_EQ(mxio_dispatcher_create(&md, test_cb), NO_ERROR, "");
+    ASSERT_EQ(mxio_dispatcher_start_pool(md, "mxio-dispatcher-test", 4), NO_ERROR, "");
+
+    static channel_state_t state[NUM_CHANNELS];
+    mx_handle_t client[NUM_CHANNELS];
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        mx_handle_t server;
+        ASSERT_EQ(mx_channel_create(0, &client[i], &server), NO_ERROR, "");
+        state[i].gate = MX_HANDLE_INVALID;
+        ASSERT_EQ(mxio_dispatcher_add(md, server, NULL, &state[i]), NO_ERROR, "");
+    }
+
+    for (uint32_t seq = 0; seq < NUM_MESSAGES; seq++) {
+        for (int i = 0; i < NUM_CHANNELS; i++) {
+            ASSERT_EQ(mx_channel_write(client[i], 0, &seq, sizeof(seq), NULL, 0), NO_ERROR, "");
+        }
+    }
+
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        EXPECT_TRUE(wait_for_handled(&state[i], NUM_MESSAGES), "messages not handled");
+        EXPECT_EQ(atomic_load(&state[i].errors), 0, "out of order or concurrent callback");
+        EXPECT_EQ(state[i].next_seq, (uint32_t)NUM_MESSAGES, "");
+        mx_handle_close(client[i]);
+    }
+
+    END_TEST;
+}
+
+bool pool_slow_channel_test(void) {
+    BEGIN_TEST;
+
+    mxio_dispatcher_t* md;
+    ASSERT_EQ(mxio_dispatcher_create(&md, test_cb), NO_ERROR, "");
+    ASSERT_EQ(mxio_dispatcher_start_pool(md, "mxio-dispatcher-test", 2), NO_ERROR, "");
+
+    static channel_state_t slow, fast;
+    mx_handle_t gate;
+    ASSERT_EQ(mx_event_create(0, &gate), NO_ERROR, "");
+    slow.gate = gate;
+    fast.gate = MX_HANDLE_INVALID;
+
+    mx_handle_t slow_client, fast_client, server;
+    ASSERT_EQ(mx_channel_create(0, &slow_client, &server), NO_ERROR, "");
+    ASSERT_EQ(mxio_dispatcher_add(md, server, NULL, &slow), NO_ERROR, "");
+    ASSERT_EQ(mx_channel_create(0, &fast_client, &server), NO_ERROR, "");
+    ASSERT_EQ(mxio_dispatcher_add(md, server, NULL, &fast), NO_ERROR, "");
+
+    uint32_t seq = 0;
+    ASSERT_EQ(mx_channel_write(slow_client, 0, &seq, sizeof(seq), NULL, 0), NO_ERROR, "");
+    ASSERT_EQ(mx_channel_write(fast_client, 0, &seq, sizeof(seq), NULL, 0), NO_ERROR, "");
+
+    // The fast channel is serviced while the slow one is stuck in its callback.
+    EXPECT_TRUE(wait_for_handled(&fast, 1), "fast channel stalled behind slow one");
+    EXPECT_EQ(atomic_load(&slow.handled), 0, "");
+
+    ASSERT_EQ(mx_object_signal(gate, 0, MX_EVENT_SIGNALED), NO_ERROR, "");
+    EXPECT_TRUE(wait_for_handled(&slow, 1), "");
+    EXPECT_EQ(atomic_load(&slow.errors) + atomic_load(&fast.errors), 0, "");
+
+    mx_handle_close(slow_client);
+    mx_handle_close(fast_client);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(mxio_dispatcher_test)
+RUN_TEST(pool_ordering_test);
+RUN_TEST(pool_slow_channel_test);
+END_TEST_CASE(mxio_dispatcher_test)
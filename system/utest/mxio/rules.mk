@@ -9,6 +9,7 @@ MODULE := $(LOCAL_DIR)
 MODULE_TYPE := usertest
 
 MODULE_SRCS += \
+    $(LOCAL_DIR)/mxio_dispatcher.c \
     $(LOCAL_DIR)/mxio_handle_fd.c
 
 MODULE_NAME := mxio-test
@@ -0,0 +1,208 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include <magenta/device/block.h>
+#include <magenta/device/device.h>
+#include <magenta/syscalls.h>
+#include <unittest/unittest.h>
+
+#define DEV_BLOCK_CORE "/dev/class/block-core"
+
+// Large enough to need a PRP list and to be split across several commands.
+#define LARGE_READ (1024 * 1024)
+#define READ_THREADS 8
+
+// These tests only read: the namespace may hold somebody's data.
+// They pass trivially on systems without an nvme controller.
+
+// Finds the first nvme namespace and opens the block device published over it.
+static int open_nvme_block(void) {
+    DIR* dir = opendir(DEV_BLOCK_CORE);
+    if (dir == NULL) {
+        return -1;
+    }
+    int fd = -1;
+    struct dirent* de;
+    while ((fd < 0) && (de = readdir(dir)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", DEV_BLOCK_CORE, de->d_name);
+        int nsfd = open(path, O_RDONLY);
+        if (nsfd < 0) {
+            continue;
+        }
+        char name[32];
+        ssize_t r = ioctl_device_get_device_name(nsfd, name, sizeof(name) - 1);
+        close(nsfd);
+        if (r < 0) {
+            continue;
+        }
+        name[r] = 0;
+        if (strncmp(name, "nvme-ns", strlen("nvme-ns"))) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s/block", DEV_BLOCK_CORE, de->d_name);
+        fd = open(path, O_RDONLY);
+    }
+    closedir(dir);
+    if (fd < 0) {
+        unittest_printf("no nvme namespace found\n");
+    }
+    return fd;
+}
+
+static bool nvme_test_info(void) {
+    BEGIN_TEST;
+    int fd = open_nvme_block();
+    if (fd >= 0) {
+        uint64_t size;
+        uint64_t blksize;
+        ASSERT_EQ(ioctl_block_get_size(fd, &size), (ssize_t)sizeof(size), "");
+        ASSERT_EQ(ioctl_block_get_blocksize(fd, &blksize), (ssize_t)sizeof(blksize), "");
+        ASSERT_GE(blksize, 512u, "block size below 512 bytes");
+        ASSERT_EQ(blksize & (blksize - 1), 0u, "block size not a power of two");
+        ASSERT_GE(size, (uint64_t)LARGE_READ, "namespace too small to test");
+        ASSERT_EQ(size % blksize, 0u, "size not a multiple of the block size");
+        close(fd);
+    }
+    END_TEST;
+}
+
+// A large read, served by several commands with PRP lists or SGLs, returns the
+// same data as reading the range a block at a time.
+static bool nvme_test_large_read(void) {
+    BEGIN_TEST;
+    int fd = open_nvme_block();
+    if (fd >= 0) {
+        uint64_t blksize;
+        ASSERT_EQ(ioctl_block_get_blocksize(fd, &blksize), (ssize_t)sizeof(blksize), "");
+
+        uint8_t* big = malloc(LARGE_READ);
+        uint8_t* small = malloc(LARGE_READ);
+        ASSERT_NONNULL(big, "");
+        ASSERT_NONNULL(small, "");
+
+        ASSERT_EQ(pread(fd, big, LARGE_READ, 0), LARGE_READ, "");
+        for (size_t off = 0; off < LARGE_READ; off += blksize) {
+            ASSERT_EQ(pread(fd, small + off, blksize, off), (ssize_t)blksize, "");
+        }
+        ASSERT_EQ(memcmp(big, small, LARGE_READ), 0, "large read differs from block reads");
+
+        free(big);
+        free(small);
+        close(fd);
+    }
+    END_TEST;
+}
+
+typedef struct {
+    int fd;
+    const uint8_t* expected;
+    size_t offset;
+    size_t length;
+    bool ok;
+} read_args_t;
+
+static int read_thread(void* arg) {
+    read_args_t* args = arg;
+    uint8_t* buf = malloc(args->length);
+    if (buf == NULL) {
+        return -1;
+    }
+    // read the slice repeatedly so the threads overlap on the queues
+    args->ok = true;
+    for (int i = 0; i < 16; i++) {
+        if ((pread(args->fd, buf, args->length, args->offset) != (ssize_t)args->length) ||
+            memcmp(buf, args->expected + args->offset, args->length)) {
+            args->ok = false;
+            break;
+        }
+    }
+    free(buf);
+    return 0;
+}
+
+// Reads issued from several threads, and so from several cpus and queue pairs,
+// all complete with the right data.
+static bool nvme_test_concurrent_reads(void) {
+    BEGIN_TEST;
+    int fd = open_nvme_block();
+    if (fd >= 0) {
+        uint8_t* expected = malloc(LARGE_READ);
+        ASSERT_NONNULL(expected, "");
+        ASSERT_EQ(pread(fd, expected, LARGE_READ, 0), LARGE_READ, "");
+
+        thrd_t threads[READ_THREADS];
+        read_args_t args[READ_THREADS];
+        size_t slice = LARGE_READ / READ_THREADS;
+        for (int i = 0; i < READ_THREADS; i++) {
+            args[i].fd = fd;
+            args[i].expected = expected;
+            args[i].offset = i * slice;
+            args[i].length = slice;
+            args[i].ok = false;
+            ASSERT_EQ(thrd_create(&threads[i], read_thread, &args[i]), thrd_success, "");
+        }
+        for (int i = 0; i < READ_THREADS; i++) {
+            int ret;
+            ASSERT_EQ(thrd_join(threads[i], &ret), thrd_success, "");
+            ASSERT_EQ(ret, 0, "");
+            ASSERT_TRUE(args[i].ok, "concurrent read returned the wrong data");
+        }
+
+        free(expected);
+        close(fd);
+    }
+    END_TEST;
+}
+
+static bool nvme_test_bad_requests(void) {
+    BEGIN_TEST;
+    int fd = open_nvme_block();
+    if (fd >= 0) {
+        uint64_t size;
+        uint64_t blksize;
+        ASSERT_EQ(ioctl_block_get_size(fd, &size), (ssize_t)sizeof(size), "");
+        ASSERT_EQ(ioctl_block_get_blocksize(fd, &blksize), (ssize_t)sizeof(blksize), "");
+
+        uint8_t buf[PAGE_SIZE];
+        ASSERT_GE(sizeof(buf), blksize, "");
+
+        // partial blocks and unaligned offsets
+        ASSERT_EQ(pread(fd, buf, blksize - 1, 0), -1, "");
+        ASSERT_EQ(errno, EINVAL, "");
+        ASSERT_EQ(pread(fd, buf, blksize, 1), -1, "");
+        ASSERT_EQ(errno, EINVAL, "");
+
+        // nothing to read past the end of the namespace
+        ASSERT_EQ(pread(fd, buf, blksize, size), 0, "");
+
+        close(fd);
+    }
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(nvme_tests)
+RUN_TEST(nvme_test_info)
+RUN_TEST(nvme_test_large_read)
+RUN_TEST(nvme_test_concurrent_reads)
+RUN_TEST(nvme_test_bad_requests)
+END_TEST_CASE(nvme_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -0,0 +1,22 @@
+# Copyright 2017 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := usertest
+
+MODULE_SRCS += \
+    $(LOCAL_DIR)/nvme.c \
+
+MODULE_NAME := nvme-test
+
+MODULE_LIBS := \
+    ulib/c \
+    ulib/magenta \
+    ulib/mxio \
+    ulib/unittest \
+
+include make/module.mk
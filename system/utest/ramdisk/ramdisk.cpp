@@ -243,6 +243,163 @@ bool ramdisk_test_fifo_basic(void) {
     END_TEST;
 }
 
+bool ramdisk_test_fifo_merge(void) {
+    BEGIN_TEST;
+    int fd = get_ramdisk("ramdisk-test-fifo-merge", PAGE_SIZE, 512);
+    mx_handle_t fifo;
+    ssize_t expected = sizeof(fifo);
+    ASSERT_EQ(ioctl_block_get_fifos(fd, &fifo), expected, "Failed to get FIFO");
+    txnid_t txnid;
+    expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(fd, &txnid), expected, "Failed to allocate txn");
+
+    const size_t kPages = 4;
+    uint64_t vmo_size = PAGE_SIZE * kPages;
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_vmo_create(vmo_size, 0, &vmo), NO_ERROR, "Failed to create VMO");
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[vmo_size]);
+    ASSERT_TRUE(ac.check(), "");
+    fill_random(buf.get(), vmo_size);
+    size_t actual;
+    ASSERT_EQ(mx_vmo_write(vmo, buf.get(), 0, vmo_size, &actual), NO_ERROR, "");
+
+    vmoid_t vmoid;
+    expected = sizeof(vmoid_t);
+    mx_handle_t xfer_vmo;
+    ASSERT_EQ(mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &xfer_vmo), NO_ERROR, "");
+    ASSERT_EQ(ioctl_block_attach_vmo(fd, &xfer_vmo, &vmoid), expected,
+              "Failed to attach vmo");
+
+    // Write contiguous pages, out of order, in one batch. The server should
+    // sort and merge them into a single operation.
+    block_fifo_request_t requests[kPages];
+    for (size_t i = 0; i < kPages; i++) {
+        size_t page = kPages - 1 - i;
+        requests[i].txnid      = txnid;
+        requests[i].vmoid      = vmoid;
+        requests[i].opcode     = BLOCKIO_WRITE;
+        requests[i].length     = PAGE_SIZE;
+        requests[i].vmo_offset = PAGE_SIZE * page;
+        requests[i].dev_offset = PAGE_SIZE * (page + 10);
+    }
+
+    fifo_client_t* client;
+    ASSERT_EQ(block_fifo_create_client(fifo, &client), NO_ERROR, "");
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], countof(requests)), NO_ERROR, "");
+
+    block_stats_t stats;
+    expected = sizeof(block_stats_t);
+    ASSERT_EQ(ioctl_block_get_stats(fd, &txnid, &stats), expected, "Failed to get stats");
+    ASSERT_EQ(stats.ops, 1u, "Contiguous writes were not merged");
+    ASSERT_EQ(stats.merged, kPages - 1, "");
+    ASSERT_EQ(stats.queued, 0u, "");
+    ASSERT_EQ(stats.in_flight, 0u, "");
+    ASSERT_EQ(stats.completed, kPages, "");
+    uint64_t total = 0;
+    for (size_t i = 0; i < BLOCK_LATENCY_BUCKETS; i++) {
+        total += stats.latency[i];
+    }
+    ASSERT_EQ(total, kPages, "Latency histogram does not match completions");
+
+    // Read it back as a single request
+    mxtl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[vmo_size]());
+    ASSERT_TRUE(ac.check(), "");
+    ASSERT_EQ(mx_vmo_write(vmo, out.get(), 0, vmo_size, &actual), NO_ERROR, "");
+    requests[0].opcode     = BLOCKIO_READ;
+    requests[0].length     = vmo_size;
+    requests[0].vmo_offset = 0;
+    requests[0].dev_offset = PAGE_SIZE * 10;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), NO_ERROR, "");
+    ASSERT_EQ(mx_vmo_read(vmo, out.get(), 0, vmo_size, &actual), NO_ERROR, "");
+    ASSERT_EQ(memcmp(buf.get(), out.get(), vmo_size), 0, "Read data not equal to written data");
+
+    requests[0].opcode = BLOCKIO_CLOSE_VMO;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), NO_ERROR, "");
+
+    ASSERT_EQ(mx_handle_close(vmo), NO_ERROR, "");
+    block_fifo_release_client(client);
+    ASSERT_GE(ioctl_ramdisk_unlink(fd), 0, "Could not unlink ramdisk device");
+    ASSERT_EQ(close(fd), 0, "");
+    END_TEST;
+}
+
+bool ramdisk_test_fifo_overlap(void) {
+    BEGIN_TEST;
+    int fd = get_ramdisk("ramdisk-test-fifo-overlap", PAGE_SIZE, 512);
+    mx_handle_t fifo;
+    ssize_t expected = sizeof(fifo);
+    ASSERT_EQ(ioctl_block_get_fifos(fd, &fifo), expected, "Failed to get FIFO");
+    txnid_t txnid;
+    expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(fd, &txnid), expected, "Failed to allocate txn");
+
+    // Pages 0 and 2 hold the data written, pages 1, 3 and 4 receive reads.
+    const size_t kPages = 5;
+    uint64_t vmo_size = PAGE_SIZE * kPages;
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_vmo_create(vmo_size, 0, &vmo), NO_ERROR, "Failed to create VMO");
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[vmo_size]());
+    ASSERT_TRUE(ac.check(), "");
+    fill_random(buf.get(), PAGE_SIZE);
+    fill_random(buf.get() + PAGE_SIZE * 2, PAGE_SIZE);
+    size_t actual;
+    ASSERT_EQ(mx_vmo_write(vmo, buf.get(), 0, vmo_size, &actual), NO_ERROR, "");
+
+    vmoid_t vmoid;
+    expected = sizeof(vmoid_t);
+    mx_handle_t xfer_vmo;
+    ASSERT_EQ(mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &xfer_vmo), NO_ERROR, "");
+    ASSERT_EQ(ioctl_block_attach_vmo(fd, &xfer_vmo, &vmoid), expected,
+              "Failed to attach vmo");
+
+    // In one batch: write A, read it back, overwrite it with B, and read B
+    // back along with the page below. Sorting by offset or merging the
+    // contiguous requests would see the wrong data.
+    const struct {
+        uint16_t opcode;
+        uint64_t pages;
+        uint64_t vmo_page;
+        uint64_t dev_page;
+    } kOps[] = {
+        { BLOCKIO_WRITE, 1, 0, 20 },
+        { BLOCKIO_READ,  1, 1, 20 },
+        { BLOCKIO_WRITE, 1, 2, 20 },
+        { BLOCKIO_READ,  2, 3, 19 },
+    };
+    block_fifo_request_t requests[countof(kOps)];
+    for (size_t i = 0; i < countof(kOps); i++) {
+        requests[i].txnid      = txnid;
+        requests[i].vmoid      = vmoid;
+        requests[i].opcode     = kOps[i].opcode;
+        requests[i].length     = PAGE_SIZE * kOps[i].pages;
+        requests[i].vmo_offset = PAGE_SIZE * kOps[i].vmo_page;
+        requests[i].dev_offset = PAGE_SIZE * kOps[i].dev_page;
+    }
+
+    fifo_client_t* client;
+    ASSERT_EQ(block_fifo_create_client(fifo, &client), NO_ERROR, "");
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], countof(requests)), NO_ERROR, "");
+
+    mxtl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[vmo_size]);
+    ASSERT_TRUE(ac.check(), "");
+    ASSERT_EQ(mx_vmo_read(vmo, out.get(), 0, vmo_size, &actual), NO_ERROR, "");
+    ASSERT_EQ(memcmp(buf.get(), out.get() + PAGE_SIZE, PAGE_SIZE), 0,
+              "Read did not see the write before it");
+    ASSERT_EQ(memcmp(buf.get() + PAGE_SIZE * 2, out.get() + PAGE_SIZE * 4, PAGE_SIZE), 0,
+              "Read did not see the last write");
+
+    requests[0].opcode = BLOCKIO_CLOSE_VMO;
+    ASSERT_EQ(block_fifo_txn(client, &requests[0], 1), NO_ERROR, "");
+
+    ASSERT_EQ(mx_handle_close(vmo), NO_ERROR, "");
+    block_fifo_release_client(client);
+    ASSERT_GE(ioctl_ramdisk_unlink(fd), 0, "Could not unlink ramdisk device");
+    ASSERT_EQ(close(fd), 0, "");
+    END_TEST;
+}
+
 typedef struct {
     uint64_t vmo_size;
     mx_handle_t vmo;
@@ -343,6 +500,99 @@ bool close_vmo_helper(fifo_client_t* client, test_vmo_object_t* obj, txnid_t txn
     return true;
 }
 
+bool ramdisk_test_fifo_scatter_gather(void) {
+    BEGIN_TEST;
+    int fd = get_ramdisk("ramdisk-test-fifo-scatter-gather", PAGE_SIZE, 512);
+    block_fifo_info_t info;
+    ssize_t expected = sizeof(info);
+    ASSERT_EQ(ioctl_block_get_fifo_info(fd, &info), expected, "Failed to get FIFO info");
+    ASSERT_EQ(info.version, BLOCK_FIFO_PROTOCOL_VERSION, "");
+    ASSERT_EQ(info.max_txn_messages, MAX_TXN_MESSAGES, "");
+    ASSERT_EQ(info.max_txn_count, MAX_TXN_COUNT, "");
+
+    mx_handle_t fifo;
+    expected = sizeof(fifo);
+    ASSERT_EQ(ioctl_block_get_fifos(fd, &fifo), expected, "Failed to get FIFO");
+    txnid_t txnid;
+    expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(fd, &txnid), expected, "Failed to allocate txn");
+
+    // Gather one page from each of several vmos, in reverse vmo order
+    const size_t kVmos = 3;
+    uint64_t total = PAGE_SIZE * kVmos;
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> buf(new (&ac) uint8_t[total]);
+    ASSERT_TRUE(ac.check(), "");
+    fill_random(buf.get(), total);
+
+    mx_handle_t vmos[kVmos];
+    block_sg_t ranges[kVmos];
+    size_t actual;
+    for (size_t i = 0; i < kVmos; i++) {
+        ASSERT_EQ(mx_vmo_create(PAGE_SIZE * kVmos, 0, &vmos[i]), NO_ERROR, "");
+        size_t vmo_offset = PAGE_SIZE * (kVmos - 1 - i);
+        ASSERT_EQ(mx_vmo_write(vmos[i], buf.get() + PAGE_SIZE * i, vmo_offset, PAGE_SIZE,
+                               &actual), NO_ERROR, "");
+        mx_handle_t xfer_vmo;
+        ASSERT_EQ(mx_handle_duplicate(vmos[i], MX_RIGHT_SAME_RIGHTS, &xfer_vmo), NO_ERROR, "");
+        expected = sizeof(vmoid_t);
+        ASSERT_EQ(ioctl_block_attach_vmo(fd, &xfer_vmo, &ranges[i].vmoid), expected,
+                  "Failed to attach vmo");
+        ranges[i].length = PAGE_SIZE;
+        ranges[i].vmo_offset = vmo_offset;
+    }
+
+    fifo_client_t* client;
+    ASSERT_EQ(block_fifo_create_client(fifo, &client), NO_ERROR, "");
+    ASSERT_EQ(block_fifo_txn_sg(client, txnid, BLOCKIO_WRITE | BLOCKIO_FUA | BLOCKIO_BARRIER,
+                                PAGE_SIZE * 20, ranges, kVmos), NO_ERROR, "");
+
+    // A flush on a device without a write cache still succeeds
+    block_fifo_request_t request;
+    request.txnid      = txnid;
+    request.vmoid      = ranges[0].vmoid;
+    request.opcode     = BLOCKIO_SYNC;
+    request.length     = 0;
+    request.vmo_offset = 0;
+    request.dev_offset = 0;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), NO_ERROR, "");
+
+    // Read it back contiguously into the first vmo
+    request.opcode     = BLOCKIO_READ;
+    request.length     = total;
+    request.dev_offset = PAGE_SIZE * 20;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), NO_ERROR, "");
+    mxtl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[total]);
+    ASSERT_TRUE(ac.check(), "");
+    ASSERT_EQ(mx_vmo_read(vmos[0], out.get(), 0, total, &actual), NO_ERROR, "");
+    ASSERT_EQ(memcmp(buf.get(), out.get(), total), 0, "Read data not equal to written data");
+
+    // Scatter it back out, and check each range landed where it was asked to
+    memset(out.get(), 0, total);
+    for (size_t i = 0; i < kVmos; i++) {
+        ASSERT_EQ(mx_vmo_write(vmos[i], out.get(), 0, total, &actual), NO_ERROR, "");
+    }
+    ASSERT_EQ(block_fifo_txn_sg(client, txnid, BLOCKIO_READ, PAGE_SIZE * 20, ranges, kVmos),
+              NO_ERROR, "");
+    for (size_t i = 0; i < kVmos; i++) {
+        ASSERT_EQ(mx_vmo_read(vmos[i], out.get(), ranges[i].vmo_offset, PAGE_SIZE, &actual),
+                  NO_ERROR, "");
+        ASSERT_EQ(memcmp(buf.get() + PAGE_SIZE * i, out.get(), PAGE_SIZE), 0,
+                  "Scattered data not equal to written data");
+    }
+
+    for (size_t i = 0; i < kVmos; i++) {
+        request.vmoid  = ranges[i].vmoid;
+        request.opcode = BLOCKIO_CLOSE_VMO;
+        ASSERT_EQ(block_fifo_txn(client, &request, 1), NO_ERROR, "");
+        ASSERT_EQ(mx_handle_close(vmos[i]), NO_ERROR, "");
+    }
+    block_fifo_release_client(client);
+    ASSERT_GE(ioctl_ramdisk_unlink(fd), 0, "Could not unlink ramdisk device");
+    ASSERT_EQ(close(fd), 0, "");
+    END_TEST;
+}
+
 bool ramdisk_test_fifo_multiple_vmo(void) {
     BEGIN_TEST;
     // Set up the initial handshake connection with the ramdisk
@@ -842,6 +1092,9 @@ RUN_TEST(ramdisk_test_bad_requests)
 RUN_TEST(ramdisk_test_multiple)
 RUN_TEST(ramdisk_test_fifo_no_op)
 RUN_TEST(ramdisk_test_fifo_basic)
+RUN_TEST(ramdisk_test_fifo_merge)
+RUN_TEST(ramdisk_test_fifo_overlap)
+RUN_TEST(ramdisk_test_fifo_scatter_gather)
 RUN_TEST(ramdisk_test_fifo_multiple_vmo)
 RUN_TEST(ramdisk_test_fifo_multiple_vmo_multithreaded)
 // TODO(smklein): Test ops across different vmos
@@ -578,6 +578,82 @@ bool vmo_zero_page_test() {
     END_TEST;
 }
 
+bool vmo_discardable_test() {
+    BEGIN_TEST;
+
+    const size_t size = PAGE_SIZE * 4;
+    mx_handle_t vmo;
+    EXPECT_EQ(ERR_INVALID_ARGS, mx_vmo_create(size, ~MX_VMO_DISCARDABLE, &vmo),
+              "unknown option");
+    ASSERT_EQ(NO_ERROR, mx_vmo_create(size, MX_VMO_DISCARDABLE, &vmo), "vm_object_create");
+
+    // starts out unlocked
+    EXPECT_EQ(ERR_BAD_STATE, mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size, nullptr, 0),
+              "unlock while unlocked");
+
+    // only the whole object can be locked
+    EXPECT_EQ(ERR_INVALID_ARGS, mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, PAGE_SIZE, nullptr, 0),
+              "partial lock");
+
+    uint32_t discarded = 0xff;
+    EXPECT_EQ(NO_ERROR, mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size,
+                                        &discarded, sizeof(discarded)), "lock");
+    EXPECT_EQ(0u, discarded, "nothing to discard yet");
+
+    uint32_t v = 42;
+    size_t actual;
+    EXPECT_EQ(NO_ERROR, mx_vmo_write(vmo, &v, PAGE_SIZE, sizeof(v), &actual), "write");
+
+    // locks nest
+    EXPECT_EQ(NO_ERROR, mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size, nullptr, 0), "lock again");
+    EXPECT_EQ(NO_ERROR, mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size, nullptr, 0), "unlock");
+    EXPECT_EQ(NO_ERROR, mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size, nullptr, 0), "unlock");
+    EXPECT_EQ(ERR_BAD_STATE, mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size, nullptr, 0),
+              "unlock too many times");
+
+    // Relock.  Either the contents survived or the kernel says they did not.
+    EXPECT_EQ(NO_ERROR, mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size,
+                                        &discarded, sizeof(discarded)), "relock");
+    uint32_t r = 0;
+    EXPECT_EQ(NO_ERROR, mx_vmo_read(vmo, &r, PAGE_SIZE, sizeof(r), &actual), "read");
+    EXPECT_EQ(discarded ? 0u : v, r, "contents after relock");
+
+    EXPECT_EQ(NO_ERROR, mx_handle_close(vmo), "handle_close");
+
+    // ordinary vmos cannot be locked
+    ASSERT_EQ(NO_ERROR, mx_vmo_create(size, 0, &vmo), "vm_object_create");
+    EXPECT_EQ(ERR_NOT_SUPPORTED, mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size, nullptr, 0),
+              "lock non-discardable");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(vmo), "handle_close");
+
+    END_TEST;
+}
+
+bool memory_pressure_event_test() {
+    BEGIN_TEST;
+
+    mx_handle_t event;
+    EXPECT_EQ(ERR_INVALID_ARGS, mx_system_get_event(0u, &event), "unknown kind");
+    ASSERT_EQ(NO_ERROR, mx_system_get_event(MX_SYSTEM_EVENT_MEMORY_PRESSURE, &event),
+              "get event");
+
+    // exactly one level is asserted
+    const mx_signals_t levels = MX_MEMORY_PRESSURE_NORMAL | MX_MEMORY_PRESSURE_WARNING |
+                                MX_MEMORY_PRESSURE_CRITICAL;
+    mx_signals_t observed = 0;
+    EXPECT_EQ(NO_ERROR, mx_object_wait_one(event, levels, 0u, &observed), "wait");
+    observed &= levels;
+    EXPECT_NEQ(0u, observed, "a level is asserted");
+    EXPECT_EQ(0u, observed & (observed - 1), "only one level is asserted");
+
+    // only the kernel gets to signal it
+    EXPECT_EQ(ERR_ACCESS_DENIED, mx_object_signal(event, 0u, MX_USER_SIGNAL_0), "signal");
+
+    EXPECT_EQ(NO_ERROR, mx_handle_close(event), "handle_close");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(vmo_tests)
 RUN_TEST(vmo_create_test);
 RUN_TEST(vmo_read_write_test);
@@ -588,6 +664,8 @@ RUN_TEST(vmo_rights_test);
 RUN_TEST(vmo_lookup_test);
 RUN_TEST(vmo_commit_test);
 RUN_TEST(vmo_zero_page_test);
+RUN_TEST(vmo_discardable_test);
+RUN_TEST(memory_pressure_event_test);
 END_TEST_CASE(vmo_tests)
 
 int main(int argc, char** argv) {